@@ -0,0 +1,326 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <margo.h>
+#include <soma/soma-server.h>
+#include <soma/soma-admin.h>
+#include <soma/soma-client.h>
+#include <soma/soma-collector.h>
+
+#define FATAL(...) \
+    do { \
+        margo_critical(__VA_ARGS__); \
+        exit(-1); \
+    } while(0)
+
+typedef enum bench_op {
+    BENCH_SUM,
+    BENCH_HELLO,
+    BENCH_PUBLISH,
+    BENCH_CREATE_DESTROY,
+    BENCH_LIST
+} bench_op;
+
+static const char* op_names[] = {
+    "sum", "hello", "publish", "create_destroy", "list"
+};
+
+typedef struct bench_options {
+    const char* protocol;     // protocol used when running the provider in-process
+    const char* address;      // address of a remote provider, NULL to run it in-process
+    uint16_t    provider_id;
+    const char* token;
+    bench_op    op;
+    unsigned    concurrency;  // number of ULTs issuing RPCs
+    unsigned    xstreams;     // number of execution streams running them
+    unsigned    iterations;   // measured RPCs per ULT
+    unsigned    warmup;       // unmeasured RPCs per ULT
+    unsigned    batch_size;   // samples per publish RPC
+} bench_options;
+
+typedef struct bench_context {
+    const bench_options*    opts;
+    margo_instance_id       mid;
+    hg_addr_t               addr;
+    soma_admin_t            admin;
+    soma_client_t           client;
+    soma_collector_id_t     collector_id;
+} bench_context;
+
+typedef struct bench_ult_args {
+    bench_context* ctx;
+    unsigned       rank;
+    double*        latencies;    // one per measured RPC
+    int            num_errors;
+} bench_ult_args;
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -o <op>        operation: sum, hello, publish, create_destroy, list (default: sum)\n"
+        "  -p <protocol>  protocol of the in-process provider (default: na+sm)\n"
+        "  -a <address>   address of a remote provider (default: run one in-process)\n"
+        "  -i <id>        provider id (default: 42)\n"
+        "  -t <token>     provider's security token (default: none)\n"
+        "  -c <n>         number of concurrent ULTs (default: 1)\n"
+        "  -x <n>         number of execution streams running them (default: 1)\n"
+        "  -n <n>         measured operations per ULT (default: 10000)\n"
+        "  -w <n>         warmup operations per ULT (default: 100)\n"
+        "  -b <n>         samples per publish operation (default: 64)\n",
+        prog);
+    exit(-1);
+}
+
+static void parse_options(int argc, char** argv, bench_options* opts)
+{
+    int c;
+    opts->protocol    = "na+sm";
+    opts->address     = NULL;
+    opts->provider_id = 42;
+    opts->token       = NULL;
+    opts->op          = BENCH_SUM;
+    opts->concurrency = 1;
+    opts->xstreams    = 1;
+    opts->iterations  = 10000;
+    opts->warmup      = 100;
+    opts->batch_size  = 64;
+    while((c = getopt(argc, argv, "o:p:a:i:t:c:x:n:w:b:h")) != -1) {
+        switch(c) {
+        case 'o': {
+            size_t i;
+            for(i = 0; i < sizeof(op_names)/sizeof(op_names[0]); i++)
+                if(strcmp(optarg, op_names[i]) == 0) break;
+            if(i == sizeof(op_names)/sizeof(op_names[0])) usage(argv[0]);
+            opts->op = (bench_op)i;
+            break;
+        }
+        case 'p': opts->protocol    = optarg; break;
+        case 'a': opts->address     = optarg; break;
+        case 'i': opts->provider_id = atoi(optarg); break;
+        case 't': opts->token       = optarg; break;
+        case 'c': opts->concurrency = atoi(optarg); break;
+        case 'x': opts->xstreams    = atoi(optarg); break;
+        case 'n': opts->iterations  = atoi(optarg); break;
+        case 'w': opts->warmup      = atoi(optarg); break;
+        case 'b': opts->batch_size  = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if(opts->concurrency == 0 || opts->xstreams == 0
+    || opts->iterations == 0 || opts->batch_size == 0)
+        usage(argv[0]);
+}
+
+/* Runs one operation, returning its result */
+static soma_return_t run_op(
+        bench_context* ctx,
+        soma_collector_handle_t rh,
+        soma_sample_t* samples,
+        unsigned i)
+{
+    const bench_options* opts = ctx->opts;
+    switch(opts->op) {
+    case BENCH_SUM: {
+        int32_t result;
+        soma_return_t ret = soma_compute_sum(rh, (int32_t)i, 1, &result);
+        if(ret == SOMA_SUCCESS && result != (int32_t)i + 1)
+            ret = SOMA_ERR_OTHER;
+        return ret;
+    }
+    case BENCH_HELLO:
+        return soma_say_hello(rh);
+    case BENCH_PUBLISH:
+        return soma_publish_batch(rh, samples, opts->batch_size);
+    case BENCH_CREATE_DESTROY: {
+        soma_collector_id_t id;
+        soma_return_t ret = soma_create_collector(ctx->admin, ctx->addr,
+                opts->provider_id, opts->token, "dummy", "{}", &id);
+        if(ret != SOMA_SUCCESS) return ret;
+        return soma_destroy_collector(ctx->admin, ctx->addr,
+                opts->provider_id, opts->token, id);
+    }
+    case BENCH_LIST: {
+        soma_collector_id_t ids[16];
+        size_t count = 16;
+        return soma_list_collectors(ctx->admin, ctx->addr,
+                opts->provider_id, opts->token, ids, &count);
+    }
+    }
+    return SOMA_ERR_OTHER;
+}
+
+static void bench_ult(void* arg)
+{
+    bench_ult_args* args = (bench_ult_args*)arg;
+    bench_context* ctx = args->ctx;
+    const bench_options* opts = ctx->opts;
+    soma_collector_handle_t rh = SOMA_COLLECTOR_HANDLE_NULL;
+    soma_sample_t* samples = NULL;
+    unsigned i;
+
+    if(soma_collector_handle_create(ctx->client, ctx->addr, opts->provider_id,
+                ctx->collector_id, &rh) != SOMA_SUCCESS) {
+        args->num_errors = opts->warmup + opts->iterations;
+        return;
+    }
+    if(opts->op == BENCH_PUBLISH) {
+        samples = (soma_sample_t*)calloc(opts->batch_size, sizeof(*samples));
+        for(i = 0; i < opts->batch_size; i++) {
+            samples[i].series    = args->rank;
+            samples[i].timestamp = i;
+            samples[i].value     = (double)i;
+        }
+    }
+
+    for(i = 0; i < opts->warmup; i++)
+        if(run_op(ctx, rh, samples, i) != SOMA_SUCCESS)
+            args->num_errors += 1;
+    for(i = 0; i < opts->iterations; i++) {
+        double t = ABT_get_wtime();
+        if(run_op(ctx, rh, samples, i) != SOMA_SUCCESS)
+            args->num_errors += 1;
+        args->latencies[i] = ABT_get_wtime() - t;
+    }
+
+    free(samples);
+    soma_collector_handle_release(rh);
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, size_t n, double p)
+{
+    size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+    return sorted[i < n ? i : n - 1];
+}
+
+int main(int argc, char** argv)
+{
+    bench_options opts;
+    bench_context ctx;
+    soma_return_t ret;
+    hg_return_t hret;
+    unsigned i;
+
+    parse_options(argc, argv, &opts);
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.opts = &opts;
+
+    /* the benchmark ULTs run in the handler pool, on opts.xstreams
+     * execution streams, along with the provider's RPCs if it runs
+     * in-process */
+    if(opts.address) {
+        char protocol[64] = {0};
+        const char* sep = strstr(opts.address, "://");
+        size_t len = sep ? (size_t)(sep - opts.address) : strlen(opts.address);
+        if(len >= sizeof(protocol)) len = sizeof(protocol) - 1;
+        memcpy(protocol, opts.address, len);
+        ctx.mid = margo_init(protocol, MARGO_CLIENT_MODE, 1, opts.xstreams);
+        if(!ctx.mid) FATAL(MARGO_INSTANCE_NULL, "Could not initialize margo");
+        hret = margo_addr_lookup(ctx.mid, opts.address, &ctx.addr);
+        if(hret != HG_SUCCESS)
+            FATAL(ctx.mid, "margo_addr_lookup failed for address %s", opts.address);
+    } else {
+        ctx.mid = margo_init(opts.protocol, MARGO_SERVER_MODE, 1, opts.xstreams);
+        if(!ctx.mid) FATAL(MARGO_INSTANCE_NULL, "Could not initialize margo");
+        hret = margo_addr_self(ctx.mid, &ctx.addr);
+        if(hret != HG_SUCCESS)
+            FATAL(ctx.mid, "margo_addr_self failed");
+        struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+        args.token = opts.token;
+        ret = soma_provider_register(ctx.mid, opts.provider_id, &args,
+                                     SOMA_PROVIDER_IGNORE);
+        if(ret != SOMA_SUCCESS)
+            FATAL(ctx.mid, "soma_provider_register failed (ret = %d)", ret);
+    }
+
+    ret = soma_admin_init(ctx.mid, &ctx.admin);
+    if(ret != SOMA_SUCCESS)
+        FATAL(ctx.mid, "soma_admin_init failed (ret = %d)", ret);
+    ret = soma_client_init(ctx.mid, &ctx.client);
+    if(ret != SOMA_SUCCESS)
+        FATAL(ctx.mid, "soma_client_init failed (ret = %d)", ret);
+    ret = soma_create_collector(ctx.admin, ctx.addr, opts.provider_id,
+            opts.token, "dummy", "{}", &ctx.collector_id);
+    if(ret != SOMA_SUCCESS)
+        FATAL(ctx.mid, "soma_create_collector failed (ret = %d)", ret);
+
+    ABT_pool pool;
+    margo_get_handler_pool(ctx.mid, &pool);
+
+    size_t total = (size_t)opts.concurrency * opts.iterations;
+    double* latencies = (double*)calloc(total, sizeof(*latencies));
+    bench_ult_args* ult_args = (bench_ult_args*)calloc(opts.concurrency, sizeof(*ult_args));
+    ABT_thread* ults = (ABT_thread*)calloc(opts.concurrency, sizeof(*ults));
+    if(!latencies || !ult_args || !ults)
+        FATAL(ctx.mid, "Could not allocate memory for %lu latencies", total);
+
+    double t_start = ABT_get_wtime();
+    for(i = 0; i < opts.concurrency; i++) {
+        ult_args[i].ctx       = &ctx;
+        ult_args[i].rank      = i;
+        ult_args[i].latencies = latencies + (size_t)i * opts.iterations;
+        if(ABT_thread_create(pool, bench_ult, &ult_args[i],
+                             ABT_THREAD_ATTR_NULL, &ults[i]) != ABT_SUCCESS)
+            FATAL(ctx.mid, "Could not create ULT");
+    }
+    int num_errors = 0;
+    for(i = 0; i < opts.concurrency; i++) {
+        ABT_thread_join(ults[i]);
+        ABT_thread_free(&ults[i]);
+        num_errors += ult_args[i].num_errors;
+    }
+    double duration = ABT_get_wtime() - t_start;
+
+    qsort(latencies, total, sizeof(*latencies), compare_doubles);
+    double sum = 0.0;
+    size_t j;
+    for(j = 0; j < total; j++) sum += latencies[j];
+
+    /* warmup operations are included in the duration, so the throughput
+     * is computed over all the operations issued */
+    double num_ops = (double)opts.concurrency * (opts.iterations + opts.warmup);
+    printf("{\n");
+    printf("  \"operation\": \"%s\",\n", op_names[opts.op]);
+    printf("  \"address\": \"%s\",\n", opts.address ? opts.address : opts.protocol);
+    printf("  \"concurrency\": %u,\n", opts.concurrency);
+    printf("  \"xstreams\": %u,\n", opts.xstreams);
+    printf("  \"iterations\": %lu,\n", total);
+    if(opts.op == BENCH_PUBLISH)
+        printf("  \"batch_size\": %u,\n", opts.batch_size);
+    printf("  \"errors\": %d,\n", num_errors);
+    printf("  \"duration\": %f,\n", duration);
+    printf("  \"ops_per_sec\": %f,\n", num_ops / duration);
+    printf("  \"latency_us\": {\n");
+    printf("    \"min\": %f,\n",   latencies[0] * 1e6);
+    printf("    \"mean\": %f,\n",  sum / total * 1e6);
+    printf("    \"p50\": %f,\n",   percentile(latencies, total, 0.5) * 1e6);
+    printf("    \"p99\": %f,\n",   percentile(latencies, total, 0.99) * 1e6);
+    printf("    \"p99.9\": %f,\n", percentile(latencies, total, 0.999) * 1e6);
+    printf("    \"max\": %f\n",    latencies[total-1] * 1e6);
+    printf("  }\n");
+    printf("}\n");
+
+    free(ults);
+    free(ult_args);
+    free(latencies);
+    soma_destroy_collector(ctx.admin, ctx.addr, opts.provider_id,
+                           opts.token, ctx.collector_id);
+    soma_client_finalize(ctx.client);
+    soma_admin_finalize(ctx.admin);
+    margo_addr_free(ctx.mid, ctx.addr);
+    margo_finalize(ctx.mid);
+    return num_errors ? -1 : 0;
+}
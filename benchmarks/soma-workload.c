@@ -0,0 +1,494 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <margo.h>
+#include <json-c/json.h>
+#include <soma/soma-server.h>
+#include <soma/soma-admin.h>
+#include <soma/soma-client.h>
+#include <soma/soma-collector.h>
+
+#define FATAL(...) \
+    do { \
+        margo_critical(__VA_ARGS__); \
+        exit(-1); \
+    } while(0)
+
+/*
+ * Synthetic telemetry workload generator. Each emulated rank is a ULT
+ * that, every reporting interval, produces one sample for every series
+ * of every metric of the workload and publishes them as a single batch
+ * (soma_publish_columns_async), keeping up to max_inflight batches in
+ * flight. The lag of a batch is the time between the moment its
+ * samples were produced and the moment the provider acknowledged it,
+ * which grows as soon as the provider falls behind.
+ *
+ * Example workload description (all fields are optional):
+ * {
+ *   "address": "na+sm://...",     // remote provider, or
+ *   "protocol": "na+sm",          // protocol of an in-process provider
+ *   "provider_id": 42,
+ *   "token": "",
+ *   "collector": { "type": "timeseries", "config": {} },
+ *   "ranks": 1000,
+ *   "xstreams": 4,
+ *   "duration": 10.0,             // seconds
+ *   "interval": 1.0,              // seconds between reports of a rank
+ *   "max_inflight": 4,            // outstanding batches per rank
+ *   "metrics": [
+ *     { "kind": "gauge",     "cardinality": 8, "min": 0, "max": 100 },
+ *     { "kind": "counter",   "cardinality": 4, "rate": 1000 },
+ *     { "kind": "histogram", "cardinality": 2, "buckets": 10 }
+ *   ],
+ *   "phases": [                   // cycled through during the run
+ *     { "duration": 5.0, "rate": 1.0 },
+ *     { "duration": 1.0, "rate": 10.0 }
+ *   ]
+ * }
+ * The cardinality of a metric is its number of label combinations,
+ * i.e. of series per rank; a histogram has one series per bucket for
+ * each of them. The rate of a phase multiplies the reporting frequency.
+ *
+ * Series identifiers are built as (metric << 48) | (rank << 24) | series,
+ * the last part being the index of the series within the metric.
+ */
+
+typedef enum metric_kind {
+    METRIC_GAUGE,
+    METRIC_COUNTER,
+    METRIC_HISTOGRAM
+} metric_kind;
+
+typedef struct metric_desc {
+    metric_kind kind;
+    unsigned    cardinality;
+    unsigned    buckets;       // histograms only
+    double      min, max;      // gauges only
+    double      rate;          // counters only, mean increase per second
+} metric_desc;
+
+typedef struct phase_desc {
+    double duration;
+    double rate;
+} phase_desc;
+
+typedef struct workload {
+    const char*  address;
+    const char*  protocol;
+    uint16_t     provider_id;
+    const char*  token;
+    const char*  collector_type;
+    const char*  collector_config;
+    unsigned     ranks;
+    unsigned     xstreams;
+    double       duration;
+    double       interval;
+    unsigned     max_inflight;
+    size_t       num_metrics;
+    metric_desc* metrics;
+    size_t       num_phases;
+    phase_desc*  phases;
+    double       cycle;            // sum of the durations of the phases
+    size_t       samples_per_report;
+} workload;
+
+typedef struct run_context {
+    const workload*     wl;
+    margo_instance_id   mid;
+    hg_addr_t           addr;
+    soma_client_t       client;
+    soma_collector_id_t collector_id;
+    double              t_start;
+} run_context;
+
+typedef struct rank_state {
+    run_context*   ctx;
+    unsigned       rank;
+    unsigned       seed;
+    /* columns of the batches in flight, max_inflight of them */
+    uint64_t*      series;
+    uint64_t*      timestamps;
+    double*        values;
+    soma_request_t* reqs;
+    double*        produced_at;    // time each in-flight batch was produced
+    double*        state;          // current value of each series
+    /* results */
+    uint64_t       num_samples;
+    uint64_t       num_batches;
+    uint64_t       num_errors;
+    double*        lags;           // one per acknowledged batch
+    size_t         num_lags;
+    size_t         lags_capacity;
+} rank_state;
+
+static double get_double(struct json_object* obj, const char* key, double dflt)
+{
+    struct json_object* val;
+    if(!json_object_object_get_ex(obj, key, &val)) return dflt;
+    return json_object_get_double(val);
+}
+
+static const char* get_string(struct json_object* obj, const char* key, const char* dflt)
+{
+    struct json_object* val;
+    if(!json_object_object_get_ex(obj, key, &val)) return dflt;
+    return json_object_get_string(val);
+}
+
+static void parse_workload(struct json_object* json, workload* wl)
+{
+    struct json_object *val, *item;
+    size_t i;
+
+    memset(wl, 0, sizeof(*wl));
+    wl->address      = get_string(json, "address", NULL);
+    wl->protocol     = get_string(json, "protocol", "na+sm");
+    wl->provider_id  = (uint16_t)get_double(json, "provider_id", 42);
+    wl->token        = get_string(json, "token", NULL);
+    wl->ranks        = (unsigned)get_double(json, "ranks", 1000);
+    wl->xstreams     = (unsigned)get_double(json, "xstreams", 4);
+    wl->duration     = get_double(json, "duration", 10.0);
+    wl->interval     = get_double(json, "interval", 1.0);
+    wl->max_inflight = (unsigned)get_double(json, "max_inflight", 4);
+    wl->collector_type   = "timeseries";
+    wl->collector_config = "{}";
+    if(json_object_object_get_ex(json, "collector", &val)) {
+        wl->collector_type = get_string(val, "type", "timeseries");
+        if(json_object_object_get_ex(val, "config", &item))
+            wl->collector_config = json_object_to_json_string(item);
+    }
+
+    if(json_object_object_get_ex(json, "metrics", &val)) {
+        wl->num_metrics = json_object_array_length(val);
+        wl->metrics = (metric_desc*)calloc(wl->num_metrics, sizeof(*wl->metrics));
+        for(i = 0; i < wl->num_metrics; i++) {
+            item = json_object_array_get_idx(val, i);
+            metric_desc* m = &wl->metrics[i];
+            const char* kind = get_string(item, "kind", "gauge");
+            if(strcmp(kind, "gauge") == 0)          m->kind = METRIC_GAUGE;
+            else if(strcmp(kind, "counter") == 0)   m->kind = METRIC_COUNTER;
+            else if(strcmp(kind, "histogram") == 0) m->kind = METRIC_HISTOGRAM;
+            else FATAL(MARGO_INSTANCE_NULL, "Unknown metric kind \"%s\"", kind);
+            m->cardinality = (unsigned)get_double(item, "cardinality", 1);
+            m->buckets     = m->kind == METRIC_HISTOGRAM ?
+                             (unsigned)get_double(item, "buckets", 10) : 1;
+            m->min         = get_double(item, "min", 0.0);
+            m->max         = get_double(item, "max", 100.0);
+            m->rate        = get_double(item, "rate", 1000.0);
+        }
+    } else {
+        wl->num_metrics = 1;
+        wl->metrics = (metric_desc*)calloc(1, sizeof(*wl->metrics));
+        wl->metrics[0].kind        = METRIC_GAUGE;
+        wl->metrics[0].cardinality = 1;
+        wl->metrics[0].buckets     = 1;
+        wl->metrics[0].max         = 100.0;
+    }
+    for(i = 0; i < wl->num_metrics; i++)
+        wl->samples_per_report += wl->metrics[i].cardinality * wl->metrics[i].buckets;
+
+    if(json_object_object_get_ex(json, "phases", &val)) {
+        wl->num_phases = json_object_array_length(val);
+        wl->phases = (phase_desc*)calloc(wl->num_phases, sizeof(*wl->phases));
+        for(i = 0; i < wl->num_phases; i++) {
+            item = json_object_array_get_idx(val, i);
+            wl->phases[i].duration = get_double(item, "duration", 1.0);
+            wl->phases[i].rate     = get_double(item, "rate", 1.0);
+        }
+    }
+    for(i = 0; i < wl->num_phases; i++)
+        wl->cycle += wl->phases[i].duration;
+
+    if(wl->ranks == 0 || wl->xstreams == 0 || wl->max_inflight == 0
+    || wl->interval <= 0 || wl->samples_per_report == 0 || wl->ranks >= (1u << 24))
+        FATAL(MARGO_INSTANCE_NULL, "Invalid workload description");
+}
+
+/* Returns the reporting rate multiplier at the given time */
+static double current_rate(const workload* wl, double elapsed)
+{
+    if(wl->num_phases == 0 || wl->cycle <= 0) return 1.0;
+    double t = elapsed - wl->cycle * (double)(uint64_t)(elapsed / wl->cycle);
+    size_t i;
+    for(i = 0; i < wl->num_phases; i++) {
+        if(t < wl->phases[i].duration) return wl->phases[i].rate;
+        t -= wl->phases[i].duration;
+    }
+    return 1.0;
+}
+
+static double uniform(unsigned* seed)
+{
+    return (double)rand_r(seed) / (double)RAND_MAX;
+}
+
+/* Fills the columns of a batch with one sample of each series */
+static void produce(rank_state* rs, size_t slot, uint64_t timestamp, double dt)
+{
+    const workload* wl = rs->ctx->wl;
+    size_t base = slot * wl->samples_per_report;
+    size_t k = 0;
+    size_t m;
+    for(m = 0; m < wl->num_metrics; m++) {
+        const metric_desc* md = &wl->metrics[m];
+        unsigned c, b;
+        for(c = 0; c < md->cardinality; c++) {
+            for(b = 0; b < md->buckets; b++, k++) {
+                double* v = &rs->state[k];
+                switch(md->kind) {
+                case METRIC_GAUGE:
+                    // random walk within [min, max]
+                    *v += (uniform(&rs->seed) - 0.5) * (md->max - md->min) * 0.1;
+                    if(*v < md->min) *v = md->min;
+                    if(*v > md->max) *v = md->max;
+                    break;
+                case METRIC_COUNTER:
+                    *v += 2.0 * uniform(&rs->seed) * md->rate * dt;
+                    break;
+                case METRIC_HISTOGRAM:
+                    // cumulative counts, lower buckets fill up faster
+                    *v += (double)(rand_r(&rs->seed) % (md->buckets - b + 1));
+                    break;
+                }
+                rs->series[base + k] = ((uint64_t)m << 48)
+                                     | ((uint64_t)rs->rank << 24)
+                                     | (uint64_t)(c * md->buckets + b);
+                rs->timestamps[base + k] = timestamp;
+                rs->values[base + k]     = *v;
+            }
+        }
+    }
+}
+
+/* Waits for the batch in the given slot, if any, and records its lag */
+static void complete(rank_state* rs, size_t slot)
+{
+    if(rs->reqs[slot] == SOMA_REQUEST_NULL) return;
+    soma_return_t ret = soma_request_wait(rs->reqs[slot]);
+    rs->reqs[slot] = SOMA_REQUEST_NULL;
+    if(ret != SOMA_SUCCESS) {
+        rs->num_errors += 1;
+        return;
+    }
+    if(rs->num_lags == rs->lags_capacity) {
+        rs->lags_capacity = rs->lags_capacity ? 2 * rs->lags_capacity : 64;
+        rs->lags = (double*)realloc(rs->lags, rs->lags_capacity * sizeof(double));
+    }
+    rs->lags[rs->num_lags++] = ABT_get_wtime() - rs->produced_at[slot];
+    rs->num_samples += rs->ctx->wl->samples_per_report;
+    rs->num_batches += 1;
+}
+
+static void rank_ult(void* arg)
+{
+    rank_state* rs = (rank_state*)arg;
+    run_context* ctx = rs->ctx;
+    const workload* wl = ctx->wl;
+    soma_collector_handle_t rh;
+    size_t n = wl->samples_per_report;
+    size_t slot = 0;
+
+    if(soma_collector_handle_create(ctx->client, ctx->addr, wl->provider_id,
+                ctx->collector_id, &rh) != SOMA_SUCCESS) {
+        rs->num_errors += 1;
+        return;
+    }
+
+    // ranks do not all start reporting at the same time
+    margo_thread_sleep(ctx->mid, uniform(&rs->seed) * wl->interval * 1000.0);
+
+    double last = ABT_get_wtime();
+    for(;;) {
+        double now = ABT_get_wtime();
+        double elapsed = now - ctx->t_start;
+        if(elapsed >= wl->duration) break;
+
+        complete(rs, slot);
+        produce(rs, slot, (uint64_t)(elapsed * 1e9), now - last);
+        rs->produced_at[slot] = now;
+        last = now;
+        if(soma_publish_columns_async(rh, n,
+                    rs->series + slot*n, rs->timestamps + slot*n, rs->values + slot*n,
+                    &rs->reqs[slot]) != SOMA_SUCCESS) {
+            rs->reqs[slot] = SOMA_REQUEST_NULL;
+            rs->num_errors += 1;
+        }
+        slot = (slot + 1) % wl->max_inflight;
+
+        double next = now + wl->interval / current_rate(wl, elapsed);
+        double wait = next - ABT_get_wtime();
+        if(wait > 0)
+            margo_thread_sleep(ctx->mid, wait * 1000.0);
+    }
+    for(slot = 0; slot < wl->max_inflight; slot++)
+        complete(rs, slot);
+
+    soma_collector_handle_release(rh);
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, size_t n, double p)
+{
+    if(n == 0) return 0.0;
+    size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+    return sorted[i < n ? i : n - 1];
+}
+
+int main(int argc, char** argv)
+{
+    if(argc != 2) {
+        fprintf(stderr, "Usage: %s <workload.json>\n", argv[0]);
+        exit(-1);
+    }
+
+    struct json_object* json = json_object_from_file(argv[1]);
+    if(!json)
+        FATAL(MARGO_INSTANCE_NULL, "Could not read workload from %s", argv[1]);
+    workload wl;
+    parse_workload(json, &wl);
+
+    run_context ctx;
+    soma_admin_t admin;
+    soma_return_t ret;
+    hg_return_t hret;
+    unsigned i;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.wl = &wl;
+
+    if(wl.address) {
+        char protocol[64] = {0};
+        const char* sep = strstr(wl.address, "://");
+        size_t len = sep ? (size_t)(sep - wl.address) : strlen(wl.address);
+        if(len >= sizeof(protocol)) len = sizeof(protocol) - 1;
+        memcpy(protocol, wl.address, len);
+        ctx.mid = margo_init(protocol, MARGO_CLIENT_MODE, 1, wl.xstreams);
+        if(!ctx.mid) FATAL(MARGO_INSTANCE_NULL, "Could not initialize margo");
+        hret = margo_addr_lookup(ctx.mid, wl.address, &ctx.addr);
+        if(hret != HG_SUCCESS)
+            FATAL(ctx.mid, "margo_addr_lookup failed for address %s", wl.address);
+    } else {
+        ctx.mid = margo_init(wl.protocol, MARGO_SERVER_MODE, 1, wl.xstreams);
+        if(!ctx.mid) FATAL(MARGO_INSTANCE_NULL, "Could not initialize margo");
+        hret = margo_addr_self(ctx.mid, &ctx.addr);
+        if(hret != HG_SUCCESS)
+            FATAL(ctx.mid, "margo_addr_self failed");
+        struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+        args.token = wl.token;
+        ret = soma_provider_register(ctx.mid, wl.provider_id, &args,
+                                     SOMA_PROVIDER_IGNORE);
+        if(ret != SOMA_SUCCESS)
+            FATAL(ctx.mid, "soma_provider_register failed (ret = %d)", ret);
+    }
+
+    ret = soma_admin_init(ctx.mid, &admin);
+    if(ret != SOMA_SUCCESS)
+        FATAL(ctx.mid, "soma_admin_init failed (ret = %d)", ret);
+    ret = soma_client_init(ctx.mid, &ctx.client);
+    if(ret != SOMA_SUCCESS)
+        FATAL(ctx.mid, "soma_client_init failed (ret = %d)", ret);
+    ret = soma_create_collector(admin, ctx.addr, wl.provider_id, wl.token,
+            wl.collector_type, wl.collector_config, &ctx.collector_id);
+    if(ret != SOMA_SUCCESS)
+        FATAL(ctx.mid, "soma_create_collector failed (ret = %d)", ret);
+
+    ABT_pool pool;
+    margo_get_handler_pool(ctx.mid, &pool);
+
+    rank_state* ranks = (rank_state*)calloc(wl.ranks, sizeof(*ranks));
+    ABT_thread* ults  = (ABT_thread*)calloc(wl.ranks, sizeof(*ults));
+    if(!ranks || !ults)
+        FATAL(ctx.mid, "Could not allocate memory for %u ranks", wl.ranks);
+    size_t columns = wl.max_inflight * wl.samples_per_report;
+    for(i = 0; i < wl.ranks; i++) {
+        rank_state* rs  = &ranks[i];
+        rs->ctx         = &ctx;
+        rs->rank        = i;
+        rs->seed        = i + 1;
+        rs->series      = (uint64_t*)calloc(columns, sizeof(uint64_t));
+        rs->timestamps  = (uint64_t*)calloc(columns, sizeof(uint64_t));
+        rs->values      = (double*)calloc(columns, sizeof(double));
+        rs->reqs        = (soma_request_t*)calloc(wl.max_inflight, sizeof(soma_request_t));
+        rs->produced_at = (double*)calloc(wl.max_inflight, sizeof(double));
+        rs->state       = (double*)calloc(wl.samples_per_report, sizeof(double));
+        if(!rs->series || !rs->timestamps || !rs->values
+        || !rs->reqs || !rs->produced_at || !rs->state)
+            FATAL(ctx.mid, "Could not allocate memory for rank %u", i);
+    }
+
+    ctx.t_start = ABT_get_wtime();
+    for(i = 0; i < wl.ranks; i++) {
+        if(ABT_thread_create(pool, rank_ult, &ranks[i],
+                             ABT_THREAD_ATTR_NULL, &ults[i]) != ABT_SUCCESS)
+            FATAL(ctx.mid, "Could not create ULT for rank %u", i);
+    }
+    for(i = 0; i < wl.ranks; i++) {
+        ABT_thread_join(ults[i]);
+        ABT_thread_free(&ults[i]);
+    }
+    double duration = ABT_get_wtime() - ctx.t_start;
+
+    uint64_t num_samples = 0, num_batches = 0, num_errors = 0;
+    size_t num_lags = 0, j;
+    for(i = 0; i < wl.ranks; i++) {
+        num_samples += ranks[i].num_samples;
+        num_batches += ranks[i].num_batches;
+        num_errors  += ranks[i].num_errors;
+        num_lags    += ranks[i].num_lags;
+    }
+    double* lags = (double*)malloc((num_lags ? num_lags : 1) * sizeof(double));
+    size_t k = 0;
+    for(i = 0; i < wl.ranks; i++)
+        for(j = 0; j < ranks[i].num_lags; j++)
+            lags[k++] = ranks[i].lags[j];
+    qsort(lags, num_lags, sizeof(double), compare_doubles);
+
+    printf("{\n");
+    printf("  \"ranks\": %u,\n", wl.ranks);
+    printf("  \"series\": %lu,\n", (unsigned long)(wl.ranks * wl.samples_per_report));
+    printf("  \"duration\": %f,\n", duration);
+    printf("  \"samples\": %lu,\n", (unsigned long)num_samples);
+    printf("  \"batches\": %lu,\n", (unsigned long)num_batches);
+    printf("  \"errors\": %lu,\n", (unsigned long)num_errors);
+    printf("  \"samples_per_sec\": %f,\n", num_samples / duration);
+    printf("  \"batches_per_sec\": %f,\n", num_batches / duration);
+    printf("  \"lag_ms\": {\n");
+    printf("    \"p50\": %f,\n",  percentile(lags, num_lags, 0.5) * 1e3);
+    printf("    \"p99\": %f,\n",  percentile(lags, num_lags, 0.99) * 1e3);
+    printf("    \"p99.9\": %f,\n", percentile(lags, num_lags, 0.999) * 1e3);
+    printf("    \"max\": %f\n",   (num_lags ? lags[num_lags-1] : 0.0) * 1e3);
+    printf("  }\n");
+    printf("}\n");
+
+    free(lags);
+    for(i = 0; i < wl.ranks; i++) {
+        free(ranks[i].series);
+        free(ranks[i].timestamps);
+        free(ranks[i].values);
+        free(ranks[i].reqs);
+        free(ranks[i].produced_at);
+        free(ranks[i].state);
+        free(ranks[i].lags);
+    }
+    free(ranks);
+    free(ults);
+    soma_destroy_collector(admin, ctx.addr, wl.provider_id, wl.token, ctx.collector_id);
+    soma_client_finalize(ctx.client);
+    soma_admin_finalize(admin);
+    margo_addr_free(ctx.mid, ctx.addr);
+    margo_finalize(ctx.mid);
+    free(wl.metrics);
+    free(wl.phases);
+    json_object_put(json);
+    return num_errors ? -1 : 0;
+}
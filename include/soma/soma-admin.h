@@ -82,6 +82,58 @@ soma_return_t soma_open_collector(
         const char* config,
         soma_collector_id_t* id);
 
+/**
+ * @brief Same as soma_create_collector, also returning the
+ * provider-local index of the collector, with which collector handles
+ * can be seeded (see soma_collector_handle_create_with_index).
+ *
+ * @param[in] admin SOMA admin object.
+ * @param[in] address address of the provider.
+ * @param[in] provider_id provider id.
+ * @param[in] token security token.
+ * @param[in] type type of collector to create.
+ * @param[in] config Configuration.
+ * @param[out] id resulting collector id.
+ * @param[out] index resulting collector index.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_create_collector_with_index(
+        soma_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        const char* type,
+        const char* config,
+        soma_collector_id_t* id,
+        soma_collector_index_t* index);
+
+/**
+ * @brief Same as soma_open_collector, also returning the
+ * provider-local index of the collector, with which collector handles
+ * can be seeded (see soma_collector_handle_create_with_index).
+ *
+ * @param[in] admin SOMA admin object.
+ * @param[in] address address of the provider.
+ * @param[in] provider_id provider id.
+ * @param[in] token security token.
+ * @param[in] type type of collector to open.
+ * @param[in] config Configuration.
+ * @param[out] id resulting collector id.
+ * @param[out] index resulting collector index.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_open_collector_with_index(
+        soma_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        const char* type,
+        const char* config,
+        soma_collector_id_t* id,
+        soma_collector_index_t* index);
+
 /**
  * @brief Requests the provider to close a collector it is managing.
  *
@@ -138,4 +190,80 @@ soma_return_t soma_list_collectors(
         soma_collector_id_t* ids,
         size_t* count);
 
+/**
+ * @brief Lists one page of the ids of collectors available on the
+ * provider, optionally only those of a given backend type. Start with
+ * *cursor set to 0 and call again with the cursor it returns until it
+ * returns 0. A page may hold fewer ids than requested, even none, while
+ * the listing is not complete, since the provider bounds the work done
+ * per call. Collectors that exist during the whole listing are listed
+ * exactly once; those created or removed meanwhile may or may not be.
+ * Large pages are transferred with RDMA directly into ids.
+ *
+ * @param[in] admin SOMA admin object.
+ * @param[in] address address of the provider.
+ * @param[in] provider_id provider id.
+ * @param[in] token security token.
+ * @param[in] type backend type to list, or NULL for all.
+ * @param[inout] cursor position in the listing (0 to start; 0 at the end).
+ * @param[out] ids array of collector ids.
+ * @param[inout] count size of the array (in), number of ids returned (out).
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_list_collectors_page(
+        soma_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        const char* type,
+        uint64_t* cursor,
+        soma_collector_id_t* ids,
+        size_t* count);
+
+/**
+ * @brief Retrieves the per-RPC statistics of a provider as a JSON
+ * document: for each RPC, the number of calls and errors, the bytes
+ * received and sent, and histograms of the time spent in the handler
+ * and of the number of requests queued in its pool when it started.
+ *
+ * @param[in] admin SOMA admin object.
+ * @param[in] address address of the provider.
+ * @param[in] provider_id provider id.
+ * @param[in] token security token.
+ * @param[out] stats JSON string (to be freed by the caller using free).
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_get_provider_stats(
+        soma_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        char** stats);
+
+/**
+ * @brief Retrieves the memory accounting of a provider as a JSON
+ * document: the bytes used by all its collectors, its memory budgets,
+ * the number of spill passes, of bytes spilled and of batches refused
+ * for exceeding a budget, and for each collector, its type, the bytes
+ * it uses, the bytes its arena obtained from the heap and the bytes it
+ * spilled, e.g. { "used" : 1048576, "collector_limit" : 0, ...,
+ * "collectors" : { "<uuid>" : { "type" : "timeseries", "used" : ... } } }.
+ *
+ * @param[in] admin SOMA admin object.
+ * @param[in] address address of the provider.
+ * @param[in] provider_id provider id.
+ * @param[in] token security token.
+ * @param[out] usage JSON string (to be freed by the caller using free).
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_get_memory_usage(
+        soma_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        char** usage);
+
 #endif
@@ -9,13 +9,112 @@
 #include <soma/soma-server.h>
 #include <soma/soma-common.h>
 
+/* Version of the backend interface described below. Version 1 only
+ * had the per-call functions up to publish; version 2 added the batch
+ * functions (ingest, query, flush); version 3 added the functions
+ * creating and opening collectors in an arena; version 4 added spill;
+ * version 5 added scan. */
+#define SOMA_BACKEND_API_VERSION 5
+
+/**
+ * @brief Columnar view of a batch of samples: the i-th sample is
+ * (series[i], timestamps[i], values[i]). The arrays point into memory
+ * owned by the provider (typically the buffer the batch was pulled
+ * into) and are only valid for the duration of the call.
+ */
+typedef struct soma_batch_t {
+    size_t          count;
+    const uint64_t* series;
+    const uint64_t* timestamps;
+    const double*   values;
+} soma_batch_t;
+
+/**
+ * @brief Arena holding the memory of a collector. The provider creates
+ * one for each collector and releases it in one go after the collector
+ * has been closed or destroyed, so a backend creating its collectors in
+ * an arena (see create_collector_in_arena below) does not need to free
+ * what it allocated from it.
+ *
+ * Allocations are served from per-collector slabs of power-of-two size
+ * classes, which keeps execution streams working on different
+ * collectors from contending on the heap. Memory is aligned on 16
+ * bytes, and on a cache line (64 bytes) for sizes of 64 bytes or more.
+ * Freed memory is reused by later allocations of the same arena; the
+ * size passed to soma_arena_free must be the one it was allocated with.
+ *
+ * All three functions accept a NULL arena, in which case they use the
+ * heap, so the same backend code can serve collectors with and without
+ * an arena.
+ */
+typedef struct soma_arena* soma_arena_t;
+
+void* soma_arena_alloc(soma_arena_t arena, size_t size);
+
+void* soma_arena_calloc(soma_arena_t arena, size_t size);
+
+void soma_arena_free(soma_arena_t arena, void* ptr, size_t size);
+
+/**
+ * @brief Accounts for memory that a collector holds outside of its
+ * arena (bytes > 0 when it is acquired, < 0 when it is released), so
+ * that it counts against the collector's memory budget. Memory still
+ * accounted for when the arena is released is discounted with it.
+ */
+void soma_arena_account(soma_arena_t arena, int64_t bytes);
+
+/**
+ * @brief Function receiving the samples of a scan (see scan below) a
+ * slice at a time; the arrays are only valid for the duration of the
+ * call. Returning a non-zero value stops the scan.
+ */
+typedef int (*soma_scan_fn)(void* uargs,
+        const uint64_t* timestamps,
+        const double* values,
+        size_t count);
+
 typedef soma_return_t (*soma_backend_create_fn)(soma_provider_t, const char*, void**);
 typedef soma_return_t (*soma_backend_open_fn)(soma_provider_t, const char*, void**);
+typedef soma_return_t (*soma_backend_create_in_arena_fn)(soma_provider_t, const char*, soma_arena_t, void**);
+typedef soma_return_t (*soma_backend_open_in_arena_fn)(soma_provider_t, const char*, soma_arena_t, void**);
 typedef soma_return_t (*soma_backend_close_fn)(void*);
 typedef soma_return_t (*soma_backend_destroy_fn)(void*);
 
 /**
  * @brief Implementation of an SOMA backend.
+ *
+ * The batch functions are the preferred way of handling samples:
+ * - ingest receives a whole batch at once;
+ * - query copies up to *count samples (in: capacity, out: number
+ *   copied) selected by the query into the provided timestamps and
+ *   values arrays;
+ * - flush makes everything ingested so far durable, if applicable;
+ * - scan passes the samples selected by the query, once the first
+ *   query->offset ones have been skipped, to the given function until
+ *   it asks to stop, in a single pass over the data. The provider
+ *   evaluates soma_query with it and, for backends without it, has to
+ *   call query repeatedly with a growing offset instead.
+ *
+ * Backends written against version 1 of this interface, which leave
+ * these functions NULL, keep working: the provider then feeds batches
+ * to publish, reports queries as unsupported, and treats flush as a
+ * no-op.
+ *
+ * When create_collector_in_arena (resp. open_collector_in_arena) is
+ * provided, the provider calls it instead of create_collector (resp.
+ * open_collector), passing the arena of the new collector. The arena
+ * stays valid until close_collector or destroy_collector has returned,
+ * which only have to release what does not live in the arena.
+ *
+ * When a collector exceeds its memory budget (see soma-server.h), the
+ * provider calls spill from a background ULT, asking the backend to
+ * move at least the given number of bytes of its oldest data out of
+ * memory, into the file at the given path (always the same for a given
+ * collector), and to set the last argument to the number of bytes it
+ * released. Spilled data should remain readable; the file belongs to
+ * the backend, which removes it when the collector is closed or
+ * destroyed. Collectors of backends without spill are refused samples
+ * once they exceed their budget.
  */
 typedef struct soma_backend_impl {
     // backend name
@@ -28,6 +127,18 @@ typedef struct soma_backend_impl {
     // RPC functions
     void (*hello)(void*);
     int32_t (*sum)(void*, int32_t, int32_t);
+    soma_return_t (*publish)(void*, const soma_sample_t*, size_t);
+    // batch functions (version 2)
+    soma_return_t (*ingest)(void*, const soma_batch_t*);
+    soma_return_t (*query)(void*, const soma_query_t*, uint64_t*, double*, size_t*);
+    soma_return_t (*flush)(void*);
+    // arena functions (version 3)
+    soma_backend_create_in_arena_fn create_collector_in_arena;
+    soma_backend_open_in_arena_fn   open_collector_in_arena;
+    // memory budget function (version 4)
+    soma_return_t (*spill)(void*, const char*, size_t, size_t*);
+    // single-pass query function (version 5)
+    soma_return_t (*scan)(void*, const soma_query_t*, soma_scan_fn, void*);
     // ... add other functions here
 } soma_backend_impl;
 
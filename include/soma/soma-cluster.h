@@ -0,0 +1,194 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __SOMA_CLUSTER_H
+#define __SOMA_CLUSTER_H
+
+#include <margo.h>
+#include <soma/soma-common.h>
+#include <soma/soma-client.h>
+#include <soma/soma-collector.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A cluster handle spreads series over a set of collectors, typically
+ * one per provider. Each series is routed to a member by consistent
+ * hashing: every member owns a number of points (virtual nodes) on a
+ * hash ring, placed according to the member's collector id, and a
+ * series belongs to the member owning the first point that follows the
+ * series' hash. All clients using the same members thus route series
+ * identically, and adding or removing a member only moves the series
+ * that it gains or loses.
+ */
+
+typedef struct soma_cluster_handle *soma_cluster_handle_t;
+#define SOMA_CLUSTER_HANDLE_NULL ((soma_cluster_handle_t)NULL)
+
+#define SOMA_DEFAULT_VIRTUAL_NODES 128 /* points per member on the ring */
+
+/**
+ * @brief Creates a cluster handle from collector handles. The cluster
+ * handle takes a reference to each of them.
+ *
+ * @param[in] client SOMA client responsible for the cluster handle.
+ * @param[in] count number of members.
+ * @param[in] members collector handles of the members.
+ * @param[in] virtual_nodes points per member on the hash ring
+ * (0 for SOMA_DEFAULT_VIRTUAL_NODES).
+ * @param[out] cluster resulting cluster handle.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_cluster_handle_create(
+        soma_client_t client,
+        size_t count,
+        const soma_collector_handle_t* members,
+        unsigned virtual_nodes,
+        soma_cluster_handle_t* cluster);
+
+/**
+ * @brief Creates a cluster handle from a JSON file listing its
+ * members, e.g.
+ *
+ * { "virtual_nodes" : 128,
+ *   "members" : [ { "address" : "na+sm://...", "provider_id" : 42,
+ *                   "collector" : "<uuid>" }, ... ] }
+ *
+ * When SOMA is built with SSG support, the addresses can instead be
+ * taken from an SSG group file, the i-th member of the group hosting
+ * the i-th collector (SSG must have been initialized):
+ *
+ * { "ssg_group_file" : "soma.ssg", "provider_id" : 42,
+ *   "collectors" : [ "<uuid>", ... ] }
+ *
+ * @param[in] client SOMA client responsible for the cluster handle.
+ * @param[in] filename path to the JSON file.
+ * @param[out] cluster resulting cluster handle.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_cluster_handle_create_from_file(
+        soma_client_t client,
+        const char* filename,
+        soma_cluster_handle_t* cluster);
+
+/**
+ * @brief Releases a cluster handle, flushing and releasing the
+ * collector handles of its members.
+ *
+ * @param[in] cluster cluster handle.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_cluster_handle_release(
+        soma_cluster_handle_t cluster);
+
+/**
+ * @brief Adds a member to the cluster. Only the series that the new
+ * member takes over are routed differently afterwards.
+ *
+ * @param[in] cluster cluster handle.
+ * @param[in] member collector handle of the new member.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_cluster_add_member(
+        soma_cluster_handle_t cluster,
+        soma_collector_handle_t member);
+
+/**
+ * @brief Removes the member with the given collector id from the
+ * cluster, flushing and releasing its collector handle. Its series
+ * are spread over the remaining members.
+ *
+ * @param[in] cluster cluster handle.
+ * @param[in] collector_id collector id of the member to remove.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_cluster_remove_member(
+        soma_cluster_handle_t cluster,
+        soma_collector_id_t collector_id);
+
+/**
+ * @brief Gets the number of members of the cluster.
+ *
+ * @param[in] cluster cluster handle.
+ * @param[out] count number of members.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_cluster_get_size(
+        soma_cluster_handle_t cluster,
+        size_t* count);
+
+/**
+ * @brief Finds the collector a series is routed to. The returned
+ * handle is owned by the cluster: callers that need it after removing
+ * its member or releasing the cluster should take a reference with
+ * soma_collector_handle_ref_incr.
+ *
+ * @param[in] cluster cluster handle.
+ * @param[in] series series identifier.
+ * @param[out] member collector handle the series is routed to.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_cluster_route(
+        soma_cluster_handle_t cluster,
+        uint64_t series,
+        soma_collector_handle_t* member);
+
+/**
+ * @brief Stages a single sample in the buffer of the collector
+ * handle its series is routed to (see soma_publish).
+ *
+ * @param[in] cluster cluster handle.
+ * @param[in] series series the sample belongs to.
+ * @param[in] timestamp timestamp of the sample.
+ * @param[in] value value of the sample.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_cluster_publish(
+        soma_cluster_handle_t cluster,
+        uint64_t series,
+        uint64_t timestamp,
+        double value);
+
+/**
+ * @brief Splits a batch of samples by member and sends each part to
+ * its member with a single RPC, the RPCs being sent concurrently.
+ *
+ * @param[in] cluster cluster handle.
+ * @param[in] samples array of samples.
+ * @param[in] count number of samples in the array.
+ *
+ * @return SOMA_SUCCESS or the first error returned by a member
+ */
+soma_return_t soma_cluster_publish_batch(
+        soma_cluster_handle_t cluster,
+        const soma_sample_t* samples,
+        size_t count);
+
+/**
+ * @brief Flushes the samples staged in the collector handles of all
+ * the members.
+ *
+ * @param[in] cluster cluster handle.
+ *
+ * @return SOMA_SUCCESS or the first error returned by a member
+ */
+soma_return_t soma_cluster_flush(
+        soma_cluster_handle_t cluster);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,9 +17,21 @@ extern "C" {
 typedef struct soma_collector_handle *soma_collector_handle_t;
 #define SOMA_COLLECTOR_HANDLE_NULL ((soma_collector_handle_t)NULL)
 
+typedef struct soma_request *soma_request_t;
+#define SOMA_REQUEST_NULL ((soma_request_t)NULL)
+
+#define SOMA_DEFAULT_BUFFER_CAPACITY  1024 /* samples */
+#define SOMA_DEFAULT_BUFFER_MAX_DELAY 1.0  /* seconds */
+#define SOMA_DEFAULT_SHM_CAPACITY     65536 /* samples */
+
 /**
  * @brief Creates a SOMA collector handle.
  *
+ * If addr is the address of the client's own margo instance and the
+ * provider is registered with that instance, the synchronous functions
+ * below call the provider directly instead of sending RPCs. The _async
+ * variants always send RPCs.
+ *
  * @param[in] client SOMA client responsible for the collector handle
  * @param[in] addr Mercury address of the provider
  * @param[in] provider_id id of the provider
@@ -34,6 +46,31 @@ soma_return_t soma_collector_handle_create(
         soma_collector_id_t collector_id,
         soma_collector_handle_t* handle);
 
+/**
+ * @brief Same as soma_collector_handle_create, seeding the handle with
+ * the provider-local index of the collector returned by
+ * soma_create_collector_with_index or soma_open_collector_with_index,
+ * so that even the first requests sent through the handle do not need
+ * the provider to look the collector up by id. A stale index is
+ * detected by the provider, and the handle then falls back to the id.
+ *
+ * @param[in] client SOMA client responsible for the collector handle
+ * @param[in] addr Mercury address of the provider
+ * @param[in] provider_id id of the provider
+ * @param[in] collector_id id of the collector
+ * @param[in] collector_index index of the collector
+ * @param[in] handle collector handle
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_collector_handle_create_with_index(
+        soma_client_t client,
+        hg_addr_t addr,
+        uint16_t provider_id,
+        soma_collector_id_t collector_id,
+        soma_collector_index_t collector_index,
+        soma_collector_handle_t* handle);
+
 /**
  * @brief Increments the reference counter of a collector handle.
  *
@@ -47,7 +84,7 @@ soma_return_t soma_collector_handle_ref_incr(
 /**
  * @brief Releases the collector handle. This will decrement the
  * reference counter, and free the collector handle if the reference
- * counter reaches 0.
+ * counter reaches 0, after flushing any sample still staged in it.
  *
  * @param[in] handle collector handle to release.
  *
@@ -55,6 +92,89 @@ soma_return_t soma_collector_handle_ref_incr(
  */
 soma_return_t soma_collector_handle_release(soma_collector_handle_t handle);
 
+/**
+ * @brief Configures the write-combining buffer of the collector
+ * handle. Samples passed to soma_publish are staged in this buffer
+ * and sent in a single RPC once capacity samples are staged, or once
+ * the oldest staged sample is max_delay seconds old, even if no other
+ * sample is published: a ULT of the handler pool of the client's margo
+ * instance then sends them, and the error it may get is returned by
+ * the next call to soma_collector_handle_flush. Setting capacity to 0
+ * disables buffering. Samples already staged are flushed first.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] capacity maximum number of staged samples.
+ * @param[in] max_delay maximum time a sample can stay staged (seconds).
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_collector_handle_set_buffering(
+        soma_collector_handle_t handle,
+        size_t capacity,
+        double max_delay);
+
+/**
+ * @brief Enables or disables direct calls through the collector
+ * handle. By default, a handle to a provider registered with the
+ * client's own margo instance calls the provider directly instead of
+ * sending RPCs. Disabling this forces RPCs, for instance to measure
+ * them. Enabling it has no effect on handles to remote providers.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] enabled whether direct calls are allowed.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_collector_handle_set_local(
+        soma_collector_handle_t handle,
+        int enabled);
+
+/**
+ * @brief Sends all the samples staged in the collector handle's
+ * buffer to the collector.
+ *
+ * @param[in] handle collector handle.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_collector_handle_flush(
+        soma_collector_handle_t handle);
+
+/**
+ * @brief Attaches a shared-memory ring of capacity samples (rounded up
+ * to a power of 2, SOMA_DEFAULT_SHM_CAPACITY if 0) between the collector
+ * handle and its provider, which must run on the same node. Once
+ * attached, soma_publish, soma_publish_batch and soma_publish_columns
+ * write samples into the ring instead of sending RPCs, and the provider
+ * drains the ring into the collector in the background; the _async
+ * variants keep using RPCs. soma_collector_handle_flush waits until
+ * the provider has consumed every sample written so far.
+ *
+ * Returns SOMA_ERR_OP_UNSUPPORTED if the provider cannot map the ring
+ * (e.g. it is on another node), in which case the handle keeps using
+ * RPCs.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] capacity number of samples the ring can hold.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_collector_handle_attach_shm(
+        soma_collector_handle_t handle,
+        size_t capacity);
+
+/**
+ * @brief Detaches the collector handle's shared-memory ring, after the
+ * provider has consumed the samples it still contains. This is done
+ * automatically when the handle is released.
+ *
+ * @param[in] handle collector handle.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_collector_handle_detach_shm(
+        soma_collector_handle_t handle);
+
 /**
  * @brief Makes the target SOMA collector print Hello World.
  *
@@ -67,6 +187,19 @@ soma_return_t soma_collector_handle_release(soma_collector_handle_t handle);
  */
 soma_return_t soma_say_hello(soma_collector_handle_t handle);
 
+/**
+ * @brief Non-blocking version of soma_say_hello. The request
+ * must be completed with soma_request_wait or soma_request_wait_any.
+ *
+ * @param[in] handle collector handle.
+ * @param[out] req resulting request.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_say_hello_async(
+        soma_collector_handle_t handle,
+        soma_request_t* req);
+
 /**
  * @brief Makes the target SOMA collector compute the sum of the
  * two numbers and return the result.
@@ -84,6 +217,292 @@ soma_return_t soma_compute_sum(
         int32_t y,
         int32_t* result);
 
+/**
+ * @brief Non-blocking version of soma_compute_sum. The result is
+ * only valid once the request has been completed with
+ * soma_request_wait or soma_request_wait_any, and the result
+ * pointer must remain valid until then.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] x first number.
+ * @param[in] y second number.
+ * @param[out] result resulting value.
+ * @param[out] req resulting request.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_compute_sum_async(
+        soma_collector_handle_t handle,
+        int32_t x,
+        int32_t y,
+        int32_t* result,
+        soma_request_t* req);
+
+/**
+ * @brief Publishes a batch of samples to the target SOMA collector
+ * using a single RPC. The samples are laid out in columns (see
+ * soma_publish_columns) before being sent, so applications that
+ * already hold their samples in columns should prefer the latter.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] samples array of samples.
+ * @param[in] count number of samples in the array.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_publish_batch(
+        soma_collector_handle_t handle,
+        const soma_sample_t* samples,
+        size_t count);
+
+/**
+ * @brief Non-blocking version of soma_publish_batch. The samples
+ * are copied, so the array can be reused as soon as this function
+ * returns.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] samples array of samples.
+ * @param[in] count number of samples in the array (must not be 0).
+ * @param[out] req resulting request.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_publish_batch_async(
+        soma_collector_handle_t handle,
+        const soma_sample_t* samples,
+        size_t count,
+        soma_request_t* req);
+
+/**
+ * @brief Publishes a batch of samples given as three columns, the
+ * i-th sample being (series[i], timestamps[i], values[i]). Small
+ * batches, whose encoding fits in the eager buffer of an RPC, are
+ * compressed into a copy sent within the RPC; larger ones are exposed
+ * to the provider via RDMA and pulled by it without being copied. In
+ * both cases the arrays must remain valid and unmodified until this
+ * function returns.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] count number of samples.
+ * @param[in] series array of series identifiers.
+ * @param[in] timestamps array of timestamps.
+ * @param[in] values array of values.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_publish_columns(
+        soma_collector_handle_t handle,
+        size_t count,
+        const uint64_t* series,
+        const uint64_t* timestamps,
+        const double* values);
+
+/**
+ * @brief Non-blocking version of soma_publish_columns. The arrays
+ * must remain valid and unmodified until the request has been
+ * completed with soma_request_wait or soma_request_wait_any.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] count number of samples (must not be 0).
+ * @param[in] series array of series identifiers.
+ * @param[in] timestamps array of timestamps.
+ * @param[in] values array of values.
+ * @param[out] req resulting request.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_publish_columns_async(
+        soma_collector_handle_t handle,
+        size_t count,
+        const uint64_t* series,
+        const uint64_t* timestamps,
+        const double* values,
+        soma_request_t* req);
+
+/**
+ * @brief Stages a single sample in the collector handle's buffer.
+ * The sample is sent along with other staged samples when the
+ * buffer is flushed (see soma_collector_handle_set_buffering).
+ *
+ * @param[in] handle collector handle.
+ * @param[in] series series the sample belongs to.
+ * @param[in] timestamp timestamp of the sample.
+ * @param[in] value value of the sample.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_publish(
+        soma_collector_handle_t handle,
+        uint64_t series,
+        uint64_t timestamp,
+        double value);
+
+/**
+ * @brief Retrieves the aggregate (count, sum, min, max, and range of
+ * timestamps) of the samples of each requested series. A collector
+ * maintains aggregates for the aggregates forwarded to it by downstream
+ * providers, and for the samples it receives if its provider is
+ * configured to forward them upstream (see soma_provider_register).
+ * Series the collector has no data for get a count of 0.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] count number of series.
+ * @param[in] series array of series identifiers.
+ * @param[out] aggregates array of count aggregates.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_get_aggregates(
+        soma_collector_handle_t handle,
+        size_t count,
+        const uint64_t* series,
+        soma_aggregate_t* aggregates);
+
+/**
+ * @brief Non-blocking version of soma_get_aggregates. Both arrays
+ * must remain valid until the request has been completed with
+ * soma_request_wait or soma_request_wait_any.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] count number of series.
+ * @param[in] series array of series identifiers.
+ * @param[out] aggregates array of count aggregates.
+ * @param[out] req resulting request.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_get_aggregates_async(
+        soma_collector_handle_t handle,
+        size_t count,
+        const uint64_t* series,
+        soma_aggregate_t* aggregates,
+        soma_request_t* req);
+
+/* maximum number of results of a single soma_query */
+#define SOMA_QUERY_MAX_RESULTS 1048576
+
+/**
+ * @brief Queries the samples of the requested series whose timestamp
+ * is in [t_start, t_end), letting the provider reduce them next to the
+ * data. The collector's backend must support queries (the timeseries
+ * backend does), otherwise SOMA_ERR_OP_UNSUPPORTED is returned.
+ *
+ * With SOMA_AGG_NONE, results receives the samples themselves, series
+ * after series in the requested order, and step is ignored. If cursor
+ * is not NULL, the samples start at the position it holds (a zeroed
+ * cursor being the start of the selection) and it is updated to the
+ * position following the last sample received. If *count is the
+ * capacity on return, the selection may hold more samples, which the
+ * next call with the same arguments and the updated cursor retrieves.
+ *
+ * Otherwise, the time range is split into steps of step units (a single
+ * step covering the whole range if step is 0), and results receives, for
+ * each requested series and for each step, the reduction of the samples
+ * in that step: the step (t_start + k * step, for the k-th step) as
+ * timestamp and the reduced value as value. This makes num_series times
+ * the number of steps results, which must not exceed the capacity nor
+ * SOMA_QUERY_MAX_RESULTS. Steps without samples get a value of 0 with
+ * SOMA_AGG_SUM and SOMA_AGG_COUNT and NaN with the other reductions, as
+ * do steps with fewer than two distinct timestamps with SOMA_AGG_RATE.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] num_series number of series.
+ * @param[in] series array of series identifiers.
+ * @param[in] t_start first timestamp included.
+ * @param[in] t_end first timestamp excluded.
+ * @param[in] aggregation reduction to apply.
+ * @param[in] step width of the steps (with a reduction).
+ * @param[inout] cursor position in the samples (without a reduction), or NULL.
+ * @param[out] results array of results.
+ * @param[inout] count in: capacity of results, out: number of results.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_query(
+        soma_collector_handle_t handle,
+        size_t num_series,
+        const uint64_t* series,
+        uint64_t t_start,
+        uint64_t t_end,
+        soma_aggregation_t aggregation,
+        uint64_t step,
+        soma_query_cursor_t* cursor,
+        soma_sample_t* results,
+        size_t* count);
+
+/**
+ * @brief Non-blocking version of soma_query. The series, cursor, results
+ * and count must remain valid until the request has been completed with
+ * soma_request_wait or soma_request_wait_any.
+ *
+ * @param[in] handle collector handle.
+ * @param[in] num_series number of series.
+ * @param[in] series array of series identifiers.
+ * @param[in] t_start first timestamp included.
+ * @param[in] t_end first timestamp excluded.
+ * @param[in] aggregation reduction to apply.
+ * @param[in] step width of the steps (with a reduction).
+ * @param[inout] cursor position in the samples (without a reduction), or NULL.
+ * @param[out] results array of results.
+ * @param[inout] count in: capacity of results, out: number of results.
+ * @param[out] req resulting request.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_query_async(
+        soma_collector_handle_t handle,
+        size_t num_series,
+        const uint64_t* series,
+        uint64_t t_start,
+        uint64_t t_end,
+        soma_aggregation_t aggregation,
+        uint64_t step,
+        soma_query_cursor_t* cursor,
+        soma_sample_t* results,
+        size_t* count,
+        soma_request_t* req);
+
+/**
+ * @brief Waits for a request to complete and frees it. The return
+ * value is that of the operation the request was created by.
+ *
+ * @param[in] req request to wait for.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_request_wait(soma_request_t req);
+
+/**
+ * @brief Checks whether a request has completed, without blocking.
+ * The request still needs to be passed to soma_request_wait to
+ * retrieve its result and free it.
+ *
+ * @param[in] req request to test.
+ * @param[out] flag set to 1 if the request has completed, 0 otherwise.
+ *
+ * @return SOMA_SUCCESS or error code defined in soma-common.h
+ */
+soma_return_t soma_request_test(soma_request_t req, int* flag);
+
+/**
+ * @brief Waits for any of the requests to complete. The completed
+ * request is freed and replaced by SOMA_REQUEST_NULL in the array,
+ * and SOMA_REQUEST_NULL entries are ignored, so the function can be
+ * called repeatedly on the same array to drain it.
+ *
+ * @param[in] count number of requests.
+ * @param[inout] reqs array of requests.
+ * @param[out] index index of the completed request, or count if
+ * none could be waited for.
+ *
+ * @return the return value of the completed operation, or an
+ * error code defined in soma-common.h
+ */
+soma_return_t soma_request_wait_any(
+        size_t count,
+        soma_request_t* reqs,
+        size_t* index);
+
 #ifdef __cplusplus
 }
 #endif
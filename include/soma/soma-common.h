@@ -29,6 +29,8 @@ typedef enum soma_return_t {
     SOMA_ERR_FROM_ARGOBOTS,     /* Argobots error */
     SOMA_ERR_OP_UNSUPPORTED,    /* Unsupported operation */
     SOMA_ERR_OP_FORBIDDEN,      /* Forbidden operation */
+    SOMA_ERR_IO,                /* I/O error */
+    SOMA_ERR_MEMORY_LIMIT,      /* Memory budget exceeded */
     /* ... TODO add more error codes here if needed */
     SOMA_ERR_OTHER              /* Other error */
 } soma_return_t;
@@ -40,6 +42,81 @@ typedef struct soma_collector_id_t {
     uuid_t uuid;
 } soma_collector_id_t;
 
+/**
+ * @brief Provider-local index of a collector. The slot is a dense
+ * index into the provider's array of collectors, and the generation
+ * tells apart successive collectors that used the same slot.
+ */
+typedef struct soma_collector_index_t {
+    uint32_t slot;
+    uint32_t generation;
+} soma_collector_index_t;
+
+#define SOMA_COLLECTOR_SLOT_NONE UINT32_MAX
+
+/**
+ * @brief A single telemetry sample.
+ */
+typedef struct soma_sample_t {
+    uint64_t series;    /* identifier of the series the sample belongs to */
+    uint64_t timestamp; /* timestamp, in a unit chosen by the application */
+    double   value;     /* sampled value */
+} soma_sample_t;
+
+/**
+ * @brief Reduction of samples of a series: how many there were, the
+ * range of their timestamps, and the sum, minimum and maximum of their
+ * values. Aggregates of disjoint sets of samples of the same series
+ * can be merged into the aggregate of their union.
+ */
+typedef struct soma_aggregate_t {
+    uint64_t series;    /* series the samples belong to */
+    uint64_t count;     /* number of samples (0 if none) */
+    uint64_t t_first;   /* smallest timestamp */
+    uint64_t t_last;    /* largest timestamp */
+    double   sum;       /* sum of the values */
+    double   min;       /* smallest value */
+    double   max;       /* largest value */
+} soma_aggregate_t;
+
+/**
+ * @brief Selection of the samples of a series whose timestamp is in
+ * [t_start, t_end). The first offset matching samples are skipped,
+ * which allows retrieving a large selection in several steps.
+ */
+typedef struct soma_query_t {
+    uint64_t series;    /* series to look at */
+    uint64_t t_start;   /* first timestamp included */
+    uint64_t t_end;     /* first timestamp excluded */
+    uint64_t offset;    /* number of matching samples to skip */
+} soma_query_t;
+
+/**
+ * @brief Position in the samples retrieved by soma_query without a
+ * reduction: the next sample is the one following the first offset
+ * samples of the series at the given index in the requested series.
+ * A zeroed cursor is the start of the selection.
+ */
+typedef struct soma_query_cursor_t {
+    uint64_t series;    /* index in the requested series */
+    uint64_t offset;    /* number of samples of that series retrieved */
+} soma_query_cursor_t;
+
+/**
+ * @brief Reduction applied by soma_query to the samples of each series
+ * that fall in the same step of the queried time range.
+ */
+typedef enum soma_aggregation_t {
+    SOMA_AGG_NONE,   /* no reduction, the samples themselves */
+    SOMA_AGG_SUM,    /* sum of the values */
+    SOMA_AGG_MIN,    /* smallest value */
+    SOMA_AGG_MAX,    /* largest value */
+    SOMA_AGG_MEAN,   /* average of the values */
+    SOMA_AGG_COUNT,  /* number of samples */
+    SOMA_AGG_RATE    /* change of the value per unit of time, between
+                        the first and the last sample */
+} soma_aggregation_t;
+
 /**
  * @brief Converts a soma_collector_id_t into a string.
  *
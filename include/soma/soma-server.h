@@ -21,10 +21,13 @@ typedef struct soma_provider* soma_provider_t;
 #define SOMA_PROVIDER_IGNORE ((soma_provider_t*)NULL)
 
 struct soma_provider_args {
-    const char*        token;  // Security token
-    const char*        config; // JSON configuration
-    ABT_pool           pool;   // Pool used to run RPCs
-    abt_io_instance_id abtio;  // ABT-IO instance
+    const char*        token;       // Security token
+    const char*        config;      // JSON configuration
+    ABT_pool           pool;        // Pool used to run RPCs (defaults to margo's handler pool)
+    ABT_pool           admin_pool;  // Pool used to run admin RPCs (defaults to pool)
+    ABT_pool           ingest_pool; // Pool used to run ingest RPCs (defaults to pool)
+    ABT_pool           query_pool;  // Pool used to run query RPCs (defaults to pool)
+    abt_io_instance_id abtio;       // ABT-IO instance
     // ...
 };
 
@@ -32,6 +35,9 @@ struct soma_provider_args {
     .token = NULL, \
     .config = NULL, \
     .pool = ABT_POOL_NULL, \
+    .admin_pool = ABT_POOL_NULL, \
+    .ingest_pool = ABT_POOL_NULL, \
+    .query_pool = ABT_POOL_NULL, \
     .abtio = ABT_IO_INSTANCE_NULL \
 }
 
@@ -40,6 +46,54 @@ struct soma_provider_args {
  * is passed as last argument, the provider will be automatically
  * destroyed when calling margo_finalize.
  *
+ * RPCs are split into three classes that can run in different pools:
+ * admin RPCs (creating, opening, closing, destroying and listing
+ * collectors), ingest RPCs (saying hello, computing sums and sending
+ * data to a collector) and query RPCs (computing results from a
+ * collector). Each class runs in the corresponding pool from the
+ * arguments if provided, otherwise in the pool named in the "pools"
+ * section of the JSON configuration, e.g. { "pools" : { "admin" :
+ * "my_admin_pool" } }, otherwise in args->pool, which defaults to
+ * margo's handler pool. The background ULTs of the provider follow
+ * the same rule, with "upstream" and "spill" entries in the "pools"
+ * section and no argument of their own; an unknown pool name is
+ * reported with a warning and replaced by args->pool.
+ *
+ * Providers can be arranged in a tree that reduces telemetry across
+ * nodes: a provider whose configuration has an "upstream" section
+ * keeps per-series aggregates (count, sum, min, max) of the samples
+ * its collectors receive, and periodically forwards what was added
+ * since the previous round to a collector of the upstream provider,
+ * e.g. { "upstream" : { "address" : "na+sm://...", "provider_id" : 42,
+ * "collector" : "<uuid>", "interval" : 1.0 } } (interval in seconds,
+ * 1 by default). The ULT doing so runs in the "upstream" pool.
+ *
+ * A provider whose configuration has a "catalog" section, e.g.
+ * { "catalog" : { "path" : "/path/to/catalog", "open_threads" : 4 } },
+ * records the id, type and configuration of the collectors it creates
+ * or opens, and forgets them when they are closed or destroyed. When
+ * registered again with the same catalog, it gets back the same
+ * collectors under the same ids without waiting for them to be opened:
+ * open_threads ULTs of the admin pool (4 by default, 0 to disable them)
+ * open them in the background, and an RPC needing one that is not open
+ * yet opens it first. Collectors whose backend type is registered after
+ * the provider are only opened on demand. Opening a collector with the
+ * type and configuration of one the catalog already has returns that
+ * collector.
+ *
+ * The memory used by each collector is accounted for, and can be
+ * bounded by a "memory" section, e.g. { "memory" : { "collector_limit"
+ * : 1073741824, "provider_limit" : 4294967296, "spill_path" : "/tmp" } }
+ * (limits in bytes, 0 or absent for no limit). When a collector, or
+ * all the collectors together, exceed their limit, the oldest data of
+ * the collector receiving samples is moved to a file of spill_path by
+ * ULTs of the "spill" pool, through the provider's ABT-IO instance, until it is
+ * back to 3/4 of the limit. A collector over its limit that cannot
+ * spill (no spill_path, no ABT-IO instance, or a backend that does not
+ * support it), or that is over it by more than a quarter because
+ * spilling cannot keep up, is refused samples with SOMA_ERR_MEMORY_LIMIT.
+ * soma_get_memory_usage (soma-admin.h) reports the accounting.
+ *
  * @param[in] mid Margo instance
  * @param[in] provider_id provider id
  * @param[in] args argument structure
@@ -24,6 +24,8 @@ soma_return_t soma_admin_init(margo_instance_id mid, soma_admin_t* admin)
         margo_registered_name(mid, "soma_close_collector", &a->close_collector_id, &flag);
         margo_registered_name(mid, "soma_destroy_collector", &a->destroy_collector_id, &flag);
         margo_registered_name(mid, "soma_list_collectors", &a->list_collectors_id, &flag);
+        margo_registered_name(mid, "soma_get_provider_stats", &a->get_stats_id, &flag);
+        margo_registered_name(mid, "soma_get_memory_usage", &a->get_memory_id, &flag);
         /* Get more existing RPCs... */
     } else {
         a->create_collector_id =
@@ -41,6 +43,12 @@ soma_return_t soma_admin_init(margo_instance_id mid, soma_admin_t* admin)
         a->list_collectors_id =
             MARGO_REGISTER(mid, "soma_list_collectors",
             list_collectors_in_t, list_collectors_out_t, NULL);
+        a->get_stats_id =
+            MARGO_REGISTER(mid, "soma_get_provider_stats",
+            get_stats_in_t, get_stats_out_t, NULL);
+        a->get_memory_id =
+            MARGO_REGISTER(mid, "soma_get_memory_usage",
+            get_stats_in_t, get_stats_out_t, NULL);
         /* Register more RPCs ... */
     }
 
@@ -62,6 +70,20 @@ soma_return_t soma_create_collector(
         const char* type,
         const char* config,
         soma_collector_id_t* id)
+{
+    return soma_create_collector_with_index(admin, address, provider_id,
+            token, type, config, id, NULL);
+}
+
+soma_return_t soma_create_collector_with_index(
+        soma_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        const char* type,
+        const char* config,
+        soma_collector_id_t* id,
+        soma_collector_index_t* index)
 {
     hg_handle_t h;
     create_collector_in_t  in;
@@ -98,6 +120,7 @@ soma_return_t soma_create_collector(
     }
 
     memcpy(id, &out.id, sizeof(*id));
+    if(index) *index = out.index;
 
     margo_free_output(h, &out);
     margo_destroy(h);
@@ -112,6 +135,20 @@ soma_return_t soma_open_collector(
         const char* type,
         const char* config,
         soma_collector_id_t* id)
+{
+    return soma_open_collector_with_index(admin, address, provider_id,
+            token, type, config, id, NULL);
+}
+
+soma_return_t soma_open_collector_with_index(
+        soma_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        const char* type,
+        const char* config,
+        soma_collector_id_t* id,
+        soma_collector_index_t* index)
 {
     hg_handle_t h;
     open_collector_in_t  in;
@@ -148,6 +185,7 @@ soma_return_t soma_open_collector(
     }
 
     memcpy(id, &out.id, sizeof(*id));
+    if(index) *index = out.index;
 
     margo_free_output(h, &out);
     margo_destroy(h);
@@ -239,6 +277,33 @@ soma_return_t soma_list_collectors(
         const char* token,
         soma_collector_id_t* ids,
         size_t* count)
+{
+    size_t max_ids = *count;
+    size_t total = 0;
+    uint64_t cursor = 0;
+    soma_return_t ret = SOMA_SUCCESS;
+
+    while(total < max_ids) {
+        size_t n = max_ids - total;
+        ret = soma_list_collectors_page(admin, address, provider_id, token,
+                                        NULL, &cursor, ids + total, &n);
+        if(ret != SOMA_SUCCESS) return ret;
+        total += n;
+        if(cursor == 0) break;
+    }
+    *count = total;
+    return SOMA_SUCCESS;
+}
+
+soma_return_t soma_list_collectors_page(
+        soma_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        const char* type,
+        uint64_t* cursor,
+        soma_collector_id_t* ids,
+        size_t* count)
 {
     hg_handle_t h;
     list_collectors_in_t  in;
@@ -246,10 +311,77 @@ soma_return_t soma_list_collectors(
     soma_return_t ret;
     hg_return_t hret;
 
-    in.token  = (char*)token;
+    in.token   = (char*)token;
+    in.type    = (char*)(type ? type : "");
+    in.cursor  = *cursor;
     in.max_ids = *count;
+    in.bulk    = HG_BULK_NULL;
+
+    /* large pages are pushed by the provider directly into ids */
+    if(*count * sizeof(*ids) > SOMA_LIST_INLINE_MAX) {
+        void* buf_ptrs[1]      = { ids };
+        hg_size_t buf_sizes[1] = { *count * sizeof(*ids) };
+        hret = margo_bulk_create(admin->mid, 1, buf_ptrs, buf_sizes,
+                                 HG_BULK_WRITE_ONLY, &in.bulk);
+        if(hret != HG_SUCCESS)
+            return SOMA_ERR_FROM_MERCURY;
+    }
 
     hret = margo_create(admin->mid, address, admin->list_collectors_id, &h);
+    if(hret != HG_SUCCESS) {
+        ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    hret = margo_provider_forward(provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    ret = out.ret;
+    if(ret == SOMA_SUCCESS) {
+        *count  = out.count;
+        *cursor = out.cursor;
+        if(!out.in_bulk)
+            memcpy(ids, out.ids, out.count*sizeof(*ids));
+    }
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+
+finish:
+    if(in.bulk != HG_BULK_NULL)
+        margo_bulk_free(in.bulk);
+    return ret;
+}
+
+/* Sends an RPC returning a JSON document (statistics or memory usage) */
+static soma_return_t get_json_document(
+        soma_admin_t admin,
+        hg_id_t rpc_id,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        char** stats)
+{
+    hg_handle_t h;
+    get_stats_in_t  in;
+    get_stats_out_t out;
+    soma_return_t ret;
+    hg_return_t hret;
+
+    in.token = (char*)token;
+
+    hret = margo_create(admin->mid, address, rpc_id, &h);
     if(hret != HG_SUCCESS)
         return SOMA_ERR_FROM_MERCURY;
 
@@ -267,11 +399,33 @@ soma_return_t soma_list_collectors(
 
     ret = out.ret;
     if(ret == SOMA_SUCCESS) {
-        *count = out.count;
-        memcpy(ids, out.ids, out.count*sizeof(*ids));
+        *stats = strdup(out.stats ? out.stats : "{}");
+        if(!*stats) ret = SOMA_ERR_ALLOCATION;
     }
-    
+
     margo_free_output(h, &out);
     margo_destroy(h);
     return ret;
 }
+
+soma_return_t soma_get_provider_stats(
+        soma_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        char** stats)
+{
+    return get_json_document(admin, admin->get_stats_id,
+                             address, provider_id, token, stats);
+}
+
+soma_return_t soma_get_memory_usage(
+        soma_admin_t admin,
+        hg_addr_t address,
+        uint16_t provider_id,
+        const char* token,
+        char** usage)
+{
+    return get_json_document(admin, admin->get_memory_id,
+                             address, provider_id, token, usage);
+}
@@ -16,6 +16,8 @@ typedef struct soma_admin {
    hg_id_t           close_collector_id;
    hg_id_t           destroy_collector_id;
    hg_id_t           list_collectors_id;
+   hg_id_t           get_stats_id;
+   hg_id_t           get_memory_id;
 } soma_admin;
 
 #endif
@@ -0,0 +1,208 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "aggregator.h"
+#include "uthash.h"
+
+typedef struct agg_entry {
+    uint64_t          series;
+    soma_aggregate_t  total;
+    soma_aggregate_t  pending;
+    struct agg_entry* next_pending; // next entry with a non-empty pending part
+    UT_hash_handle    hh;
+} agg_entry;
+
+struct soma_aggregator {
+    ABT_mutex  mutex;   // protects everything below
+    agg_entry* entries; // hash of entries by series
+    agg_entry* pending; // entries with a non-empty pending part
+    size_t     num_pending;
+};
+
+static inline void aggregate_reset(soma_aggregate_t* a, uint64_t series)
+{
+    a->series  = series;
+    a->count   = 0;
+    a->t_first = UINT64_MAX;
+    a->t_last  = 0;
+    a->sum     = 0.0;
+    a->min     = 0.0;
+    a->max     = 0.0;
+}
+
+static inline void aggregate_add(soma_aggregate_t* a, uint64_t timestamp, double value)
+{
+    if(a->count == 0 || value < a->min) a->min = value;
+    if(a->count == 0 || value > a->max) a->max = value;
+    if(timestamp < a->t_first) a->t_first = timestamp;
+    if(timestamp > a->t_last)  a->t_last  = timestamp;
+    a->sum   += value;
+    a->count += 1;
+}
+
+static inline void aggregate_merge(soma_aggregate_t* a, const soma_aggregate_t* b)
+{
+    if(b->count == 0) return;
+    if(a->count == 0 || b->min < a->min) a->min = b->min;
+    if(a->count == 0 || b->max > a->max) a->max = b->max;
+    if(b->t_first < a->t_first) a->t_first = b->t_first;
+    if(b->t_last  > a->t_last)  a->t_last  = b->t_last;
+    a->sum   += b->sum;
+    a->count += b->count;
+}
+
+/* Finds the entry of a series, creating it if needed.
+ * Must be called with the mutex held. */
+static agg_entry* find_or_add(soma_aggregator* agg, uint64_t series)
+{
+    agg_entry* e = NULL;
+    HASH_FIND(hh, agg->entries, &series, sizeof(series), e);
+    if(e) return e;
+    e = (agg_entry*)calloc(1, sizeof(*e));
+    if(!e) return NULL;
+    e->series = series;
+    aggregate_reset(&e->total, series);
+    aggregate_reset(&e->pending, series);
+    HASH_ADD(hh, agg->entries, series, sizeof(e->series), e);
+    return e;
+}
+
+/* Must be called with the mutex held, before updating e->pending */
+static inline void mark_pending(soma_aggregator* agg, agg_entry* e)
+{
+    if(e->pending.count) return;
+    e->next_pending = agg->pending;
+    agg->pending = e;
+    agg->num_pending += 1;
+}
+
+soma_aggregator* soma_aggregator_create(void)
+{
+    soma_aggregator* agg = (soma_aggregator*)calloc(1, sizeof(*agg));
+    if(!agg) return NULL;
+    if(ABT_mutex_create(&agg->mutex) != ABT_SUCCESS) {
+        free(agg);
+        return NULL;
+    }
+    return agg;
+}
+
+void soma_aggregator_free(soma_aggregator* agg)
+{
+    if(!agg) return;
+    agg_entry *e, *tmp;
+    HASH_ITER(hh, agg->entries, e, tmp) {
+        HASH_DEL(agg->entries, e);
+        free(e);
+    }
+    ABT_mutex_free(&agg->mutex);
+    free(agg);
+}
+
+soma_return_t soma_aggregator_add_batch(
+        soma_aggregator* agg,
+        const soma_batch_t* batch)
+{
+    soma_return_t ret = SOMA_SUCCESS;
+    agg_entry* e = NULL;
+    size_t i;
+    ABT_mutex_lock(agg->mutex);
+    for(i = 0; i < batch->count; i++) {
+        /* samples of a series usually come in runs */
+        if(!e || e->series != batch->series[i]) {
+            e = find_or_add(agg, batch->series[i]);
+            if(!e) {
+                ret = SOMA_ERR_ALLOCATION;
+                break;
+            }
+        }
+        mark_pending(agg, e);
+        aggregate_add(&e->total, batch->timestamps[i], batch->values[i]);
+        aggregate_add(&e->pending, batch->timestamps[i], batch->values[i]);
+    }
+    ABT_mutex_unlock(agg->mutex);
+    return ret;
+}
+
+soma_return_t soma_aggregator_merge(
+        soma_aggregator* agg,
+        const soma_aggregate_t* aggregates,
+        size_t count,
+        int flags)
+{
+    soma_return_t ret = SOMA_SUCCESS;
+    size_t i;
+    ABT_mutex_lock(agg->mutex);
+    for(i = 0; i < count; i++) {
+        if(aggregates[i].count == 0) continue;
+        agg_entry* e = find_or_add(agg, aggregates[i].series);
+        if(!e) {
+            ret = SOMA_ERR_ALLOCATION;
+            break;
+        }
+        if(flags & SOMA_AGGREGATE_TOTAL)
+            aggregate_merge(&e->total, &aggregates[i]);
+        if(flags & SOMA_AGGREGATE_PENDING) {
+            mark_pending(agg, e);
+            aggregate_merge(&e->pending, &aggregates[i]);
+        }
+    }
+    ABT_mutex_unlock(agg->mutex);
+    return ret;
+}
+
+soma_return_t soma_aggregator_drain(
+        soma_aggregator* agg,
+        soma_aggregate_t** aggregates,
+        size_t* count,
+        size_t* capacity)
+{
+    soma_return_t ret = SOMA_SUCCESS;
+    ABT_mutex_lock(agg->mutex);
+
+    if(*count + agg->num_pending > *capacity) {
+        size_t new_capacity = *capacity ? *capacity : 64;
+        while(new_capacity < *count + agg->num_pending)
+            new_capacity *= 2;
+        soma_aggregate_t* array = (soma_aggregate_t*)realloc(*aggregates,
+                new_capacity * sizeof(*array));
+        if(!array) {
+            ret = SOMA_ERR_ALLOCATION;
+            goto finish;
+        }
+        *aggregates = array;
+        *capacity   = new_capacity;
+    }
+
+    agg_entry* e = agg->pending;
+    while(e) {
+        agg_entry* next = e->next_pending;
+        (*aggregates)[(*count)++] = e->pending;
+        aggregate_reset(&e->pending, e->series);
+        e->next_pending = NULL;
+        e = next;
+    }
+    agg->pending     = NULL;
+    agg->num_pending = 0;
+
+finish:
+    ABT_mutex_unlock(agg->mutex);
+    return ret;
+}
+
+void soma_aggregator_get(
+        soma_aggregator* agg,
+        uint64_t series,
+        soma_aggregate_t* aggregate)
+{
+    agg_entry* e = NULL;
+    ABT_mutex_lock(agg->mutex);
+    HASH_FIND(hh, agg->entries, &series, sizeof(series), e);
+    if(e) *aggregate = e->total;
+    else aggregate_reset(aggregate, series);
+    ABT_mutex_unlock(agg->mutex);
+}
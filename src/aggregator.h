@@ -0,0 +1,60 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _AGGREGATOR_H
+#define _AGGREGATOR_H
+
+#include <margo.h>
+#include "soma/soma-common.h"
+#include "soma/soma-backend.h"
+
+/*
+ * Per-series aggregates of a collector. For each series, the aggregator
+ * keeps the aggregate of everything it was given (the total, which
+ * queries see) and the aggregate of what it was given since it was last
+ * drained (the pending part, which is forwarded upstream). Series with
+ * a non-empty pending part are chained so that draining does not need
+ * to look at the others.
+ */
+
+typedef struct soma_aggregator soma_aggregator;
+
+/* Parts of the aggregates updated by soma_aggregator_merge */
+#define SOMA_AGGREGATE_TOTAL   0x1
+#define SOMA_AGGREGATE_PENDING 0x2
+
+soma_aggregator* soma_aggregator_create(void);
+
+void soma_aggregator_free(soma_aggregator* agg);
+
+/* Adds raw samples to both the total and the pending aggregates. */
+soma_return_t soma_aggregator_add_batch(
+        soma_aggregator* agg,
+        const soma_batch_t* batch);
+
+/* Merges aggregates into the parts selected by flags. */
+soma_return_t soma_aggregator_merge(
+        soma_aggregator* agg,
+        const soma_aggregate_t* aggregates,
+        size_t count,
+        int flags);
+
+/* Appends the pending aggregates to *aggregates (an array of *capacity
+ * elements, *count of which are used, grown with realloc if needed) and
+ * resets them. Nothing is reset if the array cannot be grown. */
+soma_return_t soma_aggregator_drain(
+        soma_aggregator* agg,
+        soma_aggregate_t** aggregates,
+        size_t* count,
+        size_t* capacity);
+
+/* Gets the total aggregate of a series (with a count of 0 if the
+ * aggregator has never seen it). */
+void soma_aggregator_get(
+        soma_aggregator* agg,
+        uint64_t series,
+        soma_aggregate_t* aggregate);
+
+#endif
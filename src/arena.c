@@ -0,0 +1,227 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <abt.h>
+#include "arena.h"
+
+#define CACHE_LINE_SIZE 64
+#define NUM_CLASSES     12   /* 16 bytes to 32 KiB */
+/* headers take a whole cache line so that what follows stays aligned */
+#define HEADER_SIZE     CACHE_LINE_SIZE
+
+typedef struct arena_block {
+    struct arena_block* next;
+} arena_block;
+
+typedef struct arena_large {
+    struct arena_large* prev;
+    struct arena_large* next;
+    size_t              size;  // including the header
+} arena_large;
+
+struct soma_arena {
+    ABT_mutex    mutex;                    // protects everything below
+    void*        free_lists[NUM_CLASSES];  // freed objects, by size class
+    char*        cursor;                   // free space of the current block
+    char*        end;
+    size_t       next_block;               // size of the next block
+    arena_block* blocks;
+    arena_large* large;
+    size_t       reserved;                 // bytes obtained from the heap
+    size_t       used;                     // bytes in use (accessed atomically)
+    size_t*      total;                    // shared counter of bytes in use
+};
+
+/* Adds (or removes) bytes in use */
+static inline void account(soma_arena_t arena, size_t bytes, int release)
+{
+    if(release) {
+        __atomic_sub_fetch(&arena->used, bytes, __ATOMIC_RELAXED);
+        if(arena->total) __atomic_sub_fetch(arena->total, bytes, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&arena->used, bytes, __ATOMIC_RELAXED);
+        if(arena->total) __atomic_add_fetch(arena->total, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+static inline unsigned size_class(size_t size)
+{
+    if(size <= SOMA_ARENA_MIN_CLASS) return 0;
+    return (unsigned)(64 - __builtin_clzll(size - 1)) - 4;
+}
+
+static inline size_t alignment_of(size_t size)
+{
+    return size < CACHE_LINE_SIZE ? (size < 16 ? 16 : size) : CACHE_LINE_SIZE;
+}
+
+static void* heap_alloc(size_t size)
+{
+    if(size < CACHE_LINE_SIZE)
+        return malloc(size ? size : 1);
+    void* ptr = NULL;
+    if(posix_memalign(&ptr, CACHE_LINE_SIZE, size) != 0)
+        return NULL;
+    return ptr;
+}
+
+soma_return_t soma_arena_create(soma_arena_t* arena, size_t* total)
+{
+    soma_arena_t a = (soma_arena_t)calloc(1, sizeof(*a));
+    if(!a) return SOMA_ERR_ALLOCATION;
+    if(ABT_mutex_create(&a->mutex) != ABT_SUCCESS) {
+        free(a);
+        return SOMA_ERR_FROM_ARGOBOTS;
+    }
+    a->next_block = SOMA_ARENA_FIRST_BLOCK;
+    a->total      = total;
+    *arena = a;
+    return SOMA_SUCCESS;
+}
+
+void soma_arena_destroy(soma_arena_t arena)
+{
+    if(!arena) return;
+    account(arena, arena->used, 1);
+    arena_block* block = arena->blocks;
+    while(block) {
+        arena_block* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_large* large = arena->large;
+    while(large) {
+        arena_large* next = large->next;
+        free(large);
+        large = next;
+    }
+    ABT_mutex_free(&arena->mutex);
+    free(arena);
+}
+
+size_t soma_arena_reserved(soma_arena_t arena)
+{
+    ABT_mutex_lock(arena->mutex);
+    size_t reserved = arena->reserved;
+    ABT_mutex_unlock(arena->mutex);
+    return reserved;
+}
+
+size_t soma_arena_used(soma_arena_t arena)
+{
+    return __atomic_load_n(&arena->used, __ATOMIC_RELAXED);
+}
+
+void soma_arena_account(soma_arena_t arena, int64_t bytes)
+{
+    if(!arena || !bytes) return;
+    if(bytes > 0) account(arena, (size_t)bytes, 0);
+    else account(arena, (size_t)-bytes, 1);
+}
+
+/* Takes size bytes from the current block, starting a new block if it
+ * does not have enough room; must be called with the mutex held */
+static void* carve(soma_arena_t arena, size_t size)
+{
+    size_t align = alignment_of(size);
+    uintptr_t p = ((uintptr_t)arena->cursor + align - 1) & ~(uintptr_t)(align - 1);
+    if(!arena->cursor || p + size > (uintptr_t)arena->end) {
+        size_t block_size = arena->next_block;
+        if(block_size < HEADER_SIZE + size)
+            block_size = HEADER_SIZE + size;
+        void* mem = NULL;
+        if(posix_memalign(&mem, CACHE_LINE_SIZE, block_size) != 0)
+            return NULL;
+        arena_block* block = (arena_block*)mem;
+        block->next    = arena->blocks;
+        arena->blocks  = block;
+        arena->cursor  = (char*)mem + HEADER_SIZE;
+        arena->end     = (char*)mem + block_size;
+        arena->reserved += block_size;
+        if(arena->next_block < SOMA_ARENA_MAX_BLOCK)
+            arena->next_block *= 2;
+        p = (uintptr_t)arena->cursor;
+    }
+    arena->cursor = (char*)(p + size);
+    return (void*)p;
+}
+
+static void* large_alloc(soma_arena_t arena, size_t size)
+{
+    void* mem = NULL;
+    if(posix_memalign(&mem, CACHE_LINE_SIZE, HEADER_SIZE + size) != 0)
+        return NULL;
+    arena_large* large = (arena_large*)mem;
+    large->prev = NULL;
+    large->size = HEADER_SIZE + size;
+    ABT_mutex_lock(arena->mutex);
+    large->next = arena->large;
+    if(arena->large) arena->large->prev = large;
+    arena->large = large;
+    arena->reserved += large->size;
+    ABT_mutex_unlock(arena->mutex);
+    account(arena, large->size, 0);
+    return (char*)mem + HEADER_SIZE;
+}
+
+static void large_free(soma_arena_t arena, void* ptr)
+{
+    arena_large* large = (arena_large*)((char*)ptr - HEADER_SIZE);
+    ABT_mutex_lock(arena->mutex);
+    if(large->prev) large->prev->next = large->next;
+    else arena->large = large->next;
+    if(large->next) large->next->prev = large->prev;
+    arena->reserved -= large->size;
+    ABT_mutex_unlock(arena->mutex);
+    account(arena, large->size, 1);
+    free(large);
+}
+
+void* soma_arena_alloc(soma_arena_t arena, size_t size)
+{
+    if(!arena)
+        return heap_alloc(size);
+    if(size > SOMA_ARENA_MAX_CLASS)
+        return large_alloc(arena, size);
+    unsigned c = size_class(size);
+    ABT_mutex_lock(arena->mutex);
+    void* ptr = arena->free_lists[c];
+    if(ptr)
+        arena->free_lists[c] = *(void**)ptr;
+    else
+        ptr = carve(arena, (size_t)SOMA_ARENA_MIN_CLASS << c);
+    ABT_mutex_unlock(arena->mutex);
+    if(ptr) account(arena, (size_t)SOMA_ARENA_MIN_CLASS << c, 0);
+    return ptr;
+}
+
+void* soma_arena_calloc(soma_arena_t arena, size_t size)
+{
+    void* ptr = soma_arena_alloc(arena, size);
+    if(ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+void soma_arena_free(soma_arena_t arena, void* ptr, size_t size)
+{
+    if(!ptr) return;
+    if(!arena) {
+        free(ptr);
+        return;
+    }
+    if(size > SOMA_ARENA_MAX_CLASS) {
+        large_free(arena, ptr);
+        return;
+    }
+    unsigned c = size_class(size);
+    ABT_mutex_lock(arena->mutex);
+    *(void**)ptr = arena->free_lists[c];
+    arena->free_lists[c] = ptr;
+    ABT_mutex_unlock(arena->mutex);
+    account(arena, (size_t)SOMA_ARENA_MIN_CLASS << c, 1);
+}
@@ -0,0 +1,47 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include "soma/soma-backend.h"
+
+/*
+ * Arena holding the memory of a collector. Small allocations are carved
+ * out of blocks obtained from the heap, by size class (powers of two
+ * from SOMA_ARENA_MIN_CLASS to SOMA_ARENA_MAX_CLASS bytes), and freed
+ * objects go to a free list of their class for reuse by the same arena.
+ * Blocks start small and double up to SOMA_ARENA_MAX_BLOCK, so that a
+ * collector holding little memory costs little. Larger allocations are
+ * made on the heap directly and linked into the arena.
+ *
+ * Destroying the arena hands its blocks back to the heap without
+ * visiting the objects allocated in them, so a collector and everything
+ * its backend allocated from the arena go away at once, and long-lived
+ * providers do not accumulate the fragments of many collectors.
+ *
+ * The arena counts the bytes in use (rounded up to their size class),
+ * plus those the backend reports with soma_arena_account, and mirrors
+ * the count into a counter shared by the arenas of a provider.
+ */
+
+#define SOMA_ARENA_MIN_CLASS   16
+#define SOMA_ARENA_MAX_CLASS   32768
+#define SOMA_ARENA_FIRST_BLOCK 4096
+#define SOMA_ARENA_MAX_BLOCK   (256*1024)
+
+/* Creates an arena; total, if not NULL, is the shared counter of bytes
+ * in use, updated atomically. */
+soma_return_t soma_arena_create(soma_arena_t* arena, size_t* total);
+
+void soma_arena_destroy(soma_arena_t arena);
+
+/* Bytes the arena obtained from the heap */
+size_t soma_arena_reserved(soma_arena_t arena);
+
+/* Bytes in use, including those accounted for by the backend */
+size_t soma_arena_used(soma_arena_t arena);
+
+#endif
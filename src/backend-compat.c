@@ -0,0 +1,98 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include "backend-compat.h"
+
+/* number of samples converted at once for version 1 backends */
+#define COMPAT_CHUNK_SIZE 256
+
+/* number of samples read at once when scanning with query */
+#define COMPAT_PAGE_SIZE 1024
+
+soma_return_t soma_backend_ingest(
+        const soma_backend_impl* fn,
+        void* ctx,
+        const soma_batch_t* batch)
+{
+    if(fn->ingest)
+        return fn->ingest(ctx, batch);
+    if(!fn->publish)
+        return SOMA_ERR_OP_UNSUPPORTED;
+
+    /* convert the columns back into rows, one chunk at a time */
+    soma_sample_t samples[COMPAT_CHUNK_SIZE];
+    size_t i = 0;
+    while(i < batch->count) {
+        size_t n = batch->count - i;
+        if(n > COMPAT_CHUNK_SIZE) n = COMPAT_CHUNK_SIZE;
+        size_t j;
+        for(j = 0; j < n; j++) {
+            samples[j].series    = batch->series[i+j];
+            samples[j].timestamp = batch->timestamps[i+j];
+            samples[j].value     = batch->values[i+j];
+        }
+        soma_return_t ret = fn->publish(ctx, samples, n);
+        if(ret != SOMA_SUCCESS) return ret;
+        i += n;
+    }
+    return SOMA_SUCCESS;
+}
+
+soma_return_t soma_backend_query(
+        const soma_backend_impl* fn,
+        void* ctx,
+        const soma_query_t* query,
+        uint64_t* timestamps,
+        double* values,
+        size_t* count)
+{
+    if(!fn->query)
+        return SOMA_ERR_OP_UNSUPPORTED;
+    return fn->query(ctx, query, timestamps, values, count);
+}
+
+soma_return_t soma_backend_scan(
+        const soma_backend_impl* fn,
+        void* ctx,
+        const soma_query_t* query,
+        soma_scan_fn scan_fn,
+        void* uargs)
+{
+    if(fn->scan)
+        return fn->scan(ctx, query, scan_fn, uargs);
+    if(!fn->query)
+        return SOMA_ERR_OP_UNSUPPORTED;
+
+    /* page through the selection, each page starting where the previous
+     * one ended */
+    uint64_t* timestamps = (uint64_t*)malloc(
+            COMPAT_PAGE_SIZE * (sizeof(uint64_t) + sizeof(double)));
+    if(!timestamps) return SOMA_ERR_ALLOCATION;
+    double* values = (double*)(timestamps + COMPAT_PAGE_SIZE);
+
+    soma_query_t page = *query;
+    soma_return_t ret;
+    size_t n;
+    do {
+        n = COMPAT_PAGE_SIZE;
+        ret = fn->query(ctx, &page, timestamps, values, &n);
+        if(ret != SOMA_SUCCESS || (n && scan_fn(uargs, timestamps, values, n)))
+            break;
+        page.offset += n;
+    } while(n == COMPAT_PAGE_SIZE);
+
+    free(timestamps);
+    return ret;
+}
+
+soma_return_t soma_backend_flush(
+        const soma_backend_impl* fn,
+        void* ctx)
+{
+    if(!fn->flush)
+        return SOMA_SUCCESS;
+    return fn->flush(ctx);
+}
@@ -0,0 +1,39 @@
+/*
+ * (C) 2020 The University of Chicago
+ * 
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _BACKEND_COMPAT_H
+#define _BACKEND_COMPAT_H
+
+#include "soma/soma-backend.h"
+
+/* The provider calls backends only through these functions, which
+ * use the batch functions of the backend when it provides them and
+ * fall back to the version 1 functions otherwise. */
+
+soma_return_t soma_backend_ingest(
+        const soma_backend_impl* fn,
+        void* ctx,
+        const soma_batch_t* batch);
+
+soma_return_t soma_backend_query(
+        const soma_backend_impl* fn,
+        void* ctx,
+        const soma_query_t* query,
+        uint64_t* timestamps,
+        double* values,
+        size_t* count);
+
+soma_return_t soma_backend_scan(
+        const soma_backend_impl* fn,
+        void* ctx,
+        const soma_query_t* query,
+        soma_scan_fn scan_fn,
+        void* uargs);
+
+soma_return_t soma_backend_flush(
+        const soma_backend_impl* fn,
+        void* ctx);
+
+#endif
@@ -18,12 +18,23 @@ static int soma_register_provider(
     margo_instance_id mid = bedrock_args_get_margo_instance(args);
     uint16_t provider_id  = bedrock_args_get_provider_id(args);
 
-    struct soma_provider_args soma_args = { 0 };
+    struct soma_provider_args soma_args = SOMA_PROVIDER_ARGS_INIT;
     soma_args.config = bedrock_args_get_config(args);
     soma_args.pool   = bedrock_args_get_pool(args);
 
-    soma_args.abtio = (abt_io_instance_id)
-        bedrock_args_get_dependency(args, "abt_io", 0);
+    if(bedrock_args_get_num_dependencies(args, "admin_pool"))
+        soma_args.admin_pool = (ABT_pool)
+            bedrock_args_get_dependency(args, "admin_pool", 0);
+    if(bedrock_args_get_num_dependencies(args, "ingest_pool"))
+        soma_args.ingest_pool = (ABT_pool)
+            bedrock_args_get_dependency(args, "ingest_pool", 0);
+    if(bedrock_args_get_num_dependencies(args, "query_pool"))
+        soma_args.query_pool = (ABT_pool)
+            bedrock_args_get_dependency(args, "query_pool", 0);
+
+    if(bedrock_args_get_num_dependencies(args, "abt_io"))
+        soma_args.abtio = (abt_io_instance_id)
+            bedrock_args_get_dependency(args, "abt_io", 0);
 
     return soma_provider_register(mid, provider_id, &soma_args,
                                    (soma_provider_t*)provider);
@@ -86,6 +97,14 @@ static int soma_destroy_provider_handle(
     return BEDROCK_SUCCESS;
 }
 
+static struct bedrock_dependency soma_provider_dependencies[] = {
+    { "abt_io",      "abt_io", 0 },
+    { "admin_pool",  "pool",   0 },
+    { "ingest_pool", "pool",   0 },
+    { "query_pool",  "pool",   0 },
+    BEDROCK_NO_MORE_DEPENDENCIES
+};
+
 static struct bedrock_module soma = {
     .register_provider       = soma_register_provider,
     .deregister_provider     = soma_deregister_provider,
@@ -95,7 +114,7 @@ static struct bedrock_module soma = {
     .get_client_config       = soma_get_client_config,
     .create_provider_handle  = soma_create_provider_handle,
     .destroy_provider_handle = soma_destroy_provider_handle,
-    .provider_dependencies   = NULL,
+    .provider_dependencies   = soma_provider_dependencies,
     .client_dependencies     = NULL
 };
 
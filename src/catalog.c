@@ -0,0 +1,348 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <json-c/json.h>
+#include "catalog.h"
+
+#define TMP_SUFFIX ".tmp"
+
+static soma_catalog_entry* entry_create(
+        const soma_collector_id_t* id,
+        const char* type,
+        const char* config)
+{
+    soma_catalog_entry* entry = (soma_catalog_entry*)calloc(1, sizeof(*entry));
+    if(!entry) return NULL;
+    size_t type_len   = strlen(type);
+    size_t config_len = strlen(config);
+    /* type and config live in the key */
+    entry->key_len = type_len + 1 + config_len;
+    entry->key = (char*)malloc(entry->key_len + 1);
+    if(!entry->key) {
+        free(entry);
+        return NULL;
+    }
+    memcpy(entry->key, type, type_len + 1);
+    memcpy(entry->key + type_len + 1, config, config_len + 1);
+    entry->type   = entry->key;
+    entry->config = entry->key + type_len + 1;
+    entry->id     = *id;
+    return entry;
+}
+
+static void entry_insert(soma_catalog* catalog, soma_catalog_entry* entry)
+{
+    HASH_ADD(hh, catalog->by_id, id, sizeof(entry->id), entry);
+    HASH_ADD_KEYPTR(hh_key, catalog->by_key, entry->key, entry->key_len, entry);
+}
+
+static void entry_delete(soma_catalog* catalog, soma_catalog_entry* entry)
+{
+    HASH_DELETE(hh, catalog->by_id, entry);
+    HASH_DELETE(hh_key, catalog->by_key, entry);
+    free(entry->key);
+    free(entry);
+}
+
+static soma_catalog_entry* entry_find(
+        soma_catalog* catalog,
+        const soma_collector_id_t* id)
+{
+    soma_catalog_entry* entry = NULL;
+    HASH_FIND(hh, catalog->by_id, id, sizeof(*id), entry);
+    return entry;
+}
+
+/* Formats a change as a line of the catalog file; the caller frees it */
+static char* format_line(
+        const soma_collector_id_t* id,
+        const char* type,
+        const char* config)
+{
+    char id_str[37];
+    soma_collector_id_to_string(*id, id_str);
+    struct json_object* obj = json_object_new_object();
+    if(!obj) return NULL;
+    if(type) {
+        json_object_object_add(obj, "add", json_object_new_string(id_str));
+        json_object_object_add(obj, "type", json_object_new_string(type));
+        json_object_object_add(obj, "config", json_object_new_string(config));
+    } else {
+        json_object_object_add(obj, "remove", json_object_new_string(id_str));
+    }
+    const char* str = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN);
+    size_t len = strlen(str);
+    char* line = (char*)malloc(len + 2);
+    if(line) {
+        memcpy(line, str, len);
+        line[len]     = '\n';
+        line[len + 1] = '\0';
+    }
+    json_object_put(obj);
+    return line;
+}
+
+static soma_return_t write_all(int fd, const char* data, size_t size)
+{
+    while(size) {
+        ssize_t n = write(fd, data, size);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return SOMA_ERR_IO;
+        data += n;
+        size -= (size_t)n;
+    }
+    return SOMA_SUCCESS;
+}
+
+/* Applies one line of the catalog file; returns 0 if it cannot be parsed */
+static int apply_line(soma_catalog* catalog, const char* line)
+{
+    struct json_object* obj = json_tokener_parse(line);
+    struct json_object *id_obj, *type_obj, *config_obj;
+    soma_collector_id_t id;
+    int ok = 0;
+    if(!obj || !json_object_is_type(obj, json_type_object))
+        goto finish;
+    if(json_object_object_get_ex(obj, "add", &id_obj)
+    && json_object_object_get_ex(obj, "type", &type_obj)
+    && json_object_object_get_ex(obj, "config", &config_obj)) {
+        soma_collector_id_from_string(json_object_get_string(id_obj), &id);
+        soma_catalog_entry* old = entry_find(catalog, &id);
+        if(old) entry_delete(catalog, old);
+        soma_catalog_entry* entry = entry_create(&id,
+                json_object_get_string(type_obj), json_object_get_string(config_obj));
+        if(!entry) goto finish;
+        entry_insert(catalog, entry);
+        ok = 1;
+    } else if(json_object_object_get_ex(obj, "remove", &id_obj)) {
+        soma_collector_id_from_string(json_object_get_string(id_obj), &id);
+        soma_catalog_entry* entry = entry_find(catalog, &id);
+        if(entry) entry_delete(catalog, entry);
+        ok = 1;
+    }
+finish:
+    if(obj) json_object_put(obj);
+    return ok;
+}
+
+/* Reads the catalog file, if any, into the hash tables */
+static soma_return_t load(soma_catalog* catalog)
+{
+    FILE* f = fopen(catalog->path, "r");
+    if(!f) {
+        if(errno == ENOENT) return SOMA_SUCCESS;
+        margo_error(catalog->mid, "Could not open catalog %s (errno %d)", catalog->path, errno);
+        return SOMA_ERR_IO;
+    }
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    size_t num_lines = 0;
+    while((len = getline(&line, &capacity, f)) > 0) {
+        num_lines += 1;
+        /* only the last line may be incomplete, if we crashed while writing it */
+        int complete = line[len - 1] == '\n';
+        if(!apply_line(catalog, line)) {
+            if(complete)
+                margo_warning(catalog->mid, "Ignoring invalid line %lu of catalog %s",
+                              num_lines, catalog->path);
+            else
+                margo_warning(catalog->mid, "Ignoring torn last line of catalog %s",
+                              catalog->path);
+        }
+    }
+    free(line);
+    fclose(f);
+    return SOMA_SUCCESS;
+}
+
+/* Writes the current entries to a new file and moves it over the old one */
+static soma_return_t compact(soma_catalog* catalog)
+{
+    size_t tmp_len = strlen(catalog->path) + sizeof(TMP_SUFFIX);
+    char* tmp_path = (char*)malloc(tmp_len);
+    if(!tmp_path) return SOMA_ERR_ALLOCATION;
+    snprintf(tmp_path, tmp_len, "%s" TMP_SUFFIX, catalog->path);
+
+    soma_return_t ret = SOMA_SUCCESS;
+    int fd = open(tmp_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd < 0) {
+        margo_error(catalog->mid, "Could not create %s (errno %d)", tmp_path, errno);
+        free(tmp_path);
+        return SOMA_ERR_IO;
+    }
+    soma_catalog_entry *entry, *tmp;
+    HASH_ITER(hh, catalog->by_id, entry, tmp) {
+        char* line = format_line(&entry->id, entry->type, entry->config);
+        if(!line) {
+            ret = SOMA_ERR_ALLOCATION;
+            break;
+        }
+        ret = write_all(fd, line, strlen(line));
+        free(line);
+        if(ret != SOMA_SUCCESS) break;
+    }
+    if(ret == SOMA_SUCCESS && fsync(fd) != 0)
+        ret = SOMA_ERR_IO;
+    close(fd);
+    if(ret == SOMA_SUCCESS && rename(tmp_path, catalog->path) != 0)
+        ret = SOMA_ERR_IO;
+    if(ret != SOMA_SUCCESS) {
+        margo_error(catalog->mid, "Could not rewrite catalog %s", catalog->path);
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    return ret;
+}
+
+soma_return_t soma_catalog_open(
+        margo_instance_id mid,
+        const char* path,
+        soma_catalog** catalog)
+{
+    soma_catalog* c = (soma_catalog*)calloc(1, sizeof(*c));
+    if(!c) return SOMA_ERR_ALLOCATION;
+    c->mid   = mid;
+    c->fd    = -1;
+    c->mutex = ABT_MUTEX_NULL;
+    c->path  = strdup(path);
+    soma_return_t ret = c->path ? SOMA_SUCCESS : SOMA_ERR_ALLOCATION;
+    if(ret == SOMA_SUCCESS)
+        ret = load(c);
+    if(ret == SOMA_SUCCESS)
+        ret = compact(c);
+    if(ret == SOMA_SUCCESS) {
+        c->fd = open(c->path, O_WRONLY|O_APPEND);
+        if(c->fd < 0) {
+            margo_error(mid, "Could not open catalog %s (errno %d)", path, errno);
+            ret = SOMA_ERR_IO;
+        }
+    }
+    if(ret == SOMA_SUCCESS && ABT_mutex_create(&c->mutex) != ABT_SUCCESS)
+        ret = SOMA_ERR_FROM_ARGOBOTS;
+    if(ret != SOMA_SUCCESS) {
+        soma_catalog_close(c);
+        return ret;
+    }
+    *catalog = c;
+    return SOMA_SUCCESS;
+}
+
+void soma_catalog_close(soma_catalog* catalog)
+{
+    soma_catalog_entry *entry, *tmp;
+    HASH_ITER(hh, catalog->by_id, entry, tmp)
+        entry_delete(catalog, entry);
+    if(catalog->fd >= 0)
+        close(catalog->fd);
+    if(catalog->mutex != ABT_MUTEX_NULL)
+        ABT_mutex_free(&catalog->mutex);
+    free(catalog->path);
+    free(catalog);
+}
+
+/* Appends a change to the file and syncs it; must be called with
+ * the mutex held */
+static soma_return_t append_line(soma_catalog* catalog, const char* line)
+{
+    if(!line) return SOMA_ERR_ALLOCATION;
+    soma_return_t ret = write_all(catalog->fd, line, strlen(line));
+    if(ret == SOMA_SUCCESS && fdatasync(catalog->fd) != 0)
+        ret = SOMA_ERR_IO;
+    if(ret != SOMA_SUCCESS)
+        margo_error(catalog->mid, "Could not write to catalog %s (errno %d)",
+                    catalog->path, errno);
+    return ret;
+}
+
+soma_return_t soma_catalog_add(
+        soma_catalog* catalog,
+        const soma_collector_id_t* id,
+        const char* type,
+        const char* config)
+{
+    if(!config) config = "";
+    soma_catalog_entry* entry = entry_create(id, type, config);
+    if(!entry) return SOMA_ERR_ALLOCATION;
+    char* line = format_line(id, type, config);
+
+    ABT_mutex_lock(catalog->mutex);
+    soma_return_t ret = append_line(catalog, line);
+    if(ret == SOMA_SUCCESS) {
+        soma_catalog_entry* old = entry_find(catalog, id);
+        if(old) entry_delete(catalog, old);
+        entry_insert(catalog, entry);
+    }
+    ABT_mutex_unlock(catalog->mutex);
+
+    free(line);
+    if(ret != SOMA_SUCCESS) {
+        free(entry->key);
+        free(entry);
+    }
+    return ret;
+}
+
+soma_return_t soma_catalog_remove(
+        soma_catalog* catalog,
+        const soma_collector_id_t* id)
+{
+    soma_return_t ret = SOMA_SUCCESS;
+    ABT_mutex_lock(catalog->mutex);
+    soma_catalog_entry* entry = entry_find(catalog, id);
+    if(entry) {
+        char* line = format_line(id, NULL, NULL);
+        ret = append_line(catalog, line);
+        free(line);
+        if(ret == SOMA_SUCCESS)
+            entry_delete(catalog, entry);
+    }
+    ABT_mutex_unlock(catalog->mutex);
+    return ret;
+}
+
+int soma_catalog_find(
+        soma_catalog* catalog,
+        const char* type,
+        const char* config,
+        soma_collector_id_t* id)
+{
+    if(!config) config = "";
+    size_t type_len   = strlen(type);
+    size_t config_len = strlen(config);
+    size_t key_len    = type_len + 1 + config_len;
+    char* key = (char*)malloc(key_len);
+    if(!key) return 0;
+    memcpy(key, type, type_len + 1);
+    memcpy(key + type_len + 1, config, config_len);
+
+    soma_catalog_entry* entry = NULL;
+    ABT_mutex_lock(catalog->mutex);
+    HASH_FIND(hh_key, catalog->by_key, key, key_len, entry);
+    if(entry) *id = entry->id;
+    ABT_mutex_unlock(catalog->mutex);
+
+    free(key);
+    return entry != NULL;
+}
+
+void soma_catalog_iterate(
+        soma_catalog* catalog,
+        int (*fn)(const soma_catalog_entry*, void*),
+        void* uargs)
+{
+    soma_catalog_entry *entry, *tmp;
+    ABT_mutex_lock(catalog->mutex);
+    HASH_ITER(hh, catalog->by_id, entry, tmp) {
+        if(fn(entry, uargs)) break;
+    }
+    ABT_mutex_unlock(catalog->mutex);
+}
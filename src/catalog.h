@@ -0,0 +1,77 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _CATALOG_H
+#define _CATALOG_H
+
+#include <margo.h>
+#include "soma/soma-common.h"
+#include "uthash.h"
+
+/*
+ * Persistent record of the collectors of a provider: their id, backend
+ * type, and configuration. The catalog file holds one JSON object per
+ * line, either { "add" : <id>, "type" : <type>, "config" : <config> }
+ * or { "remove" : <id> }, and every change is appended and synced before
+ * the corresponding admin RPC is acknowledged. Opening the catalog
+ * replays the file, ignoring a torn last line, and rewrites it with
+ * only the current entries so that it does not grow without bounds.
+ */
+
+typedef struct soma_catalog_entry {
+    soma_collector_id_t id;
+    char*               type;
+    char*               config;
+    char*               key;    // type and config separated by a null byte
+    size_t              key_len;
+    UT_hash_handle      hh;     // by id
+    UT_hash_handle      hh_key; // by key
+} soma_catalog_entry;
+
+typedef struct soma_catalog {
+    margo_instance_id   mid;
+    char*               path;
+    int                 fd;      // catalog file, opened for appending
+    ABT_mutex           mutex;   // serializes changes
+    soma_catalog_entry* by_id;
+    soma_catalog_entry* by_key;
+} soma_catalog;
+
+/* Opens (or creates) the catalog at the given path. */
+soma_return_t soma_catalog_open(
+        margo_instance_id mid,
+        const char* path,
+        soma_catalog** catalog);
+
+void soma_catalog_close(soma_catalog* catalog);
+
+/* Records a new collector. */
+soma_return_t soma_catalog_add(
+        soma_catalog* catalog,
+        const soma_collector_id_t* id,
+        const char* type,
+        const char* config);
+
+/* Forgets a collector; does nothing if it is not in the catalog. */
+soma_return_t soma_catalog_remove(
+        soma_catalog* catalog,
+        const soma_collector_id_t* id);
+
+/* Finds the id of the collector with the given type and configuration;
+ * returns 0 if there is none. */
+int soma_catalog_find(
+        soma_catalog* catalog,
+        const char* type,
+        const char* config,
+        soma_collector_id_t* id);
+
+/* Calls fn on every entry, stopping early if it returns non-zero;
+ * the catalog cannot be changed meanwhile. */
+void soma_catalog_iterate(
+        soma_catalog* catalog,
+        int (*fn)(const soma_catalog_entry*, void*),
+        void* uargs);
+
+#endif
@@ -3,6 +3,10 @@
  * 
  * See COPYRIGHT in top-level directory.
  */
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "types.h"
 #include "client.h"
 #include "soma/soma-client.h"
@@ -21,12 +25,39 @@ soma_return_t soma_client_init(margo_instance_id mid, soma_client_t* client)
     if(flag == HG_TRUE) {
         margo_registered_name(mid, "soma_sum", &c->sum_id, &flag);
         margo_registered_name(mid, "soma_hello", &c->hello_id, &flag);
+        margo_registered_name(mid, "soma_publish_batch", &c->publish_batch_id, &flag);
+        margo_registered_name(mid, "soma_publish_packed", &c->publish_packed_id, &flag);
+        margo_registered_name(mid, "soma_get_aggregates", &c->get_aggregates_id, &flag);
+        margo_registered_name(mid, "soma_query", &c->query_id, &flag);
+        margo_registered_name(mid, "soma_shm_attach", &c->shm_attach_id, &flag);
+        margo_registered_name(mid, "soma_shm_detach", &c->shm_detach_id, &flag);
     } else {
         c->sum_id = MARGO_REGISTER(mid, "soma_sum", sum_in_t, sum_out_t, NULL);
         c->hello_id = MARGO_REGISTER(mid, "soma_hello", hello_in_t, void, NULL);
         margo_registered_disable_response(mid, c->hello_id, HG_TRUE);
+        c->publish_batch_id = MARGO_REGISTER(mid, "soma_publish_batch",
+                publish_batch_in_t, publish_batch_out_t, NULL);
+        c->publish_packed_id = MARGO_REGISTER(mid, "soma_publish_packed",
+                publish_packed_in_t, publish_batch_out_t, NULL);
+        c->get_aggregates_id = MARGO_REGISTER(mid, "soma_get_aggregates",
+                get_aggregates_in_t, get_aggregates_out_t, NULL);
+        c->query_id = MARGO_REGISTER(mid, "soma_query",
+                query_in_t, query_out_t, NULL);
+        c->shm_attach_id = MARGO_REGISTER(mid, "soma_shm_attach",
+                shm_attach_in_t, shm_attach_out_t, NULL);
+        c->shm_detach_id = MARGO_REGISTER(mid, "soma_shm_detach",
+                shm_detach_in_t, shm_detach_out_t, NULL);
     }
 
+    /* batches are sent compressed within the RPC only if their largest
+     * encoding fits in its eager buffer, larger ones are exposed as they
+     * are for the provider to pull */
+    hg_size_t eager_size = HG_Class_get_input_eager_size(margo_get_class(mid));
+    hg_size_t reserved   = SOMA_PACKED_INPUT_OVERHEAD + SOMA_PACKED_MAX_SIZE(0);
+    if(eager_size > reserved)
+        c->packed_max_samples = (eager_size - reserved)
+                              / (SOMA_PACKED_MAX_SIZE(1) - SOMA_PACKED_MAX_SIZE(0));
+
     *client = c;
     return SOMA_SUCCESS;
 }
@@ -48,6 +79,19 @@ soma_return_t soma_collector_handle_create(
         uint16_t provider_id,
         soma_collector_id_t collector_id,
         soma_collector_handle_t* handle)
+{
+    soma_collector_index_t none = { SOMA_COLLECTOR_SLOT_NONE, 0 };
+    return soma_collector_handle_create_with_index(
+            client, addr, provider_id, collector_id, none, handle);
+}
+
+soma_return_t soma_collector_handle_create_with_index(
+        soma_client_t client,
+        hg_addr_t addr,
+        uint16_t provider_id,
+        soma_collector_id_t collector_id,
+        soma_collector_index_t collector_index,
+        soma_collector_handle_t* handle)
 {
     if(client == SOMA_CLIENT_NULL)
         return SOMA_ERR_INVALID_ARGS;
@@ -63,12 +107,27 @@ soma_return_t soma_collector_handle_create(
         return SOMA_ERR_FROM_MERCURY;
     }
 
+    /* a provider at our own address may be callable directly */
+    hg_addr_t self = HG_ADDR_NULL;
+    if(margo_addr_self(client->mid, &self) == HG_SUCCESS) {
+        rh->is_local = margo_addr_cmp(client->mid, self, addr) == HG_TRUE;
+        margo_addr_free(client->mid, self);
+    }
+
+    rh->allow_local = 1;
     rh->client      = client;
     rh->provider_id = provider_id;
     rh->collector_id = collector_id;
+    rh->collector_index = ((uint64_t)collector_index.slot << 32)
+                        | collector_index.generation;
     rh->refcount    = 1;
+    rh->buffer_capacity  = SOMA_DEFAULT_BUFFER_CAPACITY;
+    rh->buffer_max_delay = SOMA_DEFAULT_BUFFER_MAX_DELAY;
+    ABT_mutex_create(&rh->buffer_mtx);
+    ABT_cond_create(&rh->buffer_cond);
+    ABT_mutex_create(&rh->cache_mtx);
 
-    client->num_collector_handles += 1;
+    __atomic_add_fetch(&client->num_collector_handles, 1, __ATOMIC_RELAXED);
 
     *handle = rh;
     return SOMA_SUCCESS;
@@ -79,83 +138,1168 @@ soma_return_t soma_collector_handle_ref_incr(
 {
     if(handle == SOMA_COLLECTOR_HANDLE_NULL)
         return SOMA_ERR_INVALID_ARGS;
-    handle->refcount += 1;
+    __atomic_add_fetch(&handle->refcount, 1, __ATOMIC_RELAXED);
     return SOMA_SUCCESS;
 }
 
+/* Drops a reference to the handle and returns whether it was the last
+ * one, in which case the handle is flushed and freed. The flusher ULT
+ * drops its own references with from_flusher set, so as not to wait
+ * for itself to exit. */
+static int handle_release(
+        soma_collector_handle_t handle,
+        int from_flusher,
+        soma_return_t* ret)
+{
+    *ret = SOMA_SUCCESS;
+    /* requests may drop their references from other ULTs concurrently,
+     * so only the value returned by the decrement is reliable */
+    if(__atomic_sub_fetch(&handle->refcount, 1, __ATOMIC_ACQ_REL) != 0)
+        return 0;
+
+    /* nobody else holds the handle: take a reference again while
+     * flushing, since the requests sent by the flush hold their own */
+    __atomic_store_n(&handle->refcount, 1, __ATOMIC_RELEASE);
+    *ret = soma_collector_handle_flush(handle);
+    if(handle->shm_ring) {
+        soma_return_t r = soma_collector_handle_detach_shm(handle);
+        if(*ret == SOMA_SUCCESS) *ret = r;
+    }
+
+    ABT_mutex_lock(handle->buffer_mtx);
+    handle->buffer_stop = 1;
+    ABT_cond_broadcast(handle->buffer_cond);
+    while(handle->buffer_flusher && !from_flusher)
+        ABT_cond_wait(handle->buffer_cond, handle->buffer_mtx);
+    ABT_mutex_unlock(handle->buffer_mtx);
+
+    size_t i;
+    for(i = 0; i < handle->num_cached_handles; i++)
+        margo_destroy(handle->cached_handles[i]);
+    ABT_mutex_free(&handle->cache_mtx);
+    ABT_cond_free(&handle->buffer_cond);
+    ABT_mutex_free(&handle->buffer_mtx);
+    free(handle->buffer_series);
+    margo_addr_free(handle->client->mid, handle->addr);
+    __atomic_sub_fetch(&handle->client->num_collector_handles, 1, __ATOMIC_RELAXED);
+    free(handle);
+    return 1;
+}
+
 soma_return_t soma_collector_handle_release(soma_collector_handle_t handle)
 {
     if(handle == SOMA_COLLECTOR_HANDLE_NULL)
         return SOMA_ERR_INVALID_ARGS;
-    handle->refcount -= 1;
-    if(handle->refcount == 0) {
-        margo_addr_free(handle->client->mid, handle->addr);
-        handle->client->num_collector_handles -= 1;
-        free(handle);
+    soma_return_t ret;
+    handle_release(handle, 0, &ret);
+    return ret;
+}
+
+/* The index of the collector is learned from the provider's responses
+ * and may be updated by concurrent requests, hence it is packed into a
+ * single 64-bit integer accessed atomically */
+static inline soma_collector_index_t load_index(soma_collector_handle_t handle)
+{
+    uint64_t v = __atomic_load_n(&handle->collector_index, __ATOMIC_RELAXED);
+    soma_collector_index_t index = { (uint32_t)(v >> 32), (uint32_t)v };
+    return index;
+}
+
+static inline void store_index(soma_collector_handle_t handle, soma_collector_index_t index)
+{
+    uint64_t v = ((uint64_t)index.slot << 32) | index.generation;
+    __atomic_store_n(&handle->collector_index, v, __ATOMIC_RELAXED);
+}
+
+/* Returns the entry points of the handle's provider if it is registered
+ * with the client's margo instance, or NULL if RPCs must be used. The
+ * lookup is redone on every call since the provider may come and go. */
+static soma_local_ops* find_local_ops(soma_collector_handle_t handle)
+{
+    hg_id_t id;
+    hg_bool_t flag = HG_FALSE;
+    if(!handle->is_local || !handle->allow_local)
+        return NULL;
+    margo_provider_registered_name(handle->client->mid, "soma_local",
+            handle->provider_id, &id, &flag);
+    if(flag != HG_TRUE)
+        return NULL;
+    return (soma_local_ops*)margo_registered_data(handle->client->mid, id);
+}
+
+static inline soma_collector_ref_t local_ref(soma_collector_handle_t handle)
+{
+    soma_collector_ref_t ref;
+    ref.index = load_index(handle);
+    memcpy(&ref.id, &(handle->collector_id), sizeof(ref.id));
+    return ref;
+}
+
+/* Counterpart of request_complete for direct calls: returns 1 if the
+ * provider did not recognize the index in ref, after replacing it so
+ * that the call can be made again with the collector's uuid. */
+static int local_retry(
+        soma_collector_handle_t handle,
+        soma_collector_ref_t* ref,
+        soma_return_t ret)
+{
+    if(ret != SOMA_ERR_INVALID_COLLECTOR
+    || ref->index.slot == SOMA_COLLECTOR_SLOT_NONE)
+        return 0;
+    soma_collector_index_t none = { SOMA_COLLECTOR_SLOT_NONE, 0 };
+    store_index(handle, none);
+    ref->index = none;
+    return 1;
+}
+
+static soma_return_t local_publish_batch(
+        soma_collector_handle_t handle,
+        soma_local_ops* local,
+        const soma_batch_t* batch)
+{
+    soma_return_t ret;
+    soma_collector_index_t index;
+    soma_collector_ref_t ref = local_ref(handle);
+    do ret = local->publish_batch(local->provider, &ref, batch, &index);
+    while(local_retry(handle, &ref, ret));
+    if(ret == SOMA_SUCCESS)
+        store_index(handle, index);
+    return ret;
+}
+
+/* Sends the staged samples; must be called with buffer_mtx held.
+ * The samples are dropped from the buffer even if the RPC fails. */
+static soma_return_t flush_buffer_locked(soma_collector_handle_t handle)
+{
+    if(handle->buffer_size == 0)
+        return SOMA_SUCCESS;
+    soma_return_t ret = soma_publish_columns(handle, handle->buffer_size,
+            handle->buffer_series, handle->buffer_timestamps, handle->buffer_values);
+    handle->buffer_size = 0;
+    return ret;
+}
+
+/* Flushes the staged samples once the oldest is max_delay seconds old,
+ * even if the application stops publishing; the error of such a flush
+ * is returned by the next soma_collector_handle_flush. The flusher holds
+ * a reference to the handle while flushing, and exits once the last
+ * reference has been dropped. */
+static void buffer_flusher(void* arg)
+{
+    soma_collector_handle_t handle = (soma_collector_handle_t)arg;
+
+    ABT_mutex_lock(handle->buffer_mtx);
+    while(!handle->buffer_stop) {
+        if(handle->buffer_size == 0) {
+            ABT_cond_wait(handle->buffer_cond, handle->buffer_mtx);
+            continue;
+        }
+        double left = handle->buffer_since + handle->buffer_max_delay - ABT_get_wtime();
+        if(left > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            double t = deadline.tv_sec + deadline.tv_nsec * 1e-9 + left;
+            deadline.tv_sec  = (time_t)t;
+            deadline.tv_nsec = (long)((t - (double)deadline.tv_sec) * 1e9);
+            ABT_cond_timedwait(handle->buffer_cond, handle->buffer_mtx, &deadline);
+            continue;
+        }
+        soma_collector_handle_ref_incr(handle);
+        soma_return_t ret = flush_buffer_locked(handle);
+        if(ret != SOMA_SUCCESS) handle->buffer_error = ret;
+        ABT_mutex_unlock(handle->buffer_mtx);
+        /* the application may have released the handle meanwhile */
+        if(handle_release(handle, 1, &ret))
+            return;
+        ABT_mutex_lock(handle->buffer_mtx);
     }
+    handle->buffer_flusher = 0;
+    ABT_cond_broadcast(handle->buffer_cond);
+    ABT_mutex_unlock(handle->buffer_mtx);
+}
+
+soma_return_t soma_collector_handle_set_buffering(
+        soma_collector_handle_t handle,
+        size_t capacity,
+        double max_delay)
+{
+    if(handle == SOMA_COLLECTOR_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+
+    ABT_mutex_lock(handle->buffer_mtx);
+    soma_return_t ret = flush_buffer_locked(handle);
+    free(handle->buffer_series);
+    handle->buffer_series    = NULL;
+    handle->buffer_capacity  = capacity;
+    handle->buffer_max_delay = max_delay;
+    ABT_cond_signal(handle->buffer_cond);
+    ABT_mutex_unlock(handle->buffer_mtx);
+    return ret;
+}
+
+soma_return_t soma_collector_handle_set_local(
+        soma_collector_handle_t handle,
+        int enabled)
+{
+    if(handle == SOMA_COLLECTOR_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+    handle->allow_local = enabled != 0;
     return SOMA_SUCCESS;
 }
 
-soma_return_t soma_say_hello(soma_collector_handle_t handle)
+soma_return_t soma_collector_handle_flush(
+        soma_collector_handle_t handle)
+{
+    if(handle == SOMA_COLLECTOR_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+
+    ABT_mutex_lock(handle->buffer_mtx);
+    soma_return_t ret = flush_buffer_locked(handle);
+    if(ret == SOMA_SUCCESS) ret = handle->buffer_error;
+    handle->buffer_error = SOMA_SUCCESS;
+    /* with a shared-memory ring, wait for the provider to catch up */
+    soma_shm_ring* ring = handle->shm_ring;
+    while(ring && __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != ring->head) {
+        if(__atomic_load_n(&ring->consumer_closed, __ATOMIC_ACQUIRE)) {
+            ret = SOMA_ERR_INVALID_COLLECTOR;
+            break;
+        }
+        ABT_thread_yield();
+    }
+    ABT_mutex_unlock(handle->buffer_mtx);
+    return ret;
+}
+
+/* Writes samples, given either as an array or as columns, to the
+ * handle's shared-memory ring, waiting for room when it is full.
+ * Returns 0, without doing anything, if the handle has no ring. */
+static int shm_publish(
+        soma_collector_handle_t handle,
+        size_t count,
+        const soma_sample_t* samples,
+        const uint64_t* series,
+        const uint64_t* timestamps,
+        const double* values,
+        soma_return_t* ret)
+{
+    if(!__atomic_load_n(&handle->shm_ring, __ATOMIC_ACQUIRE))
+        return 0;
+
+    ABT_mutex_lock(handle->buffer_mtx);
+    soma_shm_ring* ring = handle->shm_ring;
+    if(!ring) {
+        ABT_mutex_unlock(handle->buffer_mtx);
+        return 0;
+    }
+
+    *ret = SOMA_SUCCESS;
+    soma_sample_t chunk[256];
+    size_t done = 0;
+    while(done < count) {
+        const soma_sample_t* src = samples + done;
+        size_t n = count - done;
+        if(!samples) {
+            size_t i;
+            if(n > 256) n = 256;
+            for(i = 0; i < n; i++) {
+                chunk[i].series    = series[done + i];
+                chunk[i].timestamp = timestamps[done + i];
+                chunk[i].value     = values[done + i];
+            }
+            src = chunk;
+        }
+        size_t pushed = soma_shm_ring_push(ring, src, n);
+        done += pushed;
+        if(pushed < n) {
+            if(__atomic_load_n(&ring->consumer_closed, __ATOMIC_ACQUIRE)) {
+                *ret = SOMA_ERR_INVALID_COLLECTOR;
+                break;
+            }
+            ABT_thread_yield();
+        }
+    }
+
+    ABT_mutex_unlock(handle->buffer_mtx);
+    return 1;
+}
+
+soma_return_t soma_collector_handle_attach_shm(
+        soma_collector_handle_t handle,
+        size_t capacity)
+{
+    static uint64_t num_segments = 0;
+    hg_return_t hret;
+    hg_handle_t h = HG_HANDLE_NULL;
+    shm_attach_in_t  in;
+    shm_attach_out_t out;
+    char name[SOMA_SHM_NAME_MAX];
+    soma_shm_ring* ring = NULL;
+    size_t size;
+    int fd;
+
+    if(handle == SOMA_COLLECTOR_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+
+    uint64_t cap = 1;
+    if(capacity == 0) capacity = SOMA_DEFAULT_SHM_CAPACITY;
+    while(cap < capacity) cap *= 2;
+    size = soma_shm_ring_size(cap);
+
+    ABT_mutex_lock(handle->buffer_mtx);
+    soma_return_t ret = SOMA_SUCCESS;
+    if(handle->shm_ring) {
+        ret = SOMA_ERR_INVALID_ARGS;
+        goto finish;
+    }
+    /* samples staged so far go first */
+    ret = flush_buffer_locked(handle);
+    if(ret != SOMA_SUCCESS) goto finish;
+
+    snprintf(name, sizeof(name), SOMA_SHM_NAME_PREFIX "%d-%lu", (int)getpid(),
+             __atomic_add_fetch(&num_segments, 1, __ATOMIC_RELAXED));
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0) {
+        ret = SOMA_ERR_IO;
+        goto finish;
+    }
+    if(ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        ret = SOMA_ERR_IO;
+        goto finish;
+    }
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED) {
+        shm_unlink(name);
+        ret = SOMA_ERR_IO;
+        goto finish;
+    }
+    ring = (soma_shm_ring*)ptr;
+    soma_shm_ring_init(ring, cap);
+
+    /* ask the provider to map the segment */
+    in.ref.index = load_index(handle);
+    in.ref.id    = handle->collector_id;
+    in.name      = name;
+    ret = SOMA_ERR_FROM_MERCURY;
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->shm_attach_id, &h);
+    if(hret == HG_SUCCESS)
+        hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret == HG_SUCCESS)
+        hret = margo_get_output(h, &out);
+    if(hret == HG_SUCCESS) {
+        ret = out.ret;
+        if(ret == SOMA_SUCCESS) {
+            store_index(handle, out.index);
+            handle->shm_channel = out.channel;
+        }
+        margo_free_output(h, &out);
+    }
+    if(h != HG_HANDLE_NULL)
+        margo_destroy(h);
+
+    /* both sides have mapped the segment (or given up), its name is no longer needed */
+    shm_unlink(name);
+
+    if(ret == SOMA_SUCCESS) {
+        handle->shm_size = size;
+        __atomic_store_n(&handle->shm_ring, ring, __ATOMIC_RELEASE);
+    } else {
+        munmap(ring, size);
+    }
+
+finish:
+    ABT_mutex_unlock(handle->buffer_mtx);
+    return ret;
+}
+
+soma_return_t soma_collector_handle_detach_shm(
+        soma_collector_handle_t handle)
+{
+    hg_return_t hret;
+    hg_handle_t h = HG_HANDLE_NULL;
+    shm_detach_in_t  in;
+    shm_detach_out_t out;
+
+    if(handle == SOMA_COLLECTOR_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+
+    ABT_mutex_lock(handle->buffer_mtx);
+    soma_shm_ring* ring = handle->shm_ring;
+    if(!ring) {
+        ABT_mutex_unlock(handle->buffer_mtx);
+        return SOMA_ERR_INVALID_ARGS;
+    }
+
+    /* the provider drains what is left, then unmaps the ring and responds */
+    __atomic_store_n(&ring->producer_closed, 1, __ATOMIC_RELEASE);
+
+    soma_return_t ret = SOMA_ERR_FROM_MERCURY;
+    in.channel = handle->shm_channel;
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->shm_detach_id, &h);
+    if(hret == HG_SUCCESS)
+        hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret == HG_SUCCESS)
+        hret = margo_get_output(h, &out);
+    if(hret == HG_SUCCESS) {
+        ret = out.ret;
+        margo_free_output(h, &out);
+    }
+    if(h != HG_HANDLE_NULL)
+        margo_destroy(h);
+
+    __atomic_store_n(&handle->shm_ring, NULL, __ATOMIC_RELEASE);
+    munmap(ring, handle->shm_size);
+    ABT_mutex_unlock(handle->buffer_mtx);
+    return ret;
+}
+
+soma_return_t soma_publish(
+        soma_collector_handle_t handle,
+        uint64_t series,
+        uint64_t timestamp,
+        double value)
 {
-    hg_handle_t   h;
-    hello_in_t     in;
-    hg_return_t ret;
+    if(handle == SOMA_COLLECTOR_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+
+    soma_return_t ret = SOMA_SUCCESS;
+    if(shm_publish(handle, 1, NULL, &series, &timestamp, &value, &ret))
+        return ret;
+
+    /* buffering disabled, send the sample right away */
+    if(handle->buffer_capacity == 0)
+        return soma_publish_columns(handle, 1, &series, &timestamp, &value);
 
-    memcpy(&in.collector_id, &(handle->collector_id), sizeof(in.collector_id));
+    ABT_mutex_lock(handle->buffer_mtx);
 
-    ret = margo_create(handle->client->mid, handle->addr, handle->client->hello_id, &h);
-    if(ret != HG_SUCCESS)
+    if(!handle->buffer_series) {
+        size_t capacity = handle->buffer_capacity;
+        char* block = (char*)malloc(capacity * (2*sizeof(uint64_t) + sizeof(double)));
+        if(!block) {
+            ABT_mutex_unlock(handle->buffer_mtx);
+            return SOMA_ERR_ALLOCATION;
+        }
+        handle->buffer_series     = (uint64_t*)block;
+        handle->buffer_timestamps = handle->buffer_series + capacity;
+        handle->buffer_values     = (double*)(block + 2*capacity*sizeof(uint64_t));
+    }
+
+    double now = ABT_get_wtime();
+    if(handle->buffer_size == 0)
+        handle->buffer_since = now;
+    handle->buffer_series[handle->buffer_size]     = series;
+    handle->buffer_timestamps[handle->buffer_size] = timestamp;
+    handle->buffer_values[handle->buffer_size]     = value;
+    handle->buffer_size += 1;
+
+    if(handle->buffer_size == handle->buffer_capacity
+    || now - handle->buffer_since >= handle->buffer_max_delay) {
+        ret = flush_buffer_locked(handle);
+    } else if(handle->buffer_size == 1) {
+        /* have the flusher wait for this sample to be max_delay old */
+        if(!handle->buffer_flusher) {
+            ABT_pool pool;
+            margo_get_handler_pool(handle->client->mid, &pool);
+            if(ABT_thread_create(pool, buffer_flusher, handle,
+                                 ABT_THREAD_ATTR_NULL, NULL) == ABT_SUCCESS)
+                handle->buffer_flusher = 1;
+            else
+                ret = SOMA_ERR_FROM_ARGOBOTS;
+        }
+        ABT_cond_signal(handle->buffer_cond);
+    }
+
+    ABT_mutex_unlock(handle->buffer_mtx);
+    return ret;
+}
+
+/* Completion functions, called by soma_request_wait once the RPC
+ * of a request has completed, to extract the output of the RPC */
+static soma_return_t complete_hello(soma_request_t req)
+{
+    (void)req;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t complete_sum(soma_request_t req)
+{
+    sum_out_t   out;
+    hg_return_t hret;
+    soma_return_t ret;
+
+    hret = margo_get_output(req->handle, &out);
+    if(hret != HG_SUCCESS)
         return SOMA_ERR_FROM_MERCURY;
 
-    ret = margo_provider_forward(handle->provider_id, h, &in);
-    if(ret != HG_SUCCESS) {
+    ret = out.ret;
+    if(ret == SOMA_SUCCESS) {
+        store_index(req->owner, out.index);
+        if(req->result)
+            *(req->result) = out.result;
+    }
+
+    margo_free_output(req->handle, &out);
+    return ret;
+}
+
+static soma_return_t complete_publish_batch(soma_request_t req)
+{
+    publish_batch_out_t out;
+    hg_return_t hret;
+    soma_return_t ret;
+
+    hret = margo_get_output(req->handle, &out);
+    if(hret != HG_SUCCESS)
+        return SOMA_ERR_FROM_MERCURY;
+
+    ret = out.ret;
+    if(ret == SOMA_SUCCESS)
+        store_index(req->owner, out.index);
+
+    margo_free_output(req->handle, &out);
+    return ret;
+}
+
+static soma_return_t complete_get_aggregates(soma_request_t req)
+{
+    get_aggregates_out_t out;
+    hg_return_t hret;
+    soma_return_t ret;
+
+    hret = margo_get_output(req->handle, &out);
+    if(hret != HG_SUCCESS)
+        return SOMA_ERR_FROM_MERCURY;
+
+    ret = out.ret;
+    if(ret == SOMA_SUCCESS) {
+        store_index(req->owner, out.index);
+        if(out.count != req->in.get_aggregates.count)
+            ret = SOMA_ERR_OTHER;
+        else
+            memcpy(req->aggregates, out.aggregates, out.count*sizeof(*out.aggregates));
+    }
+
+    margo_free_output(req->handle, &out);
+    return ret;
+}
+
+static soma_return_t complete_query(soma_request_t req)
+{
+    query_out_t out;
+    hg_return_t hret;
+    soma_return_t ret;
+
+    hret = margo_get_output(req->handle, &out);
+    if(hret != HG_SUCCESS)
+        return SOMA_ERR_FROM_MERCURY;
+
+    ret = out.ret;
+    if(ret == SOMA_SUCCESS) {
+        store_index(req->owner, out.index);
+        if(out.count > req->in.query.capacity) {
+            ret = SOMA_ERR_OTHER;
+        } else {
+            if(out.count)
+                memcpy(req->samples, out.results, out.count*sizeof(*out.results));
+            *(req->count) = out.count;
+            if(req->cursor && req->in.query.aggregation == SOMA_AGG_NONE)
+                *(req->cursor) = out.next;
+        }
+    }
+
+    margo_free_output(req->handle, &out);
+    return ret;
+}
+
+/* Takes a Mercury handle from the collector handle's cache and resets
+ * it for the requested RPC, or creates a new one if the cache is empty */
+static hg_return_t acquire_hg_handle(
+        soma_collector_handle_t handle,
+        hg_id_t rpc_id,
+        hg_handle_t* h)
+{
+    hg_handle_t cached = HG_HANDLE_NULL;
+
+    ABT_mutex_lock(handle->cache_mtx);
+    if(handle->num_cached_handles)
+        cached = handle->cached_handles[--handle->num_cached_handles];
+    ABT_mutex_unlock(handle->cache_mtx);
+
+    if(cached != HG_HANDLE_NULL) {
+        if(margo_reset(cached, handle->addr, rpc_id) == HG_SUCCESS) {
+            *h = cached;
+            return HG_SUCCESS;
+        }
+        margo_destroy(cached);
+    }
+    return margo_create(handle->client->mid, handle->addr, rpc_id, h);
+}
+
+/* Gives a Mercury handle that is no longer in use back to the cache,
+ * destroying it if the cache is full */
+static void release_hg_handle(
+        soma_collector_handle_t handle,
+        hg_handle_t h)
+{
+    ABT_mutex_lock(handle->cache_mtx);
+    if(handle->num_cached_handles < SOMA_HG_HANDLE_CACHE_SIZE) {
+        handle->cached_handles[handle->num_cached_handles++] = h;
+        h = HG_HANDLE_NULL;
+    }
+    ABT_mutex_unlock(handle->cache_mtx);
+    if(h != HG_HANDLE_NULL)
         margo_destroy(h);
+}
+
+static void request_free(soma_request_t req)
+{
+    soma_collector_handle_t owner = req->owner;
+    if(req->bulk != HG_BULK_NULL)
+        margo_bulk_free(req->bulk);
+    free(req->staging);
+    if(req->handle != HG_HANDLE_NULL)
+        release_hg_handle(owner, req->handle);
+    free(req);
+    soma_collector_handle_release(owner);
+}
+
+/* Allocates a request and fills the reference to the collector in
+ * its input, using the collector's index if it is known already */
+static soma_request_t request_create(
+        soma_collector_handle_t handle,
+        soma_collector_ref_t* (*ref_of)(soma_request_t))
+{
+    soma_request_t req = (soma_request_t)calloc(1, sizeof(*req));
+    if(!req) return NULL;
+    req->ref = ref_of(req);
+    req->ref->index = load_index(handle);
+    memcpy(&req->ref->id, &(handle->collector_id), sizeof(req->ref->id));
+    return req;
+}
+
+static soma_collector_ref_t* hello_ref(soma_request_t req) { return &req->in.hello.ref; }
+static soma_collector_ref_t* sum_ref(soma_request_t req) { return &req->in.sum.ref; }
+static soma_collector_ref_t* publish_batch_ref(soma_request_t req) { return &req->in.publish_batch.ref; }
+static soma_collector_ref_t* publish_packed_ref(soma_request_t req) { return &req->in.publish_packed.ref; }
+static soma_collector_ref_t* get_aggregates_ref(soma_request_t req) { return &req->in.get_aggregates.ref; }
+static soma_collector_ref_t* query_ref(soma_request_t req) { return &req->in.query.ref; }
+
+/* Acquires a handle for the request and sends the RPC without waiting.
+ * The request holds a reference to the collector handle until it is
+ * freed, and is freed if anything fails. */
+static soma_return_t request_forward(
+        soma_collector_handle_t handle,
+        hg_id_t rpc_id,
+        soma_request_t req)
+{
+    hg_return_t hret;
+
+    req->owner  = handle;
+    req->rpc_id = rpc_id;
+    soma_collector_handle_ref_incr(handle);
+
+    hret = acquire_hg_handle(handle, rpc_id, &req->handle);
+    if(hret != HG_SUCCESS) {
+        req->handle = HG_HANDLE_NULL;
+        request_free(req);
+        return SOMA_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_iforward(handle->provider_id, req->handle, &req->in, &req->req);
+    if(hret != HG_SUCCESS) {
+        request_free(req);
         return SOMA_ERR_FROM_MERCURY;
     }
 
-    margo_destroy(h);
     return SOMA_SUCCESS;
 }
 
+/* Extracts the result of a request whose RPC returned hret. If the
+ * provider did not recognize the collector index we sent (e.g. because
+ * the collector was closed and reopened), the index is forgotten and
+ * the RPC is sent again, synchronously, with the collector's uuid. */
+static soma_return_t request_complete(soma_request_t req, hg_return_t hret)
+{
+    soma_return_t ret = SOMA_ERR_FROM_MERCURY;
+    if(hret == HG_SUCCESS)
+        ret = req->complete(req);
+
+    if(ret == SOMA_ERR_INVALID_COLLECTOR
+    && req->ref->index.slot != SOMA_COLLECTOR_SLOT_NONE) {
+        soma_collector_handle_t owner = req->owner;
+        soma_collector_index_t none = { SOMA_COLLECTOR_SLOT_NONE, 0 };
+        store_index(owner, none);
+        req->ref->index = none;
+        hret = margo_reset(req->handle, owner->addr, req->rpc_id);
+        if(hret == HG_SUCCESS)
+            hret = margo_provider_forward(owner->provider_id, req->handle, &req->in);
+        ret = SOMA_ERR_FROM_MERCURY;
+        if(hret == HG_SUCCESS)
+            ret = req->complete(req);
+    }
+    return ret;
+}
+
+soma_return_t soma_say_hello_async(
+        soma_collector_handle_t handle,
+        soma_request_t* req)
+{
+    soma_request_t r = request_create(handle, hello_ref);
+    if(!r) return SOMA_ERR_ALLOCATION;
+    r->complete = complete_hello;
+
+    soma_return_t ret = request_forward(handle, handle->client->hello_id, r);
+    if(ret == SOMA_SUCCESS)
+        *req = r;
+    return ret;
+}
+
+soma_return_t soma_say_hello(soma_collector_handle_t handle)
+{
+    soma_local_ops* local = find_local_ops(handle);
+    if(local) {
+        soma_return_t ret;
+        soma_collector_index_t index;
+        soma_collector_ref_t ref = local_ref(handle);
+        do ret = local->hello(local->provider, &ref, &index);
+        while(local_retry(handle, &ref, ret));
+        if(ret == SOMA_SUCCESS)
+            store_index(handle, index);
+        return ret;
+    }
+
+    soma_request_t req;
+    soma_return_t ret = soma_say_hello_async(handle, &req);
+    if(ret != SOMA_SUCCESS)
+        return ret;
+    return soma_request_wait(req);
+}
+
+soma_return_t soma_compute_sum_async(
+        soma_collector_handle_t handle,
+        int32_t x,
+        int32_t y,
+        int32_t* result,
+        soma_request_t* req)
+{
+    soma_request_t r = request_create(handle, sum_ref);
+    if(!r) return SOMA_ERR_ALLOCATION;
+    r->complete = complete_sum;
+    r->result   = result;
+    r->in.sum.x = x;
+    r->in.sum.y = y;
+
+    soma_return_t ret = request_forward(handle, handle->client->sum_id, r);
+    if(ret == SOMA_SUCCESS)
+        *req = r;
+    return ret;
+}
+
 soma_return_t soma_compute_sum(
         soma_collector_handle_t handle,
         int32_t x,
         int32_t y,
         int32_t* result)
 {
-    hg_handle_t   h;
-    sum_in_t     in;
-    sum_out_t   out;
+    soma_local_ops* local = find_local_ops(handle);
+    if(local) {
+        soma_return_t ret;
+        soma_collector_index_t index;
+        soma_collector_ref_t ref = local_ref(handle);
+        do ret = local->sum(local->provider, &ref, x, y, result, &index);
+        while(local_retry(handle, &ref, ret));
+        if(ret == SOMA_SUCCESS)
+            store_index(handle, index);
+        return ret;
+    }
+
+    soma_request_t req;
+    soma_return_t ret = soma_compute_sum_async(handle, x, y, result, &req);
+    if(ret != SOMA_SUCCESS)
+        return ret;
+    return soma_request_wait(req);
+}
+
+/* Sends a publish_batch RPC exposing the given regions, which hold
+ * the series, timestamps, and values of the samples, in that order */
+static soma_return_t publish_regions_async(
+        soma_collector_handle_t handle,
+        size_t count,
+        uint32_t num_regions,
+        void** ptrs,
+        hg_size_t* sizes,
+        void* staging,
+        soma_request_t* req)
+{
     hg_return_t hret;
-    soma_return_t ret;
 
-    memcpy(&in.collector_id, &(handle->collector_id), sizeof(in.collector_id));
-    in.x = x;
-    in.y = y;
+    soma_request_t r = request_create(handle, publish_batch_ref);
+    if(!r) {
+        free(staging);
+        return SOMA_ERR_ALLOCATION;
+    }
+    r->complete = complete_publish_batch;
+    r->staging  = staging;
+    r->in.publish_batch.count = count;
 
-    hret = margo_create(handle->client->mid, handle->addr, handle->client->sum_id, &h);
-    if(hret != HG_SUCCESS)
+    /* expose the samples so the provider can pull them */
+    hret = margo_bulk_create(handle->client->mid, num_regions, ptrs, sizes,
+                             HG_BULK_READ_ONLY, &r->bulk);
+    if(hret != HG_SUCCESS) {
+        free(r->staging);
+        free(r);
         return SOMA_ERR_FROM_MERCURY;
+    }
+    r->in.publish_batch.bulk = r->bulk;
 
-    hret = margo_provider_forward(handle->provider_id, h, &in);
-    if(hret != HG_SUCCESS) {
-        ret = SOMA_ERR_FROM_MERCURY;
-        goto finish;
+    soma_return_t ret = request_forward(handle, handle->client->publish_batch_id, r);
+    if(ret == SOMA_SUCCESS)
+        *req = r;
+    return ret;
+}
+
+/* Sends a publish_packed RPC carrying the given columns, compressed
+ * when the RPC is serialized (and serialized again if it is resent) */
+static soma_return_t publish_packed_async(
+        soma_collector_handle_t handle,
+        size_t count,
+        const uint64_t* series,
+        const uint64_t* timestamps,
+        const double* values,
+        void* staging,
+        soma_request_t* req)
+{
+    soma_request_t r = request_create(handle, publish_packed_ref);
+    if(!r) {
+        free(staging);
+        return SOMA_ERR_ALLOCATION;
     }
+    r->complete = complete_publish_batch;
+    r->staging  = staging;
+    r->in.publish_packed.samples.batch.count      = count;
+    r->in.publish_packed.samples.batch.series     = series;
+    r->in.publish_packed.samples.batch.timestamps = timestamps;
+    r->in.publish_packed.samples.batch.values     = values;
+    r->in.publish_packed.samples.columns          = NULL;
 
-    hret = margo_get_output(h, &out);
-    if(hret != HG_SUCCESS) {
-        ret = SOMA_ERR_FROM_MERCURY;
-        goto finish;
+    soma_return_t ret = request_forward(handle, handle->client->publish_packed_id, r);
+    if(ret == SOMA_SUCCESS)
+        *req = r;
+    return ret;
+}
+
+soma_return_t soma_publish_columns_async(
+        soma_collector_handle_t handle,
+        size_t count,
+        const uint64_t* series,
+        const uint64_t* timestamps,
+        const double* values,
+        soma_request_t* req)
+{
+    if(!series || !timestamps || !values || count == 0)
+        return SOMA_ERR_INVALID_ARGS;
+
+    if(count <= handle->client->packed_max_samples)
+        return publish_packed_async(handle, count, series, timestamps, values, NULL, req);
+
+    void*     buf_ptrs[3]  = { (void*)series, (void*)timestamps, (void*)values };
+    hg_size_t buf_sizes[3] = { count * sizeof(*series),
+                               count * sizeof(*timestamps),
+                               count * sizeof(*values) };
+    return publish_regions_async(handle, count, 3, buf_ptrs, buf_sizes, NULL, req);
+}
+
+soma_return_t soma_publish_columns(
+        soma_collector_handle_t handle,
+        size_t count,
+        const uint64_t* series,
+        const uint64_t* timestamps,
+        const double* values)
+{
+    if(count == 0)
+        return SOMA_SUCCESS;
+
+    soma_return_t ret = SOMA_SUCCESS;
+    if(shm_publish(handle, count, NULL, series, timestamps, values, &ret))
+        return ret;
+
+    soma_local_ops* local = find_local_ops(handle);
+    if(local) {
+        if(!series || !timestamps || !values)
+            return SOMA_ERR_INVALID_ARGS;
+        soma_batch_t batch = { count, series, timestamps, values };
+        return local_publish_batch(handle, local, &batch);
     }
 
-    ret = out.ret;
+    soma_request_t req;
+    ret = soma_publish_columns_async(handle, count,
+            series, timestamps, values, &req);
+    if(ret != SOMA_SUCCESS)
+        return ret;
+    return soma_request_wait(req);
+}
+
+soma_return_t soma_publish_batch_async(
+        soma_collector_handle_t handle,
+        const soma_sample_t* samples,
+        size_t count,
+        soma_request_t* req)
+{
+    if(!samples || count == 0)
+        return SOMA_ERR_INVALID_ARGS;
+
+    /* lay the samples out in columns, as the provider expects them */
+    hg_size_t size = count * (2*sizeof(uint64_t) + sizeof(double));
+    char* staging = (char*)malloc(size);
+    if(!staging) return SOMA_ERR_ALLOCATION;
+    uint64_t* series     = (uint64_t*)staging;
+    uint64_t* timestamps = series + count;
+    double*   values     = (double*)(staging + 2*count*sizeof(uint64_t));
+    size_t i;
+    for(i = 0; i < count; i++) {
+        series[i]     = samples[i].series;
+        timestamps[i] = samples[i].timestamp;
+        values[i]     = samples[i].value;
+    }
+
+    if(count <= handle->client->packed_max_samples)
+        return publish_packed_async(handle, count, series, timestamps, values, staging, req);
+
+    void* buf_ptrs[1] = { (void*)staging };
+    return publish_regions_async(handle, count, 1, buf_ptrs, &size, staging, req);
+}
+
+soma_return_t soma_publish_batch(
+        soma_collector_handle_t handle,
+        const soma_sample_t* samples,
+        size_t count)
+{
+    if(count == 0)
+        return SOMA_SUCCESS;
+
+    soma_return_t ret = SOMA_SUCCESS;
+    if(shm_publish(handle, count, samples, NULL, NULL, NULL, &ret))
+        return ret;
+
+    soma_local_ops* local = find_local_ops(handle);
+    if(local) {
+        if(!samples)
+            return SOMA_ERR_INVALID_ARGS;
+        char* columns = (char*)malloc(count * (2*sizeof(uint64_t) + sizeof(double)));
+        if(!columns) return SOMA_ERR_ALLOCATION;
+        uint64_t* series     = (uint64_t*)columns;
+        uint64_t* timestamps = series + count;
+        double*   values     = (double*)(columns + 2*count*sizeof(uint64_t));
+        size_t i;
+        for(i = 0; i < count; i++) {
+            series[i]     = samples[i].series;
+            timestamps[i] = samples[i].timestamp;
+            values[i]     = samples[i].value;
+        }
+        soma_batch_t batch = { count, series, timestamps, values };
+        ret = local_publish_batch(handle, local, &batch);
+        free(columns);
+        return ret;
+    }
+
+    soma_request_t req;
+    ret = soma_publish_batch_async(handle, samples, count, &req);
+    if(ret != SOMA_SUCCESS)
+        return ret;
+    return soma_request_wait(req);
+}
+
+soma_return_t soma_get_aggregates_async(
+        soma_collector_handle_t handle,
+        size_t count,
+        const uint64_t* series,
+        soma_aggregate_t* aggregates,
+        soma_request_t* req)
+{
+    if(count && (!series || !aggregates))
+        return SOMA_ERR_INVALID_ARGS;
+
+    soma_request_t r = request_create(handle, get_aggregates_ref);
+    if(!r) return SOMA_ERR_ALLOCATION;
+    r->complete   = complete_get_aggregates;
+    r->aggregates = aggregates;
+    r->in.get_aggregates.count  = count;
+    r->in.get_aggregates.series = (uint64_t*)series;
+
+    soma_return_t ret = request_forward(handle, handle->client->get_aggregates_id, r);
     if(ret == SOMA_SUCCESS)
-        *result = out.result;
+        *req = r;
+    return ret;
+}
 
-finish:
-    margo_free_output(h, &out);
-    margo_destroy(h);
+soma_return_t soma_get_aggregates(
+        soma_collector_handle_t handle,
+        size_t count,
+        const uint64_t* series,
+        soma_aggregate_t* aggregates)
+{
+    if(count && (!series || !aggregates))
+        return SOMA_ERR_INVALID_ARGS;
+
+    soma_local_ops* local = find_local_ops(handle);
+    if(local) {
+        soma_return_t ret;
+        soma_collector_index_t index;
+        soma_collector_ref_t ref = local_ref(handle);
+        do ret = local->get_aggregates(local->provider, &ref, count, series, aggregates, &index);
+        while(local_retry(handle, &ref, ret));
+        if(ret == SOMA_SUCCESS)
+            store_index(handle, index);
+        return ret;
+    }
+
+    soma_request_t req;
+    soma_return_t ret = soma_get_aggregates_async(handle, count, series, aggregates, &req);
+    if(ret != SOMA_SUCCESS)
+        return ret;
+    return soma_request_wait(req);
+}
+
+soma_return_t soma_query_async(
+        soma_collector_handle_t handle,
+        size_t num_series,
+        const uint64_t* series,
+        uint64_t t_start,
+        uint64_t t_end,
+        soma_aggregation_t aggregation,
+        uint64_t step,
+        soma_query_cursor_t* cursor,
+        soma_sample_t* results,
+        size_t* count,
+        soma_request_t* req)
+{
+    if((num_series && !series) || !count || (*count && !results) || t_end < t_start)
+        return SOMA_ERR_INVALID_ARGS;
+
+    soma_request_t r = request_create(handle, query_ref);
+    if(!r) return SOMA_ERR_ALLOCATION;
+    r->complete = complete_query;
+    r->samples  = results;
+    r->count    = count;
+    r->cursor   = cursor;
+    r->in.query.t_start     = t_start;
+    r->in.query.t_end       = t_end;
+    r->in.query.step        = step;
+    r->in.query.aggregation = (int32_t)aggregation;
+    r->in.query.capacity    = *count;
+    if(cursor) {
+        r->in.query.cursor = *cursor;
+    } else {
+        r->in.query.cursor.series = 0;
+        r->in.query.cursor.offset = 0;
+    }
+    r->in.query.count       = num_series;
+    r->in.query.series      = (uint64_t*)series;
+
+    soma_return_t ret = request_forward(handle, handle->client->query_id, r);
+    if(ret == SOMA_SUCCESS)
+        *req = r;
+    return ret;
+}
+
+soma_return_t soma_query(
+        soma_collector_handle_t handle,
+        size_t num_series,
+        const uint64_t* series,
+        uint64_t t_start,
+        uint64_t t_end,
+        soma_aggregation_t aggregation,
+        uint64_t step,
+        soma_query_cursor_t* cursor,
+        soma_sample_t* results,
+        size_t* count)
+{
+    if((num_series && !series) || !count || (*count && !results) || t_end < t_start)
+        return SOMA_ERR_INVALID_ARGS;
+
+    soma_local_ops* local = find_local_ops(handle);
+    if(local) {
+        soma_return_t ret;
+        soma_collector_index_t index;
+        soma_collector_ref_t ref = local_ref(handle);
+        soma_query_cursor_t start = { 0, 0 };
+        soma_query_params params = {
+            num_series, series, t_start, t_end, aggregation, step, *count,
+            cursor ? *cursor : start
+        };
+        do ret = local->query(local->provider, &ref, &params, results, count,
+                              cursor, &index);
+        while(local_retry(handle, &ref, ret));
+        if(ret == SOMA_SUCCESS)
+            store_index(handle, index);
+        return ret;
+    }
+
+    soma_request_t req;
+    soma_return_t ret = soma_query_async(handle, num_series, series, t_start, t_end,
+                                         aggregation, step, cursor, results, count, &req);
+    if(ret != SOMA_SUCCESS)
+        return ret;
+    return soma_request_wait(req);
+}
+
+soma_return_t soma_request_wait(soma_request_t req)
+{
+    if(req == SOMA_REQUEST_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+
+    hg_return_t hret = margo_wait(req->req);
+    soma_return_t ret = request_complete(req, hret);
+
+    request_free(req);
+    return ret;
+}
+
+soma_return_t soma_request_test(soma_request_t req, int* flag)
+{
+    if(req == SOMA_REQUEST_NULL || !flag)
+        return SOMA_ERR_INVALID_ARGS;
+
+    int hret = margo_test(req->req, flag);
+    if(hret != HG_SUCCESS)
+        return SOMA_ERR_FROM_MERCURY;
+    return SOMA_SUCCESS;
+}
+
+soma_return_t soma_request_wait_any(
+        size_t count,
+        soma_request_t* reqs,
+        size_t* index)
+{
+    size_t i;
+    hg_return_t hret;
+    soma_return_t ret;
+
+    if(!reqs || !index)
+        return SOMA_ERR_INVALID_ARGS;
+
+    margo_request* mreqs = (margo_request*)malloc(count * sizeof(*mreqs));
+    if(count && !mreqs)
+        return SOMA_ERR_ALLOCATION;
+    for(i = 0; i < count; i++)
+        mreqs[i] = reqs[i] ? reqs[i]->req : MARGO_REQUEST_NULL;
+
+    /* margo_wait_any may fail without setting the index */
+    *index = count;
+    hret = margo_wait_any(count, mreqs, index);
+    free(mreqs);
+
+    /* the wait itself failed, or all the requests were SOMA_REQUEST_NULL;
+     * otherwise the request found completed, possibly with an error */
+    if(*index >= count)
+        return hret != HG_SUCCESS ? SOMA_ERR_FROM_MERCURY : SOMA_ERR_INVALID_ARGS;
+
+    soma_request_t req = reqs[*index];
+    ret = request_complete(req, hret);
+
+    request_free(req);
+    reqs[*index] = SOMA_REQUEST_NULL;
     return ret;
 }
@@ -9,11 +9,28 @@
 #include "types.h"
 #include "soma/soma-client.h"
 #include "soma/soma-collector.h"
+#include "soma/soma-cluster.h"
+#include "shm-ring.h"
+#include "local.h"
+
+/* maximum number of idle Mercury handles kept per collector handle */
+#define SOMA_HG_HANDLE_CACHE_SIZE 16
+
+/* bytes of a publish_packed RPC's input besides the encoded samples
+ * (reference to the collector and size of the encoding) */
+#define SOMA_PACKED_INPUT_OVERHEAD (sizeof(soma_collector_ref_t) + sizeof(uint64_t))
 
 typedef struct soma_client {
    margo_instance_id mid;
    hg_id_t           hello_id;
    hg_id_t           sum_id;
+   hg_id_t           publish_batch_id;
+   hg_id_t           publish_packed_id;
+   hg_id_t           get_aggregates_id;
+   hg_id_t           query_id;
+   hg_id_t           shm_attach_id;
+   hg_id_t           shm_detach_id;
+   size_t            packed_max_samples; // largest batch sent within the RPC
    uint64_t          num_collector_handles;
 } soma_client;
 
@@ -23,6 +40,71 @@ typedef struct soma_collector_handle {
     uint16_t            provider_id;
     uint64_t            refcount;
     soma_collector_id_t collector_id;
+    uint64_t            collector_index;  // packed soma_collector_index_t learned from the provider
+    int                 is_local;         // addr is that of the client's own margo instance
+    int                 allow_local;      // direct calls allowed (soma_collector_handle_set_local)
+    /* write-combining buffer of staged samples */
+    ABT_mutex           buffer_mtx;
+    uint64_t*           buffer_series;    // staged samples, in columns (allocated lazily,
+    uint64_t*           buffer_timestamps;// as a single block starting at buffer_series)
+    double*             buffer_values;
+    size_t              buffer_size;      // number of staged samples
+    size_t              buffer_capacity;  // flush when this many samples are staged
+    double              buffer_max_delay; // flush when the oldest sample is this old (seconds)
+    double              buffer_since;     // time at which the oldest staged sample was added
+    ABT_cond            buffer_cond;      // wakes up the flusher
+    int                 buffer_flusher;   // whether the ULT enforcing buffer_max_delay runs
+    int                 buffer_stop;      // asks the flusher to exit (last reference dropped)
+    soma_return_t       buffer_error;     // error of the last flush done by the flusher
+    /* cache of Mercury handles to reuse across RPCs */
+    ABT_mutex           cache_mtx;
+    hg_handle_t         cached_handles[SOMA_HG_HANDLE_CACHE_SIZE];
+    size_t              num_cached_handles;
+    /* shared-memory ring to the provider, if attached (protected by buffer_mtx) */
+    soma_shm_ring*      shm_ring;
+    size_t              shm_size;         // size of the mapping
+    uint64_t            shm_channel;      // provider-side id of the channel
 } soma_collector_handle;
 
+/* point of a member on the hash ring of a cluster */
+typedef struct soma_cluster_point {
+    uint64_t hash;
+    uint32_t member; // index of the member in the cluster's members
+} soma_cluster_point;
+
+typedef struct soma_cluster_handle {
+    soma_client_t            client;
+    ABT_rwlock               lock;          // held for writing to change members
+    soma_collector_handle_t* members;       // collector handles of the members
+    size_t                   num_members;
+    unsigned                 virtual_nodes; // points per member
+    soma_cluster_point*      ring;          // points sorted by hash
+    size_t                   ring_size;
+} soma_cluster_handle;
+
+typedef struct soma_request {
+    soma_collector_handle_t owner; // collector handle the request was issued on
+    margo_request req;     // margo request of the pending RPC
+    hg_handle_t   handle;  // handle used to send the RPC
+    hg_id_t       rpc_id;  // RPC sent, in case it needs to be resent
+    union {
+        hello_in_t         hello;
+        sum_in_t           sum;
+        publish_batch_in_t publish_batch;
+        publish_packed_in_t publish_packed;
+        get_aggregates_in_t get_aggregates;
+        query_in_t          query;
+    } in;                  // input of the RPC
+    soma_collector_ref_t* ref; // collector reference within the input
+    hg_bulk_t     bulk;    // bulk handle exposing the input, if any
+    void*         staging; // copy of the input exposed by bulk, if any
+    int32_t*      result;  // where to store the result of a sum
+    soma_aggregate_t* aggregates; // where to store the result of a get_aggregates
+    soma_sample_t* samples; // where to store the results of a query,
+    size_t*       count;   // and their number
+    soma_query_cursor_t* cursor; // and the position following them
+    /* function extracting the output once the RPC has completed */
+    soma_return_t (*complete)(struct soma_request*);
+} soma_request;
+
 #endif
@@ -0,0 +1,578 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <json-c/json.h>
+#ifdef SOMA_HAS_SSG
+#include <ssg.h>
+#endif
+#include "client.h"
+
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Position of the v-th point of a member on the ring; it only depends
+ * on the member's collector id so that every client agrees on it */
+static inline uint64_t point_hash(const soma_collector_id_t* id, unsigned v)
+{
+    uint64_t a, b;
+    memcpy(&a, id->uuid, sizeof(a));
+    memcpy(&b, id->uuid + sizeof(a), sizeof(b));
+    return mix64(a ^ mix64(b ^ mix64((uint64_t)v + 1)));
+}
+
+static inline uint64_t series_hash(uint64_t series)
+{
+    return mix64(series ^ 0x9e3779b97f4a7c15ULL);
+}
+
+static int compare_points(const void* x, const void* y)
+{
+    const soma_cluster_point* p = (const soma_cluster_point*)x;
+    const soma_cluster_point* q = (const soma_cluster_point*)y;
+    if(p->hash != q->hash) return p->hash < q->hash ? -1 : 1;
+    return (p->member > q->member) - (p->member < q->member);
+}
+
+/* Recomputes the ring from the members; must be called with the lock
+ * held for writing (or before the cluster is visible to anyone). */
+static soma_return_t build_ring(soma_cluster_handle_t cluster)
+{
+    size_t size = cluster->num_members * cluster->virtual_nodes;
+    soma_cluster_point* ring = NULL;
+    if(size) {
+        ring = (soma_cluster_point*)malloc(size * sizeof(*ring));
+        if(!ring) return SOMA_ERR_ALLOCATION;
+    }
+    size_t i, n = 0;
+    unsigned v;
+    for(i = 0; i < cluster->num_members; i++) {
+        for(v = 0; v < cluster->virtual_nodes; v++) {
+            ring[n].hash   = point_hash(&cluster->members[i]->collector_id, v);
+            ring[n].member = (uint32_t)i;
+            n++;
+        }
+    }
+    if(size) qsort(ring, size, sizeof(*ring), compare_points);
+    free(cluster->ring);
+    cluster->ring      = ring;
+    cluster->ring_size = size;
+    return SOMA_SUCCESS;
+}
+
+/* Index of the member owning a series; must be called with the lock
+ * held and at least one member */
+static inline uint32_t find_member(soma_cluster_handle_t cluster, uint64_t series)
+{
+    uint64_t h = series_hash(series);
+    size_t lo = 0, hi = cluster->ring_size;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(cluster->ring[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    if(lo == cluster->ring_size) lo = 0;
+    return cluster->ring[lo].member;
+}
+
+static ssize_t find_member_by_id(
+        soma_cluster_handle_t cluster,
+        const soma_collector_id_t* id)
+{
+    size_t i;
+    for(i = 0; i < cluster->num_members; i++) {
+        if(memcmp(&cluster->members[i]->collector_id, id, sizeof(*id)) == 0)
+            return (ssize_t)i;
+    }
+    return -1;
+}
+
+soma_return_t soma_cluster_handle_create(
+        soma_client_t client,
+        size_t count,
+        const soma_collector_handle_t* members,
+        unsigned virtual_nodes,
+        soma_cluster_handle_t* cluster)
+{
+    if(client == SOMA_CLIENT_NULL || (count && !members))
+        return SOMA_ERR_INVALID_ARGS;
+
+    soma_cluster_handle_t c = (soma_cluster_handle_t)calloc(1, sizeof(*c));
+    if(!c) return SOMA_ERR_ALLOCATION;
+
+    c->client        = client;
+    c->virtual_nodes = virtual_nodes ? virtual_nodes : SOMA_DEFAULT_VIRTUAL_NODES;
+    if(count) {
+        c->members = (soma_collector_handle_t*)malloc(count * sizeof(*c->members));
+        if(!c->members) {
+            free(c);
+            return SOMA_ERR_ALLOCATION;
+        }
+    }
+    size_t i;
+    for(i = 0; i < count; i++) {
+        if(find_member_by_id(c, &members[i]->collector_id) >= 0)
+            continue; /* the same collector can only be a member once */
+        c->members[c->num_members++] = members[i];
+    }
+
+    soma_return_t ret = build_ring(c);
+    if(ret != SOMA_SUCCESS) {
+        free(c->members);
+        free(c);
+        return ret;
+    }
+    if(ABT_rwlock_create(&c->lock) != ABT_SUCCESS) {
+        free(c->ring);
+        free(c->members);
+        free(c);
+        return SOMA_ERR_FROM_ARGOBOTS;
+    }
+
+    for(i = 0; i < c->num_members; i++)
+        soma_collector_handle_ref_incr(c->members[i]);
+
+    *cluster = c;
+    return SOMA_SUCCESS;
+}
+
+/* Creates a collector handle for a member described by an address
+ * string, a provider id and a collector id string */
+static soma_return_t create_member(
+        soma_client_t client,
+        const char* address,
+        int64_t provider_id,
+        const char* collector,
+        soma_collector_handle_t* member)
+{
+    soma_collector_id_t id;
+    hg_addr_t addr = HG_ADDR_NULL;
+
+    if(provider_id < 0 || provider_id > UINT16_MAX
+    || !collector || strlen(collector) != 36
+    || uuid_parse(collector, id.uuid) != 0) {
+        fprintf(stderr, "Error: invalid cluster member (provider %ld, collector %s)\n",
+                provider_id, collector ? collector : "(none)");
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    if(margo_addr_lookup(client->mid, address, &addr) != HG_SUCCESS) {
+        fprintf(stderr, "Error: could not look up address %s\n", address);
+        return SOMA_ERR_FROM_MERCURY;
+    }
+    soma_return_t ret = soma_collector_handle_create(
+            client, addr, (uint16_t)provider_id, id, member);
+    margo_addr_free(client->mid, addr);
+    return ret;
+}
+
+/* Fills the members from a "members" array of the configuration */
+static soma_return_t members_from_list(
+        soma_client_t client,
+        struct json_object* list,
+        soma_collector_handle_t* members,
+        size_t* count)
+{
+    size_t i, n = json_object_array_length(list);
+    for(i = 0; i < n; i++) {
+        struct json_object* m = json_object_array_get_idx(list, i);
+        struct json_object* address = NULL;
+        struct json_object* provider_id = NULL;
+        struct json_object* collector = NULL;
+        if(!json_object_object_get_ex(m, "address", &address)
+        || !json_object_is_type(address, json_type_string)
+        || !json_object_object_get_ex(m, "provider_id", &provider_id)
+        || !json_object_is_type(provider_id, json_type_int)
+        || !json_object_object_get_ex(m, "collector", &collector)
+        || !json_object_is_type(collector, json_type_string)) {
+            fprintf(stderr, "Error: cluster member %lu should have a string \"address\","
+                            " an integer \"provider_id\", and a string \"collector\"\n", i);
+            return SOMA_ERR_INVALID_CONFIG;
+        }
+        soma_return_t ret = create_member(client,
+                json_object_get_string(address),
+                json_object_get_int64(provider_id),
+                json_object_get_string(collector),
+                &members[*count]);
+        if(ret != SOMA_SUCCESS) return ret;
+        *count += 1;
+    }
+    return SOMA_SUCCESS;
+}
+
+#ifdef SOMA_HAS_SSG
+/* Fills the members from the addresses of an SSG group file,
+ * the i-th address hosting the i-th collector of the configuration */
+static soma_return_t members_from_ssg(
+        soma_client_t client,
+        const char* group_file,
+        int64_t provider_id,
+        struct json_object* collectors,
+        soma_collector_handle_t* members,
+        size_t* count)
+{
+    ssg_group_id_t gid;
+    int num_addrs = 0;
+    soma_return_t ret = SOMA_SUCCESS;
+
+    if(ssg_group_id_load(group_file, &num_addrs, &gid) != SSG_SUCCESS) {
+        fprintf(stderr, "Error: could not load SSG group file %s\n", group_file);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    size_t i, n = json_object_array_length(collectors);
+    if(n > (size_t)num_addrs) {
+        fprintf(stderr, "Error: %lu collectors for an SSG group of %d members\n",
+                n, num_addrs);
+        ret = SOMA_ERR_INVALID_CONFIG;
+        goto finish;
+    }
+    for(i = 0; i < n; i++) {
+        char* addr_str = NULL;
+        if(ssg_group_id_get_addr_str(gid, (unsigned)i, &addr_str) != SSG_SUCCESS) {
+            ret = SOMA_ERR_OTHER;
+            goto finish;
+        }
+        ret = create_member(client, addr_str, provider_id,
+                json_object_get_string(json_object_array_get_idx(collectors, i)),
+                &members[*count]);
+        free(addr_str);
+        if(ret != SOMA_SUCCESS) goto finish;
+        *count += 1;
+    }
+
+finish:
+    ssg_group_id_free(gid);
+    return ret;
+}
+#endif
+
+soma_return_t soma_cluster_handle_create_from_file(
+        soma_client_t client,
+        const char* filename,
+        soma_cluster_handle_t* cluster)
+{
+    soma_return_t ret = SOMA_SUCCESS;
+    soma_collector_handle_t* members = NULL;
+    size_t i, count = 0;
+    unsigned virtual_nodes = 0;
+
+    if(client == SOMA_CLIENT_NULL || !filename)
+        return SOMA_ERR_INVALID_ARGS;
+
+    struct json_object* config = json_object_from_file(filename);
+    if(!config || !json_object_is_type(config, json_type_object)) {
+        fprintf(stderr, "Error: could not read cluster description from %s\n", filename);
+        json_object_put(config);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+
+    struct json_object* vnodes = NULL;
+    if(json_object_object_get_ex(config, "virtual_nodes", &vnodes)) {
+        if(!json_object_is_type(vnodes, json_type_int)
+        || json_object_get_int64(vnodes) <= 0) {
+            fprintf(stderr, "Error: \"virtual_nodes\" should be a positive integer\n");
+            ret = SOMA_ERR_INVALID_CONFIG;
+            goto finish;
+        }
+        virtual_nodes = (unsigned)json_object_get_int64(vnodes);
+    }
+
+    struct json_object* list = NULL;
+    struct json_object* collectors = NULL;
+    if(json_object_object_get_ex(config, "members", &list)
+    && json_object_is_type(list, json_type_array)) {
+        members = (soma_collector_handle_t*)calloc(
+                json_object_array_length(list) + 1, sizeof(*members));
+        if(!members) {
+            ret = SOMA_ERR_ALLOCATION;
+            goto finish;
+        }
+        ret = members_from_list(client, list, members, &count);
+    } else if(json_object_object_get_ex(config, "collectors", &collectors)
+           && json_object_is_type(collectors, json_type_array)) {
+#ifdef SOMA_HAS_SSG
+        struct json_object* group_file = NULL;
+        struct json_object* provider_id = NULL;
+        if(!json_object_object_get_ex(config, "ssg_group_file", &group_file)
+        || !json_object_is_type(group_file, json_type_string)
+        || !json_object_object_get_ex(config, "provider_id", &provider_id)
+        || !json_object_is_type(provider_id, json_type_int)) {
+            fprintf(stderr, "Error: \"collectors\" requires a string \"ssg_group_file\""
+                            " and an integer \"provider_id\"\n");
+            ret = SOMA_ERR_INVALID_CONFIG;
+            goto finish;
+        }
+        members = (soma_collector_handle_t*)calloc(
+                json_object_array_length(collectors) + 1, sizeof(*members));
+        if(!members) {
+            ret = SOMA_ERR_ALLOCATION;
+            goto finish;
+        }
+        ret = members_from_ssg(client, json_object_get_string(group_file),
+                json_object_get_int64(provider_id), collectors, members, &count);
+#else
+        fprintf(stderr, "Error: SOMA was built without SSG support\n");
+        ret = SOMA_ERR_OP_UNSUPPORTED;
+#endif
+    } else {
+        fprintf(stderr, "Error: cluster description should have a \"members\" array\n");
+        ret = SOMA_ERR_INVALID_CONFIG;
+    }
+    if(ret != SOMA_SUCCESS) goto finish;
+
+    ret = soma_cluster_handle_create(client, count, members, virtual_nodes, cluster);
+
+finish:
+    /* the cluster holds its own references */
+    for(i = 0; i < count; i++)
+        soma_collector_handle_release(members[i]);
+    free(members);
+    json_object_put(config);
+    return ret;
+}
+
+soma_return_t soma_cluster_handle_release(
+        soma_cluster_handle_t cluster)
+{
+    if(cluster == SOMA_CLUSTER_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+    soma_return_t ret = SOMA_SUCCESS;
+    size_t i;
+    for(i = 0; i < cluster->num_members; i++) {
+        soma_return_t r = soma_collector_handle_release(cluster->members[i]);
+        if(ret == SOMA_SUCCESS) ret = r;
+    }
+    ABT_rwlock_free(&cluster->lock);
+    free(cluster->ring);
+    free(cluster->members);
+    free(cluster);
+    return ret;
+}
+
+soma_return_t soma_cluster_add_member(
+        soma_cluster_handle_t cluster,
+        soma_collector_handle_t member)
+{
+    if(cluster == SOMA_CLUSTER_HANDLE_NULL || member == SOMA_COLLECTOR_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+
+    soma_return_t ret = SOMA_SUCCESS;
+    ABT_rwlock_wrlock(cluster->lock);
+
+    if(find_member_by_id(cluster, &member->collector_id) >= 0) {
+        ret = SOMA_ERR_INVALID_ARGS;
+        goto finish;
+    }
+    soma_collector_handle_t* members = (soma_collector_handle_t*)realloc(
+            cluster->members, (cluster->num_members + 1) * sizeof(*members));
+    if(!members) {
+        ret = SOMA_ERR_ALLOCATION;
+        goto finish;
+    }
+    cluster->members = members;
+    cluster->members[cluster->num_members++] = member;
+
+    ret = build_ring(cluster);
+    if(ret != SOMA_SUCCESS) {
+        cluster->num_members -= 1;
+        goto finish;
+    }
+    soma_collector_handle_ref_incr(member);
+
+finish:
+    ABT_rwlock_unlock(cluster->lock);
+    return ret;
+}
+
+soma_return_t soma_cluster_remove_member(
+        soma_cluster_handle_t cluster,
+        soma_collector_id_t collector_id)
+{
+    if(cluster == SOMA_CLUSTER_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+
+    soma_return_t ret = SOMA_SUCCESS;
+    soma_collector_handle_t member = SOMA_COLLECTOR_HANDLE_NULL;
+    ABT_rwlock_wrlock(cluster->lock);
+
+    ssize_t i = find_member_by_id(cluster, &collector_id);
+    if(i < 0) {
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto finish;
+    }
+    member = cluster->members[i];
+    memmove(cluster->members + i, cluster->members + i + 1,
+            (cluster->num_members - i - 1) * sizeof(*cluster->members));
+    cluster->num_members -= 1;
+
+    ret = build_ring(cluster);
+    if(ret != SOMA_SUCCESS) {
+        /* put the member back where it was */
+        memmove(cluster->members + i + 1, cluster->members + i,
+                (cluster->num_members - i) * sizeof(*cluster->members));
+        cluster->members[i] = member;
+        cluster->num_members += 1;
+        member = SOMA_COLLECTOR_HANDLE_NULL;
+    }
+
+finish:
+    ABT_rwlock_unlock(cluster->lock);
+    if(member != SOMA_COLLECTOR_HANDLE_NULL)
+        ret = soma_collector_handle_release(member);
+    return ret;
+}
+
+soma_return_t soma_cluster_get_size(
+        soma_cluster_handle_t cluster,
+        size_t* count)
+{
+    if(cluster == SOMA_CLUSTER_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+    ABT_rwlock_rdlock(cluster->lock);
+    *count = cluster->num_members;
+    ABT_rwlock_unlock(cluster->lock);
+    return SOMA_SUCCESS;
+}
+
+soma_return_t soma_cluster_route(
+        soma_cluster_handle_t cluster,
+        uint64_t series,
+        soma_collector_handle_t* member)
+{
+    if(cluster == SOMA_CLUSTER_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+    soma_return_t ret = SOMA_SUCCESS;
+    ABT_rwlock_rdlock(cluster->lock);
+    if(cluster->num_members)
+        *member = cluster->members[find_member(cluster, series)];
+    else
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+    ABT_rwlock_unlock(cluster->lock);
+    return ret;
+}
+
+soma_return_t soma_cluster_publish(
+        soma_cluster_handle_t cluster,
+        uint64_t series,
+        uint64_t timestamp,
+        double value)
+{
+    if(cluster == SOMA_CLUSTER_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+    soma_return_t ret = SOMA_ERR_INVALID_COLLECTOR;
+    ABT_rwlock_rdlock(cluster->lock);
+    if(cluster->num_members)
+        ret = soma_publish(cluster->members[find_member(cluster, series)],
+                           series, timestamp, value);
+    ABT_rwlock_unlock(cluster->lock);
+    return ret;
+}
+
+soma_return_t soma_cluster_publish_batch(
+        soma_cluster_handle_t cluster,
+        const soma_sample_t* samples,
+        size_t count)
+{
+    if(cluster == SOMA_CLUSTER_HANDLE_NULL || (count && !samples))
+        return SOMA_ERR_INVALID_ARGS;
+    if(count == 0)
+        return SOMA_SUCCESS;
+
+    soma_return_t ret = SOMA_SUCCESS;
+    uint32_t*       owners  = NULL;
+    size_t*         offsets = NULL;
+    soma_request_t* reqs    = NULL;
+    char*           staging = NULL;
+    size_t i, m, num_reqs = 0;
+
+    ABT_rwlock_rdlock(cluster->lock);
+    size_t n = cluster->num_members;
+    if(n == 0) {
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto finish;
+    }
+
+    owners  = (uint32_t*)malloc(count * sizeof(*owners));
+    offsets = (size_t*)calloc(n + 1, sizeof(*offsets));
+    reqs    = (soma_request_t*)calloc(n, sizeof(*reqs));
+    staging = (char*)malloc(count * (2*sizeof(uint64_t) + sizeof(double)));
+    if(!owners || !offsets || !reqs || !staging) {
+        ret = SOMA_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    /* count the samples of each member, then lay the samples out in
+     * columns grouped by member, so each member gets contiguous ranges */
+    for(i = 0; i < count; i++) {
+        owners[i] = find_member(cluster, samples[i].series);
+        offsets[owners[i] + 1] += 1;
+    }
+    for(m = 0; m < n; m++)
+        offsets[m + 1] += offsets[m];
+
+    uint64_t* series     = (uint64_t*)staging;
+    uint64_t* timestamps = series + count;
+    double*   values     = (double*)(staging + 2*count*sizeof(uint64_t));
+    for(i = 0; i < count; i++) {
+        size_t j = offsets[owners[i]]++;
+        series[j]     = samples[i].series;
+        timestamps[j] = samples[i].timestamp;
+        values[j]     = samples[i].value;
+    }
+    /* offsets[m] now is the end of member m's range */
+
+    for(m = 0; m < n; m++) {
+        size_t start = m ? offsets[m - 1] : 0;
+        size_t part  = offsets[m] - start;
+        if(part == 0) continue;
+        soma_return_t r = soma_publish_columns_async(cluster->members[m], part,
+                series + start, timestamps + start, values + start, &reqs[m]);
+        if(r != SOMA_SUCCESS) {
+            if(ret == SOMA_SUCCESS) ret = r;
+            reqs[m] = SOMA_REQUEST_NULL;
+            continue;
+        }
+        num_reqs += 1;
+    }
+
+    /* the columns must stay alive until every request has completed */
+    while(num_reqs) {
+        size_t index;
+        soma_return_t r = soma_request_wait_any(n, reqs, &index);
+        if(ret == SOMA_SUCCESS) ret = r;
+        num_reqs -= 1;
+    }
+
+finish:
+    ABT_rwlock_unlock(cluster->lock);
+    free(owners);
+    free(offsets);
+    free(reqs);
+    free(staging);
+    return ret;
+}
+
+soma_return_t soma_cluster_flush(
+        soma_cluster_handle_t cluster)
+{
+    if(cluster == SOMA_CLUSTER_HANDLE_NULL)
+        return SOMA_ERR_INVALID_ARGS;
+    soma_return_t ret = SOMA_SUCCESS;
+    size_t i;
+    ABT_rwlock_rdlock(cluster->lock);
+    for(i = 0; i < cluster->num_members; i++) {
+        soma_return_t r = soma_collector_handle_flush(cluster->members[i]);
+        if(ret == SOMA_SUCCESS) ret = r;
+    }
+    ABT_rwlock_unlock(cluster->lock);
+    return ret;
+}
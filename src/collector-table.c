@@ -0,0 +1,353 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <sys/types.h>
+#include "provider.h"
+#include "collector-table.h"
+
+#define INITIAL_CAPACITY 64
+
+/* marks a slot whose collector was removed, so that probing continues past it */
+static soma_collector tombstone_collector;
+#define TOMBSTONE (&tombstone_collector)
+
+static inline uint64_t hash_id(const soma_collector_id_t* id)
+{
+    uint64_t a, b;
+    memcpy(&a, id->uuid, sizeof(a));
+    memcpy(&b, id->uuid + sizeof(a), sizeof(b));
+    uint64_t h = a ^ (b * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static soma_collector_slots* slots_create(size_t capacity)
+{
+    soma_collector_slots* data = (soma_collector_slots*)calloc(1, sizeof(*data));
+    if(!data) return NULL;
+    data->capacity = capacity;
+    data->slots = (soma_collector**)calloc(capacity, sizeof(*data->slots));
+    if(!data->slots) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+static void slots_free(soma_collector_slots* data)
+{
+    if(!data) return;
+    free(data->slots);
+    free(data);
+}
+
+/* Waits until every reader that may have seen the table's state
+ * before the caller's last modification has left its critical section.
+ * Flipping the epoch twice guarantees that both reader counters have
+ * been observed at zero at least once after the modification. */
+static void synchronize(soma_collector_table* table)
+{
+    int i;
+    for(i = 0; i < 2; i++) {
+        uint64_t e = __atomic_fetch_add(&table->epoch, 1, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&table->readers[e & 1], __ATOMIC_SEQ_CST) != 0)
+            ABT_thread_yield();
+    }
+}
+
+/* Returns the index of the slot holding the collector, or -1 */
+static ssize_t find_slot(
+        soma_collector_slots* data,
+        const soma_collector_id_t* id)
+{
+    size_t mask = data->capacity - 1;
+    size_t i = hash_id(id) & mask;
+    size_t n;
+    for(n = 0; n < data->capacity; n++, i = (i + 1) & mask) {
+        soma_collector* c = __atomic_load_n(&data->slots[i], __ATOMIC_ACQUIRE);
+        if(c == NULL)
+            return -1;
+        if(c != TOMBSTONE && memcmp(&c->id, id, sizeof(*id)) == 0)
+            return (ssize_t)i;
+    }
+    return -1;
+}
+
+/* Puts a collector in the first free slot of its probe sequence;
+ * the caller has checked that there is enough room. */
+static void insert_slot(
+        soma_collector_slots* data,
+        soma_collector* collector)
+{
+    size_t mask = data->capacity - 1;
+    size_t i = hash_id(&collector->id) & mask;
+    for(;; i = (i + 1) & mask) {
+        soma_collector* c = data->slots[i];
+        if(c == NULL || c == TOMBSTONE) {
+            __atomic_store_n(&data->slots[i], collector, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+/* Rebuilds the slots with enough room for one more collector and no
+ * tombstones, publishes them, and frees the old ones after a grace
+ * period. Must be called with the writer mutex held. */
+static soma_return_t rebuild(soma_collector_table* table)
+{
+    soma_collector_slots* old = table->data;
+    size_t capacity = old->capacity;
+    while(4 * (table->num_collectors + 1) > capacity)
+        capacity *= 2;
+
+    soma_collector_slots* data = slots_create(capacity);
+    if(!data) return SOMA_ERR_ALLOCATION;
+
+    size_t i;
+    for(i = 0; i < old->capacity; i++) {
+        soma_collector* c = old->slots[i];
+        if(c && c != TOMBSTONE)
+            insert_slot(data, c);
+    }
+
+    __atomic_store_n(&table->data, data, __ATOMIC_SEQ_CST);
+    table->num_tombstones = 0;
+    synchronize(table);
+    slots_free(old);
+    return SOMA_SUCCESS;
+}
+
+/* Makes sure the dense array has room for index slot next_slot,
+ * growing it (and the associated arrays) if needed. Must be called
+ * with the writer mutex held. */
+static soma_return_t reserve_index_slot(soma_collector_table* table)
+{
+    soma_collector_slots* old = table->dense;
+    if(table->next_slot < old->capacity)
+        return SOMA_SUCCESS;
+    if(old->capacity >= SOMA_COLLECTOR_SLOT_NONE)
+        return SOMA_ERR_ALLOCATION;
+
+    size_t capacity = 2 * old->capacity;
+    uint32_t* generations = (uint32_t*)realloc(table->generations,
+            capacity * sizeof(*generations));
+    if(!generations) return SOMA_ERR_ALLOCATION;
+    memset(generations + old->capacity, 0, old->capacity * sizeof(*generations));
+    table->generations = generations;
+
+    uint32_t* free_slots = (uint32_t*)realloc(table->free_slots,
+            capacity * sizeof(*free_slots));
+    if(!free_slots) return SOMA_ERR_ALLOCATION;
+    table->free_slots = free_slots;
+
+    soma_collector_slots* dense = slots_create(capacity);
+    if(!dense) return SOMA_ERR_ALLOCATION;
+    memcpy(dense->slots, old->slots, old->capacity * sizeof(*old->slots));
+
+    __atomic_store_n(&table->dense, dense, __ATOMIC_SEQ_CST);
+    synchronize(table);
+    slots_free(old);
+    return SOMA_SUCCESS;
+}
+
+/* Assigns an index slot and a new generation to the collector and
+ * publishes it in the dense array. Must be called with the writer
+ * mutex held. */
+static soma_return_t assign_index(
+        soma_collector_table* table,
+        soma_collector* collector)
+{
+    uint32_t slot;
+    if(table->num_free_slots) {
+        slot = table->free_slots[--table->num_free_slots];
+    } else {
+        soma_return_t ret = reserve_index_slot(table);
+        if(ret != SOMA_SUCCESS) return ret;
+        slot = (uint32_t)table->next_slot;
+        __atomic_store_n(&table->next_slot, table->next_slot + 1, __ATOMIC_RELEASE);
+    }
+    table->generations[slot] += 1;
+    collector->index.slot       = slot;
+    collector->index.generation = table->generations[slot];
+    __atomic_store_n(&table->dense->slots[slot], collector, __ATOMIC_RELEASE);
+    return SOMA_SUCCESS;
+}
+
+soma_return_t soma_collector_table_init(soma_collector_table* table)
+{
+    memset(table, 0, sizeof(*table));
+    table->data  = slots_create(INITIAL_CAPACITY);
+    table->dense = slots_create(INITIAL_CAPACITY);
+    table->generations = (uint32_t*)calloc(INITIAL_CAPACITY, sizeof(uint32_t));
+    table->free_slots  = (uint32_t*)calloc(INITIAL_CAPACITY, sizeof(uint32_t));
+    if(!table->data || !table->dense || !table->generations || !table->free_slots) {
+        soma_collector_table_finalize(table);
+        return SOMA_ERR_ALLOCATION;
+    }
+    if(ABT_mutex_create(&table->writer_mtx) != ABT_SUCCESS) {
+        soma_collector_table_finalize(table);
+        return SOMA_ERR_FROM_ARGOBOTS;
+    }
+    return SOMA_SUCCESS;
+}
+
+void soma_collector_table_finalize(soma_collector_table* table)
+{
+    slots_free(table->data);
+    slots_free(table->dense);
+    free(table->generations);
+    free(table->free_slots);
+    table->data        = NULL;
+    table->dense       = NULL;
+    table->generations = NULL;
+    table->free_slots  = NULL;
+    if(table->writer_mtx != ABT_MUTEX_NULL)
+        ABT_mutex_free(&table->writer_mtx);
+}
+
+soma_collector* soma_collector_table_find(
+        soma_collector_table* table,
+        const soma_collector_id_t* id)
+{
+    soma_collector_slots* data = __atomic_load_n(&table->data, __ATOMIC_SEQ_CST);
+    ssize_t i = find_slot(data, id);
+    if(i < 0) return NULL;
+    soma_collector* c = __atomic_load_n(&data->slots[i], __ATOMIC_ACQUIRE);
+    return c == TOMBSTONE ? NULL : c;
+}
+
+soma_collector* soma_collector_table_find_by_index(
+        soma_collector_table* table,
+        soma_collector_index_t index)
+{
+    soma_collector_slots* dense = __atomic_load_n(&table->dense, __ATOMIC_SEQ_CST);
+    if(index.slot >= dense->capacity)
+        return NULL;
+    soma_collector* c = __atomic_load_n(&dense->slots[index.slot], __ATOMIC_ACQUIRE);
+    if(!c || c->index.generation != index.generation)
+        return NULL;
+    return c;
+}
+
+soma_return_t soma_collector_table_add(
+        soma_collector_table* table,
+        soma_collector* collector)
+{
+    soma_return_t ret = SOMA_SUCCESS;
+    ABT_mutex_lock(table->writer_mtx);
+
+    if(find_slot(table->data, &collector->id) >= 0) {
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto finish;
+    }
+
+    /* keep the load factor (including tombstones) under 1/2 */
+    if(2 * (table->num_collectors + table->num_tombstones + 1) > table->data->capacity) {
+        ret = rebuild(table);
+        if(ret != SOMA_SUCCESS) goto finish;
+    }
+
+    ret = assign_index(table, collector);
+    if(ret != SOMA_SUCCESS) goto finish;
+
+    insert_slot(table->data, collector);
+    __atomic_add_fetch(&table->num_collectors, 1, __ATOMIC_RELAXED);
+
+finish:
+    ABT_mutex_unlock(table->writer_mtx);
+    return ret;
+}
+
+soma_collector* soma_collector_table_remove(
+        soma_collector_table* table,
+        const soma_collector_id_t* id)
+{
+    soma_collector* collector = NULL;
+    ABT_mutex_lock(table->writer_mtx);
+
+    ssize_t i = find_slot(table->data, id);
+    if(i >= 0) {
+        collector = table->data->slots[i];
+        __atomic_store_n(&table->data->slots[i], TOMBSTONE, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&table->dense->slots[collector->index.slot], NULL, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(&table->num_collectors, 1, __ATOMIC_RELAXED);
+        table->num_tombstones += 1;
+        synchronize(table);
+        table->free_slots[table->num_free_slots++] = collector->index.slot;
+    }
+
+    ABT_mutex_unlock(table->writer_mtx);
+    return collector;
+}
+
+void soma_collector_table_clear(
+        soma_collector_table* table,
+        void (*fn)(soma_collector*))
+{
+    ABT_mutex_lock(table->writer_mtx);
+
+    soma_collector_slots* old = table->data;
+    soma_collector_slots* data = slots_create(INITIAL_CAPACITY);
+    if(data) {
+        __atomic_store_n(&table->data, data, __ATOMIC_SEQ_CST);
+        size_t i;
+        for(i = 0; i < table->next_slot; i++) {
+            if(table->dense->slots[i])
+                table->free_slots[table->num_free_slots++] = (uint32_t)i;
+            __atomic_store_n(&table->dense->slots[i], NULL, __ATOMIC_SEQ_CST);
+        }
+        table->num_collectors = 0;
+        table->num_tombstones = 0;
+        synchronize(table);
+        for(i = 0; i < old->capacity; i++) {
+            soma_collector* c = old->slots[i];
+            if(c && c != TOMBSTONE)
+                fn(c);
+        }
+        slots_free(old);
+    }
+
+    ABT_mutex_unlock(table->writer_mtx);
+}
+
+void soma_collector_table_iterate(
+        soma_collector_table* table,
+        int (*fn)(soma_collector*, void*),
+        void* uargs)
+{
+    soma_collector_slots* data = __atomic_load_n(&table->data, __ATOMIC_SEQ_CST);
+    size_t i;
+    for(i = 0; i < data->capacity; i++) {
+        soma_collector* c = __atomic_load_n(&data->slots[i], __ATOMIC_ACQUIRE);
+        if(c && c != TOMBSTONE)
+            if(fn(c, uargs)) return;
+    }
+}
+
+void soma_collector_table_scan(
+        soma_collector_table* table,
+        uint64_t* cursor,
+        size_t max_slots,
+        int (*fn)(soma_collector*, void*),
+        void* uargs)
+{
+    soma_collector_slots* dense = __atomic_load_n(&table->dense, __ATOMIC_SEQ_CST);
+    size_t end = __atomic_load_n(&table->next_slot, __ATOMIC_ACQUIRE);
+    if(end > dense->capacity) end = dense->capacity;
+    uint64_t i = *cursor;
+    if(max_slots < end && i < end - max_slots)
+        end = i + max_slots;
+    for(; i < end; i++) {
+        soma_collector* c = __atomic_load_n(&dense->slots[i], __ATOMIC_ACQUIRE);
+        if(c && fn(c, uargs)) {
+            *cursor = i;
+            return;
+        }
+    }
+    *cursor = i < __atomic_load_n(&table->next_slot, __ATOMIC_ACQUIRE) ? i : 0;
+}
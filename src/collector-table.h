@@ -0,0 +1,124 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _COLLECTOR_TABLE_H
+#define _COLLECTOR_TABLE_H
+
+#include <margo.h>
+#include "soma/soma-common.h"
+
+struct soma_collector;
+
+/*
+ * Open-addressing hash table of collectors, keyed by collector id.
+ *
+ * Lookups do not take any lock: readers only announce themselves in
+ * one of two reader counters (read_lock/read_unlock) for the duration
+ * during which they use the collector they found. Writers (add/remove)
+ * are serialized by a mutex and never free anything a reader may still
+ * see: removed collectors and replaced slot arrays are only handed back
+ * or freed after a grace period, i.e. once every reader that started
+ * before the removal has left its read-side critical section.
+ *
+ * Each collector is also assigned a slot in a dense array, along with
+ * a generation number that is incremented every time the slot is
+ * reused, so that it can be found with a single array access.
+ */
+
+typedef struct soma_collector_slots {
+    size_t                  capacity; // number of slots (power of 2)
+    struct soma_collector** slots;    // NULL (empty), tombstone, or collector
+} soma_collector_slots;
+
+typedef struct soma_collector_table {
+    soma_collector_slots* data;           // current slots (swapped atomically)
+    soma_collector_slots* dense;          // collectors by index slot (swapped atomically)
+    uint32_t*             generations;    // current generation of each index slot
+    uint32_t*             free_slots;     // index slots available for reuse
+    size_t                num_free_slots; // number of index slots available for reuse
+    size_t                next_slot;      // first index slot never used so far
+    size_t                num_collectors; // number of live entries
+    size_t                num_tombstones; // number of deleted entries
+    ABT_mutex             writer_mtx;     // serializes writers
+    uint64_t              epoch;          // parity selects the reader counter
+    uint64_t              readers[2];     // readers per epoch parity
+} soma_collector_table;
+
+soma_return_t soma_collector_table_init(soma_collector_table* table);
+
+void soma_collector_table_finalize(soma_collector_table* table);
+
+/* Enters a read-side critical section; the returned value must be
+ * passed to soma_collector_table_read_unlock. */
+static inline unsigned soma_collector_table_read_lock(soma_collector_table* table)
+{
+    unsigned e = __atomic_load_n(&table->epoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_add_fetch(&table->readers[e], 1, __ATOMIC_SEQ_CST);
+    return e;
+}
+
+static inline void soma_collector_table_read_unlock(soma_collector_table* table, unsigned e)
+{
+    __atomic_sub_fetch(&table->readers[e], 1, __ATOMIC_RELEASE);
+}
+
+/* Finds a collector; must be called in a read-side critical section
+ * and the result must not be used after leaving it. */
+struct soma_collector* soma_collector_table_find(
+        soma_collector_table* table,
+        const soma_collector_id_t* id);
+
+/* Finds a collector by index; must be called in a read-side critical
+ * section. Returns NULL if the slot is empty or the generation does not
+ * match that of the collector occupying the slot. */
+struct soma_collector* soma_collector_table_find_by_index(
+        soma_collector_table* table,
+        soma_collector_index_t index);
+
+/* Adds a collector and sets its index. Returns SOMA_ERR_INVALID_COLLECTOR
+ * if a collector with the same id already exists. */
+soma_return_t soma_collector_table_add(
+        soma_collector_table* table,
+        struct soma_collector* collector);
+
+/* Removes a collector and returns it once no reader can still be using
+ * it, or returns NULL if it does not exist. The caller owns the result. */
+struct soma_collector* soma_collector_table_remove(
+        soma_collector_table* table,
+        const soma_collector_id_t* id);
+
+/* Removes all the collectors, calling the provided function on each of
+ * them once no reader can still be using them. */
+void soma_collector_table_clear(
+        soma_collector_table* table,
+        void (*fn)(struct soma_collector*));
+
+/* Calls fn on every collector, stopping early if it returns non-zero;
+ * must be called in a read-side critical section. */
+void soma_collector_table_iterate(
+        soma_collector_table* table,
+        int (*fn)(struct soma_collector*, void*),
+        void* uargs);
+
+/* Calls fn on the collectors occupying index slots *cursor to
+ * *cursor + max_slots - 1, in slot order, stopping early if it returns
+ * non-zero. On return, *cursor is the first slot to visit next (the one
+ * fn stopped at, if it did), or 0 if there is none. Since collectors
+ * keep their slot, one that remains in the table from the first call
+ * (with *cursor = 0) until the scan ends is visited exactly once.
+ * Must be called in a read-side critical section. */
+void soma_collector_table_scan(
+        soma_collector_table* table,
+        uint64_t* cursor,
+        size_t max_slots,
+        int (*fn)(struct soma_collector*, void*),
+        void* uargs);
+
+static inline size_t soma_collector_table_size(soma_collector_table* table)
+{
+    return __atomic_load_n(&table->num_collectors, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -11,12 +11,14 @@
 
 typedef struct dummy_context {
     struct json_object* config;
+    uint64_t            num_samples;
     /* ... */
 } dummy_context;
 
 static soma_return_t dummy_create_collector(
         soma_provider_t provider,
         const char* config_str,
+        soma_arena_t arena,
         void** context)
 {
     (void)provider;
@@ -42,7 +44,11 @@ static soma_return_t dummy_create_collector(
         config = json_object_new_object();
     }
 
-    dummy_context* ctx = (dummy_context*)calloc(1, sizeof(*ctx));
+    dummy_context* ctx = (dummy_context*)soma_arena_calloc(arena, sizeof(*ctx));
+    if(!ctx) {
+        json_object_put(config);
+        return SOMA_ERR_ALLOCATION;
+    }
     ctx->config = config;
     *context = (void*)ctx;
     return SOMA_SUCCESS;
@@ -51,6 +57,7 @@ static soma_return_t dummy_create_collector(
 static soma_return_t dummy_open_collector(
         soma_provider_t provider,
         const char* config_str,
+        soma_arena_t arena,
         void** context)
 {
     (void)provider;
@@ -77,7 +84,11 @@ static soma_return_t dummy_open_collector(
         config = json_object_new_object();
     }
 
-    dummy_context* ctx = (dummy_context*)calloc(1, sizeof(*ctx));
+    dummy_context* ctx = (dummy_context*)soma_arena_calloc(arena, sizeof(*ctx));
+    if(!ctx) {
+        json_object_put(config);
+        return SOMA_ERR_ALLOCATION;
+    }
     ctx->config = config;
     *context = (void*)ctx;
     return SOMA_SUCCESS;
@@ -86,16 +97,16 @@ static soma_return_t dummy_open_collector(
 static soma_return_t dummy_close_collector(void* ctx)
 {
     dummy_context* context = (dummy_context*)ctx;
+    /* the context goes away with the arena */
     json_object_put(context->config);
-    free(context);
     return SOMA_SUCCESS;
 }
 
 static soma_return_t dummy_destroy_collector(void* ctx)
 {
     dummy_context* context = (dummy_context*)ctx;
+    /* the context goes away with the arena */
     json_object_put(context->config);
-    free(context);
     return SOMA_SUCCESS;
 }
 
@@ -112,16 +123,50 @@ static int32_t dummy_compute_sum(void* ctx, int32_t x, int32_t y)
     return x+y;
 }
 
+static soma_return_t dummy_ingest(void* ctx, const soma_batch_t* batch)
+{
+    dummy_context* context = (dummy_context*)ctx;
+    __atomic_add_fetch(&context->num_samples, batch->count, __ATOMIC_RELAXED);
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t dummy_query(
+        void* ctx,
+        const soma_query_t* query,
+        uint64_t* timestamps,
+        double* values,
+        size_t* count)
+{
+    (void)ctx;
+    (void)query;
+    (void)timestamps;
+    (void)values;
+    /* the dummy backend does not keep any sample */
+    *count = 0;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t dummy_flush(void* ctx)
+{
+    (void)ctx;
+    return SOMA_SUCCESS;
+}
+
 static soma_backend_impl dummy_backend = {
     .name             = "dummy",
 
-    .create_collector  = dummy_create_collector,
-    .open_collector    = dummy_open_collector,
     .close_collector   = dummy_close_collector,
     .destroy_collector = dummy_destroy_collector,
 
+    .create_collector_in_arena = dummy_create_collector,
+    .open_collector_in_arena   = dummy_open_collector,
+
     .hello            = dummy_say_hello,
-    .sum              = dummy_compute_sum
+    .sum              = dummy_compute_sum,
+
+    .ingest           = dummy_ingest,
+    .query            = dummy_query,
+    .flush            = dummy_flush
 };
 
 soma_return_t soma_provider_register_dummy_backend(soma_provider_t provider)
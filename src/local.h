@@ -0,0 +1,50 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _LOCAL_H
+#define _LOCAL_H
+
+#include "soma/soma-common.h"
+#include "soma/soma-backend.h"
+#include "types.h"
+#include "query.h"
+
+/*
+ * Entry points of a provider that clients sharing its margo instance
+ * call directly instead of sending RPCs, skipping serialization and
+ * Mercury altogether. The provider attaches this table, as registered
+ * data, to a "soma_local" RPC id that has no handler; clients look it
+ * up by provider id. Each function resolves the collector from ref
+ * exactly as the corresponding RPC handler would and, on success,
+ * returns the collector's index in *index. The functions run in the
+ * caller's ULT rather than in the provider's pools.
+ */
+typedef struct soma_local_ops {
+    void* provider;
+    soma_return_t (*hello)(void* provider,
+            const soma_collector_ref_t* ref,
+            soma_collector_index_t* index);
+    soma_return_t (*sum)(void* provider,
+            const soma_collector_ref_t* ref,
+            int32_t x, int32_t y, int32_t* result,
+            soma_collector_index_t* index);
+    soma_return_t (*publish_batch)(void* provider,
+            const soma_collector_ref_t* ref,
+            const soma_batch_t* batch,
+            soma_collector_index_t* index);
+    soma_return_t (*get_aggregates)(void* provider,
+            const soma_collector_ref_t* ref,
+            size_t count, const uint64_t* series,
+            soma_aggregate_t* aggregates,
+            soma_collector_index_t* index);
+    soma_return_t (*query)(void* provider,
+            const soma_collector_ref_t* ref,
+            const soma_query_params* params,
+            soma_sample_t* results, size_t* count,
+            soma_query_cursor_t* next,
+            soma_collector_index_t* index);
+} soma_local_ops;
+
+#endif
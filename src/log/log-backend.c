@@ -0,0 +1,168 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <json-c/json.h>
+#include "soma/soma-backend.h"
+#include "../provider.h"
+#include "../wal.h"
+#include "log-backend.h"
+
+/*
+ * The log backend appends every batch of samples it receives to a
+ * write-ahead log (see wal.h) in the directory given by the "path"
+ * field of its configuration, which also holds the log's other
+ * settings. Nothing is kept in memory, so opening an existing log does
+ * not replay it: new records simply go to a new segment.
+ */
+
+typedef struct log_context {
+    margo_instance_id   mid;
+    struct json_object* config;
+    soma_wal_config     wal_config; // points into config
+    soma_wal*           wal;
+} log_context;
+
+static soma_return_t read_config(
+        soma_provider_t provider,
+        const char* config_str,
+        log_context** context)
+{
+    struct json_object* config = NULL;
+
+    if(!config_str || !strlen(config_str)) {
+        margo_error(provider->mid, "Log backend requires a configuration with a \"path\"");
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    struct json_tokener*    tokener = json_tokener_new();
+    enum json_tokener_error jerr;
+    config = json_tokener_parse_ex(tokener, config_str, strlen(config_str));
+    if(!config) {
+        jerr = json_tokener_get_error(tokener);
+        margo_error(provider->mid, "JSON parse error: %s",
+                  json_tokener_error_desc(jerr));
+        json_tokener_free(tokener);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    json_tokener_free(tokener);
+
+    log_context* ctx = (log_context*)calloc(1, sizeof(*ctx));
+    if(!ctx) {
+        json_object_put(config);
+        return SOMA_ERR_ALLOCATION;
+    }
+    ctx->mid    = provider->mid;
+    ctx->config = config;
+    soma_return_t ret = soma_wal_read_config(provider->mid, config, &ctx->wal_config);
+    if(ret != SOMA_SUCCESS) {
+        json_object_put(config);
+        free(ctx);
+        return ret;
+    }
+    *context = ctx;
+    return SOMA_SUCCESS;
+}
+
+static void free_context(log_context* ctx)
+{
+    json_object_put(ctx->config);
+    free(ctx);
+}
+
+static soma_return_t log_create_collector(
+        soma_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    log_context* ctx = NULL;
+    soma_return_t ret = read_config(provider, config_str, &ctx);
+    if(ret != SOMA_SUCCESS) return ret;
+    ret = soma_wal_create(provider->mid, provider->abtio, &ctx->wal_config, &ctx->wal);
+    if(ret != SOMA_SUCCESS) {
+        free_context(ctx);
+        return ret;
+    }
+    *context = (void*)ctx;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t log_open_collector(
+        soma_provider_t provider,
+        const char* config_str,
+        void** context)
+{
+    log_context* ctx = NULL;
+    soma_return_t ret = read_config(provider, config_str, &ctx);
+    if(ret != SOMA_SUCCESS) return ret;
+    ret = soma_wal_open(provider->mid, provider->abtio, &ctx->wal_config,
+                        ABT_POOL_NULL, NULL, NULL, &ctx->wal);
+    if(ret != SOMA_SUCCESS) {
+        free_context(ctx);
+        return ret;
+    }
+    *context = (void*)ctx;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t log_close_collector(void* c)
+{
+    log_context* ctx = (log_context*)c;
+    soma_wal_close(ctx->wal);
+    free_context(ctx);
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t log_destroy_collector(void* c)
+{
+    log_context* ctx = (log_context*)c;
+    soma_return_t ret = soma_wal_destroy(ctx->wal);
+    free_context(ctx);
+    return ret;
+}
+
+static void log_say_hello(void* c)
+{
+    log_context* ctx = (log_context*)c;
+    printf("Hello World from Log collector (%s)\n", ctx->wal_config.path);
+}
+
+static int32_t log_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+static soma_return_t log_ingest(void* ctx, const soma_batch_t* batch)
+{
+    return soma_wal_append(((log_context*)ctx)->wal, batch);
+}
+
+static soma_return_t log_flush(void* ctx)
+{
+    return soma_wal_sync(((log_context*)ctx)->wal);
+}
+
+static soma_backend_impl log_backend = {
+    .name             = "log",
+
+    .create_collector  = log_create_collector,
+    .open_collector    = log_open_collector,
+    .close_collector   = log_close_collector,
+    .destroy_collector = log_destroy_collector,
+
+    .hello            = log_say_hello,
+    .sum              = log_compute_sum,
+
+    .ingest           = log_ingest,
+    .query            = NULL,
+    .flush            = log_flush
+};
+
+soma_return_t soma_provider_register_log_backend(soma_provider_t provider)
+{
+    return soma_provider_register_backend(provider, &log_backend);
+}
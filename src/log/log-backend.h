@@ -0,0 +1,13 @@
+/*
+ * (C) 2020 The University of Chicago
+ * 
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _LOG_BACKEND_H
+#define _LOG_BACKEND_H
+
+#include "soma/soma-server.h"
+
+soma_return_t soma_provider_register_log_backend(soma_provider_t provider);
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "provider.h"
+#include "backend-compat.h"
+#include "arena.h"
+#include "memory.h"
+
+struct spill_args {
+    soma_provider_t     provider;
+    soma_collector_id_t id;
+};
+
+static inline int over(size_t used, size_t limit)
+{
+    return limit && used > limit;
+}
+
+/* Usage above which samples are refused even if the collector can spill */
+static inline size_t hard_limit(size_t limit)
+{
+    return limit + limit / 4;
+}
+
+/* Usage to which spilling brings a collector back */
+static inline size_t low_watermark(size_t limit)
+{
+    return limit - limit / 4;
+}
+
+static inline int can_spill(soma_provider_t provider, soma_collector* collector)
+{
+    return collector->fn->spill
+        && provider->memory.spill_path
+        && provider->abtio != ABT_IO_INSTANCE_NULL;
+}
+
+static soma_return_t read_limit(
+        soma_provider_t provider,
+        struct json_object* memory,
+        const char* name,
+        size_t* limit)
+{
+    struct json_object* val = NULL;
+    if(!json_object_object_get_ex(memory, name, &val))
+        return SOMA_SUCCESS;
+    if(!json_object_is_type(val, json_type_int) || json_object_get_int64(val) < 0) {
+        margo_error(provider->mid, "\"%s\" should be a non-negative number of bytes", name);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    *limit = (size_t)json_object_get_int64(val);
+    return SOMA_SUCCESS;
+}
+
+soma_return_t soma_memory_init(
+        soma_provider_t provider,
+        ABT_pool pool)
+{
+    soma_memory* mem = &provider->memory;
+    struct json_object* memory = NULL;
+    struct json_object* path = NULL;
+    if(pool == ABT_POOL_NULL)
+        margo_get_handler_pool(provider->mid, &pool);
+    mem->pool = pool;
+    if(!json_object_object_get_ex(provider->config, "memory", &memory))
+        return SOMA_SUCCESS;
+    if(!json_object_is_type(memory, json_type_object)) {
+        margo_error(provider->mid, "\"memory\" should be an object");
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    soma_return_t ret = read_limit(provider, memory, "collector_limit", &mem->collector_limit);
+    if(ret == SOMA_SUCCESS)
+        ret = read_limit(provider, memory, "provider_limit", &mem->provider_limit);
+    if(ret != SOMA_SUCCESS)
+        return ret;
+    if(json_object_object_get_ex(memory, "spill_path", &path)) {
+        if(!json_object_is_type(path, json_type_string)) {
+            margo_error(provider->mid, "\"spill_path\" should be a string");
+            return SOMA_ERR_INVALID_CONFIG;
+        }
+        mem->spill_path = strdup(json_object_get_string(path));
+        if(!mem->spill_path) return SOMA_ERR_ALLOCATION;
+        if(provider->abtio == ABT_IO_INSTANCE_NULL)
+            margo_warning(provider->mid,
+                "Provider has a spill_path but no ABT-IO instance, collectors will not spill");
+    }
+    return SOMA_SUCCESS;
+}
+
+void soma_memory_finalize(soma_provider_t provider)
+{
+    soma_memory* mem = &provider->memory;
+    while(__atomic_load_n(&mem->num_running, __ATOMIC_ACQUIRE))
+        ABT_thread_yield();
+    free(mem->spill_path);
+    mem->spill_path = NULL;
+}
+
+/* Number of bytes the collector should move out of memory */
+static size_t bytes_to_spill(soma_memory* mem, soma_collector* collector)
+{
+    size_t used  = soma_arena_used(collector->arena);
+    size_t total = __atomic_load_n(&mem->used, __ATOMIC_RELAXED);
+    size_t bytes = 0;
+    if(over(used, mem->collector_limit))
+        bytes = used - low_watermark(mem->collector_limit);
+    if(over(total, mem->provider_limit) && total - low_watermark(mem->provider_limit) > bytes)
+        bytes = total - low_watermark(mem->provider_limit);
+    return bytes < used ? bytes : used;
+}
+
+static void spill_ult(void* a)
+{
+    struct spill_args* args = (struct spill_args*)a;
+    soma_provider_t provider = args->provider;
+    soma_memory* mem = &provider->memory;
+
+    /* the collector cannot go away while we spill it */
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* collector = soma_collector_table_find(&provider->collectors, &args->id);
+    if(collector) {
+        size_t bytes = bytes_to_spill(mem, collector);
+        char id_str[37];
+        soma_collector_id_to_string(collector->id, id_str);
+        size_t path_len = strlen(mem->spill_path) + sizeof("/soma-.spill") + 36;
+        char* path = (char*)malloc(path_len);
+        if(bytes && path) {
+            snprintf(path, path_len, "%s/soma-%s.spill", mem->spill_path, id_str);
+            size_t spilled = 0;
+            soma_return_t ret = collector->fn->spill(collector->ctx, path, bytes, &spilled);
+            __atomic_add_fetch(&collector->spilled, spilled, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&mem->spilled, spilled, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&mem->num_spills, 1, __ATOMIC_RELAXED);
+            if(ret != SOMA_SUCCESS)
+                margo_error(provider->mid, "Could not spill collector %s (error %d)", id_str, ret);
+            else
+                margo_debug(provider->mid, "Spilled %lu of %lu bytes of collector %s",
+                            spilled, bytes, id_str);
+        }
+        free(path);
+        __atomic_store_n(&collector->spilling, 0, __ATOMIC_RELEASE);
+    }
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+
+    free(args);
+    __atomic_sub_fetch(&mem->num_running, 1, __ATOMIC_RELEASE);
+}
+
+/* Starts a spill ULT for the collector, unless one is running already */
+static void start_spill(soma_provider_t provider, soma_collector* collector)
+{
+    soma_memory* mem = &provider->memory;
+    int expected = 0;
+    if(!__atomic_compare_exchange_n(&collector->spilling, &expected, 1,
+                                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+    struct spill_args* args = (struct spill_args*)malloc(sizeof(*args));
+    if(args) {
+        args->provider = provider;
+        args->id       = collector->id;
+        __atomic_add_fetch(&mem->num_running, 1, __ATOMIC_ACQ_REL);
+        if(ABT_thread_create(mem->pool, spill_ult, args, ABT_THREAD_ATTR_NULL, NULL) == ABT_SUCCESS)
+            return;
+        __atomic_sub_fetch(&mem->num_running, 1, __ATOMIC_RELEASE);
+        free(args);
+    }
+    margo_error(provider->mid, "Could not start spilling a collector");
+    __atomic_store_n(&collector->spilling, 0, __ATOMIC_RELEASE);
+}
+
+struct largest_args {
+    soma_provider_t provider;
+    soma_collector* largest;
+    size_t          used;
+};
+
+static int largest_fn(soma_collector* collector, void* uargs)
+{
+    struct largest_args* args = (struct largest_args*)uargs;
+    if(__atomic_load_n(&collector->state, __ATOMIC_ACQUIRE) != SOMA_COLLECTOR_OPEN
+    || !can_spill(args->provider, collector))
+        return 0;
+    size_t used = soma_arena_used(collector->arena);
+    if(used > args->used) {
+        args->largest = collector;
+        args->used    = used;
+    }
+    return 0;
+}
+
+soma_return_t soma_memory_ingest(
+        soma_provider_t provider,
+        soma_collector* collector,
+        const soma_batch_t* batch)
+{
+    soma_memory* mem = &provider->memory;
+    if(!mem->collector_limit && !mem->provider_limit)
+        return soma_backend_ingest(collector->fn, collector->ctx, batch);
+
+    size_t used  = soma_arena_used(collector->arena);
+    size_t total = __atomic_load_n(&mem->used, __ATOMIC_RELAXED);
+    int spill = can_spill(provider, collector);
+    if(over(used, mem->collector_limit) || over(total, mem->provider_limit)) {
+        if(!spill
+        || over(used, hard_limit(mem->collector_limit))
+        || over(total, hard_limit(mem->provider_limit))) {
+            __atomic_add_fetch(&mem->num_rejected, 1, __ATOMIC_RELAXED);
+            margo_debug(provider->mid, "Refusing %lu samples: memory budget exceeded",
+                        batch->count);
+            return SOMA_ERR_MEMORY_LIMIT;
+        }
+    }
+
+    soma_return_t ret = soma_backend_ingest(collector->fn, collector->ctx, batch);
+    if(ret != SOMA_SUCCESS)
+        return ret;
+
+    used  = soma_arena_used(collector->arena);
+    total = __atomic_load_n(&mem->used, __ATOMIC_RELAXED);
+    if(spill && over(used, mem->collector_limit)) {
+        start_spill(provider, collector);
+    } else if(over(total, mem->provider_limit)) {
+        /* relieve the provider by spilling its largest collector */
+        struct largest_args args = { provider, NULL, 0 };
+        soma_collector_table_iterate(&provider->collectors, largest_fn, &args);
+        if(args.largest)
+            start_spill(provider, args.largest);
+    }
+    return SOMA_SUCCESS;
+}
+
+static int collector_to_json(soma_collector* collector, void* uargs)
+{
+    struct json_object* collectors = (struct json_object*)uargs;
+    struct json_object* obj = json_object_new_object();
+    char id_str[37];
+    soma_collector_id_to_string(collector->id, id_str);
+    json_object_object_add(obj, "type", json_object_new_string(collector->fn->name));
+    json_object_object_add(obj, "used",
+            json_object_new_int64((int64_t)soma_arena_used(collector->arena)));
+    json_object_object_add(obj, "reserved",
+            json_object_new_int64((int64_t)soma_arena_reserved(collector->arena)));
+    json_object_object_add(obj, "spilled",
+            json_object_new_int64((int64_t)__atomic_load_n(&collector->spilled, __ATOMIC_RELAXED)));
+    json_object_object_add(collectors, id_str, obj);
+    return 0;
+}
+
+struct json_object* soma_memory_to_json(soma_provider_t provider)
+{
+    soma_memory* mem = &provider->memory;
+    struct json_object* obj = json_object_new_object();
+    if(!obj) return NULL;
+    json_object_object_add(obj, "used",
+            json_object_new_int64((int64_t)__atomic_load_n(&mem->used, __ATOMIC_RELAXED)));
+    json_object_object_add(obj, "collector_limit", json_object_new_int64((int64_t)mem->collector_limit));
+    json_object_object_add(obj, "provider_limit", json_object_new_int64((int64_t)mem->provider_limit));
+    if(mem->spill_path)
+        json_object_object_add(obj, "spill_path", json_object_new_string(mem->spill_path));
+    json_object_object_add(obj, "spills",
+            json_object_new_int64((int64_t)__atomic_load_n(&mem->num_spills, __ATOMIC_RELAXED)));
+    json_object_object_add(obj, "spilled",
+            json_object_new_int64((int64_t)__atomic_load_n(&mem->spilled, __ATOMIC_RELAXED)));
+    json_object_object_add(obj, "rejected",
+            json_object_new_int64((int64_t)__atomic_load_n(&mem->num_rejected, __ATOMIC_RELAXED)));
+    struct json_object* collectors = json_object_new_object();
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector_table_iterate(&provider->collectors, collector_to_json, collectors);
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+    json_object_object_add(obj, "collectors", collectors);
+    return obj;
+}
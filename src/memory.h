@@ -0,0 +1,59 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _MEMORY_H
+#define _MEMORY_H
+
+#include <margo.h>
+#include <json-c/json.h>
+#include "soma/soma-backend.h"
+
+struct soma_provider;
+struct soma_collector;
+
+/*
+ * Memory budgets of a provider. The arenas of the collectors count the
+ * bytes they hold into "used", and the provider checks the budgets of
+ * the "memory" section of its configuration (see soma-server.h) around
+ * every batch it hands to a collector:
+ * - before the batch, a collector over its budget is refused it if it
+ *   cannot spill, or if it is over by more than a quarter;
+ * - after the batch, a collector over its budget (or whose provider is
+ *   over its own) gets a spill ULT, unless one is already running for
+ *   it, which asks the backend to bring it back to 3/4 of the budget.
+ */
+
+typedef struct soma_memory {
+    size_t   collector_limit;  // per collector, 0 for no limit
+    size_t   provider_limit;   // for all the collectors, 0 for no limit
+    char*    spill_path;       // directory of the spill files, NULL if none
+    ABT_pool pool;             // where spill ULTs run
+    size_t   used;             // bytes used by the collectors (atomic)
+    uint64_t num_spills;       // spill passes completed (atomic)
+    uint64_t spilled;          // bytes moved out of memory (atomic)
+    uint64_t num_rejected;     // batches refused (atomic)
+    size_t   num_running;      // spill ULTs running (atomic)
+} soma_memory;
+
+/* Parses the "memory" section of the provider's configuration, if any;
+ * spill ULTs will run in the given pool (the handler pool if ABT_POOL_NULL). */
+soma_return_t soma_memory_init(
+        struct soma_provider* provider,
+        ABT_pool pool);
+
+/* Waits for the spill ULTs to complete and frees the configuration. */
+void soma_memory_finalize(struct soma_provider* provider);
+
+/* Hands a batch to a collector, enforcing the memory budgets; must be
+ * called in a read-side critical section of the collector table. */
+soma_return_t soma_memory_ingest(
+        struct soma_provider* provider,
+        struct soma_collector* collector,
+        const soma_batch_t* batch);
+
+/* Builds the JSON document returned by soma_get_memory_usage. */
+struct json_object* soma_memory_to_json(struct soma_provider* provider);
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _PACKED_H
+#define _PACKED_H
+
+#include <stdint.h>
+#include <string.h>
+#include "soma/soma-backend.h"
+
+/*
+ * Compact encoding of a batch of samples for the wire, exploiting the
+ * regularity of telemetry streams: consecutive samples tend to come
+ * from the same few series, at a fixed period, with values that change
+ * little. The encoding is the number of samples followed by its three
+ * columns, one after the other:
+ * - series: difference with the previous sample's series;
+ * - timestamps: first timestamp, then difference between the first two,
+ *   then difference between consecutive differences (delta-of-delta),
+ *   which is 0 for periodic samples;
+ * - values: bits of the value XORed with those of the previous value,
+ *   as a control byte followed by the bytes between the leading and
+ *   trailing zero bytes of the XOR (a single 0 byte if the value did
+ *   not change).
+ * Counts and differences are varints (7 bits per byte, low bits first),
+ * differences being zigzag-encoded so that small negative ones are short.
+ */
+
+/* Largest encoding of a batch of count samples */
+#define SOMA_PACKED_MAX_SIZE(count) (10 + (count) * (10 + 10 + 9))
+
+/* Differences are computed modulo 2^64, their top bit being their sign,
+ * so that no signed arithmetic (and no overflow) is involved */
+static inline uint64_t soma_zigzag(uint64_t v)
+{
+    return (v << 1) ^ (0 - (v >> 63));
+}
+
+static inline uint64_t soma_unzigzag(uint64_t v)
+{
+    return (v >> 1) ^ (0 - (v & 1));
+}
+
+static inline size_t soma_put_varint(uint8_t* p, uint64_t v)
+{
+    size_t n = 0;
+    while(v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+/* Reads a varint from [*p, end), advancing *p; returns 0 if it is truncated */
+static inline int soma_get_varint(const uint8_t** p, const uint8_t* end, uint64_t* v)
+{
+    uint64_t r = 0;
+    unsigned shift;
+    for(shift = 0; shift < 64 && *p < end; shift += 7) {
+        uint8_t b = *(*p)++;
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)) {
+            *v = r;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Encodes a batch into buf, which must hold SOMA_PACKED_MAX_SIZE(batch->count)
+ * bytes; returns the size of the encoding */
+static inline size_t soma_packed_encode(const soma_batch_t* batch, uint8_t* buf)
+{
+    size_t i, n = soma_put_varint(buf, batch->count);
+
+    uint64_t prev = 0;
+    for(i = 0; i < batch->count; i++) {
+        n += soma_put_varint(buf + n, soma_zigzag(batch->series[i] - prev));
+        prev = batch->series[i];
+    }
+
+    uint64_t prev_ts = 0;
+    uint64_t prev_delta = 0;
+    for(i = 0; i < batch->count; i++) {
+        uint64_t ts = batch->timestamps[i];
+        if(i == 0) {
+            n += soma_put_varint(buf + n, ts);
+        } else {
+            uint64_t delta = ts - prev_ts;
+            n += soma_put_varint(buf + n, soma_zigzag(delta - prev_delta));
+            prev_delta = delta;
+        }
+        prev_ts = ts;
+    }
+
+    uint64_t prev_bits = 0;
+    for(i = 0; i < batch->count; i++) {
+        uint64_t bits;
+        memcpy(&bits, &batch->values[i], sizeof(bits));
+        uint64_t x = bits ^ prev_bits;
+        prev_bits = bits;
+        if(x == 0) {
+            buf[n++] = 0;
+            continue;
+        }
+        unsigned lead  = (unsigned)__builtin_clzll(x) / 8;
+        unsigned trail = (unsigned)__builtin_ctzll(x) / 8;
+        buf[n++] = (uint8_t)(0x80 | (lead << 3) | trail);
+        int b;
+        for(b = 7 - (int)lead; b >= (int)trail; b--)
+            buf[n++] = (uint8_t)(x >> (8 * b));
+    }
+    return n;
+}
+
+/* Reads the number of samples of an encoding; returns 0 if the encoding
+ * is truncated or cannot hold that many samples */
+static inline int soma_packed_count(const uint8_t* buf, size_t size, uint64_t* count)
+{
+    const uint8_t* p = buf;
+    if(!soma_get_varint(&p, buf + size, count))
+        return 0;
+    /* every sample takes at least 3 bytes */
+    return *count <= (size - (size_t)(p - buf)) / 3;
+}
+
+/* Decodes an encoding into columns of soma_packed_count samples;
+ * returns 0 if the encoding is invalid */
+static inline int soma_packed_decode(
+        const uint8_t* buf, size_t size,
+        uint64_t* series, uint64_t* timestamps, double* values)
+{
+    const uint8_t* p = buf;
+    const uint8_t* end = buf + size;
+    uint64_t count, v, i;
+    if(!soma_get_varint(&p, end, &count))
+        return 0;
+
+    uint64_t prev = 0;
+    for(i = 0; i < count; i++) {
+        if(!soma_get_varint(&p, end, &v)) return 0;
+        series[i] = prev = prev + soma_unzigzag(v);
+    }
+
+    uint64_t prev_ts = 0;
+    uint64_t delta = 0;
+    for(i = 0; i < count; i++) {
+        if(!soma_get_varint(&p, end, &v)) return 0;
+        if(i == 0) {
+            prev_ts = v;
+        } else {
+            delta += soma_unzigzag(v);
+            prev_ts += delta;
+        }
+        timestamps[i] = prev_ts;
+    }
+
+    uint64_t bits = 0;
+    for(i = 0; i < count; i++) {
+        if(p == end) return 0;
+        uint8_t ctrl = *p++;
+        if(ctrl) {
+            unsigned lead  = (ctrl >> 3) & 7;
+            unsigned trail = ctrl & 7;
+            if(!(ctrl & 0x80) || lead + trail > 7
+            || (size_t)(end - p) < 8 - lead - trail) return 0;
+            uint64_t x = 0;
+            int b;
+            for(b = 7 - (int)lead; b >= (int)trail; b--)
+                x |= (uint64_t)(*p++) << (8 * b);
+            bits ^= x;
+        }
+        memcpy(&values[i], &bits, sizeof(bits));
+    }
+    return p == end;
+}
+
+#endif
@@ -6,25 +6,91 @@
 #include "soma/soma-server.h"
 #include "provider.h"
 #include "types.h"
+#include "backend-compat.h"
+#include "arena.h"
+#include "memory.h"
+#include "query.h"
 
 // backends that we want to add at compile time
 #include "dummy/dummy-backend.h"
+#include "timeseries/timeseries-backend.h"
+#include "log/log-backend.h"
+
+#define DEFAULT_CATALOG_OPEN_THREADS 4
+/* bounds on the work done by a single list_collectors RPC */
+#define LIST_COLLECTORS_MAX_PAGE  65536  // ids returned
+#define LIST_COLLECTORS_MAX_SCAN  262144 // index slots visited
 
 static void soma_finalize_provider(void* p);
 
-/* Functions to manipulate the hash of collectors */
+/* Functions to manipulate the table of collectors
+ * (find_collector must be called in a read-side critical section,
+ * which it may leave and enter again, updating *epoch) */
 static inline soma_collector* find_collector(
         soma_provider_t provider,
-        const soma_collector_id_t* id);
+        const soma_collector_id_t* id,
+        unsigned* epoch);
+
+static inline soma_collector* find_collector_by_ref(
+        soma_provider_t provider,
+        const soma_collector_ref_t* ref,
+        unsigned* epoch);
 
 static inline soma_return_t add_collector(
         soma_provider_t provider,
         soma_collector* collector);
 
+/* Function making sure a collector restored from the catalog is open
+ * (returns NULL if collector is NULL, could not be opened, or was removed
+ * meanwhile); opening happens outside the caller's read-side critical
+ * section, which is entered again before returning */
+static soma_collector* collector_ready(
+        soma_provider_t provider,
+        soma_collector* collector,
+        unsigned* epoch);
+
+/* Waits until no ULT opening the collector still references it */
+static void collector_wait_unpinned(soma_collector* collector);
+
+/* Functions to restore the collectors of the catalog named in the
+ * configuration: open_catalog opens it, restore_collectors adds the
+ * collectors of a backend type to the provider as that type is
+ * registered, and start_restore opens them in the background */
+static soma_return_t open_catalog(
+        soma_provider_t provider,
+        size_t* num_threads);
+
+static soma_return_t restore_collectors(
+        soma_provider_t provider,
+        soma_backend_impl* backend);
+
+static soma_return_t start_restore(
+        soma_provider_t provider,
+        size_t num_threads);
+
+static void stop_restore(soma_provider_t provider);
+
+/* Functions to allocate and free a collector along with its arena and
+ * its aggregator */
+static soma_collector* collector_alloc(
+        soma_provider_t provider,
+        soma_backend_impl* backend,
+        soma_collector_id_t id);
+
+static void collector_free(soma_collector* collector);
+
+/* Creates or opens the backend context of a collector, in its arena if
+ * the backend supports it */
+static soma_return_t collector_create_context(
+        soma_provider_t provider,
+        soma_collector* collector,
+        const char* config,
+        int open);
+
 static inline soma_return_t remove_collector(
         soma_provider_t provider,
         const soma_collector_id_t* id,
-        int close_collector);
+        int destroy_collector);
 
 static inline void remove_all_collectors(
         soma_provider_t provider);
@@ -38,6 +104,27 @@ static inline soma_return_t add_backend_impl(
         soma_provider_t provider,
         soma_backend_impl* backend);
 
+static inline size_t string_size(const char* str)
+{
+    return str ? strlen(str) : 0;
+}
+
+/* Function to parse the JSON configuration of the provider */
+static inline soma_return_t parse_config(
+        margo_instance_id mid,
+        const char* config_str,
+        struct json_object** config);
+
+/* Function to select the pool of a class of ULTs from the arguments,
+ * the "pools" section of the configuration, or the default pool
+ * (which must not be ABT_POOL_NULL) */
+static inline ABT_pool select_pool(
+        margo_instance_id mid,
+        struct json_object* config,
+        const char* name,
+        ABT_pool arg_pool,
+        ABT_pool default_pool);
+
 /* Function to check the validity of the token sent by an admin
  * (returns 0 is the token is incorrect) */
 static inline int check_token(
@@ -55,12 +142,54 @@ static DECLARE_MARGO_RPC_HANDLER(soma_destroy_collector_ult)
 static void soma_destroy_collector_ult(hg_handle_t h);
 static DECLARE_MARGO_RPC_HANDLER(soma_list_collectors_ult)
 static void soma_list_collectors_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(soma_get_stats_ult)
+static void soma_get_stats_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(soma_get_memory_ult)
+static void soma_get_memory_ult(hg_handle_t h);
 
 /* Client RPCs */
 static DECLARE_MARGO_RPC_HANDLER(soma_hello_ult)
 static void soma_hello_ult(hg_handle_t h);
 static DECLARE_MARGO_RPC_HANDLER(soma_sum_ult)
 static void soma_sum_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(soma_publish_batch_ult)
+static void soma_publish_batch_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(soma_publish_packed_ult)
+static void soma_publish_packed_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(soma_publish_aggregates_ult)
+static void soma_publish_aggregates_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(soma_get_aggregates_ult)
+static void soma_get_aggregates_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(soma_query_ult)
+static void soma_query_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(soma_shm_attach_ult)
+static void soma_shm_attach_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(soma_shm_detach_ult)
+static void soma_shm_detach_ult(hg_handle_t h);
+
+/* functions called directly by clients in the same process (see local.h) */
+static soma_return_t soma_local_hello(void* p,
+        const soma_collector_ref_t* ref,
+        soma_collector_index_t* index);
+static soma_return_t soma_local_sum(void* p,
+        const soma_collector_ref_t* ref,
+        int32_t x, int32_t y, int32_t* result,
+        soma_collector_index_t* index);
+static soma_return_t soma_local_publish_batch(void* p,
+        const soma_collector_ref_t* ref,
+        const soma_batch_t* batch,
+        soma_collector_index_t* index);
+static soma_return_t soma_local_get_aggregates(void* p,
+        const soma_collector_ref_t* ref,
+        size_t count, const uint64_t* series,
+        soma_aggregate_t* aggregates,
+        soma_collector_index_t* index);
+static soma_return_t soma_local_query(void* p,
+        const soma_collector_ref_t* ref,
+        const soma_query_params* params,
+        soma_sample_t* results, size_t* count,
+        soma_query_cursor_t* next,
+        soma_collector_index_t* index);
 
 /* add other RPC declarations here */
 
@@ -96,63 +225,207 @@ int soma_provider_register(
         return SOMA_ERR_ALLOCATION;
     }
 
+    if(parse_config(mid, a.config, &p->config) != SOMA_SUCCESS) {
+        free(p);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+
+    /* classes without a pool of their own run in args->pool,
+     * itself margo's handler pool when not provided */
+    if(a.pool == ABT_POOL_NULL)
+        margo_get_handler_pool(mid, &a.pool);
+
     p->mid = mid;
     p->provider_id = provider_id;
-    p->pool = a.pool;
+    p->admin_pool  = select_pool(mid, p->config, "admin", a.admin_pool, a.pool);
+    p->ingest_pool = select_pool(mid, p->config, "ingest", a.ingest_pool, a.pool);
+    p->query_pool  = select_pool(mid, p->config, "query", a.query_pool, a.pool);
     p->abtio = a.abtio;
     p->token = (a.token && strlen(a.token)) ? strdup(a.token) : NULL;
 
+    if(soma_collector_table_init(&p->collectors) != SOMA_SUCCESS) {
+        margo_error(mid, "Could not initialize table of collectors");
+        json_object_put(p->config);
+        free(p->token);
+        free(p);
+        return SOMA_ERR_ALLOCATION;
+    }
+
+    p->stats = soma_stats_create();
+    if(!p->stats) {
+        margo_error(mid, "Could not allocate provider statistics");
+        soma_collector_table_finalize(&p->collectors);
+        json_object_put(p->config);
+        free(p->token);
+        free(p);
+        return SOMA_ERR_ALLOCATION;
+    }
+
+    if(ABT_mutex_create(&p->shm_mtx) != ABT_SUCCESS) {
+        margo_error(mid, "Could not create mutex");
+        soma_stats_free(p->stats);
+        soma_collector_table_finalize(&p->collectors);
+        json_object_put(p->config);
+        free(p->token);
+        free(p);
+        return SOMA_ERR_FROM_ARGOBOTS;
+    }
+
     /* Admin RPCs */
     id = MARGO_REGISTER_PROVIDER(mid, "soma_create_collector",
             create_collector_in_t, create_collector_out_t,
-            soma_create_collector_ult, provider_id, p->pool);
+            soma_create_collector_ult, provider_id, p->admin_pool);
     margo_register_data(mid, id, (void*)p, NULL);
     p->create_collector_id = id;
 
     id = MARGO_REGISTER_PROVIDER(mid, "soma_open_collector",
             open_collector_in_t, open_collector_out_t,
-            soma_open_collector_ult, provider_id, p->pool);
+            soma_open_collector_ult, provider_id, p->admin_pool);
     margo_register_data(mid, id, (void*)p, NULL);
     p->open_collector_id = id;
 
     id = MARGO_REGISTER_PROVIDER(mid, "soma_close_collector",
             close_collector_in_t, close_collector_out_t,
-            soma_close_collector_ult, provider_id, p->pool);
+            soma_close_collector_ult, provider_id, p->admin_pool);
     margo_register_data(mid, id, (void*)p, NULL);
     p->close_collector_id = id;
 
     id = MARGO_REGISTER_PROVIDER(mid, "soma_destroy_collector",
             destroy_collector_in_t, destroy_collector_out_t,
-            soma_destroy_collector_ult, provider_id, p->pool);
+            soma_destroy_collector_ult, provider_id, p->admin_pool);
     margo_register_data(mid, id, (void*)p, NULL);
     p->destroy_collector_id = id;
 
     id = MARGO_REGISTER_PROVIDER(mid, "soma_list_collectors",
             list_collectors_in_t, list_collectors_out_t,
-            soma_list_collectors_ult, provider_id, p->pool);
+            soma_list_collectors_ult, provider_id, p->admin_pool);
     margo_register_data(mid, id, (void*)p, NULL);
     p->list_collectors_id = id;
 
+    id = MARGO_REGISTER_PROVIDER(mid, "soma_get_provider_stats",
+            get_stats_in_t, get_stats_out_t,
+            soma_get_stats_ult, provider_id, p->admin_pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->get_stats_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "soma_get_memory_usage",
+            get_stats_in_t, get_stats_out_t,
+            soma_get_memory_ult, provider_id, p->admin_pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->get_memory_id = id;
+
     /* Client RPCs */
 
     id = MARGO_REGISTER_PROVIDER(mid, "soma_hello",
             hello_in_t, void,
-            soma_hello_ult, provider_id, p->pool);
+            soma_hello_ult, provider_id, p->ingest_pool);
     margo_register_data(mid, id, (void*)p, NULL);
     p->hello_id = id;
     margo_registered_disable_response(mid, id, HG_TRUE);
 
     id = MARGO_REGISTER_PROVIDER(mid, "soma_sum",
             sum_in_t, sum_out_t,
-            soma_sum_ult, provider_id, p->pool);
+            soma_sum_ult, provider_id, p->ingest_pool);
     margo_register_data(mid, id, (void*)p, NULL);
     p->sum_id = id;
 
+    id = MARGO_REGISTER_PROVIDER(mid, "soma_publish_batch",
+            publish_batch_in_t, publish_batch_out_t,
+            soma_publish_batch_ult, provider_id, p->ingest_pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->publish_batch_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "soma_publish_packed",
+            publish_packed_in_t, publish_batch_out_t,
+            soma_publish_packed_ult, provider_id, p->ingest_pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->publish_packed_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "soma_publish_aggregates",
+            publish_aggregates_in_t, publish_aggregates_out_t,
+            soma_publish_aggregates_ult, provider_id, p->ingest_pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->publish_aggregates_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "soma_get_aggregates",
+            get_aggregates_in_t, get_aggregates_out_t,
+            soma_get_aggregates_ult, provider_id, p->query_pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->get_aggregates_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "soma_query",
+            query_in_t, query_out_t,
+            soma_query_ult, provider_id, p->query_pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->query_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "soma_shm_attach",
+            shm_attach_in_t, shm_attach_out_t,
+            soma_shm_attach_ult, provider_id, p->ingest_pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->shm_attach_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "soma_shm_detach",
+            shm_detach_in_t, shm_detach_out_t,
+            soma_shm_detach_ult, provider_id, p->ingest_pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->shm_detach_id = id;
+
+    /* no handler: this id only lets clients of the same margo
+     * instance find the provider's entry points */
+    p->local.provider       = p;
+    p->local.hello          = soma_local_hello;
+    p->local.sum            = soma_local_sum;
+    p->local.publish_batch  = soma_local_publish_batch;
+    p->local.get_aggregates = soma_local_get_aggregates;
+    p->local.query          = soma_local_query;
+    id = margo_provider_register_name(mid, "soma_local",
+            NULL, NULL, NULL, provider_id, ABT_POOL_NULL);
+    margo_register_data(mid, id, (void*)&p->local, NULL);
+    p->local_id = id;
+
     /* add other RPC registration here */
     /* ... */
 
+    /* read the memory budgets; spill ULTs run in the "spill" pool */
+    ABT_pool spill_pool = select_pool(mid, p->config, "spill", ABT_POOL_NULL, a.pool);
+    soma_return_t ret = soma_memory_init(p, spill_pool);
+    if(ret != SOMA_SUCCESS) {
+        margo_error(mid, "Could not read the memory budgets");
+        soma_finalize_provider(p);
+        return ret;
+    }
+
+    /* open the catalog of collectors if the configuration has one,
+     * its collectors are restored as their backend types get registered */
+    size_t num_restore_threads = 0;
+    ret = open_catalog(p, &num_restore_threads);
+    if(ret != SOMA_SUCCESS) {
+        margo_error(mid, "Could not open the catalog of collectors");
+        soma_finalize_provider(p);
+        return ret;
+    }
+
     /* add backends available at compiler time (e.g. default/dummy backends) */
     soma_provider_register_dummy_backend(p); // function from "dummy/dummy-backend.h"
+    soma_provider_register_timeseries_backend(p); // function from "timeseries/timeseries-backend.h"
+    soma_provider_register_log_backend(p); // function from "log/log-backend.h"
+
+    ret = start_restore(p, num_restore_threads);
+    if(ret != SOMA_SUCCESS) {
+        margo_error(mid, "Could not start opening the collectors of the catalog");
+        soma_finalize_provider(p);
+        return ret;
+    }
+
+    /* start forwarding aggregates if the configuration has an upstream */
+    ABT_pool upstream_pool = select_pool(mid, p->config, "upstream", ABT_POOL_NULL, a.pool);
+    ret = soma_upstream_start(p, upstream_pool);
+    if(ret != SOMA_SUCCESS) {
+        margo_error(mid, "Could not set up forwarding to the upstream provider");
+        soma_finalize_provider(p);
+        return ret;
+    }
 
     margo_provider_push_finalize_callback(mid, p, &soma_finalize_provider, p);
 
@@ -166,17 +439,42 @@ static void soma_finalize_provider(void* p)
 {
     soma_provider_t provider = (soma_provider_t)p;
     margo_info(provider->mid, "Finalizing SOMA provider");
+    margo_deregister(provider->mid, provider->local_id);
+    stop_restore(provider);
+    soma_shm_channel_close_all(provider);
+    soma_upstream_stop(provider);
     margo_deregister(provider->mid, provider->create_collector_id);
     margo_deregister(provider->mid, provider->open_collector_id);
     margo_deregister(provider->mid, provider->close_collector_id);
     margo_deregister(provider->mid, provider->destroy_collector_id);
     margo_deregister(provider->mid, provider->list_collectors_id);
+    margo_deregister(provider->mid, provider->get_stats_id);
+    margo_deregister(provider->mid, provider->get_memory_id);
     margo_deregister(provider->mid, provider->hello_id);
     margo_deregister(provider->mid, provider->sum_id);
+    margo_deregister(provider->mid, provider->publish_batch_id);
+    margo_deregister(provider->mid, provider->publish_packed_id);
+    margo_deregister(provider->mid, provider->publish_aggregates_id);
+    margo_deregister(provider->mid, provider->get_aggregates_id);
+    margo_deregister(provider->mid, provider->query_id);
+    margo_deregister(provider->mid, provider->shm_attach_id);
+    margo_deregister(provider->mid, provider->shm_detach_id);
     /* deregister other RPC ids ... */
+    soma_memory_finalize(provider);
     remove_all_collectors(provider);
+    soma_collector_table_finalize(&provider->collectors);
+    if(provider->catalog)
+        soma_catalog_close(provider->catalog);
+    if(provider->catalog_mtx != ABT_MUTEX_NULL)
+        ABT_mutex_free(&provider->catalog_mtx);
+    if(provider->restore_mtx != ABT_MUTEX_NULL)
+        ABT_mutex_free(&provider->restore_mtx);
+    free(provider->restored_ids);
+    soma_stats_free(provider->stats);
+    ABT_mutex_free(&provider->shm_mtx);
     free(provider->backend_types);
     free(provider->token);
+    json_object_put(provider->config);
     margo_instance_id mid = provider->mid;
     free(provider);
     margo_info(mid, "SOMA provider successfuly finalized");
@@ -201,7 +499,10 @@ soma_return_t soma_provider_register_backend(
 {
     margo_info(provider->mid, "Adding backend implementation \"%s\" to SOMA provider",
              backend_impl->name);
-    return add_backend_impl(provider, backend_impl);
+    soma_return_t ret = add_backend_impl(provider, backend_impl);
+    if(ret == SOMA_SUCCESS && provider->catalog)
+        ret = restore_collectors(provider, backend_impl);
+    return ret;
 }
 
 static void soma_create_collector_ult(hg_handle_t h)
@@ -210,6 +511,8 @@ static void soma_create_collector_ult(hg_handle_t h)
     soma_return_t ret;
     create_collector_in_t  in;
     create_collector_out_t out;
+    out.index.slot = SOMA_COLLECTOR_SLOT_NONE;
+    out.index.generation = 0;
 
     /* find the margo instance */
     margo_instance_id mid = margo_hg_handle_get_instance(h);
@@ -218,6 +521,11 @@ static void soma_create_collector_ult(hg_handle_t h)
     const struct hg_info* info = margo_get_info(h);
     soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
 
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_CREATE_COLLECTOR, provider->admin_pool, &timer);
+
     /* deserialize the input */
     hret = margo_get_input(h, &in);
     if(hret != HG_SUCCESS) {
@@ -226,6 +534,8 @@ static void soma_create_collector_ult(hg_handle_t h)
         goto finish;
     }
 
+    bytes_in = string_size(in.type) + string_size(in.config);
+
     /* check the token sent by the admin */
     if(!check_token(provider, in.token)) {
         margo_error(provider->mid, "Invalid token");
@@ -245,25 +555,47 @@ static void soma_create_collector_ult(hg_handle_t h)
     soma_collector_id_t id;
     uuid_generate(id.uuid);
 
-    /* create the new collector's context */
-    void* context = NULL;
-    ret = backend->create_collector(provider, in.config, &context);
+    /* allocate a collector and create its context */
+    soma_collector* collector = collector_alloc(provider, backend, id);
+    if(!collector) {
+        margo_error(provider->mid, "Could not allocate collector");
+        out.ret = SOMA_ERR_ALLOCATION;
+        goto finish;
+    }
+    ret = collector_create_context(provider, collector, in.config, 0);
     if(ret != SOMA_SUCCESS) {
         out.ret = ret;
         margo_error(provider->mid, "Could not create collector, backend returned %d", ret);
+        collector_free(collector);
         goto finish;
     }
 
-    /* allocate a collector, set it up, and add it to the provider */
-    soma_collector* collector = (soma_collector*)calloc(1, sizeof(*collector));
-    collector->fn  = backend;
-    collector->ctx = context;
-    collector->id  = id;
-    add_collector(provider, collector);
+    /* add the collector to the provider */
+    ret = add_collector(provider, collector);
+    if(ret != SOMA_SUCCESS) {
+        margo_error(provider->mid, "Could not add collector to the provider");
+        backend->close_collector(collector->ctx);
+        collector_free(collector);
+        out.ret = ret;
+        goto finish;
+    }
+    soma_collector_index_t index = collector->index;
+
+    /* record the collector so it is restored on restart */
+    if(provider->catalog) {
+        ret = soma_catalog_add(provider->catalog, &id, in.type, in.config);
+        if(ret != SOMA_SUCCESS) {
+            margo_error(provider->mid, "Could not add collector to the catalog");
+            remove_collector(provider, &id, 1);
+            out.ret = ret;
+            goto finish;
+        }
+    }
 
     /* set the response */
     out.ret = SOMA_SUCCESS;
     out.id = id;
+    out.index = index;
 
     char id_str[37];
     soma_collector_id_to_string(id, id_str);
@@ -271,6 +603,7 @@ static void soma_create_collector_ult(hg_handle_t h)
 
 finish:
     hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
     hret = margo_free_input(h, &in);
     margo_destroy(h);
 }
@@ -282,6 +615,9 @@ static void soma_open_collector_ult(hg_handle_t h)
     soma_return_t ret;
     open_collector_in_t  in;
     open_collector_out_t out;
+    out.index.slot = SOMA_COLLECTOR_SLOT_NONE;
+    out.index.generation = 0;
+    int catalog_locked = 0;
 
     /* find the margo instance */
     margo_instance_id mid = margo_hg_handle_get_instance(h);
@@ -290,6 +626,11 @@ static void soma_open_collector_ult(hg_handle_t h)
     const struct hg_info* info = margo_get_info(h);
     soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
 
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_OPEN_COLLECTOR, provider->admin_pool, &timer);
+
     /* deserialize the input */
     hret = margo_get_input(h, &in);
     if(hret != HG_SUCCESS) {
@@ -298,6 +639,8 @@ static void soma_open_collector_ult(hg_handle_t h)
         goto finish;
     }
 
+    bytes_in = string_size(in.type) + string_size(in.config);
+
     /* check the token sent by the admin */
     if(!check_token(provider, in.token)) {
         margo_error(mid, "Invalid token");
@@ -313,36 +656,83 @@ static void soma_open_collector_ult(hg_handle_t h)
         goto finish;
     }
 
-    /* create a uuid for the new collector */
+    /* with a catalog, opening the same type and configuration again
+     * gives back the collector it already has */
+    if(provider->catalog) {
+        ABT_mutex_lock(provider->catalog_mtx);
+        catalog_locked = 1;
+    }
     soma_collector_id_t id;
+    if(provider->catalog
+    && soma_catalog_find(provider->catalog, in.type, in.config, &id)) {
+        unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+        soma_collector* collector = find_collector(provider, &id, &epoch);
+        if(collector) {
+            out.ret = SOMA_SUCCESS;
+            out.id = id;
+            out.index = collector->index;
+        } else {
+            margo_error(mid, "Collector of the catalog could not be opened");
+            out.ret = SOMA_ERR_INVALID_COLLECTOR;
+        }
+        soma_collector_table_read_unlock(&provider->collectors, epoch);
+        goto finish;
+    }
+
+    /* create a uuid for the new collector */
     uuid_generate(id.uuid);
 
-    /* create the new collector's context */
-    void* context = NULL;
-    ret = backend->open_collector(provider, in.config, &context);
+    /* allocate a collector and open its context */
+    soma_collector* collector = collector_alloc(provider, backend, id);
+    if(!collector) {
+        margo_error(provider->mid, "Could not allocate collector");
+        out.ret = SOMA_ERR_ALLOCATION;
+        goto finish;
+    }
+    ret = collector_create_context(provider, collector, in.config, 1);
     if(ret != SOMA_SUCCESS) {
         margo_error(mid, "Backend failed to open collector");
+        collector_free(collector);
         out.ret = ret;
         goto finish;
     }
 
-    /* allocate a collector, set it up, and add it to the provider */
-    soma_collector* collector = (soma_collector*)calloc(1, sizeof(*collector));
-    collector->fn  = backend;
-    collector->ctx = context;
-    collector->id  = id;
-    add_collector(provider, collector);
+    /* add the collector to the provider */
+    ret = add_collector(provider, collector);
+    if(ret != SOMA_SUCCESS) {
+        margo_error(provider->mid, "Could not add collector to the provider");
+        backend->close_collector(collector->ctx);
+        collector_free(collector);
+        out.ret = ret;
+        goto finish;
+    }
+    soma_collector_index_t index = collector->index;
+
+    /* record the collector so it is restored on restart */
+    if(provider->catalog) {
+        ret = soma_catalog_add(provider->catalog, &id, in.type, in.config);
+        if(ret != SOMA_SUCCESS) {
+            margo_error(mid, "Could not add collector to the catalog");
+            remove_collector(provider, &id, 0);
+            out.ret = ret;
+            goto finish;
+        }
+    }
 
     /* set the response */
     out.ret = SOMA_SUCCESS;
     out.id = id;
+    out.index = index;
 
     char id_str[37];
     soma_collector_id_to_string(id, id_str);
     margo_debug(mid, "Created collector %s of type \"%s\"", id_str, in.type);
 
 finish:
+    if(catalog_locked)
+        ABT_mutex_unlock(provider->catalog_mtx);
     hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
     hret = margo_free_input(h, &in);
     margo_destroy(h);
 }
@@ -362,6 +752,11 @@ static void soma_close_collector_ult(hg_handle_t h)
     const struct hg_info* info = margo_get_info(h);
     soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
 
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_CLOSE_COLLECTOR, provider->admin_pool, &timer);
+
     /* deserialize the input */
     hret = margo_get_input(h, &in);
     if(hret != HG_SUCCESS) {
@@ -370,6 +765,8 @@ static void soma_close_collector_ult(hg_handle_t h)
         goto finish;
     }
 
+    bytes_in = sizeof(in.id);
+
     /* check the token sent by the admin */
     if(!check_token(provider, in.token)) {
         margo_error(mid, "Invalid token");
@@ -377,9 +774,11 @@ static void soma_close_collector_ult(hg_handle_t h)
         goto finish;
     }
 
-    /* remove the collector from the provider 
-     * (its close function will be called) */
-    ret = remove_collector(provider, &in.id, 1);
+    /* remove the collector from the provider
+     * (its close function will be called once no RPC uses it anymore) */
+    ret = remove_collector(provider, &in.id, 0);
+    if(ret == SOMA_SUCCESS && provider->catalog)
+        ret = soma_catalog_remove(provider->catalog, &in.id);
     out.ret = ret;
 
     char id_str[37];
@@ -388,6 +787,7 @@ static void soma_close_collector_ult(hg_handle_t h)
 
 finish:
     hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
     hret = margo_free_input(h, &in);
     margo_destroy(h);
 }
@@ -406,6 +806,11 @@ static void soma_destroy_collector_ult(hg_handle_t h)
     const struct hg_info* info = margo_get_info(h);
     soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
 
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_DESTROY_COLLECTOR, provider->admin_pool, &timer);
+
     /* deserialize the input */
     hret = margo_get_input(h, &in);
     if(hret != HG_SUCCESS) {
@@ -414,6 +819,8 @@ static void soma_destroy_collector_ult(hg_handle_t h)
         goto finish;
     }
 
+    bytes_in = sizeof(in.id);
+
     /* check the token sent by the admin */
     if(!check_token(provider, in.token)) {
         margo_error(mid, "Invalid token");
@@ -421,25 +828,18 @@ static void soma_destroy_collector_ult(hg_handle_t h)
         goto finish;
     }
 
-    /* find the collector */
-    soma_collector* collector = find_collector(provider, &in.id);
-    if(!collector) {
-        margo_error(mid, "Could not find collector");
-        out.ret = SOMA_ERR_INVALID_COLLECTOR;
-        goto finish;
-    }
-
-    /* destroy the collector's context */
-    collector->fn->destroy_collector(collector->ctx);
-
-    /* remove the collector from the provider 
-     * (its close function will NOT be called) */
-    out.ret = remove_collector(provider, &in.id, 0);
+    /* remove the collector from the provider
+     * (its destroy function will be called once no RPC uses it anymore) */
+    out.ret = remove_collector(provider, &in.id, 1);
+    if(out.ret == SOMA_SUCCESS && provider->catalog)
+        out.ret = soma_catalog_remove(provider->catalog, &in.id);
 
     if(out.ret == SOMA_SUCCESS) {
         char id_str[37];
         soma_collector_id_to_string(in.id, id_str);
         margo_debug(mid, "Destroyed collector with id %s", id_str);
+    } else if(out.ret == SOMA_ERR_INVALID_COLLECTOR) {
+        margo_error(mid, "Could not find collector");
     } else {
         margo_error(mid, "Could not destroy collector, collector may be left in an invalid state");
     }
@@ -447,17 +847,39 @@ static void soma_destroy_collector_ult(hg_handle_t h)
 
 finish:
     hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
     hret = margo_free_input(h, &in);
     margo_destroy(h);
 }
 static DEFINE_MARGO_RPC_HANDLER(soma_destroy_collector_ult)
 
+struct list_collectors_args {
+    list_collectors_out_t* out;
+    size_t                 max_ids;
+    const char*            type; // NULL for all types
+};
+
+static int list_collectors_fn(soma_collector* collector, void* uargs)
+{
+    struct list_collectors_args* args = (struct list_collectors_args*)uargs;
+    if(args->type && strcmp(collector->fn->name, args->type) != 0)
+        return 0;
+    if(args->out->count == args->max_ids)
+        return 1;
+    args->out->ids[args->out->count++] = collector->id;
+    return 0;
+}
+
 static void soma_list_collectors_ult(hg_handle_t h)
 {
     hg_return_t hret;
     list_collectors_in_t  in;
     list_collectors_out_t out;
-    out.ids = NULL;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    out.ids     = NULL;
+    out.count   = 0;
+    out.cursor  = 0;
+    out.in_bulk = 0;
 
     /* find margo instance */
     margo_instance_id mid = margo_hg_handle_get_instance(h);
@@ -466,6 +888,11 @@ static void soma_list_collectors_ult(hg_handle_t h)
     const struct hg_info* info = margo_get_info(h);
     soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
 
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_LIST_COLLECTORS, provider->admin_pool, &timer);
+
     /* deserialize the input */
     hret = margo_get_input(h, &in);
     if(hret != HG_SUCCESS) {
@@ -481,32 +908,197 @@ static void soma_list_collectors_ult(hg_handle_t h)
         goto finish;
     }
 
-    /* allocate array of collector ids */
-    out.ret   = SOMA_SUCCESS;
-    out.count = provider->num_collectors < in.max_ids ? provider->num_collectors : in.max_ids;
-    out.ids   = (soma_collector_id_t*)calloc(provider->num_collectors, sizeof(*out.ids));
+    bytes_in = string_size(in.type);
+    out.in_bulk = in.bulk != HG_BULK_NULL;
+    out.ret     = SOMA_SUCCESS;
+    out.cursor  = in.cursor;
+    if(in.max_ids == 0)
+        goto finish;
+
+    /* allocate array of collector ids, no larger than what the table
+     * holds and than what a single page may hold */
+    size_t max_ids = in.max_ids;
+    size_t num_collectors = soma_collector_table_size(&provider->collectors);
+    if(max_ids > LIST_COLLECTORS_MAX_PAGE) max_ids = LIST_COLLECTORS_MAX_PAGE;
+    if(max_ids > num_collectors) max_ids = num_collectors ? num_collectors : 1;
+    out.ids = (soma_collector_id_t*)calloc(max_ids, sizeof(*out.ids));
+    if(!out.ids) {
+        out.ret = SOMA_ERR_ALLOCATION;
+        goto finish;
+    }
 
-    /* iterate over the hash of collectors to fill the array of collector ids */
-    unsigned i = 0;
-    soma_collector *r, *tmp;
-    HASH_ITER(hh, provider->collectors, r, tmp) {
-        out.ids[i++] = r->id;
+    /* scan the table of collectors from the cursor to fill the array of collector ids */
+    struct list_collectors_args list_args = {
+        &out, max_ids, (in.type && strlen(in.type)) ? in.type : NULL };
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector_table_scan(&provider->collectors, &out.cursor, LIST_COLLECTORS_MAX_SCAN,
+                              list_collectors_fn, &list_args);
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+
+    bytes_out = out.count * sizeof(*out.ids);
+
+    /* large pages go to the caller's bulk region instead of the response */
+    if(out.in_bulk && out.count) {
+        if(margo_bulk_get_size(in.bulk) < bytes_out) {
+            margo_error(mid, "Invalid bulk size for %lu collector ids", in.max_ids);
+            out.ret = SOMA_ERR_INVALID_ARGS;
+            goto finish;
+        }
+        void* buf_ptrs[1]      = { out.ids };
+        hg_size_t buf_sizes[1] = { bytes_out };
+        hret = margo_bulk_create(mid, 1, buf_ptrs, buf_sizes, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret != HG_SUCCESS) {
+            margo_error(mid, "Could not create bulk handle (mercury error %d)", hret);
+            out.ret = SOMA_ERR_FROM_MERCURY;
+            goto finish;
+        }
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0,
+                                   local_bulk, 0, bytes_out);
+        if(hret != HG_SUCCESS) {
+            margo_error(mid, "Could not push collector ids (mercury error %d)", hret);
+            out.ret = SOMA_ERR_FROM_MERCURY;
+            goto finish;
+        }
     }
 
     margo_debug(mid, "Listed collectors");
 
 finish:
     hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
     hret = margo_free_input(h, &in);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
     free(out.ids);
     margo_destroy(h);
 }
 static DEFINE_MARGO_RPC_HANDLER(soma_list_collectors_ult)
 
+static void soma_get_stats_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    get_stats_in_t  in;
+    get_stats_out_t out;
+    out.stats = NULL;
+
+    /* find margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find provider */
+    const struct hg_info* info = margo_get_info(h);
+    soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
+
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_GET_STATS, provider->admin_pool, &timer);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* check the token sent by the admin */
+    if(!check_token(provider, in.token)) {
+        margo_error(mid, "Invalid token");
+        out.ret = SOMA_ERR_INVALID_TOKEN;
+        goto finish;
+    }
+
+    /* take a snapshot of the statistics */
+    struct json_object* json = soma_stats_to_json(provider->stats);
+    if(!json) {
+        out.ret = SOMA_ERR_ALLOCATION;
+        goto finish;
+    }
+    out.stats = strdup(json_object_to_json_string_ext(json, JSON_C_TO_STRING_PLAIN));
+    json_object_put(json);
+    if(!out.stats) {
+        out.ret = SOMA_ERR_ALLOCATION;
+        goto finish;
+    }
+    out.ret   = SOMA_SUCCESS;
+    bytes_out = strlen(out.stats);
+
+    margo_debug(mid, "Sent provider statistics");
+
+finish:
+    hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
+    hret = margo_free_input(h, &in);
+    free(out.stats);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(soma_get_stats_ult)
+
+static void soma_get_memory_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    get_stats_in_t  in;
+    get_stats_out_t out;
+    out.stats = NULL;
+
+    /* find margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find provider */
+    const struct hg_info* info = margo_get_info(h);
+    soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
+
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_GET_MEMORY, provider->admin_pool, &timer);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* check the token sent by the admin */
+    if(!check_token(provider, in.token)) {
+        margo_error(mid, "Invalid token");
+        out.ret = SOMA_ERR_INVALID_TOKEN;
+        goto finish;
+    }
+
+    /* take a snapshot of the accounting */
+    struct json_object* json = soma_memory_to_json(provider);
+    if(!json) {
+        out.ret = SOMA_ERR_ALLOCATION;
+        goto finish;
+    }
+    out.stats = strdup(json_object_to_json_string_ext(json, JSON_C_TO_STRING_PLAIN));
+    json_object_put(json);
+    if(!out.stats) {
+        out.ret = SOMA_ERR_ALLOCATION;
+        goto finish;
+    }
+    out.ret   = SOMA_SUCCESS;
+    bytes_out = strlen(out.stats);
+
+    margo_debug(mid, "Sent memory usage");
+
+finish:
+    hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
+    hret = margo_free_input(h, &in);
+    free(out.stats);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(soma_get_memory_ult)
+
 static void soma_hello_ult(hg_handle_t h)
 {
     hg_return_t hret;
     hello_in_t in;
+    soma_return_t ret = SOMA_SUCCESS;
 
     /* find margo instance */
     margo_instance_id mid = margo_hg_handle_get_instance(h);
@@ -515,18 +1107,26 @@ static void soma_hello_ult(hg_handle_t h)
     const struct hg_info* info = margo_get_info(h);
     soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
 
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_HELLO, provider->ingest_pool, &timer);
+
     /* deserialize the input */
     hret = margo_get_input(h, &in);
     if(hret != HG_SUCCESS) {
         margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        ret = SOMA_ERR_FROM_MERCURY;
         goto finish;
     }
 
-    /* find the collector */
-    soma_collector* collector = find_collector(provider, &in.collector_id);
+    /* find the collector, which remains valid until we leave this section */
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* collector = find_collector_by_ref(provider, &in.ref, &epoch);
     if(!collector) {
         margo_error(mid, "Could not find requested collector");
-        goto finish;
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto unlock;
     }
 
     /* call hello on the collector's context */
@@ -534,7 +1134,12 @@ static void soma_hello_ult(hg_handle_t h)
 
     margo_debug(mid, "Called hello RPC");
 
+unlock:
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
 finish:
+    soma_stats_end(provider->stats, &timer, ret, bytes_in, bytes_out);
+    if(hret == HG_SUCCESS)
+        margo_free_input(h, &in);
     margo_destroy(h);
 }
 static DEFINE_MARGO_RPC_HANDLER(soma_hello_ult)
@@ -544,6 +1149,8 @@ static void soma_sum_ult(hg_handle_t h)
     hg_return_t hret;
     sum_in_t     in;
     sum_out_t   out;
+    out.index.slot = SOMA_COLLECTOR_SLOT_NONE;
+    out.index.generation = 0;
 
     /* find the margo instance */
     margo_instance_id mid = margo_hg_handle_get_instance(h);
@@ -552,6 +1159,11 @@ static void soma_sum_ult(hg_handle_t h)
     const struct hg_info* info = margo_get_info(h);
     soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
 
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_SUM, provider->ingest_pool, &timer);
+
     /* deserialize the input */
     hret = margo_get_input(h, &in);
     if(hret != HG_SUCCESS) {
@@ -560,87 +1172,1012 @@ static void soma_sum_ult(hg_handle_t h)
         goto finish;
     }
 
-    /* find the collector */
-    soma_collector* collector = find_collector(provider, &in.collector_id);
+    /* find the collector, which remains valid until we leave this section */
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* collector = find_collector_by_ref(provider, &in.ref, &epoch);
     if(!collector) {
         margo_error(mid, "Could not find requested collector");
         out.ret = SOMA_ERR_INVALID_COLLECTOR;
-        goto finish;
+        goto unlock;
     }
 
     /* call hello on the collector's context */
     out.result = collector->fn->sum(collector->ctx, in.x, in.y);
     out.ret = SOMA_SUCCESS;
+    out.index = collector->index;
+    bytes_in  = sizeof(in.x) + sizeof(in.y);
+    bytes_out = sizeof(out.result);
 
     margo_debug(mid, "Called sum RPC");
 
+unlock:
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
 finish:
     hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
     hret = margo_free_input(h, &in);
     margo_destroy(h);
 }
 static DEFINE_MARGO_RPC_HANDLER(soma_sum_ult)
 
-static inline soma_collector* find_collector(
-        soma_provider_t provider,
-        const soma_collector_id_t* id)
+static void soma_publish_batch_ult(hg_handle_t h)
 {
-    soma_collector* collector = NULL;
-    HASH_FIND(hh, provider->collectors, id, sizeof(soma_collector_id_t), collector);
-    return collector;
-}
+    hg_return_t hret;
+    publish_batch_in_t  in;
+    publish_batch_out_t out;
+    out.index.slot = SOMA_COLLECTOR_SLOT_NONE;
+    out.index.generation = 0;
+    char* buffer = NULL;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
 
-static inline soma_return_t add_collector(
-        soma_provider_t provider,
-        soma_collector* collector)
-{
-    soma_collector* existing = find_collector(provider, &(collector->id));
-    if(existing) {
-        return SOMA_ERR_INVALID_COLLECTOR;
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
+
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_PUBLISH_BATCH, provider->ingest_pool, &timer);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
     }
-    HASH_ADD(hh, provider->collectors, id, sizeof(soma_collector_id_t), collector);
-    provider->num_collectors += 1;
-    return SOMA_SUCCESS;
-}
 
-static inline soma_return_t remove_collector(
-        soma_provider_t provider,
-        const soma_collector_id_t* id,
-        int close_collector)
-{
-    soma_collector* collector = find_collector(provider, id);
-    if(!collector) {
-        return SOMA_ERR_INVALID_COLLECTOR;
+    /* check that the exposed region matches the announced number of samples,
+     * rejecting counts for which the size of the batch would overflow */
+    const size_t sample_size = 2*sizeof(uint64_t) + sizeof(double);
+    hg_size_t size = in.count * sample_size;
+    if(in.count == 0 || in.count > SIZE_MAX / sample_size
+    || margo_bulk_get_size(in.bulk) != size) {
+        margo_error(mid, "Invalid bulk size for a batch of %lu samples", in.count);
+        out.ret = SOMA_ERR_INVALID_ARGS;
+        goto finish;
     }
-    soma_return_t ret = SOMA_SUCCESS;
-    if(close_collector) {
-        ret = collector->fn->close_collector(collector->ctx);
+
+    /* pull the columns of the batch from the client */
+    buffer = (char*)malloc(size);
+    if(!buffer) {
+        out.ret = SOMA_ERR_ALLOCATION;
+        goto finish;
     }
-    HASH_DEL(provider->collectors, collector);
-    free(collector);
-    provider->num_collectors -= 1;
-    return ret;
-}
 
-static inline void remove_all_collectors(
-        soma_provider_t provider)
-{
-    soma_collector *r, *tmp;
-    HASH_ITER(hh, provider->collectors, r, tmp) {
-        HASH_DEL(provider->collectors, r);
-        r->fn->close_collector(r->ctx);
-        free(r);
+    void* buf_ptrs[1] = { (void*)buffer };
+    hret = margo_bulk_create(mid, 1, buf_ptrs, &size, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not create bulk handle (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
     }
-    provider->num_collectors = 0;
-}
 
-static inline soma_backend_impl* find_backend_impl(
-        soma_provider_t provider,
-        const char* name)
-{
-    size_t i;
-    for(i = 0; i < provider->num_backend_types; i++) {
-        soma_backend_impl* impl = provider->backend_types[i];
+    hret = margo_bulk_transfer(mid, HG_BULK_PULL, info->addr, in.bulk, 0,
+                               local_bulk, 0, size);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not pull samples (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    bytes_in = size;
+
+    /* find the collector, which remains valid until we leave this section */
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* collector = find_collector_by_ref(provider, &in.ref, &epoch);
+    if(!collector) {
+        margo_error(mid, "Could not find requested collector");
+        out.ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto unlock;
+    }
+
+    /* hand the whole batch to the collector, pointing into the pulled buffer */
+    soma_batch_t batch;
+    batch.count      = in.count;
+    batch.series     = (const uint64_t*)buffer;
+    batch.timestamps = (const uint64_t*)buffer + in.count;
+    batch.values     = (const double*)(buffer + 2*in.count*sizeof(uint64_t));
+    out.ret = soma_memory_ingest(provider, collector, &batch);
+    if(out.ret == SOMA_ERR_OP_UNSUPPORTED)
+        margo_error(mid, "Backend \"%s\" does not support publishing samples",
+                    collector->fn->name);
+    if(out.ret == SOMA_SUCCESS && provider->upstream)
+        out.ret = soma_aggregator_add_batch(collector->aggregator, &batch);
+    out.index = collector->index;
+
+    margo_debug(mid, "Called publish_batch RPC with %lu samples", in.count);
+
+unlock:
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+finish:
+    hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
+    hret = margo_free_input(h, &in);
+    margo_bulk_free(local_bulk);
+    free(buffer);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(soma_publish_batch_ult)
+
+static void soma_publish_packed_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    publish_packed_in_t in;
+    publish_batch_out_t out;
+    out.index.slot = SOMA_COLLECTOR_SLOT_NONE;
+    out.index.generation = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
+
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_PUBLISH_PACKED, provider->ingest_pool, &timer);
+
+    /* deserialize (and decompress) the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize input (mercury error %d)", hret);
+        out.ret = hret == HG_INVALID_ARG ? SOMA_ERR_INVALID_ARGS : SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    const soma_batch_t* batch = &in.samples.batch;
+    if(batch->count == 0) {
+        margo_error(mid, "Empty batch of samples");
+        out.ret = SOMA_ERR_INVALID_ARGS;
+        goto finish;
+    }
+    bytes_in = batch->count * (2*sizeof(uint64_t) + sizeof(double));
+
+    /* find the collector, which remains valid until we leave this section */
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* collector = find_collector_by_ref(provider, &in.ref, &epoch);
+    if(!collector) {
+        margo_error(mid, "Could not find requested collector");
+        out.ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto unlock;
+    }
+
+    /* hand the whole batch to the collector */
+    out.ret = soma_memory_ingest(provider, collector, batch);
+    if(out.ret == SOMA_ERR_OP_UNSUPPORTED)
+        margo_error(mid, "Backend \"%s\" does not support publishing samples",
+                    collector->fn->name);
+    if(out.ret == SOMA_SUCCESS && provider->upstream)
+        out.ret = soma_aggregator_add_batch(collector->aggregator, batch);
+    out.index = collector->index;
+
+    margo_debug(mid, "Called publish_packed RPC with %lu samples", batch->count);
+
+unlock:
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+finish:
+    hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(soma_publish_packed_ult)
+
+static void soma_publish_aggregates_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    publish_aggregates_in_t  in;
+    publish_aggregates_out_t out;
+    out.index.slot = SOMA_COLLECTOR_SLOT_NONE;
+    out.index.generation = 0;
+    soma_aggregate_t* aggregates = NULL;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
+
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_PUBLISH_AGGREGATES, provider->ingest_pool, &timer);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* check that the exposed region matches the announced number of aggregates,
+     * rejecting counts for which the size of the aggregates would overflow */
+    hg_size_t size = in.count * sizeof(*aggregates);
+    if(in.count == 0 || in.count > SIZE_MAX / sizeof(*aggregates)
+    || margo_bulk_get_size(in.bulk) != size) {
+        margo_error(mid, "Invalid bulk size for %lu aggregates", in.count);
+        out.ret = SOMA_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    /* pull the aggregates from the downstream provider */
+    aggregates = (soma_aggregate_t*)malloc(size);
+    if(!aggregates) {
+        out.ret = SOMA_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    void* buf_ptrs[1] = { (void*)aggregates };
+    hret = margo_bulk_create(mid, 1, buf_ptrs, &size, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not create bulk handle (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    hret = margo_bulk_transfer(mid, HG_BULK_PULL, info->addr, in.bulk, 0,
+                               local_bulk, 0, size);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not pull aggregates (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    bytes_in = size;
+
+    /* find the collector, which remains valid until we leave this section */
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* collector = find_collector_by_ref(provider, &in.ref, &epoch);
+    if(!collector) {
+        margo_error(mid, "Could not find requested collector");
+        out.ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto unlock;
+    }
+
+    /* merge them, keeping them for the next round if we have an upstream too */
+    int flags = SOMA_AGGREGATE_TOTAL;
+    if(provider->upstream) flags |= SOMA_AGGREGATE_PENDING;
+    out.ret = soma_aggregator_merge(collector->aggregator, aggregates, in.count, flags);
+    out.index = collector->index;
+
+    margo_debug(mid, "Called publish_aggregates RPC with %lu aggregates", in.count);
+
+unlock:
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+finish:
+    hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
+    hret = margo_free_input(h, &in);
+    margo_bulk_free(local_bulk);
+    free(aggregates);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(soma_publish_aggregates_ult)
+
+static void soma_get_aggregates_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    get_aggregates_in_t  in;
+    get_aggregates_out_t out;
+    out.index.slot = SOMA_COLLECTOR_SLOT_NONE;
+    out.index.generation = 0;
+    out.count = 0;
+    out.aggregates = NULL;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
+
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_GET_AGGREGATES, provider->query_pool, &timer);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    bytes_in = in.count * sizeof(*in.series);
+
+    /* find the collector, which remains valid until we leave this section */
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* collector = find_collector_by_ref(provider, &in.ref, &epoch);
+    if(!collector) {
+        margo_error(mid, "Could not find requested collector");
+        out.ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto unlock;
+    }
+
+    out.aggregates = (soma_aggregate_t*)calloc(in.count, sizeof(*out.aggregates));
+    if(in.count && !out.aggregates) {
+        out.ret = SOMA_ERR_ALLOCATION;
+        goto unlock;
+    }
+    size_t i;
+    for(i = 0; i < in.count; i++)
+        soma_aggregator_get(collector->aggregator, in.series[i], &out.aggregates[i]);
+    out.count = in.count;
+    out.ret   = SOMA_SUCCESS;
+    out.index = collector->index;
+    bytes_out = out.count * sizeof(*out.aggregates);
+
+    margo_debug(mid, "Called get_aggregates RPC for %lu series", in.count);
+
+unlock:
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+finish:
+    hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
+    hret = margo_free_input(h, &in);
+    free(out.aggregates);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(soma_get_aggregates_ult)
+
+static void soma_query_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    query_in_t  in;
+    query_out_t out;
+    out.index.slot = SOMA_COLLECTOR_SLOT_NONE;
+    out.index.generation = 0;
+    out.next.series = 0;
+    out.next.offset = 0;
+    out.count = 0;
+    out.results = NULL;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
+
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_QUERY, provider->query_pool, &timer);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    bytes_in = in.count * sizeof(*in.series);
+
+    /* find the collector, which remains valid until we leave this section */
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* collector = find_collector_by_ref(provider, &in.ref, &epoch);
+    if(!collector) {
+        margo_error(mid, "Could not find requested collector");
+        out.ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto unlock;
+    }
+    out.index = collector->index;
+
+    /* evaluate the query next to the data, only the results travel back */
+    soma_query_params params = {
+        in.count, in.series, in.t_start, in.t_end,
+        (soma_aggregation_t)in.aggregation, in.step, in.capacity, in.cursor
+    };
+    size_t count = 0;
+    out.ret = soma_query_collector(collector->fn, collector->ctx,
+                                   &params, &out.results, &count, &out.next);
+    if(out.ret == SOMA_ERR_OP_UNSUPPORTED)
+        margo_error(mid, "Backend \"%s\" does not support queries", collector->fn->name);
+    if(out.ret != SOMA_SUCCESS)
+        goto unlock;
+    out.count = count;
+    bytes_out = out.count * sizeof(*out.results);
+
+    margo_debug(mid, "Called query RPC for %lu series, %lu results", in.count, count);
+
+unlock:
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+finish:
+    hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
+    hret = margo_free_input(h, &in);
+    free(out.results);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(soma_query_ult)
+
+static void soma_shm_attach_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    shm_attach_in_t  in;
+    shm_attach_out_t out;
+    out.channel = 0;
+    out.index.slot = SOMA_COLLECTOR_SLOT_NONE;
+    out.index.generation = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
+
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_SHM_ATTACH, provider->ingest_pool, &timer);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    bytes_in = string_size(in.name);
+
+    /* find the collector; the channel only keeps its id and looks
+     * it up again every time it hands samples over */
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* collector = find_collector_by_ref(provider, &in.ref, &epoch);
+    soma_collector_id_t collector_id;
+    if(collector) {
+        collector_id = collector->id;
+        out.index    = collector->index;
+    }
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+    if(!collector) {
+        margo_error(mid, "Could not find requested collector");
+        out.ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto finish;
+    }
+
+    out.ret = soma_shm_channel_open(provider, &collector_id, in.name, &out.channel);
+    if(out.ret == SOMA_SUCCESS)
+        margo_debug(mid, "Attached shared-memory channel %lu (%s)", out.channel, in.name);
+
+finish:
+    hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(soma_shm_attach_ult)
+
+static void soma_shm_detach_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    shm_detach_in_t  in;
+    shm_detach_out_t out;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    soma_provider_t provider = (soma_provider_t)margo_registered_data(mid, info->id);
+
+    /* time the RPC from here on */
+    soma_rpc_timer timer;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    soma_stats_begin(provider->stats, SOMA_RPC_SHM_DETACH, provider->ingest_pool, &timer);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SOMA_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    bytes_in = sizeof(in.channel);
+
+    /* this returns once every sample written to the ring was ingested */
+    out.ret = soma_shm_channel_close(provider, in.channel);
+    if(out.ret == SOMA_SUCCESS)
+        margo_debug(mid, "Detached shared-memory channel %lu", in.channel);
+
+finish:
+    hret = margo_respond(h, &out);
+    soma_stats_end(provider->stats, &timer, out.ret, bytes_in, bytes_out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(soma_shm_detach_ult)
+
+static soma_return_t soma_local_hello(void* p,
+        const soma_collector_ref_t* ref,
+        soma_collector_index_t* index)
+{
+    soma_provider_t provider = (soma_provider_t)p;
+    soma_return_t ret = SOMA_SUCCESS;
+
+    soma_rpc_timer timer;
+    soma_stats_begin(provider->stats, SOMA_RPC_HELLO, provider->ingest_pool, &timer);
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+
+    soma_collector* collector = find_collector_by_ref(provider, ref, &epoch);
+    if(collector) {
+        collector->fn->hello(collector->ctx);
+        *index = collector->index;
+    } else {
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+    }
+
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+    soma_stats_end(provider->stats, &timer, ret, 0, 0);
+    return ret;
+}
+
+static soma_return_t soma_local_sum(void* p,
+        const soma_collector_ref_t* ref,
+        int32_t x, int32_t y, int32_t* result,
+        soma_collector_index_t* index)
+{
+    soma_provider_t provider = (soma_provider_t)p;
+    soma_return_t ret = SOMA_SUCCESS;
+
+    soma_rpc_timer timer;
+    soma_stats_begin(provider->stats, SOMA_RPC_SUM, provider->ingest_pool, &timer);
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+
+    soma_collector* collector = find_collector_by_ref(provider, ref, &epoch);
+    if(collector) {
+        *result = collector->fn->sum(collector->ctx, x, y);
+        *index  = collector->index;
+    } else {
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+    }
+
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+    soma_stats_end(provider->stats, &timer, ret, 0, 0);
+    return ret;
+}
+
+static soma_return_t soma_local_publish_batch(void* p,
+        const soma_collector_ref_t* ref,
+        const soma_batch_t* batch,
+        soma_collector_index_t* index)
+{
+    soma_provider_t provider = (soma_provider_t)p;
+    soma_return_t ret;
+
+    soma_rpc_timer timer;
+    soma_stats_begin(provider->stats, SOMA_RPC_PUBLISH_BATCH, provider->ingest_pool, &timer);
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+
+    soma_collector* collector = find_collector_by_ref(provider, ref, &epoch);
+    if(!collector) {
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+        goto finish;
+    }
+
+    /* the backend reads the caller's columns in place */
+    ret = soma_memory_ingest(provider, collector, batch);
+    if(ret == SOMA_ERR_OP_UNSUPPORTED)
+        margo_error(provider->mid, "Backend \"%s\" does not support publishing samples",
+                    collector->fn->name);
+    if(ret == SOMA_SUCCESS && provider->upstream)
+        ret = soma_aggregator_add_batch(collector->aggregator, batch);
+    *index = collector->index;
+
+finish:
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+    soma_stats_end(provider->stats, &timer, ret, 0, 0);
+    return ret;
+}
+
+static soma_return_t soma_local_get_aggregates(void* p,
+        const soma_collector_ref_t* ref,
+        size_t count, const uint64_t* series,
+        soma_aggregate_t* aggregates,
+        soma_collector_index_t* index)
+{
+    soma_provider_t provider = (soma_provider_t)p;
+    soma_return_t ret = SOMA_SUCCESS;
+
+    soma_rpc_timer timer;
+    soma_stats_begin(provider->stats, SOMA_RPC_GET_AGGREGATES, provider->query_pool, &timer);
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+
+    soma_collector* collector = find_collector_by_ref(provider, ref, &epoch);
+    if(collector) {
+        size_t i;
+        for(i = 0; i < count; i++)
+            soma_aggregator_get(collector->aggregator, series[i], &aggregates[i]);
+        *index = collector->index;
+    } else {
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+    }
+
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+    soma_stats_end(provider->stats, &timer, ret, 0, 0);
+    return ret;
+}
+
+static soma_return_t soma_local_query(void* p,
+        const soma_collector_ref_t* ref,
+        const soma_query_params* params,
+        soma_sample_t* results, size_t* count,
+        soma_query_cursor_t* next,
+        soma_collector_index_t* index)
+{
+    soma_provider_t provider = (soma_provider_t)p;
+    soma_return_t ret;
+
+    soma_rpc_timer timer;
+    soma_stats_begin(provider->stats, SOMA_RPC_QUERY, provider->query_pool, &timer);
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+
+    soma_collector* collector = find_collector_by_ref(provider, ref, &epoch);
+    if(collector) {
+        /* the results go straight into the caller's array */
+        ret = soma_query_collector(collector->fn, collector->ctx, params,
+                                   &results, count, next);
+        *index = collector->index;
+    } else {
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+    }
+
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+    soma_stats_end(provider->stats, &timer, ret, 0, 0);
+    return ret;
+}
+
+static inline soma_collector* find_collector(
+        soma_provider_t provider,
+        const soma_collector_id_t* id,
+        unsigned* epoch)
+{
+    return collector_ready(provider,
+            soma_collector_table_find(&provider->collectors, id), epoch);
+}
+
+static inline soma_collector* find_collector_by_ref(
+        soma_provider_t provider,
+        const soma_collector_ref_t* ref,
+        unsigned* epoch)
+{
+    if(ref->index.slot != SOMA_COLLECTOR_SLOT_NONE)
+        return collector_ready(provider,
+                soma_collector_table_find_by_index(&provider->collectors, ref->index), epoch);
+    return find_collector(provider, &ref->id, epoch);
+}
+
+static inline soma_return_t add_collector(
+        soma_provider_t provider,
+        soma_collector* collector)
+{
+    return soma_collector_table_add(&provider->collectors, collector);
+}
+
+static inline soma_return_t remove_collector(
+        soma_provider_t provider,
+        const soma_collector_id_t* id,
+        int destroy_collector)
+{
+    /* a restored collector has to be opened to be destroyed */
+    if(destroy_collector) {
+        unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+        find_collector(provider, id, &epoch);
+        soma_collector_table_read_unlock(&provider->collectors, epoch);
+    }
+    /* this waits until no RPC is using the collector anymore */
+    soma_collector* collector = soma_collector_table_remove(&provider->collectors, id);
+    if(!collector) {
+        return SOMA_ERR_INVALID_COLLECTOR;
+    }
+    collector_wait_unpinned(collector);
+    soma_upstream_save(provider, collector->aggregator);
+    soma_return_t ret;
+    if(__atomic_load_n(&collector->state, __ATOMIC_ACQUIRE) != SOMA_COLLECTOR_OPEN) {
+        /* nothing to close, and nothing we can destroy */
+        ret = destroy_collector ? SOMA_ERR_INVALID_COLLECTOR : SOMA_SUCCESS;
+    } else if(destroy_collector) {
+        ret = collector->fn->destroy_collector(collector->ctx);
+    } else {
+        ret = soma_backend_flush(collector->fn, collector->ctx);
+        soma_return_t r = collector->fn->close_collector(collector->ctx);
+        if(ret == SOMA_SUCCESS) ret = r;
+    }
+    collector_free(collector);
+    return ret;
+}
+
+static void close_and_free_collector(soma_collector* collector)
+{
+    collector_wait_unpinned(collector);
+    if(__atomic_load_n(&collector->state, __ATOMIC_ACQUIRE) == SOMA_COLLECTOR_OPEN) {
+        soma_backend_flush(collector->fn, collector->ctx);
+        collector->fn->close_collector(collector->ctx);
+    }
+    collector_free(collector);
+}
+
+static soma_collector* collector_alloc(
+        soma_provider_t provider,
+        soma_backend_impl* backend,
+        soma_collector_id_t id)
+{
+    /* the collector is the first thing allocated in its arena */
+    soma_arena_t arena;
+    if(soma_arena_create(&arena, &provider->memory.used) != SOMA_SUCCESS)
+        return NULL;
+    soma_collector* collector = (soma_collector*)soma_arena_calloc(arena, sizeof(*collector));
+    if(!collector) {
+        soma_arena_destroy(arena);
+        return NULL;
+    }
+    collector->arena = arena;
+    collector->aggregator = soma_aggregator_create();
+    if(!collector->aggregator) {
+        soma_arena_destroy(arena);
+        return NULL;
+    }
+    collector->fn  = backend;
+    collector->id  = id;
+    return collector;
+}
+
+static void collector_free(soma_collector* collector)
+{
+    soma_aggregator_free(collector->aggregator);
+    if(collector->opened != ABT_EVENTUAL_NULL)
+        ABT_eventual_free(&collector->opened);
+    free(collector->config);
+    /* this also frees the collector itself */
+    soma_arena_destroy(collector->arena);
+}
+
+static soma_return_t collector_create_context(
+        soma_provider_t provider,
+        soma_collector* collector,
+        const char* config,
+        int open)
+{
+    soma_backend_impl* fn = collector->fn;
+    if(open && fn->open_collector_in_arena)
+        return fn->open_collector_in_arena(provider, config, collector->arena, &collector->ctx);
+    if(open)
+        return fn->open_collector(provider, config, &collector->ctx);
+    if(fn->create_collector_in_arena)
+        return fn->create_collector_in_arena(provider, config, collector->arena, &collector->ctx);
+    return fn->create_collector(provider, config, &collector->ctx);
+}
+
+static void collector_wait_unpinned(soma_collector* collector)
+{
+    while(__atomic_load_n(&collector->pins, __ATOMIC_ACQUIRE))
+        ABT_thread_yield();
+}
+
+static soma_collector* collector_ready(
+        soma_provider_t provider,
+        soma_collector* collector,
+        unsigned* epoch)
+{
+    if(!collector) return NULL;
+    int state = __atomic_load_n(&collector->state, __ATOMIC_ACQUIRE);
+    if(state == SOMA_COLLECTOR_OPEN) return collector;
+    if(state == SOMA_COLLECTOR_FAILED) return NULL;
+
+    /* opening may take long (e.g. replaying a log), so it is done outside
+     * the read-side critical section, lest writers wait for it; the pin
+     * keeps the collector from being freed if it is removed meanwhile */
+    soma_collector_id_t id = collector->id;
+    __atomic_add_fetch(&collector->pins, 1, __ATOMIC_ACQ_REL);
+    soma_collector_table_read_unlock(&provider->collectors, *epoch);
+
+    int expected = SOMA_COLLECTOR_UNOPENED;
+    if(__atomic_compare_exchange_n(&collector->state, &expected, SOMA_COLLECTOR_OPENING,
+                                   0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* we are the ones opening it */
+        soma_return_t ret = collector_create_context(provider, collector, collector->config, 1);
+        char id_str[37];
+        soma_collector_id_to_string(id, id_str);
+        if(ret == SOMA_SUCCESS) {
+            __atomic_store_n(&collector->state, SOMA_COLLECTOR_OPEN, __ATOMIC_RELEASE);
+            margo_debug(provider->mid, "Opened collector %s from the catalog", id_str);
+        } else {
+            __atomic_store_n(&collector->state, SOMA_COLLECTOR_FAILED, __ATOMIC_RELEASE);
+            margo_error(provider->mid,
+                        "Could not open collector %s from the catalog, backend returned %d",
+                        id_str, ret);
+        }
+        ABT_eventual_set(collector->opened, NULL, 0);
+    } else if(expected != SOMA_COLLECTOR_FAILED) {
+        /* someone else is opening it */
+        ABT_eventual_wait(collector->opened, NULL);
+    }
+
+    /* the collector is only usable if it is still in the table */
+    *epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* found = soma_collector_table_find(&provider->collectors, &id);
+    __atomic_sub_fetch(&collector->pins, 1, __ATOMIC_RELEASE);
+    if(found != collector) return NULL;
+    state = __atomic_load_n(&collector->state, __ATOMIC_ACQUIRE);
+    return state == SOMA_COLLECTOR_OPEN ? collector : NULL;
+}
+
+static soma_return_t open_catalog(
+        soma_provider_t provider,
+        size_t* num_threads)
+{
+    struct json_object* catalog = NULL;
+    struct json_object* path = NULL;
+    struct json_object* threads = NULL;
+    *num_threads = 0;
+    if(!json_object_object_get_ex(provider->config, "catalog", &catalog))
+        return SOMA_SUCCESS;
+    if(!json_object_is_type(catalog, json_type_object)
+    || !json_object_object_get_ex(catalog, "path", &path)
+    || !json_object_is_type(path, json_type_string)) {
+        margo_error(provider->mid, "\"catalog\" should be an object with a \"path\" string");
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    *num_threads = DEFAULT_CATALOG_OPEN_THREADS;
+    if(json_object_object_get_ex(catalog, "open_threads", &threads)) {
+        if(!json_object_is_type(threads, json_type_int) || json_object_get_int64(threads) < 0) {
+            margo_error(provider->mid, "\"open_threads\" should be a non-negative integer");
+            return SOMA_ERR_INVALID_CONFIG;
+        }
+        *num_threads = (size_t)json_object_get_int64(threads);
+    }
+    if(ABT_mutex_create(&provider->catalog_mtx) != ABT_SUCCESS
+    || ABT_mutex_create(&provider->restore_mtx) != ABT_SUCCESS)
+        return SOMA_ERR_FROM_ARGOBOTS;
+    return soma_catalog_open(provider->mid, json_object_get_string(path), &provider->catalog);
+}
+
+struct restore_args {
+    soma_provider_t    provider;
+    soma_backend_impl* backend;
+    soma_return_t      ret;
+};
+
+static int restore_fn(const soma_catalog_entry* entry, void* uargs)
+{
+    struct restore_args* args = (struct restore_args*)uargs;
+    soma_provider_t provider = args->provider;
+    if(strcmp(entry->type, args->backend->name) != 0)
+        return 0;
+
+    soma_collector* collector = collector_alloc(provider, args->backend, entry->id);
+    if(!collector) {
+        args->ret = SOMA_ERR_ALLOCATION;
+        return 1;
+    }
+    collector->state  = SOMA_COLLECTOR_UNOPENED;
+    collector->config = strdup(entry->config);
+    if(!collector->config
+    || ABT_eventual_create(0, &collector->opened) != ABT_SUCCESS) {
+        collector_free(collector);
+        args->ret = SOMA_ERR_ALLOCATION;
+        return 1;
+    }
+    args->ret = add_collector(provider, collector);
+    if(args->ret != SOMA_SUCCESS) {
+        collector_free(collector);
+        return 1;
+    }
+
+    /* the restore ULTs may be going through the list already */
+    ABT_mutex_lock(provider->restore_mtx);
+    soma_collector_id_t* ids = realloc(provider->restored_ids,
+            (provider->num_restored + 1) * sizeof(*ids));
+    if(ids) {
+        provider->restored_ids = ids;
+        provider->restored_ids[provider->num_restored] = entry->id;
+        provider->num_restored += 1;
+    }
+    ABT_mutex_unlock(provider->restore_mtx);
+    /* if it could not be listed, the first RPC that needs it opens it */
+    return 0;
+}
+
+static soma_return_t restore_collectors(
+        soma_provider_t provider,
+        soma_backend_impl* backend)
+{
+    struct restore_args args = { provider, backend, SOMA_SUCCESS };
+    ABT_mutex_lock(provider->restore_mtx);
+    size_t num_restored = provider->num_restored;
+    ABT_mutex_unlock(provider->restore_mtx);
+    soma_catalog_iterate(provider->catalog, restore_fn, &args);
+    ABT_mutex_lock(provider->restore_mtx);
+    num_restored = provider->num_restored - num_restored;
+    ABT_mutex_unlock(provider->restore_mtx);
+    if(args.ret != SOMA_SUCCESS)
+        margo_error(provider->mid, "Could not restore collectors of type \"%s\" (error %d)",
+                    backend->name, args.ret);
+    else if(num_restored)
+        margo_info(provider->mid, "Restored %lu collectors of type \"%s\" from the catalog",
+                   num_restored, backend->name);
+    return args.ret;
+}
+
+static void restore_ult(void* p)
+{
+    soma_provider_t provider = (soma_provider_t)p;
+    for(;;) {
+        /* backends registered late append to the list, so copy the id */
+        soma_collector_id_t id;
+        ABT_mutex_lock(provider->restore_mtx);
+        int done = provider->next_restored >= provider->num_restored;
+        if(!done) id = provider->restored_ids[provider->next_restored++];
+        ABT_mutex_unlock(provider->restore_mtx);
+        if(done) break;
+        unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+        find_collector(provider, &id, &epoch);
+        soma_collector_table_read_unlock(&provider->collectors, epoch);
+    }
+}
+
+static soma_return_t start_restore(
+        soma_provider_t provider,
+        size_t num_threads)
+{
+    if(num_threads > provider->num_restored)
+        num_threads = provider->num_restored;
+    if(num_threads == 0) return SOMA_SUCCESS;
+    provider->restore_ults = (ABT_thread*)calloc(num_threads, sizeof(ABT_thread));
+    if(!provider->restore_ults) return SOMA_ERR_ALLOCATION;
+    size_t i;
+    for(i = 0; i < num_threads; i++) {
+        int ret = ABT_thread_create(provider->admin_pool, restore_ult, provider,
+                                    ABT_THREAD_ATTR_NULL, &provider->restore_ults[i]);
+        if(ret != ABT_SUCCESS) return SOMA_ERR_FROM_ARGOBOTS;
+        provider->num_restore_ults += 1;
+    }
+    return SOMA_SUCCESS;
+}
+
+static void stop_restore(soma_provider_t provider)
+{
+    /* collectors not opened yet will stay unopened */
+    if(provider->restore_mtx != ABT_MUTEX_NULL) {
+        ABT_mutex_lock(provider->restore_mtx);
+        provider->next_restored = provider->num_restored;
+        ABT_mutex_unlock(provider->restore_mtx);
+    }
+    size_t i;
+    for(i = 0; i < provider->num_restore_ults; i++)
+        ABT_thread_free(&provider->restore_ults[i]);
+    free(provider->restore_ults);
+    provider->restore_ults = NULL;
+    provider->num_restore_ults = 0;
+}
+
+static inline void remove_all_collectors(
+        soma_provider_t provider)
+{
+    soma_collector_table_clear(&provider->collectors, close_and_free_collector);
+}
+
+static inline soma_backend_impl* find_backend_impl(
+        soma_provider_t provider,
+        const char* name)
+{
+    size_t i;
+    for(i = 0; i < provider->num_backend_types; i++) {
+        soma_backend_impl* impl = provider->backend_types[i];
         if(strcmp(name, impl->name) == 0)
             return impl;
     }
@@ -651,13 +2188,69 @@ static inline soma_return_t add_backend_impl(
         soma_provider_t provider,
         soma_backend_impl* backend)
 {
+    soma_backend_impl** backend_types = realloc(provider->backend_types,
+            (provider->num_backend_types + 1) * sizeof(*backend_types));
+    if(!backend_types) return SOMA_ERR_ALLOCATION;
+    provider->backend_types = backend_types;
+    provider->backend_types[provider->num_backend_types] = backend;
     provider->num_backend_types += 1;
-    provider->backend_types = realloc(provider->backend_types,
-                                      provider->num_backend_types);
-    provider->backend_types[provider->num_backend_types-1] = backend;
     return SOMA_SUCCESS;
 }
 
+static inline soma_return_t parse_config(
+        margo_instance_id mid,
+        const char* config_str,
+        struct json_object** config)
+{
+    if(!config_str || !strlen(config_str)) {
+        *config = json_object_new_object();
+        return SOMA_SUCCESS;
+    }
+
+    struct json_tokener*    tokener = json_tokener_new();
+    enum json_tokener_error jerr;
+    *config = json_tokener_parse_ex(tokener, config_str, strlen(config_str));
+    if(!*config) {
+        jerr = json_tokener_get_error(tokener);
+        margo_error(mid, "JSON parse error: %s", json_tokener_error_desc(jerr));
+        json_tokener_free(tokener);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    json_tokener_free(tokener);
+
+    if(!json_object_is_type(*config, json_type_object)) {
+        margo_error(mid, "Provider configuration should be a JSON object");
+        json_object_put(*config);
+        *config = NULL;
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    return SOMA_SUCCESS;
+}
+
+static inline ABT_pool select_pool(
+        margo_instance_id mid,
+        struct json_object* config,
+        const char* name,
+        ABT_pool arg_pool,
+        ABT_pool default_pool)
+{
+    if(arg_pool != ABT_POOL_NULL)
+        return arg_pool;
+
+    struct json_object* pools = NULL;
+    struct json_object* pool_name = NULL;
+    if(json_object_object_get_ex(config, "pools", &pools)
+    && json_object_object_get_ex(pools, name, &pool_name)
+    && json_object_is_type(pool_name, json_type_string)) {
+        ABT_pool pool = ABT_POOL_NULL;
+        if(margo_get_pool_by_name(mid, json_object_get_string(pool_name), &pool) == 0)
+            return pool;
+        margo_warning(mid, "Could not find pool \"%s\" for %s ULTs, using default pool",
+                      json_object_get_string(pool_name), name);
+    }
+    return default_pool;
+}
+
 static inline int check_token(
         soma_provider_t provider,
         const char* token)
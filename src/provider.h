@@ -9,37 +9,94 @@
 #include <margo.h>
 #include <abt-io.h>
 #include <uuid.h>
+#include <json-c/json.h>
 #include "soma/soma-backend.h"
-#include "uthash.h"
+#include "collector-table.h"
+#include "stats.h"
+#include "aggregator.h"
+#include "upstream.h"
+#include "shm-channel.h"
+#include "local.h"
+#include "catalog.h"
+#include "memory.h"
+
+/* Collectors restored from the catalog are added to the provider before
+ * being opened, and opened either in the background or by the first
+ * RPC that needs them, whichever comes first */
+typedef enum soma_collector_state {
+    SOMA_COLLECTOR_OPEN = 0,
+    SOMA_COLLECTOR_UNOPENED,
+    SOMA_COLLECTOR_OPENING,
+    SOMA_COLLECTOR_FAILED
+} soma_collector_state;
 
 typedef struct soma_collector {
     soma_backend_impl* fn;  // pointer to function mapping for this backend
     void*               ctx; // context required by the backend
     soma_collector_id_t id;  // identifier of the backend
-    UT_hash_handle      hh;  // handle for uthash
+    soma_collector_index_t index; // provider-local index of the collector
+    soma_aggregator*    aggregator; // per-series aggregates of what was received
+    int                 state;  // a soma_collector_state (accessed atomically)
+    ABT_eventual        opened; // set once a restored collector is opened (or failed to)
+    char*               config; // configuration to open a restored collector with
+    soma_arena_t        arena;  // memory of the collector and of its backend context
+    int                 spilling; // a spill ULT is running for the collector (atomic)
+    uint64_t            spilled;  // bytes the backend moved out of memory (atomic)
+    unsigned            pins;     // ULTs opening it outside a read-side section (atomic)
 } soma_collector;
 
 typedef struct soma_provider {
     /* Margo/Argobots/Mercury environment */
     margo_instance_id  mid;                 // Margo instance
     uint16_t           provider_id;         // Provider id
-    ABT_pool           pool;                // Pool on which to post RPC requests
+    ABT_pool           admin_pool;          // Pool on which to post admin RPC requests
+    ABT_pool           ingest_pool;         // Pool on which to post ingest RPC requests
+    ABT_pool           query_pool;          // Pool on which to post query RPC requests
     abt_io_instance_id abtio;               // ABT-IO instance
     char*              token;               // Security token
+    struct json_object* config;             // JSON configuration
     /* Resources and backend types */
     size_t               num_backend_types; // number of backend types
     soma_backend_impl** backend_types;     // array of pointers to backend types
-    size_t               num_collectors;     // number of collectors
-    soma_collector*      collectors;         // hash of collectors by uuid
+    soma_collector_table collectors;         // table of collectors by uuid
+    soma_provider_stats* stats;              // per-RPC statistics
+    soma_upstream*       upstream;           // where to forward aggregates (may be NULL)
+    /* Shared-memory channels of co-located clients */
+    soma_shm_channel*    shm_channels;
+    ABT_mutex            shm_mtx;
+    uint64_t             last_shm_channel;   // id of the last channel opened
+    /* Entry points for clients sharing the margo instance */
+    soma_local_ops       local;
+    /* Persistent catalog of collectors (may be NULL) */
+    soma_catalog*        catalog;
+    ABT_mutex            catalog_mtx;        // serializes opening collectors by type and config
+    ABT_mutex            restore_mtx;        // protects the three fields below
+    soma_collector_id_t* restored_ids;       // collectors restored from the catalog
+    size_t               num_restored;
+    size_t               next_restored;      // next one for the background ULTs to open
+    ABT_thread*          restore_ults;       // ULTs opening restored collectors
+    size_t               num_restore_ults;
+    /* Memory accounting and budgets */
+    soma_memory          memory;
     /* RPC identifiers for admins */
     hg_id_t create_collector_id;
     hg_id_t open_collector_id;
     hg_id_t close_collector_id;
     hg_id_t destroy_collector_id;
     hg_id_t list_collectors_id;
+    hg_id_t get_stats_id;
+    hg_id_t get_memory_id;
     /* RPC identifiers for clients */
     hg_id_t hello_id;
     hg_id_t sum_id;
+    hg_id_t publish_batch_id;
+    hg_id_t publish_packed_id;
+    hg_id_t publish_aggregates_id;
+    hg_id_t get_aggregates_id;
+    hg_id_t query_id;
+    hg_id_t shm_attach_id;
+    hg_id_t shm_detach_id;
+    hg_id_t local_id;
     /* ... add other RPC identifiers here ... */
 } soma_provider;
 
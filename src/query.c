@@ -0,0 +1,238 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "soma/soma-collector.h"
+#include "backend-compat.h"
+#include "query.h"
+
+/* accumulator of the samples of a step */
+typedef struct query_step {
+    uint64_t count;
+    double   sum;
+    double   min;
+    double   max;
+    uint64_t t_first;  // earliest sample
+    double   v_first;
+    uint64_t t_last;   // latest sample
+    double   v_last;
+} query_step;
+
+static inline void step_add(query_step* st, uint64_t t, double v)
+{
+    if(st->count == 0) {
+        st->sum     = v;
+        st->min     = st->max    = v;
+        st->t_first = st->t_last = t;
+        st->v_first = st->v_last = v;
+    } else {
+        st->sum += v;
+        if(v < st->min) st->min = v;
+        if(v > st->max) st->max = v;
+        if(t < st->t_first) {
+            st->t_first = t;
+            st->v_first = v;
+        }
+        if(t >= st->t_last) {
+            st->t_last = t;
+            st->v_last = v;
+        }
+    }
+    st->count += 1;
+}
+
+static inline double step_value(const query_step* st, soma_aggregation_t aggregation)
+{
+    if(aggregation == SOMA_AGG_COUNT)
+        return (double)st->count;
+    if(st->count == 0)
+        return aggregation == SOMA_AGG_SUM ? 0.0 : NAN;
+    switch(aggregation) {
+    case SOMA_AGG_SUM:  return st->sum;
+    case SOMA_AGG_MIN:  return st->min;
+    case SOMA_AGG_MAX:  return st->max;
+    case SOMA_AGG_MEAN: return st->sum / (double)st->count;
+    case SOMA_AGG_RATE:
+        if(st->t_last == st->t_first) return NAN;
+        return (st->v_last - st->v_first) / (double)(st->t_last - st->t_first);
+    default:
+        return NAN;
+    }
+}
+
+struct copy_args {
+    uint64_t       series;
+    int            grow;      // results can be reallocated
+    size_t         capacity;
+    size_t         allocated;
+    size_t         found;
+    soma_sample_t* results;
+    soma_return_t  ret;
+};
+
+static int copy_samples(
+        void* uargs,
+        const uint64_t* timestamps,
+        const double* values,
+        size_t count)
+{
+    struct copy_args* args = (struct copy_args*)uargs;
+    if(count > args->capacity - args->found)
+        count = args->capacity - args->found;
+    if(args->grow && args->found + count > args->allocated) {
+        size_t new_size = args->allocated ? 2*args->allocated : 1024;
+        if(new_size < args->found + count) new_size = args->found + count;
+        if(new_size > args->capacity) new_size = args->capacity;
+        soma_sample_t* r = (soma_sample_t*)realloc(args->results, new_size*sizeof(*r));
+        if(!r) {
+            args->ret = SOMA_ERR_ALLOCATION;
+            return 1;
+        }
+        args->results   = r;
+        args->allocated = new_size;
+    }
+    size_t i;
+    for(i = 0; i < count; i++) {
+        args->results[args->found + i].series    = args->series;
+        args->results[args->found + i].timestamp = timestamps[i];
+        args->results[args->found + i].value     = values[i];
+    }
+    args->found += count;
+    return args->found == args->capacity;
+}
+
+static soma_return_t query_samples(
+        const soma_backend_impl* fn,
+        void* ctx,
+        const soma_query_params* params,
+        soma_sample_t** results,
+        size_t* count,
+        soma_query_cursor_t* next)
+{
+    struct copy_args args = {
+        0, *results == NULL, params->capacity,
+        *results == NULL ? 0 : params->capacity, 0, *results, SOMA_SUCCESS
+    };
+    soma_query_cursor_t pos = params->cursor;
+    if(pos.series >= params->num_series) {
+        pos.series = params->num_series;
+        pos.offset = 0;
+    }
+    while(pos.series < params->num_series && args.found < params->capacity) {
+        soma_query_t query = {
+            params->series[pos.series], params->t_start, params->t_end, pos.offset
+        };
+        size_t before = args.found;
+        args.series = query.series;
+        soma_return_t ret = soma_backend_scan(fn, ctx, &query, copy_samples, &args);
+        if(ret == SOMA_SUCCESS) ret = args.ret;
+        if(ret != SOMA_SUCCESS) {
+            *results = args.results;
+            *count   = args.found;
+            return ret;
+        }
+        pos.offset += args.found - before;
+        /* a full array may have left samples of this series behind */
+        if(args.found == params->capacity) break;
+        pos.series += 1;
+        pos.offset  = 0;
+    }
+    *results = args.results;
+    *count   = args.found;
+    if(next) *next = pos;
+    return SOMA_SUCCESS;
+}
+
+struct fold_args {
+    const soma_query_params* params;
+    query_step*              steps;
+};
+
+static int fold_samples(
+        void* uargs,
+        const uint64_t* timestamps,
+        const double* values,
+        size_t count)
+{
+    struct fold_args* args = (struct fold_args*)uargs;
+    const soma_query_params* params = args->params;
+    size_t i;
+    for(i = 0; i < count; i++) {
+        size_t k = params->step ? (timestamps[i] - params->t_start) / params->step : 0;
+        step_add(&args->steps[k], timestamps[i], values[i]);
+    }
+    return 0;
+}
+
+static soma_return_t query_steps(
+        const soma_backend_impl* fn,
+        void* ctx,
+        const soma_query_params* params,
+        size_t num_steps,
+        soma_sample_t** results,
+        size_t* count)
+{
+    size_t num_results = params->num_series * num_steps;
+    if(*results == NULL) {
+        *results = (soma_sample_t*)malloc(num_results * sizeof(**results));
+        if(!*results) return SOMA_ERR_ALLOCATION;
+    }
+    query_step* steps = (query_step*)malloc(num_steps * sizeof(*steps));
+    if(!steps) return SOMA_ERR_ALLOCATION;
+
+    soma_return_t ret = SOMA_SUCCESS;
+    struct fold_args args = { params, steps };
+    size_t s;
+    for(s = 0; s < params->num_series; s++) {
+        memset(steps, 0, num_steps * sizeof(*steps));
+        soma_query_t query = { params->series[s], params->t_start, params->t_end, 0 };
+        ret = soma_backend_scan(fn, ctx, &query, fold_samples, &args);
+        if(ret != SOMA_SUCCESS) goto finish;
+
+        soma_sample_t* r = *results + s * num_steps;
+        size_t k;
+        for(k = 0; k < num_steps; k++) {
+            r[k].series    = params->series[s];
+            r[k].timestamp = params->t_start + k * params->step;
+            r[k].value     = step_value(&steps[k], params->aggregation);
+        }
+    }
+    *count = num_results;
+
+finish:
+    free(steps);
+    return ret;
+}
+
+soma_return_t soma_query_collector(
+        const soma_backend_impl* fn,
+        void* ctx,
+        const soma_query_params* params,
+        soma_sample_t** results,
+        size_t* count,
+        soma_query_cursor_t* next)
+{
+    soma_query_params q = *params;
+    *count = 0;
+    if(q.t_end < q.t_start
+    || (q.num_series && !q.series)
+    || (unsigned)q.aggregation > SOMA_AGG_RATE)
+        return SOMA_ERR_INVALID_ARGS;
+    if(q.capacity > SOMA_QUERY_MAX_RESULTS)
+        q.capacity = SOMA_QUERY_MAX_RESULTS;
+
+    if(q.aggregation == SOMA_AGG_NONE)
+        return query_samples(fn, ctx, &q, results, count, next);
+
+    uint64_t width = q.t_end - q.t_start;
+    size_t num_steps = q.step == 0 ? 1 : width / q.step + (width % q.step != 0);
+    if(num_steps == 0 || q.num_series == 0)
+        return SOMA_SUCCESS;
+    if(num_steps > q.capacity / q.num_series)
+        return SOMA_ERR_INVALID_ARGS;
+    return query_steps(fn, ctx, &q, num_steps, results, count);
+}
@@ -0,0 +1,44 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _QUERY_H
+#define _QUERY_H
+
+#include "soma/soma-common.h"
+#include "soma/soma-backend.h"
+
+/*
+ * Evaluation of soma_query (see soma-collector.h) next to the data: the
+ * samples of each series are scanned once, with soma_backend_scan, and
+ * either copied into the results or folded into one accumulator per
+ * step of the time range, so that the memory used does not depend on
+ * the number of samples selected.
+ */
+
+typedef struct soma_query_params {
+    size_t             num_series;
+    const uint64_t*    series;
+    uint64_t           t_start;
+    uint64_t           t_end;
+    soma_aggregation_t aggregation;
+    uint64_t           step;
+    size_t             capacity;  // maximum number of results
+    soma_query_cursor_t cursor;   // where to resume (without reduction)
+} soma_query_params;
+
+/* Runs the query against a collector's backend. If *results is not NULL,
+ * it is an array of params->capacity results to fill; otherwise an array
+ * just large enough is allocated with malloc, to be freed by the caller
+ * (even on error). *count is set to the number of results and, without
+ * a reduction, *next to the position following the last one. */
+soma_return_t soma_query_collector(
+        const soma_backend_impl* fn,
+        void* ctx,
+        const soma_query_params* params,
+        soma_sample_t** results,
+        size_t* count,
+        soma_query_cursor_t* next);
+
+#endif
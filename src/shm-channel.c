@@ -0,0 +1,245 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "provider.h"
+#include "shm-channel.h"
+
+#define DRAIN_BATCH_SIZE 4096 /* samples handed to the backend at once */
+#define IDLE_SPINS       64   /* yields before backing off to sleeps */
+#define IDLE_SLEEP_MS    1
+#define RETRY_SLEEP_MS   10   /* between attempts at ingesting a refused batch */
+
+/* Hands the n samples staged in the channel's columns to the collector */
+static soma_return_t ingest(soma_shm_channel* ch, size_t n)
+{
+    soma_provider_t provider = ch->provider;
+    soma_return_t ret;
+
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector* collector = soma_collector_table_find(
+            &provider->collectors, &ch->collector_id);
+    if(!collector) {
+        ret = SOMA_ERR_INVALID_COLLECTOR;
+    } else {
+        soma_batch_t batch = { n, ch->series, ch->timestamps, ch->values };
+        ret = soma_memory_ingest(provider, collector, &batch);
+        if(ret == SOMA_SUCCESS && provider->upstream)
+            ret = soma_aggregator_add_batch(collector->aggregator, &batch);
+    }
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+    return ret;
+}
+
+static void drain_loop(void* arg)
+{
+    soma_shm_channel* ch = (soma_shm_channel*)arg;
+    soma_shm_ring* ring = ch->ring;
+    margo_instance_id mid = ch->provider->mid;
+    uint64_t mask = ch->mask;
+    unsigned idle = 0;
+
+    for(;;) {
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if(head - tail > ch->capacity) {
+            margo_error(mid, "Shared-memory channel %lu is corrupted", ch->id);
+            break;
+        }
+        if(head == tail) {
+            /* the producer stores its last records before closing */
+            if(__atomic_load_n(&ring->producer_closed, __ATOMIC_ACQUIRE)
+            || __atomic_load_n(&ch->stop, __ATOMIC_ACQUIRE)) {
+                if(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+                    break;
+                continue;
+            }
+            if(++idle < IDLE_SPINS) ABT_thread_yield();
+            else margo_thread_sleep(mid, IDLE_SLEEP_MS);
+            continue;
+        }
+        idle = 0;
+
+        size_t n = head - tail < DRAIN_BATCH_SIZE ? head - tail : DRAIN_BATCH_SIZE;
+        size_t i;
+        for(i = 0; i < n; i++) {
+            const soma_sample_t* s = &ring->records[(tail + i) & mask];
+            ch->series[i]     = s->series;
+            ch->timestamps[i] = s->timestamp;
+            ch->values[i]     = s->value;
+        }
+        /* the records are copied, give their room back to the producer */
+        __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+
+        /* a collector over its memory budget refuses samples until a spill
+         * has made room: hold on to the batch meanwhile, which lets the ring
+         * fill up and pushes back on the producer; it is only dropped if the
+         * channel is closed before the collector accepts it */
+        soma_return_t ret;
+        while((ret = ingest(ch, n)) == SOMA_ERR_MEMORY_LIMIT
+              && !__atomic_load_n(&ch->stop, __ATOMIC_ACQUIRE))
+            margo_thread_sleep(mid, RETRY_SLEEP_MS);
+        if(ret == SOMA_ERR_INVALID_COLLECTOR) {
+            margo_error(mid, "Collector of shared-memory channel %lu is gone", ch->id);
+            break;
+        }
+        if(ret != SOMA_SUCCESS)
+            margo_error(mid, "Dropping %lu samples from shared-memory channel %lu"
+                             " (error %d)", n, ch->id, ret);
+    }
+    __atomic_store_n(&ring->consumer_closed, 1, __ATOMIC_RELEASE);
+}
+
+static int valid_name(const char* name)
+{
+    size_t prefix = strlen(SOMA_SHM_NAME_PREFIX);
+    return name
+        && strlen(name) < SOMA_SHM_NAME_MAX
+        && strncmp(name, SOMA_SHM_NAME_PREFIX, prefix) == 0
+        && !strchr(name + 1, '/');
+}
+
+static void channel_free(soma_shm_channel* ch)
+{
+    if(ch->ring)
+        munmap(ch->ring, ch->size);
+    free(ch->series);
+    free(ch);
+}
+
+soma_return_t soma_shm_channel_open(
+        soma_provider_t provider,
+        const soma_collector_id_t* collector_id,
+        const char* name,
+        uint64_t* id)
+{
+    margo_instance_id mid = provider->mid;
+    soma_return_t ret = SOMA_SUCCESS;
+    int fd = -1;
+
+    if(!valid_name(name)) {
+        margo_error(mid, "Invalid shared-memory segment name");
+        return SOMA_ERR_INVALID_ARGS;
+    }
+
+    soma_shm_channel* ch = (soma_shm_channel*)calloc(1, sizeof(*ch));
+    if(!ch) return SOMA_ERR_ALLOCATION;
+    ch->provider     = provider;
+    ch->collector_id = *collector_id;
+    ch->ult          = ABT_THREAD_NULL;
+
+    char* block = (char*)malloc(DRAIN_BATCH_SIZE * (2*sizeof(uint64_t) + sizeof(double)));
+    if(!block) {
+        ret = SOMA_ERR_ALLOCATION;
+        goto error;
+    }
+    ch->series     = (uint64_t*)block;
+    ch->timestamps = ch->series + DRAIN_BATCH_SIZE;
+    ch->values     = (double*)(block + 2*DRAIN_BATCH_SIZE*sizeof(uint64_t));
+
+    /* a segment we cannot open most likely belongs to another node */
+    fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0) {
+        margo_debug(mid, "Could not open shared-memory segment %s", name);
+        ret = SOMA_ERR_OP_UNSUPPORTED;
+        goto error;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(soma_shm_ring)) {
+        ret = SOMA_ERR_INVALID_ARGS;
+        goto error;
+    }
+    ch->size = (size_t)st.st_size;
+    void* ptr = mmap(NULL, ch->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ptr == MAP_FAILED) {
+        ret = SOMA_ERR_IO;
+        goto error;
+    }
+    ch->ring = (soma_shm_ring*)ptr;
+    close(fd);
+    fd = -1;
+
+    /* bound the capacity first, lest the size computed from it wraps */
+    uint64_t capacity = ch->ring->capacity;
+    if(ch->ring->magic != SOMA_SHM_MAGIC
+    || capacity == 0 || (capacity & (capacity - 1)) != 0
+    || capacity > (SIZE_MAX - sizeof(soma_shm_ring)) / sizeof(soma_sample_t)
+    || soma_shm_ring_size(capacity) != ch->size) {
+        margo_error(mid, "Shared-memory segment %s is not a valid ring", name);
+        ret = SOMA_ERR_INVALID_ARGS;
+        goto error;
+    }
+    ch->capacity = capacity;
+    ch->mask     = capacity - 1;
+
+    ABT_mutex_lock(provider->shm_mtx);
+    ch->id = ++provider->last_shm_channel;
+    ABT_pool pool = provider->ingest_pool;
+    if(pool == ABT_POOL_NULL)
+        margo_get_handler_pool(mid, &pool);
+    if(ABT_thread_create(pool, drain_loop, ch, ABT_THREAD_ATTR_NULL, &ch->ult) != ABT_SUCCESS) {
+        ABT_mutex_unlock(provider->shm_mtx);
+        ret = SOMA_ERR_FROM_ARGOBOTS;
+        goto error;
+    }
+    ch->next = provider->shm_channels;
+    provider->shm_channels = ch;
+    ABT_mutex_unlock(provider->shm_mtx);
+
+    *id = ch->id;
+    return SOMA_SUCCESS;
+
+error:
+    if(fd >= 0) close(fd);
+    channel_free(ch);
+    return ret;
+}
+
+/* Stops the channel's ULT once the ring is drained and frees it */
+static void channel_stop(soma_shm_channel* ch)
+{
+    __atomic_store_n(&ch->stop, 1, __ATOMIC_RELEASE);
+    ABT_thread_join(ch->ult);
+    ABT_thread_free(&ch->ult);
+    channel_free(ch);
+}
+
+soma_return_t soma_shm_channel_close(
+        soma_provider_t provider,
+        uint64_t id)
+{
+    soma_shm_channel* ch = NULL;
+    ABT_mutex_lock(provider->shm_mtx);
+    soma_shm_channel** prev = &provider->shm_channels;
+    while(*prev) {
+        if((*prev)->id == id) {
+            ch = *prev;
+            *prev = ch->next;
+            break;
+        }
+        prev = &(*prev)->next;
+    }
+    ABT_mutex_unlock(provider->shm_mtx);
+    if(!ch) return SOMA_ERR_INVALID_ARGS;
+    channel_stop(ch);
+    return SOMA_SUCCESS;
+}
+
+void soma_shm_channel_close_all(soma_provider_t provider)
+{
+    ABT_mutex_lock(provider->shm_mtx);
+    soma_shm_channel* ch = provider->shm_channels;
+    provider->shm_channels = NULL;
+    ABT_mutex_unlock(provider->shm_mtx);
+    while(ch) {
+        soma_shm_channel* next = ch->next;
+        channel_stop(ch);
+        ch = next;
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _SHM_CHANNEL_H
+#define _SHM_CHANNEL_H
+
+#include <margo.h>
+#include "soma/soma-common.h"
+#include "shm-ring.h"
+
+struct soma_provider;
+
+/*
+ * Provider side of the shared-memory ingestion path: a channel is a
+ * ring mapped from a client's shared memory segment along with the ULT
+ * that drains it into a collector (see shm-ring.h). The ULT runs in the
+ * ingest pool, yields while the ring is empty, and backs off to short
+ * sleeps once it has been empty for a while. A batch the collector
+ * refuses for lack of memory is retried until it is accepted, the ring
+ * filling up meanwhile so that the producer has to wait.
+ */
+
+typedef struct soma_shm_channel {
+    struct soma_shm_channel* next;
+    struct soma_provider*    provider;
+    uint64_t                 id;
+    soma_collector_id_t      collector_id; // collector receiving the samples
+    soma_shm_ring*           ring;         // mapped segment
+    size_t                   size;         // size of the mapping
+    uint64_t                 capacity;     // number of records, validated at open time
+    uint64_t                 mask;         // capacity - 1 (the ring's own fields are
+                                           // writable by the client, never trusted)
+    ABT_thread               ult;          // ULT draining the ring
+    int                      stop;         // tells the ULT to stop once the ring is empty
+    uint64_t*                series;       // columns handed to the backend
+    uint64_t*                timestamps;
+    double*                  values;
+} soma_shm_channel;
+
+/* Maps the segment of the given name and starts draining it into the
+ * collector. Fails with SOMA_ERR_OP_UNSUPPORTED if the segment cannot
+ * be opened, e.g. because the client is on another node. */
+soma_return_t soma_shm_channel_open(
+        struct soma_provider* provider,
+        const soma_collector_id_t* collector_id,
+        const char* name,
+        uint64_t* id);
+
+/* Waits until the channel's ring is drained, then unmaps it. */
+soma_return_t soma_shm_channel_close(
+        struct soma_provider* provider,
+        uint64_t id);
+
+/* Closes all the channels of the provider. */
+void soma_shm_channel_close_all(struct soma_provider* provider);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _SHM_RING_H
+#define _SHM_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include "soma/soma-common.h"
+
+/*
+ * Single-producer single-consumer ring of samples in a POSIX shared
+ * memory segment, through which a client co-located with a provider
+ * publishes samples without any RPC. The client creates the segment,
+ * the provider maps it when the client attaches it to a collector, and
+ * a ULT of the provider drains it into the collector.
+ *
+ * head and tail are free-running counters of records written and read;
+ * each is only written by one side and lives on its own cache line.
+ * The producer publishes records with a release store of head, and the
+ * consumer frees them with a release store of tail.
+ */
+
+#define SOMA_SHM_MAGIC       0x31524853414d4f53ULL /* "SOMASHR1" */
+#define SOMA_SHM_NAME_PREFIX "/soma-"
+#define SOMA_SHM_NAME_MAX    64
+
+typedef struct soma_shm_ring {
+    uint64_t magic;
+    uint64_t capacity;          // number of records (power of 2)
+    uint64_t head __attribute__((aligned(64))); // written by the producer
+    uint32_t producer_closed;   // set by the producer once it is done
+    uint64_t tail __attribute__((aligned(64))); // written by the consumer
+    uint32_t consumer_closed;   // set by the consumer if it stops reading
+    soma_sample_t records[] __attribute__((aligned(64)));
+} soma_shm_ring;
+
+static inline size_t soma_shm_ring_size(uint64_t capacity)
+{
+    return sizeof(soma_shm_ring) + capacity * sizeof(soma_sample_t);
+}
+
+static inline void soma_shm_ring_init(soma_shm_ring* ring, uint64_t capacity)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->magic    = SOMA_SHM_MAGIC;
+    ring->capacity = capacity;
+}
+
+/* Producer side: writes as many of the count samples as there is room
+ * for and returns how many were written. */
+static inline size_t soma_shm_ring_push(
+        soma_shm_ring* ring,
+        const soma_sample_t* samples,
+        size_t count)
+{
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint64_t room = ring->capacity - (head - tail);
+    size_t n = count < room ? count : (size_t)room;
+    size_t i;
+    for(i = 0; i < n; i++)
+        ring->records[(head + i) & (ring->capacity - 1)] = samples[i];
+    __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+#endif
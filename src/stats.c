@@ -0,0 +1,181 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+static const char* rpc_names[SOMA_RPC_KIND_COUNT] = {
+    "create_collector",
+    "open_collector",
+    "close_collector",
+    "destroy_collector",
+    "list_collectors",
+    "hello",
+    "sum",
+    "publish_batch",
+    "publish_packed",
+    "publish_aggregates",
+    "get_aggregates",
+    "shm_attach",
+    "shm_detach",
+    "get_stats",
+    "get_memory_usage",
+    "query"
+};
+
+static inline unsigned bucket_of(uint64_t v)
+{
+    unsigned b = 0;
+    while(v && b < SOMA_STATS_NUM_BUCKETS - 1) {
+        v >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static inline void add(uint64_t* counter, uint64_t v)
+{
+    __atomic_add_fetch(counter, v, __ATOMIC_RELAXED);
+}
+
+static inline void update_max(uint64_t* counter, uint64_t v)
+{
+    uint64_t cur = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while(v > cur
+    && !__atomic_compare_exchange_n(counter, &cur, v, 1,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline uint64_t load(const uint64_t* counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+soma_provider_stats* soma_stats_create(void)
+{
+    void* ptr = NULL;
+    if(posix_memalign(&ptr, 64, sizeof(soma_provider_stats)) != 0)
+        return NULL;
+    soma_provider_stats* stats = (soma_provider_stats*)ptr;
+    memset(stats, 0, sizeof(*stats));
+    stats->start_time = ABT_get_wtime();
+    return stats;
+}
+
+void soma_stats_free(soma_provider_stats* stats)
+{
+    free(stats);
+}
+
+void soma_stats_begin(
+        soma_provider_stats* stats,
+        soma_rpc_kind kind,
+        ABT_pool pool,
+        soma_rpc_timer* timer)
+{
+    soma_rpc_stats* s = &stats->rpcs[kind];
+    size_t depth = 0;
+    if(pool != ABT_POOL_NULL)
+        ABT_pool_get_size(pool, &depth);
+    add(&s->queue_depth, depth);
+    update_max(&s->queue_depth_max, depth);
+    add(&s->queue_depth_hist[bucket_of(depth)], 1);
+    timer->kind  = kind;
+    timer->start = ABT_get_wtime();
+}
+
+void soma_stats_end(
+        soma_provider_stats* stats,
+        const soma_rpc_timer* timer,
+        soma_return_t ret,
+        uint64_t bytes_in,
+        uint64_t bytes_out)
+{
+    soma_rpc_stats* s = &stats->rpcs[timer->kind];
+    uint64_t ns = (uint64_t)((ABT_get_wtime() - timer->start) * 1e9);
+    add(&s->calls, 1);
+    if(ret != SOMA_SUCCESS)
+        add(&s->errors, 1);
+    add(&s->bytes_in, bytes_in);
+    add(&s->bytes_out, bytes_out);
+    add(&s->handler_ns, ns);
+    update_max(&s->handler_ns_max, ns);
+    add(&s->handler_hist[bucket_of(ns / 1000)], 1);
+}
+
+/* Upper bound of the values counted in a bucket */
+static inline uint64_t bucket_bound(unsigned b)
+{
+    return (uint64_t)1 << b;
+}
+
+/* Estimates a percentile as the upper bound of the bucket it falls in */
+static uint64_t hist_percentile(const uint64_t* hist, uint64_t total, double p)
+{
+    uint64_t rank = (uint64_t)(p * (double)total);
+    uint64_t seen = 0;
+    unsigned b;
+    for(b = 0; b < SOMA_STATS_NUM_BUCKETS; b++) {
+        seen += load(&hist[b]);
+        if(seen > rank) return bucket_bound(b);
+    }
+    return bucket_bound(SOMA_STATS_NUM_BUCKETS - 1);
+}
+
+/* Describes a histogram as {"count", "mean", "max", "p50", "p99",
+ * "p99.9", "buckets": [[upper bound, count], ...]}, listing only
+ * non-empty buckets */
+static struct json_object* hist_to_json(
+        const uint64_t* hist, double sum, double max, double scale)
+{
+    struct json_object* obj = json_object_new_object();
+    struct json_object* buckets = json_object_new_array();
+    uint64_t total = 0;
+    unsigned b;
+    for(b = 0; b < SOMA_STATS_NUM_BUCKETS; b++) {
+        uint64_t c = load(&hist[b]);
+        if(c == 0) continue;
+        total += c;
+        struct json_object* pair = json_object_new_array();
+        json_object_array_add(pair, json_object_new_int64((int64_t)bucket_bound(b)));
+        json_object_array_add(pair, json_object_new_int64((int64_t)c));
+        json_object_array_add(buckets, pair);
+    }
+    json_object_object_add(obj, "count", json_object_new_int64((int64_t)total));
+    json_object_object_add(obj, "mean", json_object_new_double(total ? sum / total * scale : 0.0));
+    json_object_object_add(obj, "max", json_object_new_double(max * scale));
+    json_object_object_add(obj, "p50", json_object_new_int64((int64_t)hist_percentile(hist, total, 0.5)));
+    json_object_object_add(obj, "p99", json_object_new_int64((int64_t)hist_percentile(hist, total, 0.99)));
+    json_object_object_add(obj, "p99.9", json_object_new_int64((int64_t)hist_percentile(hist, total, 0.999)));
+    json_object_object_add(obj, "buckets", buckets);
+    return obj;
+}
+
+struct json_object* soma_stats_to_json(const soma_provider_stats* stats)
+{
+    struct json_object* root = json_object_new_object();
+    struct json_object* rpcs = json_object_new_object();
+    json_object_object_add(root, "uptime",
+            json_object_new_double(ABT_get_wtime() - stats->start_time));
+    unsigned i;
+    for(i = 0; i < SOMA_RPC_KIND_COUNT; i++) {
+        const soma_rpc_stats* s = &stats->rpcs[i];
+        struct json_object* rpc = json_object_new_object();
+        json_object_object_add(rpc, "calls", json_object_new_int64((int64_t)load(&s->calls)));
+        json_object_object_add(rpc, "errors", json_object_new_int64((int64_t)load(&s->errors)));
+        json_object_object_add(rpc, "bytes_in", json_object_new_int64((int64_t)load(&s->bytes_in)));
+        json_object_object_add(rpc, "bytes_out", json_object_new_int64((int64_t)load(&s->bytes_out)));
+        json_object_object_add(rpc, "handler_time_us",
+                hist_to_json(s->handler_hist, (double)load(&s->handler_ns),
+                             (double)load(&s->handler_ns_max), 1e-3));
+        json_object_object_add(rpc, "queue_depth",
+                hist_to_json(s->queue_depth_hist, (double)load(&s->queue_depth),
+                             (double)load(&s->queue_depth_max), 1.0));
+        json_object_object_add(rpcs, rpc_names[i], rpc);
+    }
+    json_object_object_add(root, "rpcs", rpcs);
+    return root;
+}
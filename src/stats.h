@@ -0,0 +1,95 @@
+/*
+ * (C) 2020 The University of Chicago
+ * 
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <margo.h>
+#include <json-c/json.h>
+#include "soma/soma-common.h"
+
+/*
+ * Per-RPC statistics of a provider. Every handler calls
+ * soma_stats_begin once it has found its provider and soma_stats_end
+ * once it has responded. Counters are only updated with relaxed atomic
+ * additions and each RPC's counters live on their own cache lines, so
+ * handlers of different RPCs never contend.
+ *
+ * Histograms have logarithmic buckets: bucket i counts values v such
+ * that 2^(i-1) <= v < 2^i (bucket 0 counts v < 1), the last bucket
+ * counting everything above. Handler times are in microseconds.
+ */
+
+typedef enum soma_rpc_kind {
+    SOMA_RPC_CREATE_COLLECTOR,
+    SOMA_RPC_OPEN_COLLECTOR,
+    SOMA_RPC_CLOSE_COLLECTOR,
+    SOMA_RPC_DESTROY_COLLECTOR,
+    SOMA_RPC_LIST_COLLECTORS,
+    SOMA_RPC_HELLO,
+    SOMA_RPC_SUM,
+    SOMA_RPC_PUBLISH_BATCH,
+    SOMA_RPC_PUBLISH_PACKED,
+    SOMA_RPC_PUBLISH_AGGREGATES,
+    SOMA_RPC_GET_AGGREGATES,
+    SOMA_RPC_SHM_ATTACH,
+    SOMA_RPC_SHM_DETACH,
+    SOMA_RPC_GET_STATS,
+    SOMA_RPC_GET_MEMORY,
+    SOMA_RPC_QUERY,
+    SOMA_RPC_KIND_COUNT
+} soma_rpc_kind;
+
+#define SOMA_STATS_NUM_BUCKETS 32
+
+typedef struct soma_rpc_stats {
+    uint64_t calls;
+    uint64_t errors;            // calls that did not return SOMA_SUCCESS
+    uint64_t bytes_in;          // payload received (strings, bulk data)
+    uint64_t bytes_out;         // payload sent back
+    uint64_t handler_ns;        // total time spent in the handler
+    uint64_t handler_ns_max;
+    uint64_t handler_hist[SOMA_STATS_NUM_BUCKETS];
+    uint64_t queue_depth;       // sum of the pool sizes seen by handlers
+    uint64_t queue_depth_max;
+    uint64_t queue_depth_hist[SOMA_STATS_NUM_BUCKETS];
+} __attribute__((aligned(64))) soma_rpc_stats;
+
+typedef struct soma_provider_stats {
+    double         start_time;
+    soma_rpc_stats rpcs[SOMA_RPC_KIND_COUNT];
+} soma_provider_stats;
+
+typedef struct soma_rpc_timer {
+    soma_rpc_kind kind;
+    double        start;
+} soma_rpc_timer;
+
+/* Allocates cache-aligned statistics, all counters at zero */
+soma_provider_stats* soma_stats_create(void);
+
+void soma_stats_free(soma_provider_stats* stats);
+
+/* Starts timing an RPC and records the number of ULTs waiting in the
+ * pool the handler runs in. */
+void soma_stats_begin(
+        soma_provider_stats* stats,
+        soma_rpc_kind kind,
+        ABT_pool pool,
+        soma_rpc_timer* timer);
+
+/* Records the outcome of the RPC started with soma_stats_begin. */
+void soma_stats_end(
+        soma_provider_stats* stats,
+        const soma_rpc_timer* timer,
+        soma_return_t ret,
+        uint64_t bytes_in,
+        uint64_t bytes_out);
+
+/* Returns a JSON object describing the statistics; the caller
+ * owns the returned object. */
+struct json_object* soma_stats_to_json(const soma_provider_stats* stats);
+
+#endif
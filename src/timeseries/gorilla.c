@@ -0,0 +1,148 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include "gorilla.h"
+
+#define INITIAL_WORDS      16
+/* largest encoding of a sample: '1111' + 64 bits of timestamp,
+ * '11' + 12 bits of window + 64 bits of value */
+#define MAX_SAMPLE_BITS    (4 + 64 + 2 + 12 + 64)
+
+void soma_gorilla_init(soma_gorilla_chunk* chunk)
+{
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->last_leading  = 65; /* no window yet */
+    chunk->last_trailing = 65;
+}
+
+/* Makes sure the stream has room for one more sample, plus padding */
+static soma_return_t reserve(soma_gorilla_chunk* chunk)
+{
+    size_t needed = (chunk->num_bits + MAX_SAMPLE_BITS + 63) / 64 + 1;
+    if(needed <= chunk->num_words)
+        return SOMA_SUCCESS;
+    size_t num_words = chunk->num_words ? 2 * chunk->num_words : INITIAL_WORDS;
+    if(num_words < needed) num_words = needed;
+    uint64_t* words = (uint64_t*)realloc(chunk->words, num_words * sizeof(*words));
+    if(!words) return SOMA_ERR_ALLOCATION;
+    memset(words + chunk->num_words, 0, (num_words - chunk->num_words) * sizeof(*words));
+    chunk->words     = words;
+    chunk->num_words = num_words;
+    return SOMA_SUCCESS;
+}
+
+/* Appends the n (0 to 64) low bits of v; the room has been reserved */
+static inline void put_bits(soma_gorilla_chunk* chunk, uint64_t v, unsigned n)
+{
+    if(n == 0) return;
+    if(n < 64) v &= (1ULL << n) - 1;
+    size_t w = chunk->num_bits >> 6;
+    unsigned off = chunk->num_bits & 63;
+    chunk->words[w] |= (v << (64 - n)) >> off;
+    if(off + n > 64)
+        chunk->words[w + 1] |= v << (128 - off - n);
+    chunk->num_bits += n;
+}
+
+soma_return_t soma_gorilla_append(
+        soma_gorilla_chunk* chunk,
+        uint64_t timestamp,
+        double value)
+{
+    if(chunk->sealed)
+        return SOMA_ERR_INVALID_ARGS;
+    soma_return_t ret = reserve(chunk);
+    if(ret != SOMA_SUCCESS) return ret;
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if(chunk->count == 0) {
+        put_bits(chunk, timestamp, 64);
+        put_bits(chunk, bits, 64);
+        chunk->last_timestamp = timestamp;
+        chunk->last_value     = bits;
+        chunk->count = 1;
+        return SOMA_SUCCESS;
+    }
+
+    /* timestamp */
+    /* computed modulo 2^64, so that any pair of timestamps round-trips;
+     * the top bit of dod is its sign for the zigzag encoding */
+    uint64_t delta = timestamp - chunk->last_timestamp;
+    uint64_t dod   = delta - chunk->last_delta;
+    uint64_t zz    = (dod << 1) ^ (0 - (dod >> 63));
+    if(zz == 0) {
+        put_bits(chunk, 0, 1);
+    } else if(zz < (1ULL << 7)) {
+        put_bits(chunk, 2, 2);
+        put_bits(chunk, zz, 7);
+    } else if(zz < (1ULL << 9)) {
+        put_bits(chunk, 6, 3);
+        put_bits(chunk, zz, 9);
+    } else if(zz < (1ULL << 12)) {
+        put_bits(chunk, 14, 4);
+        put_bits(chunk, zz, 12);
+    } else {
+        put_bits(chunk, 15, 4);
+        put_bits(chunk, zz, 64);
+    }
+    chunk->last_timestamp = timestamp;
+    chunk->last_delta     = delta;
+
+    /* value */
+    uint64_t x = bits ^ chunk->last_value;
+    if(x == 0) {
+        put_bits(chunk, 0, 1);
+    } else {
+        unsigned leading  = (unsigned)__builtin_clzll(x);
+        unsigned trailing = (unsigned)__builtin_ctzll(x);
+        if(leading >= chunk->last_leading && trailing >= chunk->last_trailing) {
+            put_bits(chunk, 2, 2);
+            put_bits(chunk, x >> chunk->last_trailing,
+                     64 - chunk->last_leading - chunk->last_trailing);
+        } else {
+            unsigned len = 64 - leading - trailing;
+            put_bits(chunk, 3, 2);
+            put_bits(chunk, leading, 6);
+            put_bits(chunk, len - 1, 6);
+            put_bits(chunk, x >> trailing, len);
+            chunk->last_leading  = leading;
+            chunk->last_trailing = trailing;
+        }
+    }
+    chunk->last_value = bits;
+    chunk->count += 1;
+    return SOMA_SUCCESS;
+}
+
+void soma_gorilla_seal(soma_gorilla_chunk* chunk)
+{
+    chunk->sealed = 1;
+    size_t num_words = (chunk->num_bits + 63) / 64 + 1;
+    if(num_words >= chunk->num_words)
+        return;
+    uint64_t* words = (uint64_t*)realloc(chunk->words, num_words * sizeof(*words));
+    if(!words) return; /* keep the larger stream */
+    chunk->words     = words;
+    chunk->num_words = num_words;
+}
+
+void soma_gorilla_reset(soma_gorilla_chunk* chunk)
+{
+    uint64_t* words  = chunk->words;
+    size_t num_words = chunk->num_words;
+    soma_gorilla_init(chunk);
+    if(words) memset(words, 0, num_words * sizeof(*words));
+    chunk->words     = words;
+    chunk->num_words = num_words;
+}
+
+void soma_gorilla_free(soma_gorilla_chunk* chunk)
+{
+    free(chunk->words);
+    soma_gorilla_init(chunk);
+}
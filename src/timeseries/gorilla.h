@@ -0,0 +1,172 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _GORILLA_H
+#define _GORILLA_H
+
+#include <stdint.h>
+#include <string.h>
+#include "soma/soma-common.h"
+
+/*
+ * Compressed chunk of (timestamp, value) samples, in the encoding of
+ * Facebook's Gorilla time series database. Samples are appended to a
+ * stream of bits, most significant bit first:
+ * - the first sample is its timestamp and the bits of its value, as is;
+ * - then timestamps are encoded as the difference between consecutive
+ *   differences (delta-of-delta), zigzag-encoded and prefixed with its
+ *   size class: '0' for 0, '10' + 7 bits, '110' + 9 bits, '1110' + 12
+ *   bits, and '1111' + 64 bits for anything larger;
+ * - values are XORed with the previous value: '0' if the XOR is 0,
+ *   '10' + its meaningful bits if they fit within the window of leading
+ *   and trailing zeros of the last XOR written with '11', and otherwise
+ *   '11' + 6 bits of leading zeros + 6 bits of length (minus one) + the
+ *   meaningful bits, which becomes the new window.
+ * Periodic samples of slowly changing metrics take 2 to 20 bits each
+ * instead of 128.
+ *
+ * The stream grows as samples are appended, and is trimmed to its exact
+ * size (plus one padding word read by the iterator) when the chunk is
+ * sealed, after which nothing can be appended anymore.
+ */
+
+typedef struct soma_gorilla_chunk {
+    uint64_t* words;          // stream of bits
+    size_t    num_words;      // allocated words
+    size_t    num_bits;       // bits written
+    size_t    count;          // samples written
+    int       sealed;
+    /* state of the encoder */
+    uint64_t  last_timestamp;
+    uint64_t  last_delta;     // computed modulo 2^64
+    uint64_t  last_value;     // bits of the last value
+    unsigned  last_leading;   // window of the last XOR written in full
+    unsigned  last_trailing;
+} soma_gorilla_chunk;
+
+void soma_gorilla_init(soma_gorilla_chunk* chunk);
+
+/* Appends a sample; fails with SOMA_ERR_ALLOCATION if the stream could
+ * not grow, or SOMA_ERR_INVALID_ARGS if the chunk is sealed. */
+soma_return_t soma_gorilla_append(
+        soma_gorilla_chunk* chunk,
+        uint64_t timestamp,
+        double value);
+
+/* Trims the stream to its size; the chunk becomes read-only. */
+void soma_gorilla_seal(soma_gorilla_chunk* chunk);
+
+/* Empties the chunk, keeping its stream allocated for reuse. */
+void soma_gorilla_reset(soma_gorilla_chunk* chunk);
+
+void soma_gorilla_free(soma_gorilla_chunk* chunk);
+
+/* Number of bytes used by the chunk's stream */
+static inline size_t soma_gorilla_size(const soma_gorilla_chunk* chunk)
+{
+    return chunk->num_words * sizeof(uint64_t);
+}
+
+/*
+ * Iterator decoding the samples of a chunk in order. The chunk must not
+ * be modified while the iterator is in use. Decoding reads the stream
+ * 64 bits at a time and finds the size class of a timestamp by counting
+ * leading ones rather than testing one bit after the other.
+ */
+typedef struct soma_gorilla_iter {
+    const uint64_t* words;
+    size_t          pos;       // position in bits
+    size_t          index;     // index of the next sample
+    size_t          count;
+    uint64_t        timestamp;
+    uint64_t        delta;
+    uint64_t        value;
+    unsigned        leading;
+    unsigned        trailing;
+} soma_gorilla_iter;
+
+static inline void soma_gorilla_iter_init(
+        soma_gorilla_iter* it,
+        const soma_gorilla_chunk* chunk)
+{
+    memset(it, 0, sizeof(*it));
+    it->words = chunk->words;
+    it->count = chunk->count;
+}
+
+/* Returns the 64 bits of the stream starting at pos (the stream always
+ * has a word of padding, so the next word can be read unconditionally) */
+static inline uint64_t soma_gorilla_peek(const uint64_t* words, size_t pos)
+{
+    size_t w = pos >> 6;
+    unsigned off = pos & 63;
+    return (words[w] << off) | ((words[w + 1] >> 1) >> (63 - off));
+}
+
+/* Returns the n (1 to 64) bits of the stream starting at pos */
+static inline uint64_t soma_gorilla_read(const uint64_t* words, size_t pos, unsigned n)
+{
+    return soma_gorilla_peek(words, pos) >> (64 - n);
+}
+
+/* Stores the next sample and returns 1, or returns 0 at the end */
+static inline int soma_gorilla_iter_next(
+        soma_gorilla_iter* it,
+        uint64_t* timestamp,
+        double* value)
+{
+    /* length of the prefix and number of bits of each size class,
+     * indexed by the number of leading ones of the prefix */
+    static const unsigned char prefix_bits[5] = { 1, 2, 3, 4, 4 };
+    static const unsigned char dod_bits[5]    = { 0, 7, 9, 12, 64 };
+
+    if(it->index == it->count)
+        return 0;
+    const uint64_t* words = it->words;
+    size_t pos = it->pos;
+
+    if(it->index == 0) {
+        it->timestamp = soma_gorilla_read(words, pos, 64);
+        it->value     = soma_gorilla_read(words, pos + 64, 64);
+        pos += 128;
+    } else {
+        /* timestamp */
+        uint64_t bits = ~soma_gorilla_peek(words, pos);
+        unsigned ones = bits ? (unsigned)__builtin_clzll(bits) : 64;
+        ones = ones > 4 ? 4 : ones;
+        pos += prefix_bits[ones];
+        unsigned n = dod_bits[ones];
+        uint64_t zz = n ? soma_gorilla_read(words, pos, n) : 0;
+        pos += n;
+        it->delta     += (zz >> 1) ^ (0 - (zz & 1));
+        it->timestamp += it->delta;
+
+        /* value */
+        bits = soma_gorilla_peek(words, pos);
+        if(bits >> 63) {
+            if((bits >> 62) & 1) {
+                it->leading  = (unsigned)(bits >> 56) & 63;
+                unsigned len = ((unsigned)(bits >> 50) & 63) + 1;
+                it->trailing = 64 - it->leading - len;
+                pos += 14;
+            } else {
+                pos += 2;
+            }
+            unsigned len = 64 - it->leading - it->trailing;
+            it->value ^= soma_gorilla_read(words, pos, len) << it->trailing;
+            pos += len;
+        } else {
+            pos += 1;
+        }
+    }
+
+    it->pos = pos;
+    it->index += 1;
+    *timestamp = it->timestamp;
+    memcpy(value, &it->value, sizeof(*value));
+    return 1;
+}
+
+#endif
@@ -0,0 +1,797 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <json-c/json.h>
+#include "soma/soma-backend.h"
+#include "../provider.h"
+#include "../uthash.h"
+#include "../wal.h"
+#include "timeseries-backend.h"
+#include "gorilla.h"
+
+#define CACHE_LINE_SIZE            64
+#define DEFAULT_CHUNK_CAPACITY     1024
+#define DEFAULT_MAX_CHUNKS         0 /* unlimited */
+#define SCAN_SLICE_SIZE            256 /* samples passed at once by a scan */
+
+#define ALIGN_UP(x) (((x) + CACHE_LINE_SIZE - 1) & ~((size_t)CACHE_LINE_SIZE - 1))
+
+/*
+ * Samples of a series are stored in fixed-size chunks. A chunk is a
+ * header pointing to a single cache-aligned allocation holding the
+ * column of timestamps followed by the column of values, each column
+ * starting on its own cache line so that scanning one column never
+ * pulls the other into the cache.
+ *
+ * The context, series and chunks are allocated from the arena of the
+ * collector, which the provider releases as a whole once the collector
+ * is closed or destroyed; only the streams of compressed chunks and the
+ * hash table of series live on the heap.
+ *
+ * With "compression" : "gorilla" in the configuration, chunks instead
+ * hold their samples in the compressed encoding of gorilla.h, which
+ * grows as samples are added and is trimmed once the chunk is full.
+ *
+ * If the configuration has a "wal" object (see wal.h for its fields),
+ * every batch is appended to a write-ahead log before being stored, and
+ * opening the collector replays the log to rebuild its samples. With
+ * the default "always" fsync policy, a batch is synced before being
+ * acknowledged; with the other policies it is only written, and may be
+ * lost in a crash. The log is never truncated, so it holds (and replays)
+ * every batch the collector has received.
+ *
+ * Full chunks are queued from the oldest to the newest. When the
+ * provider asks the collector to spill, the oldest ones are appended to
+ * the spill file through ABT-IO and their samples are freed, keeping
+ * only their header; queries read them back from the file. The spill
+ * file is removed when the collector is closed or destroyed.
+ */
+typedef struct ts_chunk {
+    struct ts_chunk* next;
+    size_t           count;          // number of samples in the chunk
+    uint64_t         min_timestamp;
+    uint64_t         max_timestamp;
+    uint64_t*        timestamps;     // column of timestamps
+    double*          values;         // column of values
+    soma_gorilla_chunk packed;       // compressed samples, instead of the columns
+    struct ts_chunk* older;          // queue of full chunks still in memory
+    struct ts_chunk* newer;
+    int              queued;
+    int              spilled;        // samples are in the spill file
+    uint64_t         spill_offset;
+    size_t           spill_size;
+} ts_chunk;
+
+typedef struct ts_series {
+    uint64_t       id;
+    ts_chunk*      head;             // oldest chunk
+    ts_chunk*      tail;             // chunk being filled
+    size_t         num_chunks;
+    uint64_t       num_samples;      // samples currently stored
+    UT_hash_handle hh;
+} ts_series;
+
+typedef struct timeseries_context {
+    margo_instance_id   mid;
+    soma_arena_t        arena;           // NULL if the provider did not give one
+    struct json_object* config;
+    size_t              chunk_capacity;  // samples per chunk
+    size_t              max_chunks;      // per series, 0 for unlimited
+    int                 compress;        // chunks are gorilla-compressed
+    ABT_mutex           mutex;           // protects everything below
+    ts_series*          series;          // hash of series by id
+    ts_chunk*           free_chunks;     // chunks available for reuse
+    uint64_t            num_samples;     // samples received since creation
+    soma_wal*           wal;             // write-ahead log, if configured
+    ts_chunk*           oldest;          // queue of full chunks still in memory
+    ts_chunk*           newest;
+    abt_io_instance_id  abtio;           // to spill
+    char*               spill_path;      // set at the first spill
+    int                 spill_fd;
+    uint64_t            spill_end;       // size of the spill file
+} timeseries_context;
+
+static soma_return_t replay_batch(void* c, unsigned long segment, const soma_batch_t* batch);
+
+/* Size of the allocation holding both columns of a chunk */
+static inline size_t columns_size(const timeseries_context* ctx)
+{
+    return 2 * ALIGN_UP(ctx->chunk_capacity * sizeof(uint64_t));
+}
+
+static ts_chunk* chunk_alloc(timeseries_context* ctx)
+{
+    ts_chunk* chunk = ctx->free_chunks;
+    if(chunk) {
+        ctx->free_chunks = chunk->next;
+    } else {
+        chunk = (ts_chunk*)soma_arena_calloc(ctx->arena, sizeof(*chunk));
+        if(!chunk) return NULL;
+        soma_gorilla_init(&chunk->packed);
+        if(!ctx->compress) {
+            /* the arena aligns allocations of a cache line or more */
+            char* ptr = (char*)soma_arena_alloc(ctx->arena, columns_size(ctx));
+            if(!ptr) {
+                soma_arena_free(ctx->arena, chunk, sizeof(*chunk));
+                return NULL;
+            }
+            chunk->timestamps = (uint64_t*)ptr;
+            chunk->values     = (double*)(ptr + columns_size(ctx) / 2);
+        }
+    }
+    chunk->next          = NULL;
+    chunk->older         = NULL;
+    chunk->newer         = NULL;
+    chunk->count         = 0;
+    chunk->min_timestamp = UINT64_MAX;
+    chunk->max_timestamp = 0;
+    return chunk;
+}
+
+static void queue_push(timeseries_context* ctx, ts_chunk* chunk)
+{
+    chunk->older  = ctx->newest;
+    chunk->newer  = NULL;
+    chunk->queued = 1;
+    if(ctx->newest) ctx->newest->newer = chunk;
+    else ctx->oldest = chunk;
+    ctx->newest = chunk;
+}
+
+static void queue_remove(timeseries_context* ctx, ts_chunk* chunk)
+{
+    if(chunk->older) chunk->older->newer = chunk->newer;
+    else ctx->oldest = chunk->newer;
+    if(chunk->newer) chunk->newer->older = chunk->older;
+    else ctx->newest = chunk->older;
+    chunk->older  = NULL;
+    chunk->newer  = NULL;
+    chunk->queued = 0;
+}
+
+static void chunk_release(timeseries_context* ctx, ts_chunk* chunk)
+{
+    if(chunk->queued)
+        queue_remove(ctx, chunk);
+    if(chunk->spilled) {
+        /* its samples are gone from memory, there is little to reuse */
+        soma_arena_free(ctx->arena, chunk, sizeof(*chunk));
+        return;
+    }
+    soma_gorilla_reset(&chunk->packed);
+    chunk->next = ctx->free_chunks;
+    ctx->free_chunks = chunk;
+}
+
+static void chunk_list_free(timeseries_context* ctx, ts_chunk* chunk)
+{
+    while(chunk) {
+        ts_chunk* next = chunk->next;
+        soma_arena_account(ctx->arena, -(int64_t)soma_gorilla_size(&chunk->packed));
+        soma_gorilla_free(&chunk->packed);
+        soma_arena_free(ctx->arena, chunk->timestamps, columns_size(ctx));
+        soma_arena_free(ctx->arena, chunk, sizeof(*chunk));
+        chunk = next;
+    }
+}
+
+static ts_series* find_or_create_series(timeseries_context* ctx, uint64_t id)
+{
+    ts_series* series = NULL;
+    HASH_FIND(hh, ctx->series, &id, sizeof(id), series);
+    if(series) return series;
+    series = (ts_series*)soma_arena_calloc(ctx->arena, sizeof(*series));
+    if(!series) return NULL;
+    series->id = id;
+    HASH_ADD(hh, ctx->series, id, sizeof(series->id), series);
+    return series;
+}
+
+/* Returns the chunk in which the next sample of the series should go,
+ * starting a new one if the current one is full. When the series has
+ * reached its maximum number of chunks, its oldest chunk is recycled. */
+static ts_chunk* writable_chunk(timeseries_context* ctx, ts_series* series)
+{
+    ts_chunk* tail = series->tail;
+    if(tail && tail->count < ctx->chunk_capacity)
+        return tail;
+    if(tail && !tail->queued && !tail->spilled) {
+        if(ctx->compress) {
+            size_t size = soma_gorilla_size(&tail->packed);
+            soma_gorilla_seal(&tail->packed);
+            soma_arena_account(ctx->arena, (int64_t)soma_gorilla_size(&tail->packed) - (int64_t)size);
+        }
+        queue_push(ctx, tail);
+    }
+
+    if(ctx->max_chunks && series->num_chunks >= ctx->max_chunks) {
+        ts_chunk* oldest = series->head;
+        series->head = oldest->next;
+        series->num_chunks  -= 1;
+        series->num_samples -= oldest->count;
+        if(series->tail == oldest) series->tail = NULL;
+        chunk_release(ctx, oldest);
+    }
+
+    ts_chunk* chunk = chunk_alloc(ctx);
+    if(!chunk) return NULL;
+    if(series->tail) series->tail->next = chunk;
+    else series->head = chunk;
+    series->tail = chunk;
+    series->num_chunks += 1;
+    return chunk;
+}
+
+static soma_return_t read_config(
+        soma_provider_t provider,
+        const char* config_str,
+        soma_arena_t arena,
+        timeseries_context** context)
+{
+    struct json_object* config = NULL;
+
+    // read JSON config from provided string argument
+    if (config_str && strlen(config_str)) {
+        struct json_tokener*    tokener = json_tokener_new();
+        enum json_tokener_error jerr;
+        config = json_tokener_parse_ex(
+                tokener, config_str,
+                strlen(config_str));
+        if (!config) {
+            jerr = json_tokener_get_error(tokener);
+            margo_error(provider->mid, "JSON parse error: %s",
+                      json_tokener_error_desc(jerr));
+            json_tokener_free(tokener);
+            return SOMA_ERR_INVALID_CONFIG;
+        }
+        json_tokener_free(tokener);
+    } else {
+        // create default JSON config
+        config = json_object_new_object();
+    }
+    if(!json_object_is_type(config, json_type_object)) {
+        margo_error(provider->mid, "Timeseries backend config should be an object");
+        json_object_put(config);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+
+    int64_t chunk_capacity = DEFAULT_CHUNK_CAPACITY;
+    int64_t max_chunks     = DEFAULT_MAX_CHUNKS;
+    const char* compression = "none";
+    struct json_object* val;
+    if(json_object_object_get_ex(config, "compression", &val))
+        compression = json_object_get_string(val);
+    if(strcmp(compression, "none") != 0 && strcmp(compression, "gorilla") != 0) {
+        margo_error(provider->mid,
+            "Invalid compression \"%s\" in timeseries config (expected \"none\" or \"gorilla\")",
+            compression);
+        json_object_put(config);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    int compress = strcmp(compression, "gorilla") == 0;
+    if(json_object_object_get_ex(config, "chunk_capacity", &val))
+        chunk_capacity = json_object_get_int64(val);
+    if(json_object_object_get_ex(config, "max_chunks_per_series", &val))
+        max_chunks = json_object_get_int64(val);
+    if(chunk_capacity <= 0 || max_chunks < 0) {
+        margo_error(provider->mid,
+            "Invalid chunk_capacity or max_chunks_per_series in timeseries config");
+        json_object_put(config);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    // store back the values actually used
+    json_object_object_add(config, "chunk_capacity", json_object_new_int64(chunk_capacity));
+    json_object_object_add(config, "max_chunks_per_series", json_object_new_int64(max_chunks));
+    json_object_object_add(config, "compression",
+                           json_object_new_string(compress ? "gorilla" : "none"));
+
+    timeseries_context* ctx = (timeseries_context*)soma_arena_calloc(arena, sizeof(*ctx));
+    if(!ctx) {
+        json_object_put(config);
+        return SOMA_ERR_ALLOCATION;
+    }
+    ctx->mid            = provider->mid;
+    ctx->arena          = arena;
+    ctx->abtio          = provider->abtio;
+    ctx->spill_fd       = -1;
+    ctx->config         = config;
+    ctx->chunk_capacity = (size_t)chunk_capacity;
+    ctx->max_chunks     = (size_t)max_chunks;
+    ctx->compress       = compress;
+    if(ABT_mutex_create(&ctx->mutex) != ABT_SUCCESS) {
+        json_object_put(config);
+        soma_arena_free(arena, ctx, sizeof(*ctx));
+        return SOMA_ERR_FROM_ARGOBOTS;
+    }
+    *context = ctx;
+    return SOMA_SUCCESS;
+}
+
+static void free_context(timeseries_context* ctx)
+{
+    if(ctx->arena && !ctx->compress) {
+        /* the arena will take the series and chunks with it */
+        HASH_CLEAR(hh, ctx->series);
+    } else {
+        ts_series *series, *tmp;
+        HASH_ITER(hh, ctx->series, series, tmp) {
+            HASH_DEL(ctx->series, series);
+            chunk_list_free(ctx, series->head);
+            soma_arena_free(ctx->arena, series, sizeof(*series));
+        }
+        chunk_list_free(ctx, ctx->free_chunks);
+    }
+    if(ctx->spill_fd >= 0) {
+        abt_io_close(ctx->abtio, ctx->spill_fd);
+        abt_io_unlink(ctx->abtio, ctx->spill_path);
+    }
+    free(ctx->spill_path);
+    ABT_mutex_free(&ctx->mutex);
+    json_object_put(ctx->config);
+    soma_arena_free(ctx->arena, ctx, sizeof(*ctx));
+}
+
+/* Creates or opens the collector, along with its write-ahead log if the
+ * configuration has one. Without a log, samples only live in memory, so
+ * opening a collector is the same as creating an empty one. */
+static soma_return_t create_or_open(
+        soma_provider_t provider,
+        const char* config_str,
+        soma_arena_t arena,
+        int open,
+        void** context)
+{
+    timeseries_context* ctx = NULL;
+    soma_return_t ret = read_config(provider, config_str, arena, &ctx);
+    if(ret != SOMA_SUCCESS) return ret;
+
+    struct json_object* wal_json;
+    if(json_object_object_get_ex(ctx->config, "wal", &wal_json)) {
+        soma_wal_config wal_config;
+        ret = soma_wal_read_config(provider->mid, wal_json, &wal_config);
+        if(ret == SOMA_SUCCESS && open)
+            ret = soma_wal_open(provider->mid, provider->abtio, &wal_config,
+                                provider->admin_pool, replay_batch, ctx, &ctx->wal);
+        else if(ret == SOMA_SUCCESS)
+            ret = soma_wal_create(provider->mid, provider->abtio, &wal_config, &ctx->wal);
+        if(ret != SOMA_SUCCESS) {
+            free_context(ctx);
+            return ret;
+        }
+    }
+
+    *context = (void*)ctx;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t timeseries_create_collector(
+        soma_provider_t provider,
+        const char* config_str,
+        soma_arena_t arena,
+        void** context)
+{
+    return create_or_open(provider, config_str, arena, 0, context);
+}
+
+static soma_return_t timeseries_open_collector(
+        soma_provider_t provider,
+        const char* config_str,
+        soma_arena_t arena,
+        void** context)
+{
+    return create_or_open(provider, config_str, arena, 1, context);
+}
+
+static soma_return_t timeseries_close_collector(void* c)
+{
+    timeseries_context* ctx = (timeseries_context*)c;
+    if(ctx->wal)
+        soma_wal_close(ctx->wal);
+    free_context(ctx);
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t timeseries_destroy_collector(void* c)
+{
+    timeseries_context* ctx = (timeseries_context*)c;
+    soma_return_t ret = SOMA_SUCCESS;
+    if(ctx->wal)
+        ret = soma_wal_destroy(ctx->wal);
+    free_context(ctx);
+    return ret;
+}
+
+static void timeseries_say_hello(void* c)
+{
+    timeseries_context* ctx = (timeseries_context*)c;
+    ABT_mutex_lock(ctx->mutex);
+    unsigned num_series = HASH_COUNT(ctx->series);
+    uint64_t num_samples = ctx->num_samples;
+    ABT_mutex_unlock(ctx->mutex);
+    printf("Hello World from Timeseries collector (%u series, %lu samples)\n",
+           num_series, (unsigned long)num_samples);
+}
+
+static int32_t timeseries_compute_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    return x+y;
+}
+
+/* Stores a batch in the series' chunks */
+static soma_return_t store_batch(timeseries_context* ctx, const soma_batch_t* batch)
+{
+    soma_return_t ret = SOMA_SUCCESS;
+    size_t i = 0;
+
+    ABT_mutex_lock(ctx->mutex);
+    while(i < batch->count) {
+        /* consecutive samples often belong to the same series,
+         * handle each such run with a single lookup */
+        uint64_t id = batch->series[i];
+        size_t end = i + 1;
+        while(end < batch->count && batch->series[end] == id)
+            end++;
+        ts_series* series = find_or_create_series(ctx, id);
+        if(!series) {
+            ret = SOMA_ERR_ALLOCATION;
+            break;
+        }
+        /* copy the run into the series' chunks, column by column */
+        while(i < end) {
+            ts_chunk* chunk = writable_chunk(ctx, series);
+            if(!chunk) {
+                ret = SOMA_ERR_ALLOCATION;
+                goto finish;
+            }
+            size_t n = ctx->chunk_capacity - chunk->count;
+            if(n > end - i) n = end - i;
+            const uint64_t* timestamps = batch->timestamps + i;
+            if(ctx->compress) {
+                size_t size = soma_gorilla_size(&chunk->packed);
+                size_t j;
+                for(j = 0; j < n && ret == SOMA_SUCCESS; j++)
+                    ret = soma_gorilla_append(&chunk->packed, timestamps[j], batch->values[i + j]);
+                /* account for what was appended before a failure */
+                if(ret != SOMA_SUCCESS) n = j - 1;
+                soma_arena_account(ctx->arena,
+                        (int64_t)soma_gorilla_size(&chunk->packed) - (int64_t)size);
+            } else {
+                memcpy(chunk->timestamps + chunk->count, timestamps, n*sizeof(uint64_t));
+                memcpy(chunk->values + chunk->count, batch->values + i, n*sizeof(double));
+            }
+            uint64_t min_ts = chunk->min_timestamp;
+            uint64_t max_ts = chunk->max_timestamp;
+            size_t j;
+            for(j = 0; j < n; j++) {
+                min_ts = timestamps[j] < min_ts ? timestamps[j] : min_ts;
+                max_ts = timestamps[j] > max_ts ? timestamps[j] : max_ts;
+            }
+            chunk->min_timestamp = min_ts;
+            chunk->max_timestamp = max_ts;
+            chunk->count        += n;
+            series->num_samples += n;
+            ctx->num_samples    += n;
+            i += n;
+            if(ret != SOMA_SUCCESS) goto finish;
+        }
+    }
+
+finish:
+    ABT_mutex_unlock(ctx->mutex);
+    if(ret != SOMA_SUCCESS)
+        margo_error(ctx->mid, "Timeseries backend could not allocate a chunk");
+    return ret;
+}
+
+static soma_return_t replay_batch(void* c, unsigned long segment, const soma_batch_t* batch)
+{
+    (void)segment;
+    return store_batch((timeseries_context*)c, batch);
+}
+
+static soma_return_t timeseries_ingest(void* c, const soma_batch_t* batch)
+{
+    timeseries_context* ctx = (timeseries_context*)c;
+    /* the batch must be in the log (and durable, with the default
+     * fsync policy) before it becomes visible */
+    if(ctx->wal) {
+        soma_return_t ret = soma_wal_append(ctx->wal, batch);
+        if(ret != SOMA_SUCCESS) return ret;
+    }
+    return store_batch(ctx, batch);
+}
+
+static soma_return_t timeseries_flush(void* c)
+{
+    timeseries_context* ctx = (timeseries_context*)c;
+    if(ctx->wal)
+        return soma_wal_sync(ctx->wal);
+    return SOMA_SUCCESS;
+}
+
+/* Appends the samples of the oldest full chunk to the spill file and
+ * frees them; must be called with the mutex held */
+static soma_return_t spill_oldest(timeseries_context* ctx, size_t* spilled)
+{
+    ts_chunk* chunk = ctx->oldest;
+    const char* data;
+    size_t size;
+    if(ctx->compress) {
+        data = (const char*)chunk->packed.words;
+        size = soma_gorilla_size(&chunk->packed);
+    } else {
+        data = (const char*)chunk->timestamps;
+        size = columns_size(ctx);
+    }
+    size_t done = 0;
+    while(done < size) {
+        ssize_t n = abt_io_pwrite(ctx->abtio, ctx->spill_fd, data + done,
+                                  size - done, ctx->spill_end + done);
+        if(n <= 0) {
+            margo_error(ctx->mid, "Could not write to spill file %s (errno %d)",
+                        ctx->spill_path, (int)-n);
+            return SOMA_ERR_IO;
+        }
+        done += (size_t)n;
+    }
+    queue_remove(ctx, chunk);
+    chunk->spilled      = 1;
+    chunk->spill_offset = ctx->spill_end;
+    chunk->spill_size   = size;
+    ctx->spill_end     += size;
+    if(ctx->compress) {
+        soma_arena_account(ctx->arena, -(int64_t)size);
+        soma_gorilla_free(&chunk->packed);
+    } else {
+        soma_arena_free(ctx->arena, chunk->timestamps, size);
+        chunk->timestamps = NULL;
+        chunk->values     = NULL;
+    }
+    *spilled += size;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t timeseries_spill(
+        void* c,
+        const char* path,
+        size_t bytes,
+        size_t* spilled)
+{
+    timeseries_context* ctx = (timeseries_context*)c;
+    soma_return_t ret = SOMA_SUCCESS;
+    *spilled = 0;
+    if(ctx->abtio == ABT_IO_INSTANCE_NULL)
+        return SOMA_ERR_OP_UNSUPPORTED;
+    /* one chunk at a time, so that samples keep coming in meanwhile */
+    while(*spilled < bytes && ret == SOMA_SUCCESS) {
+        ABT_mutex_lock(ctx->mutex);
+        if(!ctx->oldest) {
+            ABT_mutex_unlock(ctx->mutex);
+            break;
+        }
+        if(ctx->spill_fd < 0) {
+            ctx->spill_path = strdup(path);
+            ctx->spill_fd = ctx->spill_path
+                ? abt_io_open(ctx->abtio, path, O_RDWR|O_CREAT|O_TRUNC, 0600) : -ENOMEM;
+            if(ctx->spill_fd < 0) {
+                margo_error(ctx->mid, "Could not open spill file %s (errno %d)",
+                            path, -ctx->spill_fd);
+                free(ctx->spill_path);
+                ctx->spill_path = NULL;
+                ret = SOMA_ERR_IO;
+            }
+        }
+        if(ret == SOMA_SUCCESS)
+            ret = spill_oldest(ctx, spilled);
+        ABT_mutex_unlock(ctx->mutex);
+    }
+    return ret;
+}
+
+/* Gives a view of the samples of a chunk, reading them from the spill
+ * file into *buffer (to be freed by the caller) if needed; must be
+ * called with the mutex held */
+static soma_return_t load_chunk(
+        timeseries_context* ctx,
+        const ts_chunk* chunk,
+        ts_chunk* view,
+        char** buffer)
+{
+    *view = *chunk;
+    *buffer = NULL;
+    if(!chunk->spilled)
+        return SOMA_SUCCESS;
+    char* buf = (char*)malloc(chunk->spill_size);
+    if(!buf) return SOMA_ERR_ALLOCATION;
+    size_t done = 0;
+    while(done < chunk->spill_size) {
+        ssize_t n = abt_io_pread(ctx->abtio, ctx->spill_fd, buf + done,
+                                 chunk->spill_size - done, chunk->spill_offset + done);
+        if(n <= 0) {
+            margo_error(ctx->mid, "Could not read from spill file %s (errno %d)",
+                        ctx->spill_path, (int)-n);
+            free(buf);
+            return SOMA_ERR_IO;
+        }
+        done += (size_t)n;
+    }
+    if(ctx->compress) {
+        view->packed.words     = (uint64_t*)buf;
+        view->packed.num_words = chunk->spill_size / sizeof(uint64_t);
+        view->packed.count     = chunk->count;
+    } else {
+        view->timestamps = (uint64_t*)buf;
+        view->values     = (double*)(buf + chunk->spill_size / 2);
+    }
+    *buffer = buf;
+    return SOMA_SUCCESS;
+}
+
+/* Passes the samples of a chunk selected by the query, once *to_skip
+ * of them have been skipped, to fn a slice at a time, decoding them into
+ * the slice buffers unless they can be passed in place; returns 1 if fn
+ * stopped the scan */
+static int scan_chunk(
+        const timeseries_context* ctx,
+        const ts_chunk* chunk,
+        const soma_query_t* query,
+        uint64_t* to_skip,
+        uint64_t* timestamps,
+        double* values,
+        soma_scan_fn fn,
+        void* uargs)
+{
+    if(!ctx->compress
+    && chunk->min_timestamp >= query->t_start
+    && chunk->max_timestamp < query->t_end) {
+        size_t first = (size_t)*to_skip;
+        *to_skip = 0;
+        return fn(uargs, chunk->timestamps + first, chunk->values + first,
+                  chunk->count - first) != 0;
+    }
+    soma_gorilla_iter it;
+    size_t j = 0, n = 0;
+    uint64_t t;
+    double v;
+    if(ctx->compress)
+        soma_gorilla_iter_init(&it, &chunk->packed);
+    for(;;) {
+        if(ctx->compress) {
+            if(!soma_gorilla_iter_next(&it, &t, &v)) break;
+        } else {
+            if(j == chunk->count) break;
+            t = chunk->timestamps[j];
+            v = chunk->values[j];
+            j++;
+        }
+        if(t < query->t_start || t >= query->t_end)
+            continue;
+        if(*to_skip) {
+            (*to_skip)--;
+            continue;
+        }
+        timestamps[n] = t;
+        values[n]     = v;
+        if(++n == SCAN_SLICE_SIZE) {
+            if(fn(uargs, timestamps, values, n)) return 1;
+            n = 0;
+        }
+    }
+    return n && fn(uargs, timestamps, values, n);
+}
+
+static soma_return_t timeseries_scan(
+        void* c,
+        const soma_query_t* query,
+        soma_scan_fn fn,
+        void* uargs)
+{
+    timeseries_context* ctx = (timeseries_context*)c;
+    uint64_t to_skip = query->offset;
+    ts_series* series = NULL;
+    ts_chunk* chunk;
+    soma_return_t ret = SOMA_SUCCESS;
+
+    uint64_t* timestamps = (uint64_t*)malloc(
+            SCAN_SLICE_SIZE * (sizeof(uint64_t) + sizeof(double)));
+    if(!timestamps) return SOMA_ERR_ALLOCATION;
+    double* values = (double*)(timestamps + SCAN_SLICE_SIZE);
+
+    ABT_mutex_lock(ctx->mutex);
+    HASH_FIND(hh, ctx->series, &query->series, sizeof(query->series), series);
+    for(chunk = series ? series->head : NULL; chunk; chunk = chunk->next) {
+        if(chunk->count == 0
+        || chunk->max_timestamp < query->t_start
+        || chunk->min_timestamp >= query->t_end)
+            continue;
+        /* a chunk whose samples are all selected and all skipped is
+         * not even read back or decoded */
+        if(to_skip >= chunk->count
+        && chunk->min_timestamp >= query->t_start
+        && chunk->max_timestamp < query->t_end) {
+            to_skip -= chunk->count;
+            continue;
+        }
+        ts_chunk view;
+        char* buffer;
+        ret = load_chunk(ctx, chunk, &view, &buffer);
+        if(ret != SOMA_SUCCESS) break;
+        int stop = scan_chunk(ctx, &view, query, &to_skip,
+                              timestamps, values, fn, uargs);
+        free(buffer);
+        if(stop) break;
+    }
+    ABT_mutex_unlock(ctx->mutex);
+
+    free(timestamps);
+    return ret;
+}
+
+struct copy_args {
+    uint64_t* timestamps;
+    double*   values;
+    size_t    capacity;
+    size_t    found;
+};
+
+static int copy_samples(
+        void* uargs,
+        const uint64_t* timestamps,
+        const double* values,
+        size_t count)
+{
+    struct copy_args* args = (struct copy_args*)uargs;
+    if(count > args->capacity - args->found)
+        count = args->capacity - args->found;
+    memcpy(args->timestamps + args->found, timestamps, count * sizeof(*timestamps));
+    memcpy(args->values + args->found, values, count * sizeof(*values));
+    args->found += count;
+    return args->found == args->capacity;
+}
+
+static soma_return_t timeseries_query(
+        void* c,
+        const soma_query_t* query,
+        uint64_t* timestamps,
+        double* values,
+        size_t* count)
+{
+    struct copy_args args = { timestamps, values, *count, 0 };
+    soma_return_t ret = SOMA_SUCCESS;
+    if(args.capacity)
+        ret = timeseries_scan(c, query, copy_samples, &args);
+    *count = args.found;
+    return ret;
+}
+
+static soma_backend_impl timeseries_backend = {
+    .name             = "timeseries",
+
+    .close_collector   = timeseries_close_collector,
+    .destroy_collector = timeseries_destroy_collector,
+
+    .create_collector_in_arena = timeseries_create_collector,
+    .open_collector_in_arena   = timeseries_open_collector,
+    .spill                     = timeseries_spill,
+
+    .hello            = timeseries_say_hello,
+    .sum              = timeseries_compute_sum,
+
+    .ingest           = timeseries_ingest,
+    .query            = timeseries_query,
+    .flush            = timeseries_flush,
+
+    .scan             = timeseries_scan
+};
+
+soma_return_t soma_provider_register_timeseries_backend(soma_provider_t provider)
+{
+    return soma_provider_register_backend(provider, &timeseries_backend);
+}
@@ -0,0 +1,13 @@
+/*
+ * (C) 2020 The University of Chicago
+ * 
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _TIMESERIES_BACKEND_H
+#define _TIMESERIES_BACKEND_H
+
+#include "soma/soma-server.h"
+
+soma_return_t soma_provider_register_timeseries_backend(soma_provider_t provider);
+
+#endif
@@ -11,9 +11,33 @@
 #include <mercury_macros.h>
 #include <mercury_proc.h>
 #include <mercury_proc_string.h>
+#include <mercury_proc_bulk.h>
 #include "soma/soma-common.h"
+#include "packed.h"
 
 static inline hg_return_t hg_proc_soma_collector_id_t(hg_proc_t proc, soma_collector_id_t *id);
+static inline hg_return_t hg_proc_soma_collector_index_t(hg_proc_t proc, soma_collector_index_t *index);
+
+/* Reference to a collector sent by clients: the provider-local index of
+ * the collector if known, and its uuid otherwise. The uuid is only
+ * serialized when index.slot is SOMA_COLLECTOR_SLOT_NONE. */
+typedef struct soma_collector_ref_t {
+    soma_collector_index_t index;
+    soma_collector_id_t    id;
+} soma_collector_ref_t;
+
+static inline hg_return_t hg_proc_soma_collector_ref_t(hg_proc_t proc, soma_collector_ref_t *ref);
+
+/* Batch of samples sent within an RPC, compressed as described in
+ * packed.h. The sender points batch to its columns; the receiver gets
+ * batch pointing into columns, a block it owns holding the decoded
+ * series, timestamps, and values. */
+typedef struct soma_packed_batch_t {
+    soma_batch_t batch;
+    void*        columns;
+} soma_packed_batch_t;
+
+static inline hg_return_t hg_proc_soma_packed_batch_t(hg_proc_t proc, soma_packed_batch_t *packed);
 
 /* Admin RPC types */
 
@@ -24,7 +48,8 @@ MERCURY_GEN_PROC(create_collector_in_t,
 
 MERCURY_GEN_PROC(create_collector_out_t,
         ((int32_t)(ret))\
-        ((soma_collector_id_t)(id)))
+        ((soma_collector_id_t)(id))\
+        ((soma_collector_index_t)(index)))
 
 MERCURY_GEN_PROC(open_collector_in_t,
         ((hg_string_t)(type))\
@@ -33,7 +58,8 @@ MERCURY_GEN_PROC(open_collector_in_t,
 
 MERCURY_GEN_PROC(open_collector_out_t,
         ((int32_t)(ret))\
-        ((soma_collector_id_t)(id)))
+        ((soma_collector_id_t)(id))\
+        ((soma_collector_index_t)(index)))
 
 MERCURY_GEN_PROC(close_collector_in_t,
         ((hg_string_t)(token))\
@@ -49,13 +75,27 @@ MERCURY_GEN_PROC(destroy_collector_in_t,
 MERCURY_GEN_PROC(destroy_collector_out_t,
         ((int32_t)(ret)))
 
+/* Pages of at most this many bytes of ids are sent inline in the
+ * response, larger ones are pushed to a bulk region of the caller */
+#define SOMA_LIST_INLINE_MAX 4096
+
+/* type is the backend type to list ("" for all), cursor is 0 for the
+ * first page and the cursor of the previous response for the next ones,
+ * bulk is HG_BULK_NULL or exposes room for max_ids ids */
 MERCURY_GEN_PROC(list_collectors_in_t,
         ((hg_string_t)(token))\
-        ((hg_size_t)(max_ids)))
+        ((hg_string_t)(type))\
+        ((uint64_t)(cursor))\
+        ((hg_size_t)(max_ids))\
+        ((hg_bulk_t)(bulk)))
 
+/* ids are only serialized if the input had no bulk handle;
+ * cursor is 0 once the listing is complete */
 typedef struct list_collectors_out_t {
     int32_t ret;
     hg_size_t count;
+    uint64_t cursor;
+    uint8_t in_bulk;
     soma_collector_id_t* ids;
 } list_collectors_out_t;
 
@@ -70,6 +110,13 @@ static inline hg_return_t hg_proc_list_collectors_out_t(hg_proc_t proc, void *da
     ret = hg_proc_hg_size_t(proc, &(out->count));
     if(ret != HG_SUCCESS) return ret;
 
+    ret = hg_proc_hg_uint64_t(proc, &(out->cursor));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_uint8_t(proc, &(out->in_bulk));
+    if(ret != HG_SUCCESS) return ret;
+    if(out->in_bulk) return HG_SUCCESS;
+
     switch(hg_proc_get_op(proc)) {
     case HG_DECODE:
         out->ids = (soma_collector_id_t*)calloc(out->count, sizeof(*(out->ids)));
@@ -85,18 +132,244 @@ static inline hg_return_t hg_proc_list_collectors_out_t(hg_proc_t proc, void *da
     return ret;
 }
 
+MERCURY_GEN_PROC(get_stats_in_t,
+        ((hg_string_t)(token)))
+
+MERCURY_GEN_PROC(get_stats_out_t,
+        ((int32_t)(ret))\
+        ((hg_string_t)(stats)))
+
 /* Client RPC types */
 
 MERCURY_GEN_PROC(hello_in_t,
-        ((soma_collector_id_t)(collector_id)))
+        ((soma_collector_ref_t)(ref)))
 
 MERCURY_GEN_PROC(sum_in_t,
-        ((soma_collector_id_t)(collector_id))\
+        ((soma_collector_ref_t)(ref))\
         ((int32_t)(x))\
         ((int32_t)(y)))
 
 MERCURY_GEN_PROC(sum_out_t,
         ((int32_t)(result))\
+        ((int32_t)(ret))\
+        ((soma_collector_index_t)(index)))
+
+/* the bulk region holds the series of the count samples,
+ * followed by their timestamps, followed by their values */
+MERCURY_GEN_PROC(publish_batch_in_t,
+        ((soma_collector_ref_t)(ref))\
+        ((hg_size_t)(count))\
+        ((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(publish_batch_out_t,
+        ((int32_t)(ret))\
+        ((soma_collector_index_t)(index)))
+
+/* the samples travel compressed within the RPC itself,
+ * the response is a publish_batch_out_t */
+MERCURY_GEN_PROC(publish_packed_in_t,
+        ((soma_collector_ref_t)(ref))\
+        ((soma_packed_batch_t)(samples)))
+
+/* the bulk region holds count soma_aggregate_t */
+MERCURY_GEN_PROC(publish_aggregates_in_t,
+        ((soma_collector_ref_t)(ref))\
+        ((hg_size_t)(count))\
+        ((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(publish_aggregates_out_t,
+        ((int32_t)(ret))\
+        ((soma_collector_index_t)(index)))
+
+typedef struct get_aggregates_in_t {
+    soma_collector_ref_t ref;
+    hg_size_t count;
+    uint64_t* series;
+} get_aggregates_in_t;
+
+static inline hg_return_t hg_proc_get_aggregates_in_t(hg_proc_t proc, void *data)
+{
+    get_aggregates_in_t* in = (get_aggregates_in_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_soma_collector_ref_t(proc, &(in->ref));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(in->count));
+    if(ret != HG_SUCCESS) return ret;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_DECODE:
+        in->series = (uint64_t*)calloc(in->count, sizeof(*(in->series)));
+        if(in->count && !in->series) return HG_NOMEM;
+        /* fall through */
+    case HG_ENCODE:
+        if(in->count)
+            ret = hg_proc_memcpy(proc, in->series, sizeof(*(in->series))*in->count);
+        break;
+    case HG_FREE:
+        free(in->series);
+        break;
+    }
+    return ret;
+}
+
+typedef struct get_aggregates_out_t {
+    int32_t ret;
+    soma_collector_index_t index;
+    hg_size_t count;
+    soma_aggregate_t* aggregates;
+} get_aggregates_out_t;
+
+static inline hg_return_t hg_proc_get_aggregates_out_t(hg_proc_t proc, void *data)
+{
+    get_aggregates_out_t* out = (get_aggregates_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_soma_collector_index_t(proc, &(out->index));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(out->count));
+    if(ret != HG_SUCCESS) return ret;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_DECODE:
+        out->aggregates = (soma_aggregate_t*)calloc(out->count, sizeof(*(out->aggregates)));
+        if(out->count && !out->aggregates) return HG_NOMEM;
+        /* fall through */
+    case HG_ENCODE:
+        if(out->count)
+            ret = hg_proc_memcpy(proc, out->aggregates, sizeof(*(out->aggregates))*out->count);
+        break;
+    case HG_FREE:
+        free(out->aggregates);
+        break;
+    }
+    return ret;
+}
+
+/* capacity is the maximum number of results the caller accepts, and
+ * cursor the position to resume from (see soma_query_cursor_t) */
+typedef struct query_in_t {
+    soma_collector_ref_t ref;
+    uint64_t t_start;
+    uint64_t t_end;
+    uint64_t step;
+    int32_t aggregation;
+    hg_size_t capacity;
+    soma_query_cursor_t cursor;
+    hg_size_t count;
+    uint64_t* series;
+} query_in_t;
+
+static inline hg_return_t hg_proc_query_in_t(hg_proc_t proc, void *data)
+{
+    query_in_t* in = (query_in_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_soma_collector_ref_t(proc, &(in->ref));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_uint64_t(proc, &(in->t_start));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_uint64_t(proc, &(in->t_end));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_uint64_t(proc, &(in->step));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(in->aggregation));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(in->capacity));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_uint64_t(proc, &(in->cursor.series));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_uint64_t(proc, &(in->cursor.offset));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(in->count));
+    if(ret != HG_SUCCESS) return ret;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_DECODE:
+        in->series = (uint64_t*)calloc(in->count, sizeof(*(in->series)));
+        if(in->count && !in->series) return HG_NOMEM;
+        /* fall through */
+    case HG_ENCODE:
+        if(in->count)
+            ret = hg_proc_memcpy(proc, in->series, sizeof(*(in->series))*in->count);
+        break;
+    case HG_FREE:
+        free(in->series);
+        break;
+    }
+    return ret;
+}
+
+typedef struct query_out_t {
+    int32_t ret;
+    soma_collector_index_t index;
+    soma_query_cursor_t next;
+    hg_size_t count;
+    soma_sample_t* results;
+} query_out_t;
+
+static inline hg_return_t hg_proc_query_out_t(hg_proc_t proc, void *data)
+{
+    query_out_t* out = (query_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_soma_collector_index_t(proc, &(out->index));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_uint64_t(proc, &(out->next.series));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_uint64_t(proc, &(out->next.offset));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(out->count));
+    if(ret != HG_SUCCESS) return ret;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_DECODE:
+        out->results = (soma_sample_t*)calloc(out->count, sizeof(*(out->results)));
+        if(out->count && !out->results) return HG_NOMEM;
+        /* fall through */
+    case HG_ENCODE:
+        if(out->count)
+            ret = hg_proc_memcpy(proc, out->results, sizeof(*(out->results))*out->count);
+        break;
+    case HG_FREE:
+        free(out->results);
+        break;
+    }
+    return ret;
+}
+
+MERCURY_GEN_PROC(shm_attach_in_t,
+        ((soma_collector_ref_t)(ref))\
+        ((hg_string_t)(name)))
+
+MERCURY_GEN_PROC(shm_attach_out_t,
+        ((int32_t)(ret))\
+        ((uint64_t)(channel))\
+        ((soma_collector_index_t)(index)))
+
+MERCURY_GEN_PROC(shm_detach_in_t,
+        ((uint64_t)(channel)))
+
+MERCURY_GEN_PROC(shm_detach_out_t,
         ((int32_t)(ret)))
 
 /* Extra hand-coded serialization functions */
@@ -107,4 +380,79 @@ static inline hg_return_t hg_proc_soma_collector_id_t(
     return hg_proc_memcpy(proc, id, sizeof(*id));
 }
 
+static inline hg_return_t hg_proc_soma_collector_index_t(
+        hg_proc_t proc, soma_collector_index_t *index)
+{
+    return hg_proc_memcpy(proc, index, sizeof(*index));
+}
+
+static inline hg_return_t hg_proc_soma_collector_ref_t(
+        hg_proc_t proc, soma_collector_ref_t *ref)
+{
+    hg_return_t ret = hg_proc_soma_collector_index_t(proc, &ref->index);
+    if(ret != HG_SUCCESS) return ret;
+    if(ref->index.slot == SOMA_COLLECTOR_SLOT_NONE)
+        ret = hg_proc_soma_collector_id_t(proc, &ref->id);
+    return ret;
+}
+
+static inline hg_return_t hg_proc_soma_packed_batch_t(
+        hg_proc_t proc, soma_packed_batch_t *packed)
+{
+    hg_return_t ret = HG_SUCCESS;
+    uint64_t size = 0;
+    uint8_t* buf = NULL;
+    uint64_t count = 0;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_ENCODE:
+        buf = (uint8_t*)malloc(SOMA_PACKED_MAX_SIZE(packed->batch.count));
+        if(!buf) return HG_NOMEM;
+        size = soma_packed_encode(&packed->batch, buf);
+        ret = hg_proc_hg_uint64_t(proc, &size);
+        if(ret == HG_SUCCESS)
+            ret = hg_proc_memcpy(proc, buf, size);
+        free(buf);
+        break;
+    case HG_DECODE:
+        packed->columns = NULL;
+        memset(&packed->batch, 0, sizeof(packed->batch));
+        ret = hg_proc_hg_uint64_t(proc, &size);
+        if(ret != HG_SUCCESS) return ret;
+        if(size > hg_proc_get_size_left(proc)) return HG_INVALID_ARG;
+        buf = (uint8_t*)hg_proc_save_ptr(proc, size);
+        if(!soma_packed_count(buf, size, &count)) {
+            ret = HG_INVALID_ARG;
+        } else if(count) {
+            packed->columns = malloc(count * (2*sizeof(uint64_t) + sizeof(double)));
+            if(!packed->columns) {
+                ret = HG_NOMEM;
+            } else {
+                uint64_t* series     = (uint64_t*)packed->columns;
+                uint64_t* timestamps = series + count;
+                double*   values     = (double*)(timestamps + count);
+                if(soma_packed_decode(buf, size, series, timestamps, values)) {
+                    packed->batch.count      = count;
+                    packed->batch.series     = series;
+                    packed->batch.timestamps = timestamps;
+                    packed->batch.values     = values;
+                } else {
+                    ret = HG_INVALID_ARG;
+                }
+            }
+        }
+        if(ret != HG_SUCCESS) {
+            free(packed->columns);
+            packed->columns = NULL;
+        }
+        hg_proc_restore_ptr(proc, buf, size);
+        break;
+    case HG_FREE:
+        free(packed->columns);
+        packed->columns = NULL;
+        break;
+    }
+    return ret;
+}
+
 #endif
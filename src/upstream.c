@@ -0,0 +1,307 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <time.h>
+#include "types.h"
+#include "provider.h"
+#include "upstream.h"
+
+#define DEFAULT_INTERVAL 1.0
+
+struct drain_args {
+    soma_aggregate_t* aggregates;
+    size_t            count;
+    size_t            capacity;
+    soma_return_t     ret;
+};
+
+static int drain_collector_fn(soma_collector* collector, void* uargs)
+{
+    struct drain_args* args = (struct drain_args*)uargs;
+    args->ret = soma_aggregator_drain(collector->aggregator,
+            &args->aggregates, &args->count, &args->capacity);
+    return args->ret != SOMA_SUCCESS;
+}
+
+/* Sends the aggregates in a single publish_aggregates RPC */
+static soma_return_t send_aggregates(
+        soma_provider_t provider,
+        const soma_aggregate_t* aggregates,
+        size_t count)
+{
+    soma_upstream* up = provider->upstream;
+    margo_instance_id mid = provider->mid;
+    hg_return_t hret;
+    hg_handle_t h = HG_HANDLE_NULL;
+    publish_aggregates_in_t  in;
+    publish_aggregates_out_t out;
+    soma_return_t ret = SOMA_ERR_FROM_MERCURY;
+
+    in.bulk = HG_BULK_NULL;
+
+    if(up->addr == HG_ADDR_NULL) {
+        hret = margo_addr_lookup(mid, up->address, &up->addr);
+        if(hret != HG_SUCCESS) {
+            up->addr = HG_ADDR_NULL;
+            margo_error(mid, "Could not look up upstream address %s (mercury error %d)",
+                        up->address, hret);
+            goto finish;
+        }
+    }
+
+    in.ref.index.slot       = SOMA_COLLECTOR_SLOT_NONE;
+    in.ref.index.generation = 0;
+    in.ref.id               = up->collector_id;
+    in.count                = count;
+
+    void*     buf_ptrs[1]  = { (void*)aggregates };
+    hg_size_t buf_sizes[1] = { count * sizeof(*aggregates) };
+    hret = margo_bulk_create(mid, 1, buf_ptrs, buf_sizes, HG_BULK_READ_ONLY, &in.bulk);
+    if(hret != HG_SUCCESS) goto finish;
+
+    hret = margo_create(mid, up->addr, up->rpc_id, &h);
+    if(hret != HG_SUCCESS) goto finish;
+
+    /* an unresponsive upstream must not hold the round (and the final
+     * flush when the provider stops) forever; the caller puts the
+     * aggregates back in the backlog so they go with the next round */
+    hret = margo_provider_forward_timed(up->provider_id, h, &in, up->timeout * 1000.0);
+    if(hret == HG_TIMEOUT) {
+        margo_warning(mid, "Forwarding aggregates to %s timed out after %g seconds",
+                      up->address, up->timeout);
+        goto finish;
+    }
+    if(hret != HG_SUCCESS) goto finish;
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) goto finish;
+    ret = out.ret;
+    margo_free_output(h, &out);
+
+finish:
+    if(h != HG_HANDLE_NULL)
+        margo_destroy(h);
+    margo_bulk_free(in.bulk);
+    return ret;
+}
+
+/* Collects the pending aggregates of the backlog and of every
+ * collector and sends them upstream, putting them in the backlog
+ * if they could not be sent */
+static void forward_round(soma_provider_t provider)
+{
+    soma_upstream* up = provider->upstream;
+    struct drain_args args = { NULL, 0, 0, SOMA_SUCCESS };
+
+    soma_aggregator_drain(up->backlog, &args.aggregates, &args.count, &args.capacity);
+
+    unsigned epoch = soma_collector_table_read_lock(&provider->collectors);
+    soma_collector_table_iterate(&provider->collectors, drain_collector_fn, &args);
+    soma_collector_table_read_unlock(&provider->collectors, epoch);
+
+    if(args.count) {
+        soma_return_t ret = send_aggregates(provider, args.aggregates, args.count);
+        if(ret != SOMA_SUCCESS) {
+            margo_warning(provider->mid,
+                    "Could not forward %lu aggregates upstream (error %d), will retry",
+                    args.count, ret);
+            soma_aggregator_merge(up->backlog, args.aggregates, args.count,
+                                  SOMA_AGGREGATE_PENDING);
+        } else {
+            margo_debug(provider->mid, "Forwarded %lu aggregates upstream", args.count);
+        }
+    }
+    free(args.aggregates);
+}
+
+static void forward_loop(void* arg)
+{
+    soma_provider_t provider = (soma_provider_t)arg;
+    soma_upstream* up = provider->upstream;
+
+    ABT_mutex_lock(up->mutex);
+    while(!up->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        double t = deadline.tv_sec + deadline.tv_nsec * 1e-9 + up->interval;
+        deadline.tv_sec  = (time_t)t;
+        deadline.tv_nsec = (long)((t - (double)deadline.tv_sec) * 1e9);
+        ABT_cond_timedwait(up->cond, up->mutex, &deadline);
+        if(up->stop) break;
+        ABT_mutex_unlock(up->mutex);
+        forward_round(provider);
+        ABT_mutex_lock(up->mutex);
+    }
+    ABT_mutex_unlock(up->mutex);
+}
+
+static void upstream_free(margo_instance_id mid, soma_upstream* up)
+{
+    if(up->addr != HG_ADDR_NULL)
+        margo_addr_free(mid, up->addr);
+    soma_aggregator_free(up->backlog);
+    if(up->cond != ABT_COND_NULL)
+        ABT_cond_free(&up->cond);
+    if(up->mutex != ABT_MUTEX_NULL)
+        ABT_mutex_free(&up->mutex);
+    free(up->address);
+    free(up);
+}
+
+static soma_return_t parse_upstream_config(
+        margo_instance_id mid,
+        struct json_object* config,
+        soma_upstream* up)
+{
+    struct json_object* address     = json_object_object_get(config, "address");
+    struct json_object* provider_id = json_object_object_get(config, "provider_id");
+    struct json_object* collector   = json_object_object_get(config, "collector");
+    struct json_object* interval    = json_object_object_get(config, "interval");
+    struct json_object* timeout     = json_object_object_get(config, "timeout");
+
+    if(!json_object_is_type(config, json_type_object)
+    || !address     || !json_object_is_type(address, json_type_string)
+    || !provider_id || !json_object_is_type(provider_id, json_type_int)
+    || !collector   || !json_object_is_type(collector, json_type_string)) {
+        margo_error(mid, "\"upstream\" should be an object with a string \"address\","
+                         " an integer \"provider_id\", and a string \"collector\"");
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    if(json_object_get_string_len(collector) != 36
+    || uuid_parse(json_object_get_string(collector), up->collector_id.uuid) != 0) {
+        margo_error(mid, "Invalid upstream collector id \"%s\"",
+                    json_object_get_string(collector));
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    int64_t id = json_object_get_int64(provider_id);
+    if(id < 0 || id > UINT16_MAX) {
+        margo_error(mid, "Invalid upstream provider id %ld", id);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    up->provider_id = (uint16_t)id;
+
+    up->interval = DEFAULT_INTERVAL;
+    if(interval) {
+        if(!json_object_is_type(interval, json_type_double)
+        && !json_object_is_type(interval, json_type_int)) {
+            margo_error(mid, "\"interval\" in \"upstream\" should be a number");
+            return SOMA_ERR_INVALID_CONFIG;
+        }
+        up->interval = json_object_get_double(interval);
+        if(up->interval <= 0) {
+            margo_error(mid, "\"interval\" in \"upstream\" should be positive");
+            return SOMA_ERR_INVALID_CONFIG;
+        }
+    }
+
+    up->timeout = up->interval;
+    if(timeout) {
+        if(!json_object_is_type(timeout, json_type_double)
+        && !json_object_is_type(timeout, json_type_int)) {
+            margo_error(mid, "\"timeout\" in \"upstream\" should be a number");
+            return SOMA_ERR_INVALID_CONFIG;
+        }
+        up->timeout = json_object_get_double(timeout);
+        if(up->timeout <= 0) {
+            margo_error(mid, "\"timeout\" in \"upstream\" should be positive");
+            return SOMA_ERR_INVALID_CONFIG;
+        }
+    }
+
+    up->address = strdup(json_object_get_string(address));
+    if(!up->address) return SOMA_ERR_ALLOCATION;
+    return SOMA_SUCCESS;
+}
+
+soma_return_t soma_upstream_start(
+        soma_provider_t provider,
+        ABT_pool pool)
+{
+    margo_instance_id mid = provider->mid;
+    struct json_object* config = NULL;
+    soma_return_t ret;
+
+    if(!json_object_object_get_ex(provider->config, "upstream", &config))
+        return SOMA_SUCCESS;
+
+    soma_upstream* up = (soma_upstream*)calloc(1, sizeof(*up));
+    if(!up) return SOMA_ERR_ALLOCATION;
+    up->addr  = HG_ADDR_NULL;
+    up->ult   = ABT_THREAD_NULL;
+    up->mutex = ABT_MUTEX_NULL;
+    up->cond  = ABT_COND_NULL;
+
+    ret = parse_upstream_config(mid, config, up);
+    if(ret != SOMA_SUCCESS) goto error;
+
+    up->backlog = soma_aggregator_create();
+    if(!up->backlog) {
+        ret = SOMA_ERR_ALLOCATION;
+        goto error;
+    }
+    if(ABT_mutex_create(&up->mutex) != ABT_SUCCESS
+    || ABT_cond_create(&up->cond) != ABT_SUCCESS) {
+        ret = SOMA_ERR_FROM_ARGOBOTS;
+        goto error;
+    }
+
+    hg_bool_t flag;
+    margo_registered_name(mid, "soma_publish_aggregates", &up->rpc_id, &flag);
+    if(flag == HG_FALSE)
+        up->rpc_id = MARGO_REGISTER(mid, "soma_publish_aggregates",
+                publish_aggregates_in_t, publish_aggregates_out_t, NULL);
+
+    if(pool == ABT_POOL_NULL)
+        margo_get_handler_pool(mid, &pool);
+
+    provider->upstream = up;
+    if(ABT_thread_create(pool, forward_loop, provider, ABT_THREAD_ATTR_NULL,
+                         &up->ult) != ABT_SUCCESS) {
+        provider->upstream = NULL;
+        ret = SOMA_ERR_FROM_ARGOBOTS;
+        goto error;
+    }
+
+    margo_info(mid, "Forwarding aggregates to provider %u at %s every %g seconds",
+               up->provider_id, up->address, up->interval);
+    return SOMA_SUCCESS;
+
+error:
+    upstream_free(mid, up);
+    return ret;
+}
+
+void soma_upstream_stop(soma_provider_t provider)
+{
+    soma_upstream* up = provider->upstream;
+    if(!up) return;
+
+    ABT_mutex_lock(up->mutex);
+    up->stop = 1;
+    ABT_cond_signal(up->cond);
+    ABT_mutex_unlock(up->mutex);
+    ABT_thread_join(up->ult);
+    ABT_thread_free(&up->ult);
+
+    /* send whatever was received since the last round */
+    forward_round(provider);
+
+    provider->upstream = NULL;
+    upstream_free(provider->mid, up);
+}
+
+void soma_upstream_save(
+        soma_provider_t provider,
+        soma_aggregator* agg)
+{
+    soma_upstream* up = provider->upstream;
+    if(!up || !agg) return;
+    soma_aggregate_t* aggregates = NULL;
+    size_t count = 0, capacity = 0;
+    if(soma_aggregator_drain(agg, &aggregates, &count, &capacity) == SOMA_SUCCESS)
+        soma_aggregator_merge(up->backlog, aggregates, count, SOMA_AGGREGATE_PENDING);
+    free(aggregates);
+}
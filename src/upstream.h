@@ -0,0 +1,65 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _UPSTREAM_H
+#define _UPSTREAM_H
+
+#include <margo.h>
+#include <json-c/json.h>
+#include "soma/soma-common.h"
+#include "aggregator.h"
+
+struct soma_provider;
+
+/*
+ * Forwarding of aggregates to an upstream provider. A provider whose
+ * configuration has an "upstream" section aggregates the samples its
+ * collectors receive and, every "interval" seconds, sends the aggregates
+ * accumulated since the previous round to a collector of the upstream
+ * provider, which merges them into its own aggregates (and forwards
+ * them further if it has an upstream itself):
+ *
+ * { "upstream" : { "address" : "na+sm://...", "provider_id" : 42,
+ *                  "collector" : "<uuid>", "interval" : 1.0,
+ *                  "timeout" : 1.0 } }
+ *
+ * Aggregates that could not be sent, including when the upstream
+ * provider did not answer within "timeout" seconds (by default the
+ * interval), are kept in a backlog and sent along with those of the
+ * next round.
+ */
+
+typedef struct soma_upstream {
+    char*               address;      // address of the upstream provider
+    uint16_t            provider_id;  // provider id of the upstream provider
+    soma_collector_id_t collector_id; // upstream collector receiving the aggregates
+    double              interval;     // seconds between rounds
+    double              timeout;      // seconds to wait for the upstream provider
+    hg_addr_t           addr;         // looked up at the first round
+    hg_id_t             rpc_id;       // id of the publish_aggregates RPC
+    soma_aggregator*    backlog;      // aggregates not sent yet
+    ABT_thread          ult;          // ULT running the rounds
+    ABT_mutex           mutex;
+    ABT_cond            cond;         // signaled to stop the ULT
+    int                 stop;
+} soma_upstream;
+
+/* Parses the "upstream" section of the provider's configuration, if
+ * any, and starts forwarding aggregates in a ULT of the given pool. */
+soma_return_t soma_upstream_start(
+        struct soma_provider* provider,
+        ABT_pool pool);
+
+/* Stops the ULT, sends the remaining aggregates, and frees the
+ * provider's upstream. Does nothing if the provider has no upstream. */
+void soma_upstream_stop(struct soma_provider* provider);
+
+/* Moves the pending aggregates of an aggregator that is going away
+ * to the backlog, so that they are sent with the next round. */
+void soma_upstream_save(
+        struct soma_provider* provider,
+        soma_aggregator* agg);
+
+#endif
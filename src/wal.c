@@ -0,0 +1,685 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "wal.h"
+
+#define DEFAULT_SEGMENT_SIZE        (64*1024*1024)
+#define DEFAULT_FSYNC_INTERVAL      1.0
+#define DEFAULT_GROUP_COMMIT_DELAY  0.0
+#define DEFAULT_REPLAY_THREADS      4
+#define RECORD_MAGIC                0x534f4d41 /* "SOMA" */
+#define SEGMENT_NAME_FORMAT         "%s/segment-%08lu.log"
+#define SEGMENT_NAME_MAX            4096
+
+typedef struct wal_record_header {
+    uint32_t magic;
+    uint32_t count;     // number of samples following the header
+    uint64_t checksum;  // FNV-1a hash of the columns
+} wal_record_header;
+
+typedef struct wal_buffer {
+    char*  data;
+    size_t size;
+    size_t capacity;
+} wal_buffer;
+
+struct soma_wal {
+    margo_instance_id     mid;
+    abt_io_instance_id    abtio;
+    int                   owns_abtio;         // abtio was created by this log
+    char*                 path;               // directory holding the segments
+    size_t                segment_size;
+    soma_wal_fsync_policy fsync_policy;
+    double                fsync_interval;     // seconds
+    double                group_commit_delay; // seconds a leader waits for followers
+    ABT_mutex             mutex;              // protects everything below
+    ABT_cond              cond;               // signaled when a group is written
+    wal_buffer            pending;            // records waiting for the next write
+    wal_buffer            spare;              // buffer swapped with pending by the leader
+    uint64_t              pending_group;      // group number of the pending records
+    uint64_t              written_group;      // last group written
+    int                   writing;            // a leader is writing a group
+    soma_return_t         error;              // set on the first I/O error
+    /* only accessed by the leader */
+    int                   fd;                 // current segment
+    unsigned long         segment_index;
+    off_t                 offset;             // end of the current segment
+    double                last_sync;
+};
+
+#define CHECKSUM_INIT 0xcbf29ce484222325ULL
+
+static uint64_t checksum(uint64_t h, const void* data, size_t size)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    size_t i;
+    for(i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static soma_return_t buffer_append(wal_buffer* buf, const void* data, size_t size)
+{
+    if(buf->size + size > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 4096;
+        while(capacity < buf->size + size) capacity *= 2;
+        char* d = (char*)realloc(buf->data, capacity);
+        if(!d) return SOMA_ERR_ALLOCATION;
+        buf->data     = d;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t open_segment(soma_wal* wal, unsigned long index)
+{
+    char name[SEGMENT_NAME_MAX];
+    snprintf(name, sizeof(name), SEGMENT_NAME_FORMAT, wal->path, index);
+    int fd = abt_io_open(wal->abtio, name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd < 0) {
+        margo_error(wal->mid, "Could not open log segment %s (errno %d)", name, -fd);
+        return SOMA_ERR_IO;
+    }
+    wal->fd            = fd;
+    wal->segment_index = index;
+    wal->offset        = 0;
+    wal->last_sync     = ABT_get_wtime();
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t sync_segment(soma_wal* wal)
+{
+    int r = abt_io_fdatasync(wal->abtio, wal->fd);
+    if(r != 0) {
+        margo_error(wal->mid, "fdatasync failed on log segment %lu (errno %d)",
+                    wal->segment_index, -r);
+        return SOMA_ERR_IO;
+    }
+    wal->last_sync = ABT_get_wtime();
+    return SOMA_SUCCESS;
+}
+
+/* Writes a group of records, moving to a new segment first if the
+ * current one is full, then applies the fsync policy. Only called by
+ * the leader, without holding the mutex. */
+static soma_return_t write_group(soma_wal* wal, const char* data, size_t size)
+{
+    soma_return_t ret;
+
+    if(wal->offset > 0 && (size_t)wal->offset + size > wal->segment_size) {
+        if(wal->fsync_policy != SOMA_WAL_FSYNC_NEVER) {
+            ret = sync_segment(wal);
+            if(ret != SOMA_SUCCESS) return ret;
+        }
+        abt_io_close(wal->abtio, wal->fd);
+        wal->fd = -1;
+        ret = open_segment(wal, wal->segment_index + 1);
+        if(ret != SOMA_SUCCESS) return ret;
+    }
+
+    size_t done = 0;
+    while(done < size) {
+        ssize_t n = abt_io_pwrite(wal->abtio, wal->fd, data + done,
+                                  size - done, wal->offset + done);
+        if(n <= 0) {
+            margo_error(wal->mid, "pwrite failed on log segment %lu (errno %d)",
+                        wal->segment_index, (int)-n);
+            return SOMA_ERR_IO;
+        }
+        done += (size_t)n;
+    }
+    wal->offset += size;
+
+    switch(wal->fsync_policy) {
+    case SOMA_WAL_FSYNC_ALWAYS:
+        return sync_segment(wal);
+    case SOMA_WAL_FSYNC_INTERVAL:
+        if(ABT_get_wtime() - wal->last_sync >= wal->fsync_interval)
+            return sync_segment(wal);
+        return SOMA_SUCCESS;
+    default:
+        return SOMA_SUCCESS;
+    }
+}
+
+/* Waits until the given group has been written, writing pending
+ * groups ourselves if no other ULT is doing so. Must be called with
+ * the mutex held. */
+static soma_return_t wait_for_group(soma_wal* wal, uint64_t group)
+{
+    while(wal->written_group < group && wal->error == SOMA_SUCCESS) {
+        if(wal->writing) {
+            ABT_cond_wait(wal->cond, wal->mutex);
+            continue;
+        }
+        // become the leader for the pending group
+        wal->writing = 1;
+        if(wal->group_commit_delay > 0) {
+            ABT_mutex_unlock(wal->mutex);
+            margo_thread_sleep(wal->mid, wal->group_commit_delay * 1000.0);
+            ABT_mutex_lock(wal->mutex);
+        }
+        wal_buffer tmp = wal->spare;
+        wal->spare   = wal->pending;
+        wal->pending = tmp;
+        wal->pending.size = 0;
+        uint64_t writing_group = wal->pending_group++;
+        ABT_mutex_unlock(wal->mutex);
+
+        soma_return_t r = write_group(wal, wal->spare.data, wal->spare.size);
+
+        ABT_mutex_lock(wal->mutex);
+        wal->writing = 0;
+        wal->written_group = writing_group;
+        if(r != SOMA_SUCCESS) wal->error = r;
+        ABT_cond_broadcast(wal->cond);
+    }
+    return wal->error;
+}
+
+soma_return_t soma_wal_append(soma_wal* wal, const soma_batch_t* batch)
+{
+    soma_return_t ret = SOMA_SUCCESS;
+    size_t i, r;
+
+    /* the checksums only depend on the batch, so they are computed
+     * before taking the mutex that serializes the appenders */
+    size_t num_records = batch->count / UINT32_MAX + (batch->count % UINT32_MAX != 0);
+    wal_record_header one_header;
+    wal_record_header* headers = &one_header;
+    if(num_records > 1) {
+        headers = (wal_record_header*)malloc(num_records * sizeof(*headers));
+        if(!headers) return SOMA_ERR_ALLOCATION;
+    }
+    for(i = 0, r = 0; i < batch->count; i += headers[r++].count) {
+        size_t n = batch->count - i;
+        if(n > UINT32_MAX) n = UINT32_MAX;
+        headers[r].magic    = RECORD_MAGIC;
+        headers[r].count    = (uint32_t)n;
+        headers[r].checksum = checksum(CHECKSUM_INIT, batch->series + i, n*sizeof(uint64_t));
+        headers[r].checksum = checksum(headers[r].checksum, batch->timestamps + i, n*sizeof(uint64_t));
+        headers[r].checksum = checksum(headers[r].checksum, batch->values + i, n*sizeof(double));
+    }
+
+    ABT_mutex_lock(wal->mutex);
+    if(wal->error != SOMA_SUCCESS) {
+        ret = wal->error;
+        goto finish;
+    }
+
+    size_t rollback = wal->pending.size;
+    for(i = 0, r = 0; r < num_records; i += headers[r++].count) {
+        size_t n = headers[r].count;
+        ret = buffer_append(&wal->pending, &headers[r], sizeof(headers[r]));
+        if(ret == SOMA_SUCCESS)
+            ret = buffer_append(&wal->pending, batch->series + i, n*sizeof(uint64_t));
+        if(ret == SOMA_SUCCESS)
+            ret = buffer_append(&wal->pending, batch->timestamps + i, n*sizeof(uint64_t));
+        if(ret == SOMA_SUCCESS)
+            ret = buffer_append(&wal->pending, batch->values + i, n*sizeof(double));
+        if(ret != SOMA_SUCCESS) {
+            wal->pending.size = rollback;
+            goto finish;
+        }
+    }
+
+    ret = wait_for_group(wal, wal->pending_group);
+
+finish:
+    ABT_mutex_unlock(wal->mutex);
+    if(headers != &one_header)
+        free(headers);
+    return ret;
+}
+
+soma_return_t soma_wal_sync(soma_wal* wal)
+{
+    ABT_mutex_lock(wal->mutex);
+    uint64_t group = wal->pending.size ? wal->pending_group : wal->pending_group - 1;
+    soma_return_t ret = wait_for_group(wal, group);
+    if(ret == SOMA_SUCCESS) {
+        // the leader role also protects the segment from being switched
+        while(wal->writing)
+            ABT_cond_wait(wal->cond, wal->mutex);
+        wal->writing = 1;
+        ABT_mutex_unlock(wal->mutex);
+        soma_return_t r = sync_segment(wal);
+        ABT_mutex_lock(wal->mutex);
+        wal->writing = 0;
+        if(r != SOMA_SUCCESS) wal->error = r;
+        ABT_cond_broadcast(wal->cond);
+        ret = wal->error;
+    }
+    ABT_mutex_unlock(wal->mutex);
+    return ret;
+}
+
+/* Returns the index of the last segment in the directory, or -1 */
+static long last_segment_index(const char* path)
+{
+    long last = -1;
+    DIR* dir = opendir(path);
+    if(!dir) return -1;
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL) {
+        unsigned long index;
+        if(sscanf(entry->d_name, "segment-%08lu.log", &index) == 1
+        && (long)index > last)
+            last = (long)index;
+    }
+    closedir(dir);
+    return last;
+}
+
+/* Replay: ULTs claim segments in order, read and check them in
+ * parallel, and hand their records to the replay function one segment
+ * at a time, in order, so at most replay_threads segments are held in
+ * memory at once. */
+
+typedef struct replay_state {
+    soma_wal*          wal;
+    soma_wal_replay_fn fn;
+    void*              uargs;
+    unsigned long      num_segments;
+    ABT_mutex          mutex;         // protects everything below
+    ABT_cond           cond;          // signaled when a segment has been replayed
+    unsigned long      next_to_read;  // next segment to claim
+    unsigned long      next_to_apply; // next segment to hand to fn
+    soma_return_t      error;
+} replay_state;
+
+/* Reads a whole segment into a newly allocated buffer */
+static soma_return_t read_segment(
+        soma_wal* wal,
+        unsigned long index,
+        char** data,
+        size_t* size)
+{
+    char name[SEGMENT_NAME_MAX];
+    struct stat st;
+    snprintf(name, sizeof(name), SEGMENT_NAME_FORMAT, wal->path, index);
+
+    *data = NULL;
+    *size = 0;
+    if(stat(name, &st) != 0) {
+        // segments that were never created (e.g. removed by hand) are empty
+        return errno == ENOENT ? SOMA_SUCCESS : SOMA_ERR_IO;
+    }
+    if(st.st_size == 0)
+        return SOMA_SUCCESS;
+
+    int fd = abt_io_open(wal->abtio, name, O_RDONLY, 0);
+    if(fd < 0) {
+        margo_error(wal->mid, "Could not open log segment %s (errno %d)", name, -fd);
+        return SOMA_ERR_IO;
+    }
+    char* buf = (char*)malloc(st.st_size);
+    if(!buf) {
+        abt_io_close(wal->abtio, fd);
+        return SOMA_ERR_ALLOCATION;
+    }
+    size_t done = 0;
+    while(done < (size_t)st.st_size) {
+        ssize_t n = abt_io_pread(wal->abtio, fd, buf + done, st.st_size - done, done);
+        if(n < 0) {
+            margo_error(wal->mid, "pread failed on log segment %s (errno %d)", name, (int)-n);
+            abt_io_close(wal->abtio, fd);
+            free(buf);
+            return SOMA_ERR_IO;
+        }
+        if(n == 0) break;
+        done += (size_t)n;
+    }
+    abt_io_close(wal->abtio, fd);
+    *data = buf;
+    *size = done;
+    return SOMA_SUCCESS;
+}
+
+/* Hands the valid records of a segment to the replay function */
+static soma_return_t replay_segment(
+        replay_state* state,
+        unsigned long index,
+        const char* data,
+        size_t size)
+{
+    size_t offset = 0;
+    while(offset + sizeof(wal_record_header) <= size) {
+        wal_record_header header;
+        memcpy(&header, data + offset, sizeof(header));
+        size_t n = header.count;
+        size_t record_size = sizeof(header) + n*(2*sizeof(uint64_t) + sizeof(double));
+        if(header.magic != RECORD_MAGIC || offset + record_size > size)
+            break;
+        /* records are 8-byte aligned within the segment since the
+         * header and every column are a multiple of 8 bytes long */
+        const char* columns = data + offset + sizeof(header);
+        uint64_t h = checksum(CHECKSUM_INIT, columns, n*(2*sizeof(uint64_t) + sizeof(double)));
+        if(h != header.checksum)
+            break;
+        soma_batch_t batch;
+        batch.count      = n;
+        batch.series     = (const uint64_t*)columns;
+        batch.timestamps = batch.series + n;
+        batch.values     = (const double*)(columns + 2*n*sizeof(uint64_t));
+        soma_return_t ret = state->fn(state->uargs, index, &batch);
+        if(ret != SOMA_SUCCESS) return ret;
+        offset += record_size;
+    }
+    if(offset < size)
+        margo_warning(state->wal->mid, "Ignoring %lu bytes at the end of log segment %lu",
+                      size - offset, index);
+    return SOMA_SUCCESS;
+}
+
+static void replay_ult(void* args)
+{
+    replay_state* state = (replay_state*)args;
+    for(;;) {
+        ABT_mutex_lock(state->mutex);
+        if(state->error != SOMA_SUCCESS || state->next_to_read >= state->num_segments) {
+            ABT_mutex_unlock(state->mutex);
+            break;
+        }
+        unsigned long index = state->next_to_read++;
+        ABT_mutex_unlock(state->mutex);
+
+        char* data = NULL;
+        size_t size = 0;
+        soma_return_t ret = read_segment(state->wal, index, &data, &size);
+
+        /* wait for our turn */
+        ABT_mutex_lock(state->mutex);
+        while(state->next_to_apply != index && state->error == SOMA_SUCCESS)
+            ABT_cond_wait(state->cond, state->mutex);
+        if(state->error != SOMA_SUCCESS)
+            ret = state->error;
+        ABT_mutex_unlock(state->mutex);
+
+        if(ret == SOMA_SUCCESS)
+            ret = replay_segment(state, index, data, size);
+        free(data);
+
+        ABT_mutex_lock(state->mutex);
+        if(ret != SOMA_SUCCESS && state->error == SOMA_SUCCESS)
+            state->error = ret;
+        state->next_to_apply++;
+        ABT_cond_broadcast(state->cond);
+        ABT_mutex_unlock(state->mutex);
+    }
+}
+
+static soma_return_t replay(
+        soma_wal* wal,
+        unsigned long num_segments,
+        unsigned num_threads,
+        ABT_pool pool,
+        soma_wal_replay_fn fn,
+        void* uargs)
+{
+    replay_state state;
+    memset(&state, 0, sizeof(state));
+    state.wal          = wal;
+    state.fn           = fn;
+    state.uargs        = uargs;
+    state.num_segments = num_segments;
+
+    if(pool == ABT_POOL_NULL)
+        margo_get_handler_pool(wal->mid, &pool);
+    if(num_threads == 0) num_threads = 1;
+    if(num_threads > num_segments) num_threads = (unsigned)num_segments;
+
+    ABT_thread* ults = (ABT_thread*)calloc(num_threads, sizeof(*ults));
+    if(!ults) return SOMA_ERR_ALLOCATION;
+    if(ABT_mutex_create(&state.mutex) != ABT_SUCCESS
+    || ABT_cond_create(&state.cond) != ABT_SUCCESS) {
+        if(state.mutex != ABT_MUTEX_NULL) ABT_mutex_free(&state.mutex);
+        free(ults);
+        return SOMA_ERR_FROM_ARGOBOTS;
+    }
+
+    unsigned i, num_created = 0;
+    for(i = 0; i < num_threads; i++) {
+        if(ABT_thread_create(pool, replay_ult, &state, ABT_THREAD_ATTR_NULL, &ults[i]) != ABT_SUCCESS)
+            break;
+        num_created++;
+    }
+    /* if no ULT could be created, replay from the caller */
+    if(num_created == 0)
+        replay_ult(&state);
+    for(i = 0; i < num_created; i++) {
+        ABT_thread_join(ults[i]);
+        ABT_thread_free(&ults[i]);
+    }
+
+    ABT_cond_free(&state.cond);
+    ABT_mutex_free(&state.mutex);
+    free(ults);
+    return state.error;
+}
+
+soma_return_t soma_wal_read_config(
+        margo_instance_id mid,
+        struct json_object* config,
+        soma_wal_config* wal_config)
+{
+    struct json_object* val;
+
+    if(!json_object_is_type(config, json_type_object)
+    || !json_object_object_get_ex(config, "path", &val)
+    || !json_object_is_type(val, json_type_string)) {
+        margo_error(mid, "Write-ahead log requires a \"path\" string in its configuration");
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    const char* path = json_object_get_string(val);
+
+    int64_t segment_size        = DEFAULT_SEGMENT_SIZE;
+    double fsync_interval       = DEFAULT_FSYNC_INTERVAL;
+    double group_commit_delay   = DEFAULT_GROUP_COMMIT_DELAY;
+    int64_t replay_threads      = DEFAULT_REPLAY_THREADS;
+    soma_wal_fsync_policy policy = SOMA_WAL_FSYNC_ALWAYS;
+    if(json_object_object_get_ex(config, "segment_size", &val))
+        segment_size = json_object_get_int64(val);
+    if(json_object_object_get_ex(config, "fsync_interval", &val))
+        fsync_interval = json_object_get_double(val);
+    if(json_object_object_get_ex(config, "group_commit_delay", &val))
+        group_commit_delay = json_object_get_double(val);
+    if(json_object_object_get_ex(config, "replay_threads", &val))
+        replay_threads = json_object_get_int64(val);
+    if(json_object_object_get_ex(config, "fsync", &val)) {
+        const char* p = json_object_get_string(val);
+        if(strcmp(p, "always") == 0)        policy = SOMA_WAL_FSYNC_ALWAYS;
+        else if(strcmp(p, "interval") == 0) policy = SOMA_WAL_FSYNC_INTERVAL;
+        else if(strcmp(p, "never") == 0)    policy = SOMA_WAL_FSYNC_NEVER;
+        else {
+            margo_error(mid, "Invalid fsync policy \"%s\" in write-ahead log config", p);
+            return SOMA_ERR_INVALID_CONFIG;
+        }
+    }
+    if(segment_size <= 0 || fsync_interval < 0 || group_commit_delay < 0
+    || replay_threads <= 0) {
+        margo_error(mid, "Invalid segment_size, fsync_interval, group_commit_delay "
+                    "or replay_threads in write-ahead log config");
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+
+    wal_config->path               = path;
+    wal_config->segment_size       = (size_t)segment_size;
+    wal_config->fsync_policy       = policy;
+    wal_config->fsync_interval     = fsync_interval;
+    wal_config->group_commit_delay = group_commit_delay;
+    wal_config->replay_threads     = (unsigned)replay_threads;
+    return SOMA_SUCCESS;
+}
+
+static void wal_free(soma_wal* wal)
+{
+    if(wal->owns_abtio && wal->abtio != ABT_IO_INSTANCE_NULL)
+        abt_io_finalize(wal->abtio);
+    if(wal->cond != ABT_COND_NULL)
+        ABT_cond_free(&wal->cond);
+    if(wal->mutex != ABT_MUTEX_NULL)
+        ABT_mutex_free(&wal->mutex);
+    free(wal->pending.data);
+    free(wal->spare.data);
+    free(wal->path);
+    free(wal);
+}
+
+static soma_return_t wal_alloc(
+        margo_instance_id mid,
+        abt_io_instance_id abtio,
+        const soma_wal_config* config,
+        soma_wal** wal)
+{
+    soma_wal* w = (soma_wal*)calloc(1, sizeof(*w));
+    if(!w) return SOMA_ERR_ALLOCATION;
+    w->mid                = mid;
+    w->path               = strdup(config->path);
+    w->segment_size       = config->segment_size;
+    w->fsync_policy       = config->fsync_policy;
+    w->fsync_interval     = config->fsync_interval;
+    w->group_commit_delay = config->group_commit_delay;
+    w->pending_group      = 1;
+    w->fd                 = -1;
+    w->abtio              = abtio;
+    w->mutex              = ABT_MUTEX_NULL;
+    w->cond               = ABT_COND_NULL;
+    if(!w->path) {
+        wal_free(w);
+        return SOMA_ERR_ALLOCATION;
+    }
+    if(w->abtio == ABT_IO_INSTANCE_NULL) {
+        // no ABT-IO instance was provided, use our own
+        w->abtio = abt_io_init(1);
+        w->owns_abtio = 1;
+        if(w->abtio == ABT_IO_INSTANCE_NULL) {
+            margo_error(mid, "Write-ahead log could not initialize ABT-IO");
+            wal_free(w);
+            return SOMA_ERR_FROM_ARGOBOTS;
+        }
+    }
+    if(ABT_mutex_create(&w->mutex) != ABT_SUCCESS
+    || ABT_cond_create(&w->cond) != ABT_SUCCESS) {
+        wal_free(w);
+        return SOMA_ERR_FROM_ARGOBOTS;
+    }
+    *wal = w;
+    return SOMA_SUCCESS;
+}
+
+soma_return_t soma_wal_create(
+        margo_instance_id mid,
+        abt_io_instance_id abtio,
+        const soma_wal_config* config,
+        soma_wal** wal)
+{
+    soma_wal* w = NULL;
+    soma_return_t ret = wal_alloc(mid, abtio, config, &w);
+    if(ret != SOMA_SUCCESS) return ret;
+
+    if(mkdir(w->path, 0755) != 0 && errno != EEXIST) {
+        margo_error(mid, "Could not create log directory %s", w->path);
+        wal_free(w);
+        return SOMA_ERR_IO;
+    }
+    if(last_segment_index(w->path) >= 0) {
+        margo_error(mid, "Log directory %s already contains a log", w->path);
+        wal_free(w);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    ret = open_segment(w, 0);
+    if(ret != SOMA_SUCCESS) {
+        wal_free(w);
+        return ret;
+    }
+    *wal = w;
+    return SOMA_SUCCESS;
+}
+
+soma_return_t soma_wal_open(
+        margo_instance_id mid,
+        abt_io_instance_id abtio,
+        const soma_wal_config* config,
+        ABT_pool pool,
+        soma_wal_replay_fn fn,
+        void* uargs,
+        soma_wal** wal)
+{
+    soma_wal* w = NULL;
+    soma_return_t ret = wal_alloc(mid, abtio, config, &w);
+    if(ret != SOMA_SUCCESS) return ret;
+
+    long last = last_segment_index(w->path);
+    if(last < 0) {
+        margo_error(mid, "No log found in %s", w->path);
+        wal_free(w);
+        return SOMA_ERR_INVALID_CONFIG;
+    }
+    if(fn) {
+        double t = ABT_get_wtime();
+        ret = replay(w, (unsigned long)last + 1, config->replay_threads, pool, fn, uargs);
+        if(ret != SOMA_SUCCESS) {
+            margo_error(mid, "Could not replay log in %s", w->path);
+            wal_free(w);
+            return ret;
+        }
+        margo_debug(mid, "Replayed %ld log segments from %s in %f seconds",
+                    last + 1, w->path, ABT_get_wtime() - t);
+    }
+    /* existing segments are left untouched (the last one may end with a
+     * partially written record), new records go to a new segment */
+    ret = open_segment(w, (unsigned long)last + 1);
+    if(ret != SOMA_SUCCESS) {
+        wal_free(w);
+        return ret;
+    }
+    *wal = w;
+    return SOMA_SUCCESS;
+}
+
+void soma_wal_close(soma_wal* wal)
+{
+    if(wal->fd >= 0) {
+        if(wal->fsync_policy != SOMA_WAL_FSYNC_NEVER && wal->error == SOMA_SUCCESS)
+            sync_segment(wal);
+        abt_io_close(wal->abtio, wal->fd);
+    }
+    wal_free(wal);
+}
+
+soma_return_t soma_wal_destroy(soma_wal* wal)
+{
+    soma_return_t ret = SOMA_SUCCESS;
+    if(wal->fd >= 0) {
+        abt_io_close(wal->abtio, wal->fd);
+        wal->fd = -1;
+    }
+    long last = last_segment_index(wal->path);
+    long i;
+    for(i = 0; i <= last; i++) {
+        char name[SEGMENT_NAME_MAX];
+        snprintf(name, sizeof(name), SEGMENT_NAME_FORMAT, wal->path, (unsigned long)i);
+        abt_io_unlink(wal->abtio, name);
+    }
+    if(rmdir(wal->path) != 0) {
+        margo_error(wal->mid, "Could not remove log directory %s", wal->path);
+        ret = SOMA_ERR_IO;
+    }
+    wal_free(wal);
+    return ret;
+}
@@ -0,0 +1,116 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _WAL_H
+#define _WAL_H
+
+#include <margo.h>
+#include <abt-io.h>
+#include <json-c/json.h>
+#include "soma/soma-backend.h"
+
+/*
+ * Write-ahead log that backends can use to make the batches they ingest
+ * durable. Batches are appended as records at the end of the current
+ * segment file of the log's directory, and the log moves on to a new
+ * segment once the current one has reached segment_size bytes. A record
+ * is a header (magic, number of samples, checksum) followed by the
+ * series, timestamps, and values of its samples, one column after the
+ * other, and is never split across segments.
+ *
+ * Writes go through ABT-IO so that they run on its execution streams
+ * instead of blocking the RPC ULTs. Concurrent appends are combined
+ * (group commit): the first caller to find no write in progress becomes
+ * the leader and writes everything accumulated so far in a single
+ * pwrite, while the others wait for the group containing their record
+ * to be written. Whether that write is followed by an fdatasync depends
+ * on the fsync policy:
+ * - "always" (the default): before acknowledging any record, so that
+ *   acknowledged records survive a crash; group commit amortizes the
+ *   fdatasync over the records written together;
+ * - "interval": at most every fsync_interval seconds, checked when a
+ *   group is written, so that the records of the last group before an
+ *   idle period stay unsynced until the next append, sync, or close;
+ * - "never": left to the operating system.
+ *
+ * Opening an existing log replays its records, segment by segment, in
+ * the order in which they were appended. Segments are read and checked
+ * by replay_threads ULTs in parallel, each handing its segment's records
+ * to the replay function once the previous segments have been replayed.
+ * A segment's records stop at the first record that is truncated or
+ * whose checksum does not match (e.g. one being written during a crash).
+ * New records then go to a new segment. Segments are only removed when
+ * the log is destroyed: the log is never truncated or checkpointed, so
+ * it keeps every record appended since its creation, and both its size
+ * and the time taken to replay it when opened grow with each reopening
+ * and each batch.
+ */
+
+typedef enum soma_wal_fsync_policy {
+    SOMA_WAL_FSYNC_ALWAYS,
+    SOMA_WAL_FSYNC_INTERVAL,
+    SOMA_WAL_FSYNC_NEVER
+} soma_wal_fsync_policy;
+
+typedef struct soma_wal_config {
+    const char*           path;               // directory holding the segments
+    size_t                segment_size;       // bytes
+    soma_wal_fsync_policy fsync_policy;
+    double                fsync_interval;     // seconds
+    double                group_commit_delay; // seconds a leader waits for followers
+    unsigned              replay_threads;     // ULTs reading segments on open
+} soma_wal_config;
+
+typedef struct soma_wal soma_wal;
+
+/* Called with the records of an existing log when it is opened, in the
+ * order in which they were appended; segment is the index of the
+ * segment holding the record. */
+typedef soma_return_t (*soma_wal_replay_fn)(void* uargs, unsigned long segment,
+                                            const soma_batch_t* batch);
+
+/* Reads the "path", "segment_size", "fsync", "fsync_interval",
+ * "group_commit_delay", and "replay_threads" fields of a JSON object,
+ * using defaults for the missing optional ones. The path points into
+ * the JSON object. */
+soma_return_t soma_wal_read_config(
+        margo_instance_id mid,
+        struct json_object* config,
+        soma_wal_config* wal_config);
+
+/* Creates a new log; fails if the directory already holds one. If abtio
+ * is ABT_IO_INSTANCE_NULL, the log uses an ABT-IO instance of its own. */
+soma_return_t soma_wal_create(
+        margo_instance_id mid,
+        abt_io_instance_id abtio,
+        const soma_wal_config* config,
+        soma_wal** wal);
+
+/* Opens an existing log, replaying its records with fn (if not NULL)
+ * from ULTs created in pool (the handler pool if ABT_POOL_NULL). */
+soma_return_t soma_wal_open(
+        margo_instance_id mid,
+        abt_io_instance_id abtio,
+        const soma_wal_config* config,
+        ABT_pool pool,
+        soma_wal_replay_fn fn,
+        void* uargs,
+        soma_wal** wal);
+
+/* Appends a batch and returns once it has been written (and synced, if
+ * the fsync policy requires it). */
+soma_return_t soma_wal_append(soma_wal* wal, const soma_batch_t* batch);
+
+/* Writes whatever is pending and syncs the current segment,
+ * regardless of the fsync policy. */
+soma_return_t soma_wal_sync(soma_wal* wal);
+
+/* Syncs (unless the fsync policy is "never") and closes the log. */
+void soma_wal_close(soma_wal* wal);
+
+/* Closes the log and removes its segments and directory. */
+soma_return_t soma_wal_destroy(soma_wal* wal);
+
+#endif
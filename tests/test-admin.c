@@ -4,7 +4,9 @@
  * See COPYRIGHT in top-level directory.
  */
 #include <stdio.h>
+#include <string.h>
 #include <margo.h>
+#include <json-c/json.h>
 #include <soma/soma-server.h>
 #include <soma/soma-admin.h>
 #include "munit/munit.h"
@@ -107,6 +109,16 @@ static MunitResult test_collector(const MunitParameter params[], void* data)
     // note: open and close are essentially the same as create and
     // destroy in this code so we won't be testing them.
 
+    // test that create can also return the index of the collector
+    soma_collector_index_t index = { SOMA_COLLECTOR_SLOT_NONE, 0 };
+    ret = soma_create_collector_with_index(admin, context->addr,
+            provider_id, valid_token, "dummy", backend_config, &id, &index);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_uint32(index.slot, !=, SOMA_COLLECTOR_SLOT_NONE);
+    ret = soma_destroy_collector(admin, context->addr,
+            provider_id, valid_token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
     // test that we can free the admin object
     ret = soma_admin_finalize(admin);
     munit_assert_int(ret, ==, SOMA_SUCCESS);
@@ -114,6 +126,85 @@ static MunitResult test_collector(const MunitParameter params[], void* data)
     return MUNIT_OK;
 }
 
+static MunitResult test_list_pages(const MunitParameter params[], void* data)
+{
+    (void)params;
+    (void)data;
+    struct test_context* context = (struct test_context*)data;
+    soma_admin_t admin;
+    soma_return_t ret;
+    soma_collector_id_t created[310];
+    soma_collector_id_t ids[512];
+    size_t count, total, i, j;
+    uint64_t cursor;
+    ret = soma_admin_init(context->mid, &admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // 300 dummy collectors and 10 timeseries collectors
+    for(i = 0; i < 310; i++) {
+        ret = soma_create_collector(admin, context->addr, provider_id, valid_token,
+                i < 300 ? "dummy" : "timeseries", i < 300 ? backend_config : "{}",
+                &created[i]);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+
+    // small pages, sent inline
+    total = 0;
+    cursor = 0;
+    do {
+        count = 7;
+        ret = soma_list_collectors_page(admin, context->addr, provider_id, valid_token,
+                NULL, &cursor, ids + total, &count);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        munit_assert_ulong(count, <=, 7);
+        total += count;
+        munit_assert_ulong(total, <=, 310);
+    } while(cursor != 0);
+    munit_assert_ulong(total, ==, 310);
+    for(i = 0; i < 310; i++) {
+        for(j = 0; j < total; j++)
+            if(memcmp(&ids[j], &created[i], sizeof(created[i])) == 0) break;
+        munit_assert_ulong(j, <, total);
+    }
+
+    // filtering by type
+    cursor = 0;
+    count = 512;
+    ret = soma_list_collectors_page(admin, context->addr, provider_id, valid_token,
+            "timeseries", &cursor, ids, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(count, ==, 10);
+    munit_assert_ulong(cursor, ==, 0);
+    for(i = 0; i < 10; i++)
+        munit_assert_memory_equal(sizeof(ids[i]), &ids[i], &created[300 + i]);
+
+    // a large page, sent with RDMA
+    cursor = 0;
+    count = 512;
+    ret = soma_list_collectors_page(admin, context->addr, provider_id, valid_token,
+            NULL, &cursor, ids, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(count, ==, 310);
+    munit_assert_ulong(cursor, ==, 0);
+    munit_assert_memory_equal(sizeof(ids[0]), &ids[0], &created[0]);
+
+    // the wrapper stops at the size of the array
+    count = 100;
+    ret = soma_list_collectors(admin, context->addr, provider_id, valid_token, ids, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(count, ==, 100);
+
+    for(i = 0; i < 310; i++) {
+        ret = soma_destroy_collector(admin, context->addr,
+                provider_id, valid_token, created[i]);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    ret = soma_admin_finalize(admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
 static MunitResult test_invalid(const MunitParameter params[], void* data)
 {
     (void)params;
@@ -168,10 +259,68 @@ static MunitResult test_invalid(const MunitParameter params[], void* data)
     return MUNIT_OK;
 }
 
+static MunitResult test_stats(const MunitParameter params[], void* data)
+{
+    (void)params;
+    (void)data;
+    struct test_context* context = (struct test_context*)data;
+    soma_admin_t admin;
+    soma_return_t ret;
+    soma_collector_id_t id;
+    char* stats = NULL;
+    // test that we can create an admin object
+    ret = soma_admin_init(context->mid, &admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // issue a successful and a failing RPC
+    ret = soma_create_collector(admin, context->addr,
+            provider_id, valid_token, "dummy", backend_config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(admin, context->addr,
+            provider_id, valid_token, "blah", backend_config, &id);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_BACKEND);
+
+    // test that the wrong token is rejected
+    ret = soma_get_provider_stats(admin, context->addr,
+            provider_id, wrong_token, &stats);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_TOKEN);
+
+    // test that the statistics account for both calls
+    ret = soma_get_provider_stats(admin, context->addr,
+            provider_id, valid_token, &stats);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_not_null(stats);
+    struct json_object* json = json_tokener_parse(stats);
+    munit_assert_not_null(json);
+    struct json_object* rpcs = NULL;
+    struct json_object* create = NULL;
+    struct json_object* field = NULL;
+    munit_assert_true(json_object_object_get_ex(json, "rpcs", &rpcs));
+    munit_assert_true(json_object_object_get_ex(rpcs, "create_collector", &create));
+    munit_assert_true(json_object_object_get_ex(create, "calls", &field));
+    munit_assert_int64(json_object_get_int64(field), ==, 2);
+    munit_assert_true(json_object_object_get_ex(create, "errors", &field));
+    munit_assert_int64(json_object_get_int64(field), ==, 1);
+    munit_assert_true(json_object_object_get_ex(create, "handler_time_us", &field));
+    json_object_put(json);
+    free(stats);
+
+    ret = soma_destroy_collector(admin, context->addr, provider_id, valid_token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // test that we can free the admin object
+    ret = soma_admin_finalize(admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
 static MunitTest test_suite_tests[] = {
     { (char*) "/admin",    test_admin,    test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
     { (char*) "/collector", test_collector, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/list_pages", test_list_pages, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
     { (char*) "/invalid",  test_invalid,  test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/stats",    test_stats,    test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
     { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
 
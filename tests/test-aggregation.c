@@ -0,0 +1,259 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <margo.h>
+#include <soma/soma-server.h>
+#include <soma/soma-admin.h>
+#include <soma/soma-client.h>
+#include <soma/soma-collector.h>
+#include "munit/munit.h"
+
+struct test_context {
+    margo_instance_id   mid;
+    hg_addr_t           addr;
+    char                addr_str[256];
+    soma_admin_t        admin;
+    soma_collector_id_t root_id; // collector of the upstream provider
+};
+
+static const char* token = "ABCDEFGH";
+static const uint16_t leaf_provider_id = 42;
+static const uint16_t root_provider_id = 43;
+static const char* backend_config = "{}";
+
+static void* test_context_setup(const MunitParameter params[], void* user_data)
+{
+    (void) params;
+    (void) user_data;
+    soma_return_t ret;
+    // create margo instance
+    struct test_context* context = (struct test_context*)calloc(1, sizeof(*context));
+    munit_assert_not_null(context);
+    context->mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    munit_assert_not_null(context->mid);
+    // get address of current process
+    hg_return_t hret = margo_addr_self(context->mid, &context->addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    hg_size_t addr_size = sizeof(context->addr_str);
+    hret = margo_addr_to_string(context->mid, context->addr_str, &addr_size, context->addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    // register the root provider
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token = token;
+    ret = soma_provider_register(
+            context->mid, root_provider_id, &args,
+            SOMA_PROVIDER_IGNORE);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // create the collector receiving the aggregates
+    ret = soma_admin_init(context->mid, &context->admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(context->admin, context->addr,
+            root_provider_id, token, "dummy", backend_config, &context->root_id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    return context;
+}
+
+static void test_context_tear_down(void* fixture)
+{
+    struct test_context* context = (struct test_context*)fixture;
+    soma_destroy_collector(context->admin, context->addr,
+            root_provider_id, token, context->root_id);
+    soma_admin_finalize(context->admin);
+    margo_addr_free(context->mid, context->addr);
+    margo_finalize(context->mid);
+    free(context);
+}
+
+/* Registers a leaf provider forwarding to the root provider's collector */
+static soma_return_t register_leaf(
+        struct test_context* context,
+        double interval,
+        soma_provider_t* provider)
+{
+    char root_id_str[37];
+    char config[512];
+    soma_collector_id_to_string(context->root_id, root_id_str);
+    snprintf(config, sizeof(config),
+            "{ \"upstream\" : { \"address\" : \"%s\", \"provider_id\" : %u,"
+            " \"collector\" : \"%s\", \"interval\" : %g } }",
+            context->addr_str, root_provider_id, root_id_str, interval);
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token  = token;
+    args.config = config;
+    return soma_provider_register(context->mid, leaf_provider_id, &args, provider);
+}
+
+static MunitResult test_forward(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_provider_t leaf;
+    soma_collector_id_t leaf_id;
+    soma_client_t client;
+    soma_collector_handle_t leaf_handle, root_handle;
+    soma_return_t ret;
+
+    // forward only when the leaf goes away
+    ret = register_leaf(context, 3600.0, &leaf);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(context->admin, context->addr,
+            leaf_provider_id, token, "dummy", backend_config, &leaf_id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(client,
+            context->addr, leaf_provider_id, leaf_id, &leaf_handle);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(client,
+            context->addr, root_provider_id, context->root_id, &root_handle);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // publish two series to the leaf
+    soma_sample_t samples[5] = {
+        { 1, 10, 1.0 }, { 1, 11, -2.0 }, { 2, 10, 5.0 }, { 1, 12, 4.0 }, { 2, 13, 7.0 }
+    };
+    ret = soma_publish_batch(leaf_handle, samples, 5);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // the leaf aggregates what it received
+    uint64_t series[3] = { 1, 2, 3 };
+    soma_aggregate_t aggregates[3];
+    ret = soma_get_aggregates(leaf_handle, 3, series, aggregates);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(aggregates[0].count, ==, 3);
+    munit_assert_ulong(aggregates[1].count, ==, 2);
+    munit_assert_ulong(aggregates[2].count, ==, 0);
+
+    // nothing was forwarded yet
+    ret = soma_get_aggregates(root_handle, 3, series, aggregates);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(aggregates[0].count, ==, 0);
+
+    ret = soma_collector_handle_release(leaf_handle);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // destroying the leaf sends its remaining aggregates upstream
+    ret = soma_provider_destroy(leaf);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    ret = soma_get_aggregates(root_handle, 3, series, aggregates);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(aggregates[0].series, ==, 1);
+    munit_assert_ulong(aggregates[0].count, ==, 3);
+    munit_assert_ulong(aggregates[0].t_first, ==, 10);
+    munit_assert_ulong(aggregates[0].t_last, ==, 12);
+    munit_assert_double(aggregates[0].sum, ==, 3.0);
+    munit_assert_double(aggregates[0].min, ==, -2.0);
+    munit_assert_double(aggregates[0].max, ==, 4.0);
+    munit_assert_ulong(aggregates[1].count, ==, 2);
+    munit_assert_double(aggregates[1].sum, ==, 12.0);
+    munit_assert_ulong(aggregates[2].count, ==, 0);
+
+    ret = soma_collector_handle_release(root_handle);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_periodic(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_provider_t leaf;
+    soma_collector_id_t leaf_id;
+    soma_client_t client;
+    soma_collector_handle_t leaf_handle, root_handle;
+    soma_return_t ret;
+
+    ret = register_leaf(context, 0.01, &leaf);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(context->admin, context->addr,
+            leaf_provider_id, token, "dummy", backend_config, &leaf_id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(client,
+            context->addr, leaf_provider_id, leaf_id, &leaf_handle);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(client,
+            context->addr, root_provider_id, context->root_id, &root_handle);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // publish in two rounds, each of which should be forwarded once
+    uint64_t series = 7;
+    soma_aggregate_t aggregate;
+    int round, attempts;
+    for(round = 1; round <= 2; round++) {
+        ret = soma_publish_batch(leaf_handle, &(soma_sample_t){ 7, (uint64_t)round, 1.0 }, 1);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        for(attempts = 0; attempts < 500; attempts++) {
+            ret = soma_get_aggregates(root_handle, 1, &series, &aggregate);
+            munit_assert_int(ret, ==, SOMA_SUCCESS);
+            if(aggregate.count == (uint64_t)round) break;
+            margo_thread_sleep(context->mid, 10);
+        }
+        munit_assert_ulong(aggregate.count, ==, round);
+        munit_assert_double(aggregate.sum, ==, round);
+    }
+
+    soma_collector_handle_release(leaf_handle);
+    soma_collector_handle_release(root_handle);
+    soma_client_finalize(client);
+    ret = soma_provider_destroy(leaf);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // nothing was left to forward
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(client,
+            context->addr, root_provider_id, context->root_id, &root_handle);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_get_aggregates(root_handle, 1, &series, &aggregate);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(aggregate.count, ==, 2);
+    soma_collector_handle_release(root_handle);
+    soma_client_finalize(client);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_invalid_config(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    soma_return_t ret;
+
+    args.config = "{ \"upstream\" : { \"address\" : \"na+sm://1-2\", \"provider_id\" : 43 } }";
+    ret = soma_provider_register(context->mid, leaf_provider_id, &args, SOMA_PROVIDER_IGNORE);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+
+    args.config = "{ \"upstream\" : { \"address\" : \"na+sm://1-2\", \"provider_id\" : 43,"
+                  " \"collector\" : \"not-a-uuid\" } }";
+    ret = soma_provider_register(context->mid, leaf_provider_id, &args, SOMA_PROVIDER_IGNORE);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+
+    return MUNIT_OK;
+}
+
+static MunitTest test_suite_tests[] = {
+    { (char*) "/forward",        test_forward,        test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/periodic",       test_periodic,       test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/invalid_config", test_invalid_config, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite test_suite = {
+    (char*) "/soma/aggregation", test_suite_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char* argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
+    return munit_suite_main(&test_suite, (void*) "soma", argc, argv);
+}
@@ -0,0 +1,205 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <margo.h>
+#include <soma/soma-server.h>
+#include <soma/soma-admin.h>
+#include <soma/soma-client.h>
+#include <soma/soma-collector.h>
+#include "munit/munit.h"
+
+struct test_context {
+    margo_instance_id   mid;
+    hg_addr_t           addr;
+    soma_admin_t        admin;
+    soma_client_t       client;
+    soma_provider_t     provider;
+    char                dir[64];
+    char                config[256];
+};
+
+static const char* token = "ABCDEFGH";
+static const uint16_t provider_id = 42;
+
+static char* open_threads_params[] = { "4", "0", NULL };
+
+static MunitParameterEnum test_params[] = {
+    { "open_threads", open_threads_params },
+    { NULL, NULL }
+};
+
+static void register_provider(struct test_context* context)
+{
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token  = token;
+    args.config = context->config;
+    soma_return_t ret = soma_provider_register(
+            context->mid, provider_id, &args,
+            &context->provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+}
+
+static void* test_context_setup(const MunitParameter params[], void* user_data)
+{
+    (void) user_data;
+    soma_return_t ret;
+    // create margo instance
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    munit_assert_not_null(mid);
+    struct test_context* context = (struct test_context*)calloc(1, sizeof(*context));
+    munit_assert_not_null(context);
+    context->mid = mid;
+    // get address of current process
+    hg_return_t hret = margo_addr_self(mid, &context->addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    // the catalog lives in a fresh directory
+    strcpy(context->dir, "/tmp/soma-catalog-XXXXXX");
+    munit_assert_not_null(mkdtemp(context->dir));
+    snprintf(context->config, sizeof(context->config),
+             "{ \"catalog\" : { \"path\" : \"%s/catalog\", \"open_threads\" : %s } }",
+             context->dir, munit_parameters_get(params, "open_threads"));
+    // register soma provider
+    register_provider(context);
+    // create an admin and a client
+    ret = soma_admin_init(mid, &context->admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_init(mid, &context->client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    return context;
+}
+
+static void test_context_tear_down(void* fixture)
+{
+    struct test_context* context = (struct test_context*)fixture;
+    char path[128];
+    soma_client_finalize(context->client);
+    soma_admin_finalize(context->admin);
+    soma_provider_destroy(context->provider);
+    margo_addr_free(context->mid, context->addr);
+    // we are not checking the return value of the above function with
+    // munit because we need margo_finalize to be called no matter what.
+    margo_finalize(context->mid);
+    snprintf(path, sizeof(path), "%s/catalog", context->dir);
+    unlink(path);
+    rmdir(context->dir);
+    free(context);
+}
+
+static int has_id(const soma_collector_id_t* ids, size_t count, soma_collector_id_t id)
+{
+    size_t i;
+    for(i = 0; i < count; i++)
+        if(memcmp(&ids[i], &id, sizeof(id)) == 0) return 1;
+    return 0;
+}
+
+static MunitResult test_restart(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_collector_id_t id1, id2, id3, other;
+    soma_collector_id_t ids[4];
+    size_t count = 4;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    int32_t result = 0;
+
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", "{}", &id1);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_open_collector(context->admin, context->addr, provider_id, token,
+            "dummy", "{ \"x\" : 1 }", &id2);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "dummy", "{}", &id3);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // opening the same type and configuration gives the same collector
+    ret = soma_open_collector(context->admin, context->addr, provider_id, token,
+            "dummy", "{ \"x\" : 1 }", &other);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_memory_equal(sizeof(id2), &id2, &other);
+    // closed collectors are forgotten
+    ret = soma_close_collector(context->admin, context->addr, provider_id, token, id3);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // restart the provider
+    soma_provider_destroy(context->provider);
+    register_provider(context);
+
+    ret = soma_list_collectors(context->admin, context->addr, provider_id, token,
+            ids, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_long(count, ==, 2);
+    munit_assert_true(has_id(ids, count, id1));
+    munit_assert_true(has_id(ids, count, id2));
+
+    // restored collectors can be used under their ids
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id1, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_compute_sum(rh, 2, 3, &result);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_int(result, ==, 5);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    ret = soma_open_collector(context->admin, context->addr, provider_id, token,
+            "dummy", "{ \"x\" : 1 }", &other);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_memory_equal(sizeof(id2), &id2, &other);
+
+    // destroying a collector that was never opened since the restart
+    ret = soma_destroy_collector(context->admin, context->addr, provider_id, token, id1);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_close_collector(context->admin, context->addr, provider_id, token, id2);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // restart again, nothing is left
+    soma_provider_destroy(context->provider);
+    register_provider(context);
+    count = 4;
+    ret = soma_list_collectors(context->admin, context->addr, provider_id, token,
+            ids, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_long(count, ==, 0);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_invalid_config(const MunitParameter params[], void* data)
+{
+    (void)params;
+    (void)data;
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    munit_assert_not_null(mid);
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    soma_provider_t provider;
+    args.config = "{ \"catalog\" : { \"open_threads\" : 2 } }";
+    soma_return_t ret = soma_provider_register(mid, provider_id, &args, &provider);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+    args.config = "{ \"catalog\" : { \"path\" : \"/tmp/catalog\", \"open_threads\" : -1 } }";
+    ret = soma_provider_register(mid, provider_id, &args, &provider);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+    margo_finalize(mid);
+    return MUNIT_OK;
+}
+
+static MunitTest test_suite_tests[] = {
+    { (char*) "/restart", test_restart, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params },
+    { (char*) "/invalid_config", test_invalid_config, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite test_suite = {
+    (char*) "/soma/catalog", test_suite_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char* argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
+    return munit_suite_main(&test_suite, (void*) "soma", argc, argv);
+}
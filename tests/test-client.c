@@ -4,11 +4,14 @@
  * See COPYRIGHT in top-level directory.
  */
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
 #include <margo.h>
 #include <soma/soma-server.h>
 #include <soma/soma-admin.h>
 #include <soma/soma-client.h>
 #include <soma/soma-collector.h>
+#include <soma/soma-backend.h>
 #include "munit/munit.h"
 
 struct test_context {
@@ -16,6 +19,7 @@ struct test_context {
     hg_addr_t           addr;
     soma_admin_t       admin;
     soma_collector_id_t id;
+    int                 local; // handles call the provider directly
 };
 
 static const char* token = "ABCDEFGH";
@@ -24,7 +28,6 @@ static const char* backend_config = "{ \"foo\" : \"bar\" }";
 
 static void* test_context_setup(const MunitParameter params[], void* user_data)
 {
-    (void) params;
     (void) user_data;
     soma_return_t      ret;
     margo_instance_id   mid;
@@ -58,6 +61,8 @@ static void* test_context_setup(const MunitParameter params[], void* user_data)
     context->addr  = addr;
     context->admin = admin;
     context->id    = id;
+    const char* path = munit_parameters_get(params, "path");
+    context->local = !path || strcmp(path, "rpc") != 0;
     return context;
 }
 
@@ -79,6 +84,21 @@ static void test_context_tear_down(void* fixture)
     margo_finalize(context->mid);
 }
 
+/* Creates a collector handle that calls the provider directly or
+ * sends RPCs, depending on the "path" parameter of the test. */
+static soma_return_t test_handle_create(
+        struct test_context* context,
+        soma_client_t client,
+        uint16_t pid,
+        soma_collector_id_t id,
+        soma_collector_handle_t* rh)
+{
+    soma_return_t ret = soma_collector_handle_create(client,
+            context->addr, pid, id, rh);
+    if(ret != SOMA_SUCCESS) return ret;
+    return soma_collector_handle_set_local(*rh, context->local);
+}
+
 static MunitResult test_client(const MunitParameter params[], void* data)
 {
     (void)params;
@@ -108,8 +128,8 @@ static MunitResult test_collector(const MunitParameter params[], void* data)
     ret = soma_client_init(context->mid, &client);
     munit_assert_int(ret, ==, SOMA_SUCCESS);
     // test that we can create a collector handle
-    ret = soma_collector_handle_create(client,
-            context->addr, provider_id, context->id, &rh);
+    ret = test_handle_create(context, client,
+            provider_id, context->id, &rh);
     munit_assert_int(ret, ==, SOMA_SUCCESS);
     // test that we can increase the ref count
     ret = soma_collector_handle_ref_incr(rh);
@@ -140,8 +160,8 @@ static MunitResult test_hello(const MunitParameter params[], void* data)
     ret = soma_client_init(context->mid, &client);
     munit_assert_int(ret, ==, SOMA_SUCCESS);
     // test that we can create a collector handle
-    ret = soma_collector_handle_create(client,
-            context->addr, provider_id, context->id, &rh);
+    ret = test_handle_create(context, client,
+            provider_id, context->id, &rh);
     munit_assert_int(ret, ==, SOMA_SUCCESS);
     // test that we can send a hello RPC to the collector
     ret = soma_say_hello(rh);
@@ -168,8 +188,8 @@ static MunitResult test_sum(const MunitParameter params[], void* data)
     ret = soma_client_init(context->mid, &client);
     munit_assert_int(ret, ==, SOMA_SUCCESS);
     // test that we can create a collector handle
-    ret = soma_collector_handle_create(client,
-            context->addr, provider_id, context->id, &rh);
+    ret = test_handle_create(context, client,
+            provider_id, context->id, &rh);
     munit_assert_int(ret, ==, SOMA_SUCCESS);
     // test that we can send a sum RPC to the collector
     int32_t result = 0;
@@ -186,6 +206,605 @@ static MunitResult test_sum(const MunitParameter params[], void* data)
     return MUNIT_OK;
 }
 
+static MunitResult test_stale_index(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    int32_t result = 0;
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = test_handle_create(context, client,
+            provider_id, context->id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // the first sum teaches the handle the collector's index,
+    // the second one uses it
+    ret = soma_compute_sum(rh, 1, 2, &result);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_compute_sum(rh, 3, 4, &result);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_int(result, ==, 7);
+    // replace the collector with another one, which reuses its index slot
+    ret = soma_destroy_collector(context->admin,
+            context->addr, provider_id, token, context->id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(context->admin, context->addr,
+            provider_id, token, "dummy", backend_config, &context->id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // the stale index must not reach the new collector
+    ret = soma_compute_sum(rh, 5, 6, &result);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_COLLECTOR);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // a new handle to the new collector works
+    ret = test_handle_create(context, client,
+            provider_id, context->id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_compute_sum(rh, 5, 6, &result);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_int(result, ==, 11);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_destroyed(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    int32_t result = 0;
+    uint64_t series = 1, timestamp = 2;
+    double value = 3.0;
+    soma_aggregate_t aggregate;
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = test_handle_create(context, client,
+            provider_id, context->id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // learn the collector's index, then destroy the collector
+    ret = soma_compute_sum(rh, 1, 2, &result);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(context->admin,
+            context->addr, provider_id, token, context->id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // neither the index nor the id must resolve anymore
+    ret = soma_compute_sum(rh, 3, 4, &result);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_COLLECTOR);
+    ret = soma_publish_columns(rh, 1, &series, &timestamp, &value);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_COLLECTOR);
+    ret = soma_get_aggregates(rh, 1, &series, &aggregate);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_COLLECTOR);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // recreate a collector for the tear down to destroy
+    ret = soma_create_collector(context->admin, context->addr,
+            provider_id, token, "dummy", backend_config, &context->id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_async(const MunitParameter params[], void* data)
+{
+    (void)params;
+    (void)data;
+    struct test_context* context = (struct test_context*)data;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    // test that we can create a client object
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can create a collector handle
+    ret = test_handle_create(context, client,
+            provider_id, context->id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can send a hello RPC asynchronously
+    soma_request_t req;
+    ret = soma_say_hello_async(rh, &req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_request_wait(req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can test and wait for a single sum
+    int32_t result = 0;
+    int flag = 0;
+    ret = soma_compute_sum_async(rh, 45, 55, &result, &req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_request_test(req, &flag);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_request_wait(req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_int(result, ==, 100);
+    // test that we can keep several sums in flight and drain them
+    soma_request_t reqs[8];
+    int32_t results[8];
+    int i;
+    for(i = 0; i < 8; i++) {
+        ret = soma_compute_sum_async(rh, i, 10*i, &results[i], &reqs[i]);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    for(i = 0; i < 8; i++) {
+        size_t index = 8;
+        ret = soma_request_wait_any(8, reqs, &index);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        munit_assert_ulong(index, <, 8);
+        munit_assert_null(reqs[index]);
+        munit_assert_int(results[index], ==, 11*(int)index);
+    }
+    // test that waiting on an array of completed requests is an error
+    size_t index;
+    ret = soma_request_wait_any(8, reqs, &index);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_ARGS);
+    // test that we can destroy the collector handle
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can free the client object
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_publish_batch(const MunitParameter params[], void* data)
+{
+    (void)params;
+    (void)data;
+    struct test_context* context = (struct test_context*)data;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    // test that we can create a client object
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can create a collector handle
+    ret = test_handle_create(context, client,
+            provider_id, context->id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can publish a batch of samples in a single RPC
+    size_t count = 4096;
+    soma_sample_t* samples = (soma_sample_t*)calloc(count, sizeof(*samples));
+    munit_assert_not_null(samples);
+    size_t i;
+    for(i = 0; i < count; i++) {
+        samples[i].series    = i % 16;
+        samples[i].timestamp = i;
+        samples[i].value     = (double)i;
+    }
+    ret = soma_publish_batch(rh, samples, count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that publishing an empty batch is a no-op
+    ret = soma_publish_batch(rh, samples, 0);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    free(samples);
+    // test that we can destroy the collector handle
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can free the client object
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_publish_columns(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = test_handle_create(context, client,
+            provider_id, context->id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can publish samples held in separate columns
+    uint64_t series[64], timestamps[64];
+    double values[64];
+    size_t i;
+    for(i = 0; i < 64; i++) {
+        series[i]     = i % 4;
+        timestamps[i] = i;
+        values[i]     = (double)i;
+    }
+    ret = soma_publish_columns(rh, 64, series, timestamps, values);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    soma_request_t req;
+    ret = soma_publish_columns_async(rh, 64, series, timestamps, values, &req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_request_wait(req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that missing columns are rejected
+    ret = soma_publish_columns(rh, 64, series, NULL, values);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_ARGS);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+/* backend written against version 1 of the backend interface,
+ * which only receives samples through publish */
+static uint64_t legacy_sum_of_values;
+
+static soma_return_t legacy_create(soma_provider_t p, const char* c, void** ctx)
+{
+    (void)p; (void)c;
+    *ctx = NULL;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t legacy_close(void* ctx)
+{
+    (void)ctx;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t legacy_publish(void* ctx, const soma_sample_t* samples, size_t count)
+{
+    (void)ctx;
+    size_t i;
+    for(i = 0; i < count; i++)
+        legacy_sum_of_values += (uint64_t)samples[i].value;
+    return SOMA_SUCCESS;
+}
+
+static soma_backend_impl legacy_backend = {
+    .name              = "legacy",
+    .create_collector  = legacy_create,
+    .open_collector    = legacy_create,
+    .close_collector   = legacy_close,
+    .destroy_collector = legacy_close,
+    .publish           = legacy_publish
+};
+
+static MunitResult test_legacy_backend(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_provider_t provider;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_collector_id_t id;
+    soma_return_t ret;
+    // register a second provider with the legacy backend
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token = token;
+    ret = soma_provider_register(context->mid, provider_id + 1, &args, &provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_provider_register_backend(provider, &legacy_backend);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(context->admin, context->addr,
+            provider_id + 1, token, "legacy", "{}", &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // batches larger than the conversion chunk reach publish entirely
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = test_handle_create(context, client,
+            provider_id + 1, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    soma_sample_t samples[1000];
+    size_t i;
+    uint64_t expected = 0;
+    for(i = 0; i < 1000; i++) {
+        samples[i].series    = 0;
+        samples[i].timestamp = i;
+        samples[i].value     = (double)i;
+        expected += i;
+    }
+    legacy_sum_of_values = 0;
+    ret = soma_publish_batch(rh, samples, 1000);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(legacy_sum_of_values, ==, expected);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(context->admin, context->addr,
+            provider_id + 1, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_provider_destroy(provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+/* backend recording the last batch it ingested */
+static uint64_t recorded_series[256];
+static uint64_t recorded_timestamps[256];
+static double   recorded_values[256];
+static size_t   recorded_count;
+
+static soma_return_t recording_ingest(void* ctx, const soma_batch_t* batch)
+{
+    (void)ctx;
+    recorded_count = batch->count;
+    if(batch->count > 256) return SOMA_ERR_INVALID_ARGS;
+    memcpy(recorded_series, batch->series, batch->count*sizeof(uint64_t));
+    memcpy(recorded_timestamps, batch->timestamps, batch->count*sizeof(uint64_t));
+    memcpy(recorded_values, batch->values, batch->count*sizeof(double));
+    return SOMA_SUCCESS;
+}
+
+static soma_backend_impl recording_backend = {
+    .name              = "recording",
+    .create_collector  = legacy_create,
+    .open_collector    = legacy_create,
+    .close_collector   = legacy_close,
+    .destroy_collector = legacy_close,
+    .ingest            = recording_ingest
+};
+
+static MunitResult test_packed(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_provider_t provider;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_collector_id_t id;
+    soma_request_t req;
+    soma_return_t ret;
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token = token;
+    ret = soma_provider_register(context->mid, provider_id + 1, &args, &provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_provider_register_backend(provider, &recording_backend);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(context->admin, context->addr,
+            provider_id + 1, token, "recording", "{}", &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = test_handle_create(context, client,
+            provider_id + 1, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // samples exercising every case of the compressed encoding:
+    // periodic and irregular timestamps, going back in time, series
+    // ids far apart, repeated values, special and random values; few
+    // enough for their largest encoding to fit in the eager buffer of
+    // the RPC, so that they are sent compressed
+    uint64_t series[100], timestamps[100];
+    double values[100];
+    size_t i;
+    for(i = 0; i < 100; i++) {
+        series[i]     = (i % 5 == 4) ? UINT64_MAX - i : i % 3;
+        timestamps[i] = (i < 50) ? 1000000 + 10*i : 5000000 - i*i*7;
+        values[i]     = (i % 7 == 0 && i) ? values[i-1] : munit_rand_double() * 1e6 - 5e5;
+    }
+    timestamps[80] = UINT64_MAX;
+    timestamps[81] = 0;
+    values[0]  = 0.0;
+    values[10] = -0.0;
+    values[20] = 1.0 / 0.0;
+    values[30] = 0.0 / 0.0;
+    values[40] = 5e-324;
+    // asynchronous publishing goes through an RPC even within a process
+    ret = soma_publish_columns_async(rh, 100, series, timestamps, values, &req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_request_wait(req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(recorded_count, ==, 100);
+    munit_assert_memory_equal(sizeof(series), recorded_series, series);
+    munit_assert_memory_equal(sizeof(timestamps), recorded_timestamps, timestamps);
+    munit_assert_memory_equal(sizeof(values), recorded_values, values);
+    // a single sample
+    ret = soma_publish_columns_async(rh, 1, series + 3, timestamps + 3, values + 3, &req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_request_wait(req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(recorded_count, ==, 1);
+    munit_assert_memory_equal(sizeof(double), recorded_values, values + 3);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(context->admin, context->addr,
+            provider_id + 1, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_provider_destroy(provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+/* backend keeping a list of nodes in the arena of its collectors,
+ * with a large allocation for every batch, and freeing nothing */
+typedef struct arena_node {
+    struct arena_node* next;
+    uint64_t           series;
+    double             value;
+} arena_node;
+
+typedef struct arena_context {
+    soma_arena_t arena;
+    arena_node*  nodes;
+    char*        buffers;
+    size_t       count;
+} arena_context;
+
+static size_t arena_misaligned;
+
+static soma_return_t arena_create(soma_provider_t p, const char* c, soma_arena_t arena, void** ctx)
+{
+    (void)p; (void)c;
+    munit_assert_not_null(arena);
+    arena_context* context = (arena_context*)soma_arena_calloc(arena, sizeof(*context));
+    munit_assert_not_null(context);
+    context->arena = arena;
+    *ctx = context;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t arena_ingest(void* ctx, const soma_batch_t* batch)
+{
+    arena_context* context = (arena_context*)ctx;
+    size_t i;
+    for(i = 0; i < batch->count; i++) {
+        arena_node* node = (arena_node*)soma_arena_alloc(context->arena, sizeof(*node));
+        if(!node) return SOMA_ERR_ALLOCATION;
+        if((uintptr_t)node % 16) arena_misaligned += 1;
+        node->series = batch->series[i];
+        node->value  = batch->values[i];
+        node->next   = context->nodes;
+        context->nodes = node;
+        /* freed objects are reused */
+        if(i % 3 == 0) {
+            void* tmp = soma_arena_alloc(context->arena, 200);
+            soma_arena_free(context->arena, tmp, 200);
+            munit_assert_ptr_equal(soma_arena_alloc(context->arena, 256), tmp);
+        }
+    }
+    char* buffer = (char*)soma_arena_alloc(context->arena, 100000);
+    if(!buffer) return SOMA_ERR_ALLOCATION;
+    if((uintptr_t)buffer % 64) arena_misaligned += 1;
+    memset(buffer, 0xab, 100000);
+    soma_arena_free(context->arena, context->buffers, 100000);
+    context->buffers = buffer;
+    context->count  += batch->count;
+    return SOMA_SUCCESS;
+}
+
+static soma_return_t arena_close(void* ctx)
+{
+    arena_context* context = (arena_context*)ctx;
+    /* everything ingested is still there */
+    size_t count = 0;
+    double sum = 0.0;
+    arena_node* node;
+    for(node = context->nodes; node; node = node->next) {
+        munit_assert_ulong(node->series, ==, 7);
+        sum += node->value;
+        count += 1;
+    }
+    munit_assert_ulong(count, ==, context->count);
+    munit_assert_double(sum, ==, (double)(count * (count - 1) / 2));
+    munit_assert_uint8((uint8_t)context->buffers[99999], ==, 0xab);
+    return SOMA_SUCCESS;
+}
+
+static soma_backend_impl arena_backend = {
+    .name              = "arena",
+    .close_collector   = arena_close,
+    .destroy_collector = arena_close,
+    .ingest            = arena_ingest,
+    .create_collector_in_arena = arena_create,
+    .open_collector_in_arena   = arena_create
+};
+
+static MunitResult test_arena(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_provider_t provider;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_collector_id_t id;
+    soma_return_t ret;
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token = token;
+    ret = soma_provider_register(context->mid, provider_id + 1, &args, &provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_provider_register_backend(provider, &arena_backend);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // one collector is destroyed and the other closed with its provider
+    int i;
+    for(i = 0; i < 2; i++) {
+        ret = soma_create_collector(context->admin, context->addr,
+                provider_id + 1, token, "arena", "{}", &id);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        ret = test_handle_create(context, client,
+                provider_id + 1, id, &rh);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        uint64_t series[1000], timestamps[1000];
+        double values[1000];
+        size_t j, k;
+        for(j = 0; j < 10; j++) {
+            for(k = 0; k < 1000; k++) {
+                series[k]     = 7;
+                timestamps[k] = j*1000 + k;
+                values[k]     = (double)(j*1000 + k);
+            }
+            ret = soma_publish_columns(rh, 1000, series, timestamps, values);
+            munit_assert_int(ret, ==, SOMA_SUCCESS);
+        }
+        munit_assert_ulong(arena_misaligned, ==, 0);
+        ret = soma_collector_handle_release(rh);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        if(i == 0) {
+            ret = soma_destroy_collector(context->admin, context->addr,
+                    provider_id + 1, token, id);
+            munit_assert_int(ret, ==, SOMA_SUCCESS);
+        }
+    }
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_provider_destroy(provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_publish(const MunitParameter params[], void* data)
+{
+    (void)params;
+    (void)data;
+    struct test_context* context = (struct test_context*)data;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    // test that we can create a client object
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can create a collector handle
+    ret = test_handle_create(context, client,
+            provider_id, context->id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can configure the handle's buffer
+    ret = soma_collector_handle_set_buffering(rh, 64, 10.0);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can stage more samples than the buffer holds
+    uint64_t i;
+    for(i = 0; i < 1000; i++) {
+        ret = soma_publish(rh, i % 8, i, (double)i);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    // test that we can flush the remaining samples
+    ret = soma_collector_handle_flush(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that publishing without buffering works
+    ret = soma_collector_handle_set_buffering(rh, 0, 0.0);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_publish(rh, 0, 1000, 1000.0);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that releasing the handle flushes staged samples
+    ret = soma_collector_handle_set_buffering(rh, 64, 10.0);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_publish(rh, 0, 1001, 1001.0);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // test that we can free the client object
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
 static MunitResult test_invalid(const MunitParameter params[], void* data)
 {
     (void)params;
@@ -199,12 +818,12 @@ static MunitResult test_invalid(const MunitParameter params[], void* data)
     ret = soma_client_init(context->mid, &client);
     munit_assert_int(ret, ==, SOMA_SUCCESS);
     // create a collector handle for a wrong collector id
-    ret = soma_collector_handle_create(client,
-            context->addr, provider_id, invalid_id, &rh1);
+    ret = test_handle_create(context, client,
+            provider_id, invalid_id, &rh1);
     munit_assert_int(ret, ==, SOMA_SUCCESS);
     // create a collector handle for a wrong provider id
-    ret = soma_collector_handle_create(client,
-            context->addr, provider_id + 1, context->id, &rh2);
+    ret = test_handle_create(context, client,
+            provider_id + 1, context->id, &rh2);
     munit_assert_int(ret, ==, SOMA_SUCCESS);
     // test sending to the invalid collector id
     int32_t result;
@@ -226,12 +845,240 @@ static MunitResult test_invalid(const MunitParameter params[], void* data)
     return MUNIT_OK;
 }
 
+static MunitResult test_max_delay(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_provider_t provider;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_collector_id_t id;
+    soma_return_t ret;
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token = token;
+    ret = soma_provider_register(context->mid, provider_id + 1, &args, &provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_provider_register_backend(provider, &recording_backend);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(context->admin, context->addr,
+            provider_id + 1, token, "recording", "{}", &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_init(context->mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = test_handle_create(context, client,
+            provider_id + 1, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_set_buffering(rh, 64, 0.1);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // staged samples are sent once the oldest is max_delay old,
+    // although nothing is published after them
+    recorded_count = 0;
+    uint64_t i;
+    for(i = 0; i < 3; i++) {
+        ret = soma_publish(rh, i, 100 + i, (double)i);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    int attempts;
+    for(attempts = 0; attempts < 500 && recorded_count == 0; attempts++)
+        margo_thread_sleep(context->mid, 10);
+    munit_assert_ulong(recorded_count, ==, 3);
+    munit_assert_ulong(recorded_timestamps[2], ==, 102);
+    // and so are the next ones
+    recorded_count = 0;
+    ret = soma_publish(rh, 7, 200, 1.0);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    for(attempts = 0; attempts < 500 && recorded_count == 0; attempts++)
+        margo_thread_sleep(context->mid, 10);
+    munit_assert_ulong(recorded_count, ==, 1);
+    ret = soma_collector_handle_flush(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // releasing the handle stops the flusher
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(context->admin, context->addr,
+            provider_id + 1, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_provider_destroy(provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+/* backend recording the pool in which each class of RPCs ran */
+static ABT_pool admin_ran_in, hello_ran_in, sum_ran_in, query_ran_in;
+
+static soma_return_t pools_create(soma_provider_t p, const char* c, void** ctx)
+{
+    (void)p; (void)c;
+    *ctx = NULL;
+    ABT_self_get_last_pool(&admin_ran_in);
+    return SOMA_SUCCESS;
+}
+
+static void pools_hello(void* ctx)
+{
+    (void)ctx;
+    ABT_self_get_last_pool(&hello_ran_in);
+}
+
+static int32_t pools_sum(void* ctx, int32_t x, int32_t y)
+{
+    (void)ctx;
+    ABT_self_get_last_pool(&sum_ran_in);
+    return x + y;
+}
+
+static soma_return_t pools_scan(void* ctx, const soma_query_t* query,
+                                soma_scan_fn fn, void* uargs)
+{
+    (void)ctx; (void)query; (void)fn; (void)uargs;
+    ABT_self_get_last_pool(&query_ran_in);
+    return SOMA_SUCCESS;
+}
+
+static soma_backend_impl pools_backend = {
+    .name              = "pools",
+    .create_collector  = pools_create,
+    .open_collector    = pools_create,
+    .close_collector   = legacy_close,
+    .destroy_collector = legacy_close,
+    .hello             = pools_hello,
+    .sum               = pools_sum,
+    .scan              = pools_scan
+};
+
+static int pool_warnings;
+
+static void count_pool_warnings(void* uargs, const char* message)
+{
+    (void)uargs;
+    if(strstr(message, "Could not find pool"))
+        pool_warnings++;
+}
+
+static void ignore_log(void* uargs, const char* message)
+{
+    (void)uargs; (void)message;
+}
+
+static MunitResult test_pools(const MunitParameter params[], void* data)
+{
+    (void)params;
+    (void)data;
+    soma_provider_t provider;
+    soma_admin_t admin;
+    soma_client_t client;
+    soma_collector_handle_t rh;
+    soma_collector_id_t id;
+    soma_return_t ret;
+    hg_addr_t addr;
+    // a margo instance with two named pools, run by an execution stream
+    // of their own, besides the default handler pool
+    struct margo_init_info info;
+    memset(&info, 0, sizeof(info));
+    info.json_config =
+        "{ \"argobots\" : {"
+        "    \"pools\" : [ { \"name\" : \"ingest_pool\", \"kind\" : \"fifo_wait\", \"access\" : \"mpmc\" },"
+        "                  { \"name\" : \"query_pool\",  \"kind\" : \"fifo_wait\", \"access\" : \"mpmc\" } ],"
+        "    \"xstreams\" : [ { \"name\" : \"rpc_es\", \"scheduler\" : { \"type\" : \"basic_wait\","
+        "                       \"pools\" : [ \"ingest_pool\", \"query_pool\" ] } } ] } }";
+    margo_instance_id mid = margo_init_ext("na+sm", MARGO_SERVER_MODE, &info);
+    munit_assert_not_null(mid);
+    ABT_pool handler_pool, ingest_pool, query_pool;
+    munit_assert_int(margo_get_handler_pool(mid, &handler_pool), ==, 0);
+    munit_assert_int(margo_get_pool_by_name(mid, "ingest_pool", &ingest_pool), ==, 0);
+    munit_assert_int(margo_get_pool_by_name(mid, "query_pool", &query_pool), ==, 0);
+    struct margo_logger logger = {
+        NULL, ignore_log, ignore_log, ignore_log, count_pool_warnings, ignore_log, ignore_log
+    };
+    margo_set_logger(mid, &logger);
+    // the pool of ingest RPCs comes from the arguments, which take precedence
+    // over the configuration, that of query RPCs from the configuration, and
+    // admin RPCs fall back to the default pool since theirs does not exist
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token       = token;
+    args.ingest_pool = ingest_pool;
+    args.config      = "{ \"pools\" : { \"admin\" : \"no_such_pool\","
+                       " \"ingest\" : \"query_pool\", \"query\" : \"query_pool\" } }";
+    pool_warnings = 0;
+    ret = soma_provider_register(mid, provider_id, &args, &provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_int(pool_warnings, ==, 1);
+    ret = soma_provider_register_backend(provider, &pools_backend);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    munit_assert_int(margo_addr_self(mid, &addr), ==, HG_SUCCESS);
+    ret = soma_admin_init(mid, &admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(admin, addr, provider_id, token, "pools", "{}", &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_init(mid, &client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(client, addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // direct calls would run in this ULT rather than in the provider's pools
+    ret = soma_collector_handle_set_local(rh, 0);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_say_hello(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    int32_t result = 0;
+    ret = soma_compute_sum(rh, 1, 2, &result);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    uint64_t series = 0;
+    soma_sample_t sample;
+    size_t count = 1;
+    ret = soma_query(rh, 1, &series, 0, UINT64_MAX, SOMA_AGG_NONE, 0, NULL, &sample, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_size(count, ==, 0);
+    munit_assert_ptr_equal(admin_ran_in, handler_pool);
+    munit_assert_ptr_equal(hello_ran_in, ingest_pool);
+    munit_assert_ptr_equal(sum_ran_in, ingest_pool);
+    munit_assert_ptr_equal(query_ran_in, query_pool);
+
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_finalize(client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(admin, addr, provider_id, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_admin_finalize(admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    margo_addr_free(mid, addr);
+    ret = soma_provider_destroy(provider);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+/* every test involving a collector handle runs once with handles calling
+ * the provider directly and once with handles sending RPCs */
+static char* path_values[] = { (char*)"local", (char*)"rpc", NULL };
+
+static MunitParameterEnum path_params[] = {
+    { (char*)"path", path_values },
+    { NULL, NULL }
+};
+
 static MunitTest test_suite_tests[] = {
     { (char*) "/client",   test_client,   test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
-    { (char*) "/collector", test_collector, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
-    { (char*) "/hello",    test_hello,    test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
-    { (char*) "/sum",      test_sum,      test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
-    { (char*) "/invalid",  test_invalid,  test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/collector", test_collector, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/hello",    test_hello,    test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/sum",      test_sum,      test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/stale_index", test_stale_index, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/destroyed", test_destroyed, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/async",    test_async,    test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/publish_batch", test_publish_batch, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/packed", test_packed, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/max_delay", test_max_delay, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/publish_columns", test_publish_columns, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/arena", test_arena, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/legacy_backend", test_legacy_backend, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/publish",  test_publish,  test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/invalid",  test_invalid,  test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, path_params },
+    { (char*) "/pools",    test_pools,    NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
     { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
 
@@ -0,0 +1,270 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <margo.h>
+#include <soma/soma-server.h>
+#include <soma/soma-admin.h>
+#include <soma/soma-client.h>
+#include <soma/soma-collector.h>
+#include <soma/soma-cluster.h>
+#include "munit/munit.h"
+
+#define NUM_PROVIDERS 4
+#define NUM_SERIES    20000
+
+struct test_context {
+    margo_instance_id   mid;
+    hg_addr_t           addr;
+    soma_admin_t        admin;
+    soma_client_t       client;
+    soma_collector_id_t ids[NUM_PROVIDERS];
+    soma_collector_handle_t handles[NUM_PROVIDERS];
+};
+
+static const char* token = "ABCDEFGH";
+static const uint16_t first_provider_id = 42;
+static const char* backend_config = "{}";
+
+static void* test_context_setup(const MunitParameter params[], void* user_data)
+{
+    (void) params;
+    (void) user_data;
+    soma_return_t ret;
+    int i;
+    struct test_context* context = (struct test_context*)calloc(1, sizeof(*context));
+    munit_assert_not_null(context);
+    // create margo instance
+    context->mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    munit_assert_not_null(context->mid);
+    // get address of current process
+    hg_return_t hret = margo_addr_self(context->mid, &context->addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    ret = soma_admin_init(context->mid, &context->admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_init(context->mid, &context->client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // register providers, each with a collector
+    for(i = 0; i < NUM_PROVIDERS; i++) {
+        struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+        args.token = token;
+        ret = soma_provider_register(context->mid, first_provider_id + i,
+                &args, SOMA_PROVIDER_IGNORE);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        ret = soma_create_collector(context->admin, context->addr,
+                first_provider_id + i, token, "dummy", backend_config, &context->ids[i]);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        ret = soma_collector_handle_create(context->client, context->addr,
+                first_provider_id + i, context->ids[i], &context->handles[i]);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    return context;
+}
+
+static void test_context_tear_down(void* fixture)
+{
+    struct test_context* context = (struct test_context*)fixture;
+    int i;
+    for(i = 0; i < NUM_PROVIDERS; i++) {
+        soma_collector_handle_release(context->handles[i]);
+        soma_destroy_collector(context->admin, context->addr,
+                first_provider_id + i, token, context->ids[i]);
+    }
+    soma_client_finalize(context->client);
+    soma_admin_finalize(context->admin);
+    margo_addr_free(context->mid, context->addr);
+    margo_finalize(context->mid);
+    free(context);
+}
+
+static int member_index(struct test_context* context, soma_collector_handle_t h)
+{
+    int i;
+    for(i = 0; i < NUM_PROVIDERS; i++)
+        if(context->handles[i] == h) return i;
+    return -1;
+}
+
+static MunitResult test_routing(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_cluster_handle_t cluster;
+    soma_collector_handle_t h;
+    soma_return_t ret;
+    uint64_t s;
+    int* before = (int*)malloc(NUM_SERIES * sizeof(int));
+    int counts[NUM_PROVIDERS] = { 0 };
+
+    // start with all the members but the last one
+    ret = soma_cluster_handle_create(context->client,
+            NUM_PROVIDERS - 1, context->handles, 0, &cluster);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // the series should be spread evenly
+    for(s = 0; s < NUM_SERIES; s++) {
+        ret = soma_cluster_route(cluster, s, &h);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        before[s] = member_index(context, h);
+        munit_assert_int(before[s], >=, 0);
+        munit_assert_int(before[s], <, NUM_PROVIDERS - 1);
+        counts[before[s]] += 1;
+    }
+    int i;
+    for(i = 0; i < NUM_PROVIDERS - 1; i++) {
+        munit_assert_int(counts[i], >, NUM_SERIES / (NUM_PROVIDERS - 1) * 3 / 4);
+        munit_assert_int(counts[i], <, NUM_SERIES / (NUM_PROVIDERS - 1) * 5 / 4);
+    }
+
+    // another cluster with the same members routes identically
+    soma_cluster_handle_t other;
+    soma_collector_handle_t reversed[NUM_PROVIDERS - 1];
+    for(i = 0; i < NUM_PROVIDERS - 1; i++)
+        reversed[i] = context->handles[NUM_PROVIDERS - 2 - i];
+    ret = soma_cluster_handle_create(context->client,
+            NUM_PROVIDERS - 1, reversed, 0, &other);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    for(s = 0; s < NUM_SERIES; s++) {
+        ret = soma_cluster_route(other, s, &h);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        munit_assert_int(member_index(context, h), ==, before[s]);
+    }
+    ret = soma_cluster_handle_release(other);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // adding a member only moves series to the new member
+    ret = soma_cluster_add_member(cluster, context->handles[NUM_PROVIDERS - 1]);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_cluster_add_member(cluster, context->handles[NUM_PROVIDERS - 1]);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_ARGS);
+    size_t size;
+    ret = soma_cluster_get_size(cluster, &size);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(size, ==, NUM_PROVIDERS);
+    int moved = 0;
+    for(s = 0; s < NUM_SERIES; s++) {
+        ret = soma_cluster_route(cluster, s, &h);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        int m = member_index(context, h);
+        if(m != before[s]) {
+            munit_assert_int(m, ==, NUM_PROVIDERS - 1);
+            moved += 1;
+        }
+    }
+    munit_assert_int(moved, >, NUM_SERIES / NUM_PROVIDERS * 3 / 4);
+    munit_assert_int(moved, <, NUM_SERIES / NUM_PROVIDERS * 5 / 4);
+
+    // removing it brings the series back where they were
+    ret = soma_cluster_remove_member(cluster, context->ids[NUM_PROVIDERS - 1]);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    for(s = 0; s < NUM_SERIES; s++) {
+        ret = soma_cluster_route(cluster, s, &h);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        munit_assert_int(member_index(context, h), ==, before[s]);
+    }
+
+    ret = soma_cluster_handle_release(cluster);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    free(before);
+    return MUNIT_OK;
+}
+
+static MunitResult test_publish(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_cluster_handle_t cluster;
+    soma_return_t ret;
+    size_t i;
+
+    ret = soma_cluster_handle_create(context->client,
+            NUM_PROVIDERS, context->handles, 16, &cluster);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    soma_sample_t samples[256];
+    for(i = 0; i < 256; i++) {
+        samples[i].series    = i % 37;
+        samples[i].timestamp = i;
+        samples[i].value     = (double)i;
+    }
+    ret = soma_cluster_publish_batch(cluster, samples, 256);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    for(i = 0; i < 256; i++) {
+        ret = soma_cluster_publish(cluster, samples[i].series,
+                samples[i].timestamp, samples[i].value);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    ret = soma_cluster_flush(cluster);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    ret = soma_cluster_handle_release(cluster);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    return MUNIT_OK;
+}
+
+static MunitResult test_from_file(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_cluster_handle_t cluster;
+    soma_return_t ret;
+    char addr_str[256];
+    hg_size_t addr_size = sizeof(addr_str);
+    int i;
+
+    hg_return_t hret = margo_addr_to_string(context->mid, addr_str, &addr_size, context->addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    char filename[] = "/tmp/soma-cluster-XXXXXX";
+    int fd = mkstemp(filename);
+    munit_assert_int(fd, >=, 0);
+    FILE* file = fdopen(fd, "w");
+    fprintf(file, "{ \"virtual_nodes\" : 64, \"members\" : [");
+    for(i = 0; i < NUM_PROVIDERS; i++) {
+        char id_str[37];
+        soma_collector_id_to_string(context->ids[i], id_str);
+        fprintf(file, "%s{ \"address\" : \"%s\", \"provider_id\" : %d, \"collector\" : \"%s\" }",
+                i ? "," : "", addr_str, first_provider_id + i, id_str);
+    }
+    fprintf(file, "] }");
+    fclose(file);
+
+    ret = soma_cluster_handle_create_from_file(context->client, filename, &cluster);
+    unlink(filename);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    size_t size;
+    ret = soma_cluster_get_size(cluster, &size);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(size, ==, NUM_PROVIDERS);
+
+    soma_sample_t sample = { 1, 2, 3.0 };
+    ret = soma_cluster_publish_batch(cluster, &sample, 1);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    ret = soma_cluster_handle_release(cluster);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    ret = soma_cluster_handle_create_from_file(context->client, "/nonexistent.json", &cluster);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+    return MUNIT_OK;
+}
+
+static MunitTest test_suite_tests[] = {
+    { (char*) "/routing",   test_routing,   test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/publish",   test_publish,   test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/from_file", test_from_file, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite test_suite = {
+    (char*) "/soma/cluster", test_suite_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char* argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
+    return munit_suite_main(&test_suite, (void*) "soma", argc, argv);
+}
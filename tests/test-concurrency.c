@@ -0,0 +1,184 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <margo.h>
+#include <soma/soma-server.h>
+#include <soma/soma-admin.h>
+#include <soma/soma-client.h>
+#include <soma/soma-collector.h>
+#include "munit/munit.h"
+
+#define NUM_SLOTS       8
+#define NUM_SUM_ULTS    32
+#define NUM_ITERATIONS  200
+#define NUM_CHURNS      100
+
+struct test_context {
+    margo_instance_id   mid;
+    hg_addr_t           addr;
+    soma_admin_t        admin;
+    soma_client_t       client;
+    ABT_pool            pool;
+    /* collectors being created and destroyed while sums run on them */
+    ABT_mutex           ids_mtx;
+    soma_collector_id_t ids[NUM_SLOTS];
+    int                 num_failures;
+};
+
+static const char* token = "ABCDEFGH";
+static const uint16_t provider_id = 42;
+
+static void* test_context_setup(const MunitParameter params[], void* user_data)
+{
+    (void) params;
+    (void) user_data;
+    soma_return_t ret;
+    // create margo instance with several execution streams serving RPCs
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 1, 4);
+    munit_assert_not_null(mid);
+    struct test_context* context = (struct test_context*)calloc(1, sizeof(*context));
+    munit_assert_not_null(context);
+    context->mid = mid;
+    // get address of current process
+    hg_return_t hret = margo_addr_self(mid, &context->addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    // register soma provider
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token = token;
+    ret = soma_provider_register(
+            mid, provider_id, &args,
+            SOMA_PROVIDER_IGNORE);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // create an admin and a client
+    ret = soma_admin_init(mid, &context->admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_init(mid, &context->client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // run the test's ULTs in the same pool as the RPC handlers
+    margo_get_handler_pool(mid, &context->pool);
+    ABT_mutex_create(&context->ids_mtx);
+    return context;
+}
+
+static void test_context_tear_down(void* fixture)
+{
+    struct test_context* context = (struct test_context*)fixture;
+    soma_client_finalize(context->client);
+    soma_admin_finalize(context->admin);
+    ABT_mutex_free(&context->ids_mtx);
+    margo_addr_free(context->mid, context->addr);
+    // we are not checking the return value of the above function with
+    // munit because we need margo_finalize to be called no matter what.
+    margo_finalize(context->mid);
+    free(context);
+}
+
+static void sum_ult(void* arg)
+{
+    struct test_context* context = (struct test_context*)arg;
+    int i;
+    for(i = 0; i < NUM_ITERATIONS; i++) {
+        soma_collector_id_t id;
+        ABT_mutex_lock(context->ids_mtx);
+        id = context->ids[i % NUM_SLOTS];
+        ABT_mutex_unlock(context->ids_mtx);
+
+        soma_collector_handle_t rh;
+        soma_return_t ret = soma_collector_handle_create(context->client,
+                context->addr, provider_id, id, &rh);
+        if(ret != SOMA_SUCCESS) {
+            __atomic_add_fetch(&context->num_failures, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        // the collector may have been destroyed in the meantime,
+        // but if the sum succeeds its result must be correct
+        int32_t result = 0;
+        ret = soma_compute_sum(rh, i, 2*i, &result);
+        if(!(ret == SOMA_SUCCESS && result == 3*i)
+        && ret != SOMA_ERR_INVALID_COLLECTOR)
+            __atomic_add_fetch(&context->num_failures, 1, __ATOMIC_RELAXED);
+        soma_collector_handle_release(rh);
+    }
+}
+
+static void churn_ult(void* arg)
+{
+    struct test_context* context = (struct test_context*)arg;
+    int i;
+    for(i = 0; i < NUM_CHURNS; i++) {
+        soma_collector_id_t old_id, new_id;
+        soma_return_t ret = soma_create_collector(context->admin, context->addr,
+                provider_id, token, "dummy", "{}", &new_id);
+        if(ret != SOMA_SUCCESS) {
+            __atomic_add_fetch(&context->num_failures, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        ABT_mutex_lock(context->ids_mtx);
+        old_id = context->ids[i % NUM_SLOTS];
+        context->ids[i % NUM_SLOTS] = new_id;
+        ABT_mutex_unlock(context->ids_mtx);
+        ret = soma_destroy_collector(context->admin, context->addr,
+                provider_id, token, old_id);
+        if(ret != SOMA_SUCCESS)
+            __atomic_add_fetch(&context->num_failures, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static MunitResult test_churn(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_return_t ret;
+    int i;
+    // create the initial set of collectors
+    for(i = 0; i < NUM_SLOTS; i++) {
+        ret = soma_create_collector(context->admin, context->addr,
+                provider_id, token, "dummy", "{}", &context->ids[i]);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    // run sums on many ULTs while collectors are created and destroyed
+    ABT_thread ults[NUM_SUM_ULTS + 1];
+    for(i = 0; i < NUM_SUM_ULTS; i++) {
+        int r = ABT_thread_create(context->pool, sum_ult, context,
+                                  ABT_THREAD_ATTR_NULL, &ults[i]);
+        munit_assert_int(r, ==, ABT_SUCCESS);
+    }
+    int r = ABT_thread_create(context->pool, churn_ult, context,
+                              ABT_THREAD_ATTR_NULL, &ults[NUM_SUM_ULTS]);
+    munit_assert_int(r, ==, ABT_SUCCESS);
+    for(i = 0; i < NUM_SUM_ULTS + 1; i++) {
+        ABT_thread_join(ults[i]);
+        ABT_thread_free(&ults[i]);
+    }
+    munit_assert_int(context->num_failures, ==, 0);
+    // the collectors left in the slots must all be valid
+    soma_collector_id_t ids[NUM_SLOTS + 1];
+    size_t count = NUM_SLOTS + 1;
+    ret = soma_list_collectors(context->admin, context->addr,
+            provider_id, token, ids, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_ulong(count, ==, NUM_SLOTS);
+    for(i = 0; i < NUM_SLOTS; i++) {
+        ret = soma_destroy_collector(context->admin, context->addr,
+                provider_id, token, context->ids[i]);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+
+    return MUNIT_OK;
+}
+
+static MunitTest test_suite_tests[] = {
+    { (char*) "/churn", test_churn, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite test_suite = {
+    (char*) "/soma/concurrency", test_suite_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char* argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
+    return munit_suite_main(&test_suite, (void*) "soma", argc, argv);
+}
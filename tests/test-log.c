@@ -0,0 +1,211 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <margo.h>
+#include <soma/soma-server.h>
+#include <soma/soma-admin.h>
+#include <soma/soma-client.h>
+#include <soma/soma-collector.h>
+#include "munit/munit.h"
+
+#define NUM_BATCHES 20
+#define BATCH_SIZE  10
+/* each record is a 16-byte header followed by the samples */
+#define RECORD_SIZE (16 + BATCH_SIZE * sizeof(soma_sample_t))
+
+struct test_context {
+    margo_instance_id   mid;
+    hg_addr_t           addr;
+    soma_admin_t        admin;
+    soma_client_t       client;
+    char                path[64];
+    char                config[256];
+};
+
+static const char* token = "ABCDEFGH";
+static const uint16_t provider_id = 42;
+
+static void* test_context_setup(const MunitParameter params[], void* user_data)
+{
+    (void) params;
+    (void) user_data;
+    soma_return_t ret;
+    // create margo instance
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    munit_assert_not_null(mid);
+    struct test_context* context = (struct test_context*)calloc(1, sizeof(*context));
+    munit_assert_not_null(context);
+    context->mid = mid;
+    // get address of current process
+    hg_return_t hret = margo_addr_self(mid, &context->addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    // register soma provider
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token = token;
+    ret = soma_provider_register(
+            mid, provider_id, &args,
+            SOMA_PROVIDER_IGNORE);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // create an admin and a client
+    ret = soma_admin_init(mid, &context->admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_init(mid, &context->client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // the log goes in a fresh subdirectory of a temporary directory
+    strcpy(context->path, "/tmp/soma-test-log-XXXXXX");
+    munit_assert_not_null(mkdtemp(context->path));
+    snprintf(context->config, sizeof(context->config),
+             "{ \"path\" : \"%s/log\", \"segment_size\" : 1000, \"fsync\" : \"always\" }",
+             context->path);
+    return context;
+}
+
+static void test_context_tear_down(void* fixture)
+{
+    struct test_context* context = (struct test_context*)fixture;
+    soma_client_finalize(context->client);
+    soma_admin_finalize(context->admin);
+    rmdir(context->path);
+    margo_addr_free(context->mid, context->addr);
+    // we are not checking the return value of the above function with
+    // munit because we need margo_finalize to be called no matter what.
+    margo_finalize(context->mid);
+    free(context);
+}
+
+/* Returns the total size of the segments in the log directory */
+static size_t log_size(const char* path, int* num_segments)
+{
+    char name[512];
+    size_t total = 0;
+    *num_segments = 0;
+    DIR* dir = opendir(path);
+    munit_assert_not_null(dir);
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL) {
+        if(strncmp(entry->d_name, "segment-", 8) != 0) continue;
+        struct stat st;
+        snprintf(name, sizeof(name), "%s/%s", path, entry->d_name);
+        munit_assert_int(stat(name, &st), ==, 0);
+        total += st.st_size;
+        *num_segments += 1;
+    }
+    closedir(dir);
+    return total;
+}
+
+static MunitResult test_publish(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_collector_id_t id;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    char log_path[128];
+    snprintf(log_path, sizeof(log_path), "%s/log", context->path);
+
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "log", context->config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // a second collector cannot be created on top of an existing log
+    soma_collector_id_t other_id;
+    soma_sample_t samples[NUM_BATCHES][BATCH_SIZE];
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // send all the batches at once so that the provider can group them
+    soma_request_t reqs[NUM_BATCHES];
+    int b, i;
+    for(b = 0; b < NUM_BATCHES; b++) {
+        for(i = 0; i < BATCH_SIZE; i++) {
+            samples[b][i].series    = i;
+            samples[b][i].timestamp = b;
+            samples[b][i].value     = (double)(b*i);
+        }
+        ret = soma_publish_batch_async(rh, samples[b], BATCH_SIZE, &reqs[b]);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    for(b = 0; b < NUM_BATCHES; b++) {
+        ret = soma_request_wait(reqs[b]);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    // every record is on disk, spread over several segments
+    int num_segments = 0;
+    munit_assert_ulong(log_size(log_path, &num_segments), ==, NUM_BATCHES * RECORD_SIZE);
+    munit_assert_int(num_segments, >, 1);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "log", context->config, &other_id);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+    // close and reopen the collector, new records go to a new segment
+    ret = soma_close_collector(context->admin, context->addr, provider_id, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_open_collector(context->admin, context->addr, provider_id, token,
+            "log", context->config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_publish_batch(rh, samples[0], BATCH_SIZE);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    int num_segments_after = 0;
+    munit_assert_ulong(log_size(log_path, &num_segments_after), ==, (NUM_BATCHES + 1) * RECORD_SIZE);
+    munit_assert_int(num_segments_after, ==, num_segments + 1);
+    // destroying the collector removes the log
+    ret = soma_destroy_collector(context->admin, context->addr, provider_id, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    struct stat st;
+    munit_assert_int(stat(log_path, &st), !=, 0);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_invalid_config(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_collector_id_t id;
+    soma_return_t ret;
+    // a path is required
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "log", "{}", &id);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+    // the fsync policy must be known
+    char config[256];
+    snprintf(config, sizeof(config),
+             "{ \"path\" : \"%s/log\", \"fsync\" : \"sometimes\" }", context->path);
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "log", config, &id);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+    // opening requires an existing log
+    ret = soma_open_collector(context->admin, context->addr, provider_id, token,
+            "log", context->config, &id);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+
+    return MUNIT_OK;
+}
+
+static MunitTest test_suite_tests[] = {
+    { (char*) "/publish", test_publish, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/invalid_config", test_invalid_config, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite test_suite = {
+    (char*) "/soma/log", test_suite_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char* argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
+    return munit_suite_main(&test_suite, (void*) "soma", argc, argv);
+}
@@ -0,0 +1,164 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <margo.h>
+#include <soma/soma-server.h>
+#include <soma/soma-admin.h>
+#include <soma/soma-client.h>
+#include <soma/soma-collector.h>
+#include "munit/munit.h"
+
+struct test_context {
+    margo_instance_id   mid;
+    hg_addr_t           addr;
+    soma_admin_t        admin;
+    soma_client_t       client;
+};
+
+static const char* token = "ABCDEFGH";
+static const uint16_t provider_id = 42;
+
+static void* test_context_setup(const MunitParameter params[], void* user_data)
+{
+    (void) params;
+    (void) user_data;
+    soma_return_t ret;
+    // create margo instance
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    munit_assert_not_null(mid);
+    struct test_context* context = (struct test_context*)calloc(1, sizeof(*context));
+    munit_assert_not_null(context);
+    context->mid = mid;
+    // get address of current process
+    hg_return_t hret = margo_addr_self(mid, &context->addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    // register soma provider
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token = token;
+    ret = soma_provider_register(
+            mid, provider_id, &args,
+            SOMA_PROVIDER_IGNORE);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // create an admin and a client
+    ret = soma_admin_init(mid, &context->admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_init(mid, &context->client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    return context;
+}
+
+static void test_context_tear_down(void* fixture)
+{
+    struct test_context* context = (struct test_context*)fixture;
+    soma_client_finalize(context->client);
+    soma_admin_finalize(context->admin);
+    margo_addr_free(context->mid, context->addr);
+    // we are not checking the return value of the above function with
+    // munit because we need margo_finalize to be called no matter what.
+    margo_finalize(context->mid);
+    free(context);
+}
+
+static MunitResult test_publish(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_collector_id_t id;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", "{}", &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // stage a few samples, they should be flushed when attaching
+    ret = soma_publish(rh, 0, 0, 1.0);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // small ring, so that publishing wraps around it many times
+    ret = soma_collector_handle_attach_shm(rh, 50);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_attach_shm(rh, 50);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_ARGS);
+    size_t count = 100;
+    soma_sample_t samples[100];
+    uint64_t series[100], timestamps[100];
+    double values[100];
+    int b;
+    for(b = 0; b < 10; b++) {
+        size_t i;
+        for(i = 0; i < count; i++) {
+            samples[i].series    = series[i]     = i % 3;
+            samples[i].timestamp = timestamps[i] = b * count + i + 1;
+            samples[i].value     = values[i]     = (double)i;
+        }
+        ret = soma_publish_batch(rh, samples, count);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        ret = soma_publish_columns(rh, count, series, timestamps, values);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        ret = soma_publish(rh, 3, b, 2.0);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    ret = soma_collector_handle_flush(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // RPCs still work while attached
+    int32_t result = 0;
+    ret = soma_compute_sum(rh, 2, 3, &result);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_int(result, ==, 5);
+    ret = soma_collector_handle_detach_shm(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_detach_shm(rh);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_ARGS);
+    // back to RPCs
+    ret = soma_publish_batch(rh, samples, count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // attach again and let the release detach
+    ret = soma_collector_handle_attach_shm(rh, 0);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_publish_batch(rh, samples, count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(context->admin, context->addr, provider_id, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_invalid_collector(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_collector_id_t id;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    memset(&id, 0, sizeof(id));
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_attach_shm(rh, 0);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_COLLECTOR);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitTest test_suite_tests[] = {
+    { (char*) "/publish", test_publish, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/invalid_collector", test_invalid_collector, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite test_suite = {
+    (char*) "/soma/shm", test_suite_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char* argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
+    return munit_suite_main(&test_suite, (void*) "soma", argc, argv);
+}
@@ -0,0 +1,588 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <margo.h>
+#include <soma/soma-server.h>
+#include <soma/soma-admin.h>
+#include <soma/soma-client.h>
+#include <soma/soma-collector.h>
+#include <json-c/json.h>
+#include "munit/munit.h"
+
+struct test_context {
+    margo_instance_id   mid;
+    hg_addr_t           addr;
+    soma_admin_t        admin;
+    soma_client_t       client;
+};
+
+static const char* token = "ABCDEFGH";
+static const uint16_t provider_id = 42;
+
+static char* compression_params[] = { "none", "gorilla", NULL };
+
+static MunitParameterEnum publish_params[] = {
+    { "compression", compression_params },
+    { NULL, NULL }
+};
+
+static void* test_context_setup(const MunitParameter params[], void* user_data)
+{
+    (void) params;
+    (void) user_data;
+    soma_return_t ret;
+    // create margo instance
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    munit_assert_not_null(mid);
+    struct test_context* context = (struct test_context*)calloc(1, sizeof(*context));
+    munit_assert_not_null(context);
+    context->mid = mid;
+    // get address of current process
+    hg_return_t hret = margo_addr_self(mid, &context->addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    // register soma provider
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token = token;
+    ret = soma_provider_register(
+            mid, provider_id, &args,
+            SOMA_PROVIDER_IGNORE);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // create an admin and a client
+    ret = soma_admin_init(mid, &context->admin);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_client_init(mid, &context->client);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    return context;
+}
+
+static void test_context_tear_down(void* fixture)
+{
+    struct test_context* context = (struct test_context*)fixture;
+    soma_client_finalize(context->client);
+    soma_admin_finalize(context->admin);
+    margo_addr_free(context->mid, context->addr);
+    // we are not checking the return value of the above function with
+    // munit because we need margo_finalize to be called no matter what.
+    margo_finalize(context->mid);
+    free(context);
+}
+
+static MunitResult test_publish(const MunitParameter params[], void* data)
+{
+    struct test_context* context = (struct test_context*)data;
+    soma_collector_id_t id;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    char config[256];
+    // small chunks, so that samples span several of them and old ones get recycled
+    snprintf(config, sizeof(config),
+             "{ \"chunk_capacity\" : 7, \"max_chunks_per_series\" : 3, \"compression\" : \"%s\" }",
+             munit_parameters_get(params, "compression"));
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // publish batches mixing several series
+    size_t count = 100;
+    soma_sample_t samples[100];
+    int b;
+    for(b = 0; b < 10; b++) {
+        size_t i;
+        for(i = 0; i < count; i++) {
+            samples[i].series    = i % 3;
+            samples[i].timestamp = b * count + i;
+            samples[i].value     = (double)i;
+        }
+        ret = soma_publish_batch(rh, samples, count);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    // the timeseries backend also answers the other RPCs
+    int32_t result = 0;
+    ret = soma_compute_sum(rh, 2, 3, &result);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_int(result, ==, 5);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(context->admin, context->addr, provider_id, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_query(const MunitParameter params[], void* data)
+{
+    struct test_context* context = (struct test_context*)data;
+    soma_collector_id_t id;
+    soma_collector_handle_t rh;
+    soma_request_t req;
+    soma_return_t ret;
+    char config[256];
+    snprintf(config, sizeof(config),
+             "{ \"chunk_capacity\" : 64, \"max_chunks_per_series\" : 0, \"compression\" : \"%s\" }",
+             munit_parameters_get(params, "compression"));
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // series s has a sample at every timestamp t < 1000, of value s * t
+    soma_sample_t samples[100];
+    int b;
+    for(b = 0; b < 20; b++) {
+        size_t i;
+        for(i = 0; i < 100; i++) {
+            samples[i].series    = 1 + i % 2;
+            samples[i].timestamp = b * 50 + i / 2;
+            samples[i].value     = (double)(samples[i].series * samples[i].timestamp);
+        }
+        ret = soma_publish_batch(rh, samples, 100);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    uint64_t series[3] = { 2, 1, 3 };
+    soma_sample_t results[300];
+    size_t count, i;
+
+    // raw samples, series after series
+    count = 300;
+    ret = soma_query(rh, 3, series, 100, 200, SOMA_AGG_NONE, 0, NULL, results, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_size(count, ==, 200);
+    for(i = 0; i < count; i++) {
+        munit_assert_uint64(results[i].series, ==, i < 100 ? 2 : 1);
+        munit_assert_uint64(results[i].timestamp, ==, 100 + i % 100);
+        munit_assert_double(results[i].value, ==, (double)(results[i].series * results[i].timestamp));
+    }
+    // truncated to the capacity, the cursor resuming where it stopped
+    soma_query_cursor_t cursor = { 0, 0 };
+    soma_sample_t page[64];
+    size_t total = 0;
+    do {
+        count = 64;
+        ret = soma_query(rh, 3, series, 100, 200, SOMA_AGG_NONE, 0, &cursor, page, &count);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        for(i = 0; i < count; i++) {
+            munit_assert_uint64(page[i].series, ==, results[total + i].series);
+            munit_assert_uint64(page[i].timestamp, ==, results[total + i].timestamp);
+        }
+        total += count;
+    } while(count == 64);
+    munit_assert_size(total, ==, 200);
+    munit_assert_uint64(cursor.series, ==, 3);
+    // and over RPC
+    cursor.series = 0;
+    cursor.offset = 150;
+    count = 64;
+    ret = soma_query_async(rh, 3, series, 100, 200, SOMA_AGG_NONE, 0,
+                           &cursor, page, &count, &req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_request_wait(req);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_size(count, ==, 50);
+    munit_assert_uint64(page[0].series, ==, 1);
+    munit_assert_uint64(page[0].timestamp, ==, 150);
+    munit_assert_uint64(cursor.series, ==, 1);
+    munit_assert_uint64(cursor.offset, ==, 64);
+
+    // reductions by steps of 100, over RPC
+    struct { soma_aggregation_t aggregation; double expected[2]; } cases[] = {
+        { SOMA_AGG_SUM,   { 2 * 14950.0, 14950.0 } }, // sum of t for t in [100, 200)
+        { SOMA_AGG_MIN,   { 200.0, 100.0 } },
+        { SOMA_AGG_MAX,   { 398.0, 199.0 } },
+        { SOMA_AGG_MEAN,  { 299.0, 149.5 } },
+        { SOMA_AGG_COUNT, { 100.0, 100.0 } },
+        { SOMA_AGG_RATE,  { 2.0, 1.0 } }
+    };
+    size_t c;
+    for(c = 0; c < sizeof(cases)/sizeof(cases[0]); c++) {
+        count = 300;
+        ret = soma_query_async(rh, 3, series, 0, 1000, cases[c].aggregation, 100,
+                               NULL, results, &count, &req);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        ret = soma_request_wait(req);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        munit_assert_size(count, ==, 30);
+        munit_assert_uint64(results[1].timestamp, ==, 100);
+        munit_assert_double(results[1].value, ==, cases[c].expected[0]);
+        munit_assert_double(results[11].value, ==, cases[c].expected[1]);
+        // series 3 has no samples
+        if(cases[c].aggregation == SOMA_AGG_SUM || cases[c].aggregation == SOMA_AGG_COUNT)
+            munit_assert_double(results[21].value, ==, 0.0);
+        else
+            munit_assert_true(isnan(results[21].value));
+    }
+    // a single step covering the whole range
+    count = 3;
+    ret = soma_query(rh, 3, series, 0, 1000, SOMA_AGG_COUNT, 0, NULL, results, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_size(count, ==, 3);
+    munit_assert_double(results[0].value, ==, 1000.0);
+
+    // more steps than room for their results
+    count = 20;
+    ret = soma_query(rh, 3, series, 0, 1000, SOMA_AGG_SUM, 100, NULL, results, &count);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_ARGS);
+    count = 300;
+    ret = soma_query(rh, 3, series, 1000, 0, SOMA_AGG_SUM, 100, NULL, results, &count);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_ARGS);
+
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(context->admin, context->addr, provider_id, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    // backends without queries (such as the log backend) report it
+    char path[64];
+    strcpy(path, "/tmp/soma-test-query-XXXXXX");
+    munit_assert_not_null(mkdtemp(path));
+    snprintf(config, sizeof(config), "{ \"path\" : \"%s/log\" }", path);
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "log", config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    count = 300;
+    ret = soma_query(rh, 3, series, 0, 1000, SOMA_AGG_NONE, 0, NULL, results, &count);
+    munit_assert_int(ret, ==, SOMA_ERR_OP_UNSUPPORTED);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(context->admin, context->addr, provider_id, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_int(rmdir(path), ==, 0);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_round_trip(const MunitParameter params[], void* data)
+{
+    struct test_context* context = (struct test_context*)data;
+    soma_collector_id_t id;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    char config[256];
+    snprintf(config, sizeof(config),
+             "{ \"chunk_capacity\" : 64, \"compression\" : \"%s\" }",
+             munit_parameters_get(params, "compression"));
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // irregular timestamps, going back and forth across the whole range
+    // so that deltas and deltas of deltas need all 64 bits
+    static const uint64_t edges[] = {
+        0, 1, UINT64_MAX - 1, 5, 1ULL << 63, 7, (1ULL << 63) - 1, 1000, 999,
+        UINT64_MAX - 2, 0, 2, 2, 2, 3, 1ULL << 62, 1000000007
+    };
+    const size_t num_edges = sizeof(edges)/sizeof(edges[0]);
+    soma_sample_t samples[300];
+    size_t i;
+    for(i = 0; i < 300; i++) {
+        samples[i].series = 1;
+        if(i < num_edges)
+            samples[i].timestamp = edges[i];
+        else if(i % 2)
+            samples[i].timestamp = samples[i-1].timestamp / 2 + munit_rand_int_range(0, 5000);
+        else
+            samples[i].timestamp = ((uint64_t)munit_rand_uint32() << 32 | munit_rand_uint32())
+                                 % (UINT64_MAX - 1);
+        samples[i].value = i % 5 ? munit_rand_double() * 1e300 : -0.0;
+    }
+    ret = soma_publish_batch(rh, samples, 300);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // every sample comes back, in the order it was published
+    uint64_t series = 1;
+    soma_sample_t results[300];
+    size_t count = 300;
+    ret = soma_query(rh, 1, &series, 0, UINT64_MAX, SOMA_AGG_NONE, 0, NULL, results, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_size(count, ==, 300);
+    for(i = 0; i < count; i++) {
+        munit_assert_uint64(results[i].timestamp, ==, samples[i].timestamp);
+        munit_assert_memory_equal(sizeof(double), &results[i].value, &samples[i].value);
+    }
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(context->admin, context->addr, provider_id, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_wal(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_collector_id_t id;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    char path[64], config[256], segment[128];
+    strcpy(path, "/tmp/soma-test-wal-XXXXXX");
+    munit_assert_not_null(mkdtemp(path));
+    // small segments so that replay spans several of them
+    snprintf(config, sizeof(config),
+             "{ \"wal\" : { \"path\" : \"%s/wal\", \"segment_size\" : 4096,"
+             " \"fsync\" : \"never\", \"replay_threads\" : 3 } }", path);
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    soma_sample_t samples[100];
+    int b;
+    for(b = 0; b < 10; b++) {
+        size_t i;
+        for(i = 0; i < 100; i++) {
+            samples[i].series    = i % 3;
+            samples[i].timestamp = b * 100 + i;
+            samples[i].value     = (double)i;
+        }
+        ret = soma_publish_batch(rh, samples, 100);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_close_collector(context->admin, context->addr, provider_id, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // simulate a record torn by a crash at the end of the last segment
+    snprintf(segment, sizeof(segment), "%s/wal/segment-%08lu.log", path, 9UL);
+    FILE* f = fopen(segment, "a");
+    munit_assert_not_null(f);
+    fwrite("SOMA", 1, 4, f);
+    fclose(f);
+    // reopening replays the log
+    ret = soma_open_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // every sample logged before the close is back, series by series
+    uint64_t series[3] = { 0, 1, 2 };
+    soma_sample_t results[3];
+    size_t count = 3;
+    ret = soma_query(rh, 3, series, 0, 1000, SOMA_AGG_COUNT, 0, NULL, results, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_size(count, ==, 3);
+    munit_assert_double(results[0].value, ==, 340.0);
+    munit_assert_double(results[1].value, ==, 330.0);
+    munit_assert_double(results[2].value, ==, 330.0);
+    count = 3;
+    ret = soma_query(rh, 3, series, 0, 1000, SOMA_AGG_SUM, 0, NULL, results, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_double(results[0].value, ==, 16830.0);
+    munit_assert_double(results[1].value, ==, 16170.0);
+    munit_assert_double(results[2].value, ==, 16500.0);
+    ret = soma_publish_batch(rh, samples, 100);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // destroying the collector removes the log
+    ret = soma_destroy_collector(context->admin, context->addr, provider_id, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_int(rmdir(path), ==, 0);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_invalid_config(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    soma_collector_id_t id;
+    soma_return_t ret;
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", "{ \"chunk_capacity\" : 0 }", &id);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", "{ \"max_chunks_per_series\" : -1 }", &id);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", "[ 1, 2 ]", &id);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", "{ \"compression\" : \"zstd\" }", &id);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+    ret = soma_create_collector(context->admin, context->addr, provider_id, token,
+            "timeseries", "{ \"wal\" : { \"fsync\" : \"always\" } }", &id);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+
+    return MUNIT_OK;
+}
+
+static int64_t memory_field(struct test_context* context, uint16_t pid, const char* name)
+{
+    char* usage = NULL;
+    soma_return_t ret = soma_get_memory_usage(context->admin, context->addr,
+            pid, token, &usage);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    struct json_object* json = json_tokener_parse(usage);
+    munit_assert_not_null(json);
+    struct json_object* field = NULL;
+    munit_assert_true(json_object_object_get_ex(json, name, &field));
+    int64_t value = json_object_get_int64(field);
+    json_object_put(json);
+    free(usage);
+    return value;
+}
+
+static MunitResult test_memory(const MunitParameter params[], void* data)
+{
+    struct test_context* context = (struct test_context*)data;
+    soma_provider_t spilling = SOMA_PROVIDER_NULL;
+    soma_provider_t bounded  = SOMA_PROVIDER_NULL;
+    soma_collector_id_t id;
+    soma_collector_handle_t rh;
+    soma_return_t ret;
+    char path[64], config[256], ts_config[256];
+    strcpy(path, "/tmp/soma-test-spill-XXXXXX");
+    munit_assert_not_null(mkdtemp(path));
+    abt_io_instance_id abtio = abt_io_init(1);
+    munit_assert_not_null(abtio);
+    // one provider that spills to disk, and one that can only refuse samples
+    struct soma_provider_args args = SOMA_PROVIDER_ARGS_INIT;
+    args.token  = token;
+    args.abtio  = abtio;
+    snprintf(config, sizeof(config),
+             "{ \"memory\" : { \"collector_limit\" : 65536, \"spill_path\" : \"%s\" } }", path);
+    args.config = config;
+    ret = soma_provider_register(context->mid, provider_id + 1, &args, &spilling);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    args.abtio  = ABT_IO_INSTANCE_NULL;
+    args.config = "{ \"memory\" : { \"provider_limit\" : 65536 } }";
+    ret = soma_provider_register(context->mid, provider_id + 2, &args, &bounded);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    args.config = "{ \"memory\" : { \"collector_limit\" : \"64k\" } }";
+    ret = soma_provider_register(context->mid, provider_id + 3, &args, SOMA_PROVIDER_IGNORE);
+    munit_assert_int(ret, ==, SOMA_ERR_INVALID_CONFIG);
+
+    // publish well over the budget, in chunks of 64 samples that stay in memory
+    snprintf(ts_config, sizeof(ts_config),
+             "{ \"chunk_capacity\" : 64, \"max_chunks_per_series\" : 0,"
+             " \"compression\" : \"%s\" }", munit_parameters_get(params, "compression"));
+    ret = soma_create_collector(context->admin, context->addr, provider_id + 1, token,
+            "timeseries", ts_config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id + 1, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // noisy values, which Gorilla compression cannot shrink below the budget
+    double* expected = (double*)malloc(20000 * sizeof(double));
+    munit_assert_not_null(expected);
+    soma_sample_t samples[100];
+    int b;
+    for(b = 0; b < 200; b++) {
+        size_t i;
+        for(i = 0; i < 100; i++) {
+            samples[i].series    = 0;
+            samples[i].timestamp = b * 100 + i;
+            samples[i].value     = (double)i + munit_rand_double();
+            expected[b * 100 + i] = samples[i].value;
+        }
+        // batches refused while a spill catches up are sent again
+        int attempts = 0;
+        while((ret = soma_publish_batch(rh, samples, 100)) == SOMA_ERR_MEMORY_LIMIT
+              && attempts++ < 100)
+            margo_thread_sleep(context->mid, 10);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+    }
+    int attempts = 0;
+    while(memory_field(context, provider_id + 1, "spilled") == 0 && attempts++ < 100)
+        margo_thread_sleep(context->mid, 10);
+    munit_assert_int64(memory_field(context, provider_id + 1, "spilled"), >, 0);
+    munit_assert_int64(memory_field(context, provider_id + 1, "used"), <=, 65536 + 65536 / 4);
+    // queries read spilled chunks back, whether folding them or copying
+    // their samples a page at a time
+    uint64_t series = 0;
+    soma_sample_t results[1000];
+    size_t count = 1;
+    double sum = 0.0;
+    size_t i;
+    for(i = 0; i < 20000; i++)
+        sum += expected[i];
+    ret = soma_query(rh, 1, &series, 0, 20000, SOMA_AGG_COUNT, 0, NULL, results, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_double(results[0].value, ==, 20000.0);
+    count = 1;
+    ret = soma_query(rh, 1, &series, 0, 20000, SOMA_AGG_SUM, 0, NULL, results, &count);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_double(results[0].value, ==, sum);
+    soma_query_cursor_t cursor = { 0, 0 };
+    size_t total = 0;
+    do {
+        count = 1000;
+        ret = soma_query(rh, 1, &series, 0, 20000, SOMA_AGG_NONE, 0, &cursor, results, &count);
+        munit_assert_int(ret, ==, SOMA_SUCCESS);
+        for(i = 0; i < count; i++) {
+            munit_assert_uint64(results[i].timestamp, ==, total + i);
+            munit_assert_double(results[i].value, ==, expected[total + i]);
+        }
+        total += count;
+    } while(count == 1000);
+    munit_assert_size(total, ==, 20000);
+    free(expected);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    // destroying the collector removes its spill file
+    ret = soma_destroy_collector(context->admin, context->addr, provider_id + 1, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    munit_assert_int64(memory_field(context, provider_id + 1, "used"), ==, 0);
+    munit_assert_int(rmdir(path), ==, 0);
+
+    // without anywhere to spill, samples are refused once over the budget
+    ret = soma_create_collector(context->admin, context->addr, provider_id + 2, token,
+            "timeseries", ts_config, &id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_collector_handle_create(context->client,
+            context->addr, provider_id + 2, id, &rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    for(b = 0; b < 200; b++) {
+        ret = soma_publish_batch(rh, samples, 100);
+        if(ret != SOMA_SUCCESS) break;
+    }
+    munit_assert_int(ret, ==, SOMA_ERR_MEMORY_LIMIT);
+    munit_assert_int64(memory_field(context, provider_id + 2, "rejected"), ==, 1);
+    munit_assert_int64(memory_field(context, provider_id + 2, "spilled"), ==, 0);
+    ret = soma_collector_handle_release(rh);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_destroy_collector(context->admin, context->addr, provider_id + 2, token, id);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+
+    ret = soma_provider_destroy(bounded);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    ret = soma_provider_destroy(spilling);
+    munit_assert_int(ret, ==, SOMA_SUCCESS);
+    abt_io_finalize(abtio);
+
+    return MUNIT_OK;
+}
+
+static MunitTest test_suite_tests[] = {
+    { (char*) "/publish", test_publish, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, publish_params },
+    { (char*) "/query", test_query, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, publish_params },
+    { (char*) "/round_trip", test_round_trip, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, publish_params },
+    { (char*) "/wal", test_wal, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/memory", test_memory, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, publish_params },
+    { (char*) "/invalid_config", test_invalid_config, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite test_suite = {
+    (char*) "/soma/timeseries", test_suite_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char* argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
+    return munit_suite_main(&test_suite, (void*) "soma", argc, argv);
+}